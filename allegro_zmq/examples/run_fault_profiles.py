@@ -0,0 +1,52 @@
+#
+#   Compare control-loop metrics across fault profiles on the simulated CAN bus
+#   Needs a server built with -DALLEGRO_SIM_CAN=ON
+#   Connects REQ socket to tcp://localhost:5556
+#
+import sys
+import os
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', '..'))
+
+from allegro_zmq.utils import zmq_utils
+
+import time
+import zmq
+
+PROFILES = [
+    ("baseline", []),
+    ("rx jitter", ["0 inf delay 200 500 exp"]),
+    ("5% drops", ["0 inf drop all 0.05"]),
+    ("finger 2 drops", ["0 inf drop 0x21 0.2"]),
+    ("duplicates + reorder", ["0 inf dup 0.05", "0 inf reorder 0.05"]),
+    ("error frames", ["0 inf errframe 0.02"]),
+    ("tx back-pressure", ["0 inf txslow 8"]),
+    ("bus-off 200 ms", ["1 1.2 busoff"]),
+]
+SECONDS = 3.0
+
+HOME = [0.0, 0.4, 0.6, 0.4] * 3 + [0.8, 0.4, 0.4, 0.4]
+
+context = zmq.Context()
+socket = context.socket(zmq.REQ)
+socket.connect("tcp://localhost:5556")
+
+
+def request(msg):
+    socket.send_string(msg)
+    return socket.recv_string()
+
+
+request(zmq_utils.convert_allegro_q_to_zmq_str(HOME))
+time.sleep(1.0)
+
+for name, rules in PROFILES:
+    request("sim_fault clear")
+    for rule in rules:
+        print(request("sim_fault " + rule))
+    request("loop_stats_reset")
+    time.sleep(SECONDS)
+    print("=== %s" % name)
+    print(request("loop_stats"))
+    print(request("sim_stats"))
+
+request("sim_fault clear")
@@ -0,0 +1,49 @@
+#
+#   Rock-paper-scissors as an on-server motion script
+#   Connects REQ socket to tcp://localhost:5556
+#
+import sys
+import os
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', '..'))
+
+from allegro_zmq.utils import zmq_utils
+
+import time
+import zmq
+
+RPS_SCRIPT = """
+pose rock -0.1194,1.2068,1.0,1.4042,-0.0093,1.2481,1.4073,0.8163,0.1116,1.2712,1.3881,1.0122,0.6017,0.2976,0.9034,0.7929
+pose paper -0.1220,0.4,0.6,-0.0769,0.0312,0.4,0.6,-0.0,0.1767,0.4,0.6,-0.0528,0.5284,0.3693,0.8977,0.4863
+pose scissors 0.0885,0.4,0.6,-0.0704,0.0312,0.4,0.6,-0.0,0.1019,1.2375,1.1346,1.0244,1.0,0.6331,1.3509,1.0
+
+loop:
+    move rock 0.5
+    wait_err 0.1 1.5
+    wait 1.0
+    move paper 0.5
+    wait_err 0.1 1.5
+    wait 1.0
+    move scissors 0.5
+    wait_err 0.1 1.5
+    wait 1.0
+    goto loop
+"""
+
+context = zmq.Context()
+socket = context.socket(zmq.REQ)
+socket.connect("tcp://localhost:5556")
+
+# upload once, then trigger by ID
+socket.send_string(zmq_utils.convert_script_to_zmq_str(0, RPS_SCRIPT))
+print("Upload: %s" % socket.recv_string())
+
+socket.send_string("script_run 0")
+print("Run: %s" % socket.recv_string())
+
+for _ in range(10):
+    time.sleep(1)
+    socket.send_string("script_status")
+    print("Status: %s" % socket.recv_string())
+
+socket.send_string("script_stop")
+print("Stop: %s" % socket.recv_string())
@@ -0,0 +1,28 @@
+import numpy as np
+
+# Tracking-error reports for the friction feedforward (FrictionComp.h)
+
+
+def tracking_rms(samples, skip=0):
+    """Per-joint RMS of q_des - q over history samples (decode_history), after the first `skip` cycles."""
+    e = samples['q_des'][skip:] - samples['q'][skip:]
+    return np.sqrt(np.mean(e * e, axis=0))
+
+
+def compare(before, after, skip=0):
+    """Replay the same motion twice (e.g. teach_play with 'friction off' and 'friction on'), fetch both
+    windows with 'history_range' and compare: returns (rms_before, rms_after, relative improvement)."""
+    rb = tracking_rms(before, skip)
+    ra = tracking_rms(after, skip)
+    return rb, ra, 1.0 - ra / np.maximum(rb, 1e-12)
+
+
+def parse_stats(reply):
+    """Decode a 'friction_stats' reply into a dict of flags, cycle counts and per-joint arrays."""
+    lines = reply.split('\n')
+    on, adapt, n_off, n_on = map(int, lines[0].split())
+    rows = np.array([list(map(float, l.split())) for l in lines[1:]])
+    return {
+        'on': bool(on), 'adapt': bool(adapt), 'cycles_off': n_off, 'cycles_on': n_on,
+        'fc': rows[:, 1], 'fv': rows[:, 2], 'rms_off': rows[:, 3], 'rms_on': rows[:, 4],
+    }
@@ -0,0 +1,52 @@
+import struct
+
+import numpy as np
+
+# Writer for the on-robot MLP policy format (cpp/include/MlpPolicy.h)
+_MAGIC = 0x504d4c41
+_VERSION = 1
+_ACTIVATIONS = {'linear': 0, 'relu': 1, 'tanh': 2}
+
+
+def obs_dim(history):
+    """Observation size: q, qdot, q_des and `history` past q vectors."""
+    return 48 + 16 * history
+
+
+def save_mlp(path, weights, biases, activations, obs_mean=None, obs_std=None,
+             act_scale=None, act_offset=None, history=0, decimation=1):
+    """Write a policy file.
+
+    weights[i] is (out, in), biases[i] is (out,), activations[i] one of 'linear', 'relu', 'tanh'.
+    The first layer takes obs_dim(history) inputs, the last one returns 16 outputs y, and the
+    server sets q_des = act_offset + act_scale * y.
+    """
+    n = obs_dim(history)
+    obs_mean = np.zeros(n) if obs_mean is None else np.asarray(obs_mean)
+    obs_std = np.ones(n) if obs_std is None else np.asarray(obs_std)
+    act_scale = np.ones(16) if act_scale is None else np.asarray(act_scale)
+    act_offset = np.zeros(16) if act_offset is None else np.asarray(act_offset)
+    assert obs_mean.shape == (n,) and obs_std.shape == (n,)
+    assert weights[0].shape[1] == n and weights[-1].shape[0] == 16
+
+    with open(path, 'wb') as f:
+        f.write(struct.pack('<5I', _MAGIC, _VERSION, len(weights), history, decimation))
+        for a in (obs_mean, obs_std, act_scale, act_offset):
+            f.write(np.asarray(a, dtype='<f4').tobytes())
+        for w, b, act in zip(weights, biases, activations):
+            w = np.asarray(w, dtype='<f4')
+            f.write(struct.pack('<3I', w.shape[1], w.shape[0], _ACTIVATIONS[act]))
+            f.write(w.tobytes())
+            f.write(np.asarray(b, dtype='<f4').tobytes())
+
+
+def mlp_forward(obs, weights, biases, activations, obs_mean, obs_std, act_scale, act_offset):
+    """Reference evaluation, for checking a file against the server (before joint-limit clamping)."""
+    x = (np.asarray(obs) - obs_mean) / obs_std
+    for w, b, act in zip(weights, biases, activations):
+        x = w @ x + b
+        if act == 'relu':
+            x = np.maximum(x, 0.0)
+        elif act == 'tanh':
+            x = np.tanh(x)
+    return act_offset + act_scale * x
@@ -0,0 +1,40 @@
+import struct
+
+import numpy as np
+
+# Reader for the reachability map written by bake_reachability (ReachabilityMap.h)
+_MAGIC = b'ALRMAP1\x00'
+_VERSION = 1
+_SEED_SCALE = 1.0e-4
+_HEADER = struct.Struct('<8sIIfI')
+_FINGER = struct.Struct('<3f3II4xQQ')
+
+
+class ReachabilityMap:
+    def __init__(self, path):
+        self._mm = np.memmap(path, dtype=np.uint8, mode='r')
+        magic, version, right_hand, voxel, num_fingers = _HEADER.unpack_from(self._mm, 0)
+        assert magic == _MAGIC and version == _VERSION, 'not a reachability map: %s' % path
+        self.right_hand = bool(right_hand)
+        self.voxel = voxel
+        self._fingers = []
+        offset = _HEADER.size
+        for _ in range(num_fingers):
+            f = _FINGER.unpack_from(self._mm, offset)
+            offset += _FINGER.size
+            origin, dims = np.array(f[0:3]), np.array(f[3:6])
+            n = int(np.prod(dims))
+            bits = self._mm[f[7]:f[7] + (n + 7) // 8]
+            seeds = np.frombuffer(self._mm, dtype='<i2', count=n * 4, offset=f[8]).reshape(n, 4)
+            self._fingers.append((origin, dims, bits, seeds))
+
+    def query(self, finger, p):
+        """Return the IK seed (4 joint angles) for a palm-frame point, or None if unreachable."""
+        origin, dims, bits, seeds = self._fingers[finger]
+        idx = np.floor((np.asarray(p) - origin) / self.voxel).astype(int)
+        if np.any(idx < 0) or np.any(idx >= dims):
+            return None
+        n = (idx[2] * dims[1] + idx[1]) * dims[0] + idx[0]
+        if not bits[n >> 3] & (1 << (n & 7)):
+            return None
+        return seeds[n] * _SEED_SCALE
@@ -0,0 +1,70 @@
+import struct
+
+import numpy as np
+
+# Decoder for 'history' / 'history_range' replies (StateHistory.h)
+_MAGIC = 0x48534c41
+_VERSION = 1
+_HEADER = struct.Struct('<IIIIq')
+
+STATE_DTYPE = np.dtype([
+    ('t_ns', '<i8'),
+    ('cycle', '<u8'),
+    ('q', '<f8', 16),
+    ('qdot', '<f8', 16),
+    ('q_des', '<f8', 16),
+    ('tau_des', '<f8', 16),
+    ('enc', '<i2', 16),
+])
+
+
+def decode_history(msg):
+    """Return (samples, server_now_ns); samples is a structured array with STATE_DTYPE fields."""
+    magic, version, count, sample_bytes, now_ns = _HEADER.unpack_from(msg, 0)
+    assert magic == _MAGIC and version == _VERSION, 'not a history reply'
+    assert sample_bytes == STATE_DTYPE.itemsize, 'sample layout mismatch'
+    samples = np.frombuffer(msg, dtype=STATE_DTYPE, count=count, offset=_HEADER.size)
+    return samples, now_ns
+
+
+def step_request(q, cycles):
+    """'step' request: apply the 16 joint targets q at the next cycle and reply after `cycles` cycles."""
+    q = np.squeeze(q)
+    assert q.shape == (16,)
+    return 'step %d %s' % (cycles, ','.join(map(str, q)))
+
+
+def decode_step(msg):
+    """Return (applied, observation) samples of a 'step' reply; t_ns and cycle give the exact timing."""
+    if len(msg) < _HEADER.size:
+        raise RuntimeError('step failed')
+    samples, _ = decode_history(msg)
+    return samples[0], samples[1]
+
+
+# 'state_at' replies: the same header with magic "ALSI", then one record per requested time stamp
+_INTERP_MAGIC = 0x49534c41
+STATE_AT_OK, STATE_AT_GAP, STATE_AT_LATE, STATE_AT_EARLY = range(4)
+
+INTERP_DTYPE = np.dtype([
+    ('t_ns', '<i8'),
+    ('status', '<i4'),
+    ('reserved', '<i4'),
+    ('q', '<f8', 16),
+    ('qdot', '<f8', 16),
+])
+
+
+def state_at_request(t_ns):
+    """'state_at' request for a batch of server CLOCK_MONOTONIC time stamps (ns), up to 4096."""
+    t_ns = np.asarray(t_ns, dtype=np.int64).ravel()
+    return 'state_at ' + ' '.join(map(str, t_ns))
+
+
+def decode_state_at(msg):
+    """Return (records, server_now_ns); records follow the request order, see STATE_AT_* for status."""
+    magic, version, count, sample_bytes, now_ns = _HEADER.unpack_from(msg, 0)
+    assert magic == _INTERP_MAGIC and version == _VERSION, 'not a state_at reply'
+    assert sample_bytes == INTERP_DTYPE.itemsize, 'record layout mismatch'
+    records = np.frombuffer(msg, dtype=INTERP_DTYPE, count=count, offset=_HEADER.size)
+    return records, now_ns
@@ -0,0 +1,105 @@
+import struct
+
+import numpy as np
+import zmq
+
+# Client side of the 'subscribe' state streams (StatePublisher.h)
+_MAGIC = 0x4d534c41
+_HEADER = struct.Struct('<IHHQq')
+
+FIELD_Q = 0x01
+FIELD_QDOT = 0x02
+FIELD_Q_DES = 0x04
+FIELD_TAU_DES = 0x08
+FIELD_ENC = 0x10
+FIELD_ALL = 0x1f
+
+_FIELDS = [(FIELD_Q, 'q', '<f8'), (FIELD_QDOT, 'qdot', '<f8'), (FIELD_Q_DES, 'q_des', '<f8'),
+           (FIELD_TAU_DES, 'tau_des', '<f8'), (FIELD_ENC, 'enc', '<i2')]
+
+
+def decode_state_msg(msg):
+    """Return a dict with 'cycle', 't_ns', 'divisor' and the subscribed fields (16-element arrays)."""
+    magic, mask, divisor, cycle, t_ns = _HEADER.unpack_from(msg, 0)
+    assert magic == _MAGIC, 'not a state message'
+    out = {'cycle': cycle, 't_ns': t_ns, 'divisor': divisor}
+    offset = _HEADER.size
+    for bit, name, dtype in _FIELDS:
+        if mask & bit:
+            out[name] = np.frombuffer(msg, dtype=dtype, count=16, offset=offset)
+            offset += out[name].nbytes
+    return out
+
+
+def subscribe(ctx, req_socket, host, divisor=1, mask=FIELD_ALL):
+    """Register a stream over the command socket and return a connected DEALER socket for it."""
+    req_socket.send_string('subscribe %d %d' % (divisor, mask))
+    reply = req_socket.recv_string().split()
+    assert reply[0] == 'succ', 'subscribe failed'
+    sub_id, routing_id, port = int(reply[1]), reply[2], int(reply[3])
+    sock = ctx.socket(zmq.DEALER)
+    sock.setsockopt(zmq.ROUTING_ID, routing_id.encode())
+    sock.setsockopt(zmq.RCVHWM, 16)
+    sock.connect('tcp://%s:%d' % (host, port))
+    return sub_id, sock
+
+
+FIELD_ENC_DELTA = 0x20
+
+
+def _varint(buf, pos):
+    r = shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        r |= (b & 0x7f) << shift
+        if not b & 0x80:
+            return r, pos
+        shift += 7
+
+
+def _unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+class EncoderDeltaDecoder:
+    """Decoder for FIELD_ENC_DELTA streams (StateCodec.h).
+
+    decode() returns (cycle, t_ns, enc) or None while waiting for a keyframe after a lost frame.
+    """
+
+    def __init__(self):
+        self.synced = False
+        self.divisor = 1
+        self.cycle = 0
+        self.t_ns = 0
+        self.enc = np.zeros(16, dtype=np.int16)
+        self.gaps = 0
+
+    def decode(self, msg):
+        kind = msg[0]
+        if kind == ord('K'):
+            self.divisor, pos = _varint(msg, 1)
+            self.cycle, pos = _varint(msg, pos)
+            self.t_ns, = struct.unpack_from('<q', msg, pos)
+            self.enc = np.frombuffer(msg, dtype='<i2', count=16, offset=pos + 8).copy()
+            self.synced = True
+        elif kind == ord('D'):
+            cycle, pos = _varint(msg, 1)
+            if not self.synced:
+                return None
+            if cycle != self.cycle + self.divisor:
+                self.synced = False
+                self.gaps += 1
+                return None
+            dt, pos = _varint(msg, pos)
+            deltas = np.empty(16, dtype=np.int64)
+            for i in range(16):
+                v, pos = _varint(msg, pos)
+                deltas[i] = _unzigzag(v)
+            self.cycle = cycle
+            self.t_ns += _unzigzag(dt)
+            self.enc = ((self.enc.astype(np.int64) + deltas + 0x8000) % 0x10000 - 0x8000).astype(np.int16)
+        else:
+            raise ValueError('not an encoder delta frame')
+        return self.cycle, self.t_ns, self.enc
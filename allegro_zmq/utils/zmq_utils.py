@@ -31,3 +31,19 @@ def convert_allegro_q_to_zmq_str(allegro_q, precision=6):
     assert allegro_q_1d.shape == (16,)
     allegro_str = ','.join(map(str, allegro_q_1d))
     return allegro_str
+
+def convert_allegro_path_to_zmq_str(waypoints):
+    """'path' request for an (N, 16) array of joint waypoints; the server adds the timing."""
+    waypoints = np.atleast_2d(waypoints)
+    assert waypoints.shape[1] == 16
+    return 'path ' + ';'.join(','.join(map(str, wp)) for wp in waypoints)
+
+def convert_script_to_zmq_str(script_id, script_text):
+    """'script_upload' request; run it later with 'script_run <id>'."""
+    return 'script_upload %d\n%s' % (script_id, script_text)
+
+def convert_sync_q_to_zmq_str(allegro_qs, delay_cycles=3):
+    """'sync_q' request: one 16-joint target per hand, applied in the same control cycle."""
+    allegro_qs = np.atleast_2d(allegro_qs)
+    assert allegro_qs.shape[1] == 16
+    return 'sync_q %d %s' % (delay_cycles, ','.join(map(str, allegro_qs.reshape(-1))))
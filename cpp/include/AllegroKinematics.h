@@ -0,0 +1,40 @@
+#ifndef _ALLEGROKINEMATICS_H
+#define _ALLEGROKINEMATICS_H
+
+// Fingertip kinematics of the Allegro Hand v4.
+// Link geometry and joint limits follow the allegro_hand_description URDF
+// (right hand). The left hand is handled as the mirror image about the
+// palm's xz-plane. All lengths are in meters, all angles in radians.
+
+#define NUM_FINGERS         4
+#define DOF_PER_FINGER      4
+
+#define FINGER_INDEX        0
+#define FINGER_MIDDLE       1
+#define FINGER_RING         2
+#define FINGER_THUMB        3
+
+/**
+ * @brief Lower/upper joint limits, indexed like q[MAX_DOF].
+ */
+extern const double kJointLimitLower[NUM_FINGERS*DOF_PER_FINGER];
+extern const double kJointLimitUpper[NUM_FINGERS*DOF_PER_FINGER];
+
+/**
+ * @brief Forward kinematics of one finger.
+ * @param finger finger index [0,3]
+ * @param q the four joint angles of that finger
+ * @param right_hand true for the right hand model
+ * @param tip fingertip position in the palm frame (output)
+ */
+void FingerFK(int finger, const double q[DOF_PER_FINGER], bool right_hand, double tip[3]);
+
+/**
+ * @brief Forward kinematics returning the joint frames as well.
+ * @param axis world-frame rotation axis of each joint (output, may be NULL)
+ * @param origin world-frame position of each joint (output, may be NULL)
+ */
+void FingerFKEx(int finger, const double q[DOF_PER_FINGER], bool right_hand, double tip[3],
+                double axis[DOF_PER_FINGER][3], double origin[DOF_PER_FINGER][3]);
+
+#endif
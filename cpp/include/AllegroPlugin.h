@@ -0,0 +1,76 @@
+/*
+*\brief Controller plugin ABI
+*\detailed A plugin is a shared object exporting allegro_plugin_get(), which
+*          returns a static AllegroPluginDesc. The server calls init() once
+*          off the control thread, compute() once per control cycle on the
+*          control thread, and shutdown() off the control thread after the
+*          plugin has been unloaded or replaced.
+*
+*          compute() sees the state of the cycle and may set joint targets
+*          for the built-in PD controller (ALLEGRO_PLUGIN_OUT_TARGET), a
+*          torque command that replaces the computed one
+*          (ALLEGRO_PLUGIN_OUT_TORQUE), or both. Torques are normalized like
+*          the server's own (|tau| <= 1, scaled to PWM) and still go through
+*          the safety clamp. compute() must not allocate, lock or block: it
+*          has a time budget and is disabled after repeated overruns.
+*
+*          This header is plain C and only changes together with
+*          ALLEGRO_PLUGIN_ABI_VERSION.
+*/
+
+#ifndef _ALLEGROPLUGIN_H
+#define _ALLEGROPLUGIN_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ALLEGRO_PLUGIN_ABI_VERSION  1
+#define ALLEGRO_PLUGIN_DOF          16
+#define ALLEGRO_PLUGIN_ENTRY        "allegro_plugin_get"
+
+#define ALLEGRO_PLUGIN_OUT_TARGET   0x1     /* q_des valid */
+#define ALLEGRO_PLUGIN_OUT_TORQUE   0x2     /* tau valid */
+
+typedef struct
+{
+	int64_t  t_ns;                          /* CLOCK_MONOTONIC when the cycle's encoder frames were in */
+	uint64_t cycle;
+	double   dt;                            /* control period (s) */
+	double   q[ALLEGRO_PLUGIN_DOF];         /* joint angles (rad) */
+	double   qdot[ALLEGRO_PLUGIN_DOF];      /* filtered joint velocities (rad/s) */
+	double   q_des[ALLEGRO_PLUGIN_DOF];     /* current targets, after earlier plugins */
+	double   tau_prev[ALLEGRO_PLUGIN_DOF];  /* torque sent in the previous cycle */
+	int16_t  enc[ALLEGRO_PLUGIN_DOF];       /* raw encoder counts */
+} AllegroPluginState;
+
+typedef struct
+{
+	uint32_t flags;                         /* ALLEGRO_PLUGIN_OUT_* */
+	double   q_des[ALLEGRO_PLUGIN_DOF];
+	double   tau[ALLEGRO_PLUGIN_DOF];
+} AllegroPluginOutput;
+
+typedef struct
+{
+	uint32_t abi_version;                   /* ALLEGRO_PLUGIN_ABI_VERSION */
+	const char* name;
+
+	/* Create the plugin instance; args is the rest of the load command. NULL on failure. */
+	void* (*init)(const char* args, double dt);
+
+	/* One control cycle; out->flags is 0 on entry. Return 0, or <0 to be disabled. */
+	int (*compute)(void* ctx, const AllegroPluginState* in, AllegroPluginOutput* out);
+
+	void (*shutdown)(void* ctx);
+} AllegroPluginDesc;
+
+typedef const AllegroPluginDesc* (*AllegroPluginGetFn)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _BUFFERPOOL_H
+#define _BUFFERPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Fixed set of equally sized buffers, allocated once.
+//
+// Free slots sit on a lock-free stack (head index plus an ABA tag in one
+// 64-bit word). Acquire() pops from the owning thread; Release() may run on
+// any thread, which lets it serve as the ZMQ free callback: a slot handed to
+// zmq_msg_init_data() returns to the pool when the last message referencing
+// it has been sent.
+
+typedef struct
+{
+	uint32_t slots;
+	uint32_t in_use;
+	uint64_t acquired;
+	uint64_t exhausted;             // Acquire() found no free slot
+} BufferPoolStats_t;
+
+class BufferPool
+{
+public:
+	BufferPool();
+	~BufferPool();
+
+	bool Create(uint32_t slots, size_t slot_bytes);
+	size_t SlotBytes() const { return slot_bytes_; }
+
+	/**
+	 * @brief Take a free slot; NULL if all are in use.
+	 */
+	void* Acquire();
+
+	/**
+	 * @brief Return a slot; signature matches zmq_free_fn, hint is the pool.
+	 */
+	static void Release(void* data, void* hint);
+
+	void GetStats(BufferPoolStats_t* st) const;
+
+private:
+	void Push(uint32_t index);
+
+	uint8_t* mem_;
+	std::atomic<uint32_t>* next_;   // free-list links
+	uint32_t slots_;
+	size_t slot_bytes_;
+	std::atomic<uint64_t> head_;    // low 32 bits: slot index (slots_ = empty), high 32 bits: tag
+	std::atomic<uint32_t> in_use_;
+	std::atomic<uint64_t> acquired_;
+	std::atomic<uint64_t> exhausted_;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _CARTESIANIMPEDANCE_H
+#define _CARTESIANIMPEDANCE_H
+
+#include <atomic>
+#include "rDeviceAllegroHandCANDef.h"
+#include "AllegroKinematics.h"
+
+// Per-finger Cartesian impedance on the control thread.
+//
+// Every cycle each selected finger gets
+//     tau = J^T (K (x_d - x) - D xdot),   xdot = J qdot
+// with x the fingertip in the palm frame (AllegroKinematics) and K, D
+// diagonal per finger and axis. The force is limited to f_max per finger.
+// The torques are added to the ones computed by BHand, which runs gravity
+// compensation while the mode covers the whole hand. With a partial mask
+// BHand stays in joint PD, so the other fingers hold their targets, and
+// ReleaseTargets() sets q_des = q for the impedance fingers each cycle.
+//
+// Parameters are handed to the control thread through two preallocated
+// buffers (the pattern of TrajectoryPlayer), so gains and targets change
+// at the next cycle without a reset and the control thread never
+// allocates or blocks.
+
+#define IMP_DEFAULT_K       200.0       // N/m
+#define IMP_DEFAULT_D       2.0         // N s/m
+#define IMP_DEFAULT_F_MAX   5.0         // N
+
+typedef struct
+{
+	double k[NUM_FINGERS][3];           // stiffness, palm frame axes
+	double d[NUM_FINGERS][3];           // damping
+	double x_d[NUM_FINGERS][3];         // fingertip targets (m)
+	double f_max;                       // force limit per finger (N)
+	int mask;                           // fingers under impedance control (bit per finger)
+} ImpedanceParams_t;
+
+class CartesianImpedance
+{
+public:
+	explicit CartesianImpedance(bool right_hand);
+
+	/**
+	 * @brief Command thread: current parameters (as last set).
+	 */
+	const ImpedanceParams_t& Params() const { return params_; }
+
+	/**
+	 * @brief Command thread: replace the parameters at the next cycle.
+	 * @return false if the previous hand-off was not picked up
+	 */
+	bool SetParams(const ImpedanceParams_t& p);
+
+	void Start() { running_.store(true, std::memory_order_release); }
+	void Stop() { running_.store(false, std::memory_order_release); }
+	bool IsRunning() const { return running_.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Control thread, before the BHand torques: joint targets of the
+	 *        impedance fingers follow q, so a joint PD adds no position term.
+	 */
+	void ReleaseTargets(const double* q, double* q_des);
+
+	/**
+	 * @brief Control thread: add the impedance torques to tau.
+	 * @return true if the mode is active
+	 */
+	bool Update(const double* q, const double* qdot, double* tau);
+
+	/**
+	 * @brief Any thread: fingertip positions and forces of the last cycle.
+	 */
+	void GetState(double x[NUM_FINGERS][3], double f[NUM_FINGERS][3]) const;
+
+private:
+	const ImpedanceParams_t& Active();
+
+	bool right_hand_;
+	ImpedanceParams_t params_;          // command thread copy
+	ImpedanceParams_t buf_[2];
+	std::atomic<int> pending_;          // buffer waiting to be picked up, -1 if none
+	std::atomic<int> active_;           // buffer used by the control thread
+	std::atomic<bool> running_;
+
+	// seqlock-protected telemetry
+	std::atomic<unsigned> seq_;
+	double x_[NUM_FINGERS][3];
+	double f_[NUM_FINGERS][3];
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef _CORECHANNEL_H
+#define _CORECHANNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+// Command channel between the real-time core and the network gateway.
+//
+// With --core the server owns only CAN and control; a separate gateway
+// process (grasp_gateway) runs ZMQ, request parsing and the state streams.
+// The core creates a POSIX shared-memory segment per hand holding two
+// single-producer/single-consumer byte rings: commands from the gateway to
+// the core, replies from the core to the gateway. Both sides only publish
+// a ring position after the bytes are in place, so neither ever blocks on
+// the other and a gateway that dies halfway through a message leaves the
+// rings consistent. A restarted gateway drops stale replies and carries on.
+// Only one gateway attaches at a time (flock on the segment); the segments
+// are private to the user running the core.
+//
+// The core also posts a heartbeat (its control cycle count) so the gateway
+// can tell a stopped control loop from a slow command.
+
+#define CORE_SHM_NAME       "/allegro_core%d"       // per hand index
+#define CORE_HISTORY_NAME   "/allegro_history%d"    // StateHistory ring of the core
+#define CORE_RING_BYTES     (1 << 20)               // per direction, power of two
+#define CORE_MAX_MESSAGE    (CORE_RING_BYTES / 4)
+
+typedef struct alignas(64)
+{
+	std::atomic<uint64_t> head;     // bytes written (producer)
+	char pad0[56];
+	std::atomic<uint64_t> tail;     // bytes consumed (consumer)
+	char pad1[56];
+	char data[CORE_RING_BYTES];
+} CoreRing_t;
+
+typedef struct alignas(64)
+{
+	std::atomic<uint32_t> magic;    // written last by the core
+	uint32_t version;
+	int32_t hand;
+	int32_t core_pid;
+	double period;                  // control period (s)
+	std::atomic<uint64_t> heartbeat;        // control cycles run
+	std::atomic<int64_t> heartbeat_ns;      // time of the last one
+	std::atomic<uint32_t> gateway_pid;      // last gateway attached
+	std::atomic<uint64_t> commands;         // handled by the core
+	CoreRing_t cmd;                 // gateway -> core
+	CoreRing_t reply;               // core -> gateway
+} CoreShared_t;
+
+class CoreChannel
+{
+public:
+	CoreChannel();
+	~CoreChannel();
+
+	/**
+	 * @brief Core: create the segment for a hand (replaces a stale one).
+	 */
+	bool Create(int hand, double period);
+
+	/**
+	 * @brief Gateway: map the segment of a running core; drops replies to a previous gateway.
+	 *        Fails, with Busy() set, while another gateway is attached.
+	 */
+	bool Attach(int hand);
+	void Detach();
+	bool IsOpen() const { return shm_ != NULL; }
+	bool Busy() const { return busy_; }
+
+	/**
+	 * @brief Gateway: queue a command. False if the ring is full or the message too large.
+	 */
+	bool PostCommand(uint32_t id, const std::string& msg);
+
+	/**
+	 * @brief Gateway: take the next reply, if any.
+	 */
+	bool ReadReply(uint32_t* id, std::string* msg);
+
+	/**
+	 * @brief Core: take the next command, if any.
+	 */
+	bool ReadCommand(uint32_t* id, std::string* msg);
+
+	/**
+	 * @brief Core: queue the reply to a command.
+	 */
+	bool PostReply(uint32_t id, const std::string& msg);
+
+	/**
+	 * @brief Core, control thread: one control cycle done.
+	 */
+	void Heartbeat(uint64_t cycle, int64_t t_ns);
+
+	/**
+	 * @brief Gateway: time since the last control cycle (ns), -1 if none yet.
+	 */
+	int64_t HeartbeatAge(int64_t now_ns) const;
+
+	const CoreShared_t* Shared() const { return shm_; }
+
+private:
+	static bool Write(CoreRing_t* r, uint32_t id, const std::string& msg);
+	static bool Read(CoreRing_t* r, uint32_t* id, std::string* msg);
+
+	CoreShared_t* shm_;
+	bool owner_;
+	int fd_;                        // gateway: holds the exclusive lock
+	bool busy_;
+	char name_[64];
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _ENCODERVALIDATOR_H
+#define _ENCODERVALIDATOR_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Glitch rejection for the encoder frames, run in the decode stage.
+//
+// Every joint count is checked against the joint's range (joint limits plus
+// a margin) and against the largest change a real joint can make since its
+// last valid reading. A frame of the wrong length is rejected as a whole.
+// Rejected joints keep their last valid count, so a corrupted value never
+// reaches q and the PD derivative term. If a joint's readings keep failing
+// the delta check but agree with each other, the joint really moved (e.g. it
+// was pushed while frames were lost) and the validator resynchronizes to it.
+// Constant time per joint; always on.
+
+#define ENC_RANGE_MARGIN_RAD    0.5     // beyond the joint limits
+#define ENC_MAX_SPEED_RAD_S     15.0    // fastest plausible joint motion
+#define ENC_RESYNC_CYCLES       5       // consecutive delta rejections, each within max delta of the previous, before accepting
+
+enum
+{
+	ENC_REJECT_LENGTH = 0,              // frame of the wrong length (counted per joint)
+	ENC_REJECT_RANGE,
+	ENC_REJECT_DELTA,
+	ENC_RESYNC,
+	ENC_COUNTERS
+};
+
+class EncoderValidator
+{
+public:
+	/**
+	 * @param period control period (s)
+	 * @param rad_per_count encoder scale
+	 */
+	EncoderValidator(double period, double rad_per_count);
+
+	/**
+	 * @brief Control thread: validate one finger's pose frame into enc[0..3].
+	 * @return number of joints that kept their last valid count
+	 */
+	int CheckFrame(int finger, const unsigned char* data, int len, int* enc);
+
+	/**
+	 * @brief Control thread: joint ranges in counts for a per-joint calibration
+	 *        q = enc * scale + offset (see JointCalibration.h).
+	 * @param check_range false: accept any count (hard-stop calibration)
+	 */
+	void SetCalibration(const double* scale, const double* offset, bool check_range);
+
+	/**
+	 * @brief Any thread: counters per joint as text.
+	 */
+	void Report(std::string* out) const;
+
+private:
+	int min_count_[MAX_DOF];
+	int max_count_[MAX_DOF];
+	int max_delta_;                     // counts per cycle
+	int max_stale_;                     // stale_ saturates here; the window then spans every 16-bit count
+	int last_[MAX_DOF];                 // last valid count
+	int stale_[MAX_DOF];                // cycles since last valid count
+	bool valid_[MAX_DOF];               // a valid count has been seen
+	int cand_[MAX_DOF];                 // last count rejected by the delta check
+	int cand_n_[MAX_DOF];               // consecutive delta rejections agreeing with each other
+
+	std::atomic<uint64_t> frames_;
+	std::atomic<uint64_t> count_[ENC_COUNTERS][MAX_DOF];
+};
+
+#endif
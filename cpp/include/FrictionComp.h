@@ -0,0 +1,79 @@
+#ifndef _FRICTIONCOMP_H
+#define _FRICTIONCOMP_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Per-joint friction feedforward added to tau_des before the safety clamp.
+//
+//     v     = qd_ref + LAMBDA * e                   e = q_des - q
+//     tau_f = fc * v / (|v| + V_SMOOTH) + fv * qd_ref
+//
+// qd_ref is the rate of change of q_des. Adding the weighted tracking error
+// makes the Coulomb term push through stiction when the reference is at
+// rest but the joint has not arrived, and v/(|v|+V_SMOOTH) is a smooth sign
+// that avoids chatter around zero velocity.
+//
+// fc and fv adapt online by gradient steps on the sliding variable
+// s = (qd_ref - qdot) + LAMBDA * e, with projection onto [0, max]. Adaptation
+// pauses while |e| exceeds ADAPT_MAX_ERR (contact, large steps). The cost is
+// a dozen flops per joint.
+//
+// RMS tracking error is accumulated separately for cycles with and without
+// compensation, so the improvement can be read from friction_stats.
+
+#define FRICTION_LAMBDA         10.0    // 1/s, error weight in v and s
+#define FRICTION_V_SMOOTH       0.05    // rad/s, width of the smooth sign
+#define FRICTION_MAX_REF_VEL    3.0     // rad/s, limit on qd_ref (steps in q_des)
+#define FRICTION_GAMMA_C        0.05    // Coulomb adaptation gain
+#define FRICTION_GAMMA_V        0.02    // viscous adaptation gain
+#define FRICTION_FC_MAX         0.15    // tau_des units
+#define FRICTION_FV_MAX         0.10    // tau_des units per rad/s
+#define FRICTION_ADAPT_MAX_ERR  0.2     // rad
+
+class FrictionComp
+{
+public:
+	explicit FrictionComp(double period);
+
+	void Enable(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+	void EnableAdaptation(bool on) { adapt_.store(on, std::memory_order_relaxed); }
+	bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Any thread: set the parameters of a joint (-1: all joints).
+	 */
+	void SetParams(int joint, double fc, double fv);
+
+	/**
+	 * @brief Control thread: add the friction torque to tau while tracking q_des.
+	 * @param tracking false while q_des is not being tracked (gravity compensation, impedance)
+	 */
+	void Update(const double* q, const double* qdot, const double* q_des, bool tracking, double* tau);
+
+	/**
+	 * @brief Any thread: parameters and RMS tracking error with/without compensation.
+	 */
+	void Report(std::string* out) const;
+	void ResetStats() { reset_.store(true, std::memory_order_release); }
+
+private:
+	double dt_;
+	std::atomic<bool> enabled_;
+	std::atomic<bool> adapt_;
+	std::atomic<bool> reset_;
+	std::atomic<double> fc_[MAX_DOF];
+	std::atomic<double> fv_[MAX_DOF];
+
+	// control thread
+	double q_des_prev_[MAX_DOF];
+	bool have_prev_;
+
+	// written by the control thread: [0] without, [1] with compensation
+	std::atomic<double> err2_[2][MAX_DOF];
+	std::atomic<uint64_t> cycles_[2];
+};
+
+#endif
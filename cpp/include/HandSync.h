@@ -0,0 +1,164 @@
+#ifndef _HANDSYNC_H
+#define _HANDSYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Shared cycle clock for several hands, each run by its own server process.
+//
+// Hand 0 creates a POSIX shared-memory segment holding the master clock
+// (epoch and period); the other hands attach to it. Every hand starts its
+// periodic encoder stream on a master-clock tick, derives its cycle index
+// from the same clock and sends its torques in a fixed, staggered TX slot
+// of each cycle. Joint targets for all hands can be posted together with an
+// apply cycle, so they take effect in the same control cycle everywhere.
+//
+// Each hand's stream runs on the hand's own oscillator, so it drifts off the
+// master clock over time. Every hand tracks the phase of its encoder frames
+// against the clock, relative to the first cycles after the stream started,
+// and asks for its stream to be restarted on a tick when the error grows
+// past SYNC_REPHASE_US.
+//
+// The segment outlives the processes: a restarted hand 0 keeps a compatible
+// clock as it is, and otherwise re-initializes it in place under a new
+// generation, which the other hands pick up and re-phase to.
+
+#define SYNC_SHM_NAME       "/allegro_hand_sync"
+#define SYNC_MAX_HANDS      4
+#define SYNC_HISTORY        64      // cycles of RX timestamps kept per hand
+#define SYNC_PHASE_SETTLE   100     // cycles averaged for the reference phase after the stream starts
+#define SYNC_PHASE_HOLDOFF  10      // cycles ignored after a re-phase
+#define SYNC_PHASE_ALPHA    0.01    // low-pass of the phase error
+#define SYNC_REPHASE_US     250.0   // filtered phase error that restarts the stream
+#define SYNC_POST_TRIES     1000    // attempts at a hand's target lock before PostTargets gives up
+
+typedef struct
+{
+	std::atomic<int32_t> owner;             // pid of the process posting, 0 if none
+	std::atomic<uint32_t> seq;              // seqlock, odd while being written
+	int64_t apply_cycle;
+	double q[MAX_DOF];
+} SyncTarget_t;
+
+typedef struct
+{
+	std::atomic<int64_t> rx_ns[SYNC_HISTORY];   // cycle-complete time, indexed by cycle % SYNC_HISTORY
+	std::atomic<int64_t> rx_cycle[SYNC_HISTORY];
+	SyncTarget_t target;
+} SyncHand_t;
+
+typedef struct
+{
+	std::atomic<uint32_t> magic;            // written last by the master
+	uint32_t version;
+	std::atomic<uint32_t> generation;       // odd while hand 0 re-initializes the clock
+	int64_t epoch_ns;
+	int64_t period_ns;
+	int64_t tx_offset_ns;                   // TX slot of hand 0 after each tick
+	int64_t stagger_ns;                     // extra TX delay per hand index
+	SyncHand_t hand[SYNC_MAX_HANDS];
+} SyncShared_t;
+
+typedef struct
+{
+	uint64_t cycles;
+	uint64_t late_tx;           // TX slot already missed, sent immediately
+	uint64_t skew_samples;
+	double skew_mean_us;        // |RX time - hand 0 RX time| for the same cycle
+	double skew_max_us;
+	double tx_wait_mean_us;
+	double phase_err_us;        // filtered phase of this hand's stream against the clock
+	double phase_err_max_us;
+	uint64_t rephases;          // stream restarts on a tick
+	uint64_t clock_changes;     // master clock re-initialized by hand 0
+} SyncStats_t;
+
+class HandSync
+{
+public:
+	HandSync();
+	~HandSync();
+
+	/**
+	 * @brief Create (hand 0) or attach to the shared clock.
+	 * @param period control period (s)
+	 * @param tx_offset TX slot of hand 0 after each tick (s)
+	 * @param stagger TX delay added per hand index (s)
+	 */
+	bool Attach(int hand, int num_hands, double period, double tx_offset, double stagger);
+	void Detach();
+	bool IsAttached() const { return shm_ != NULL; }
+	int Hand() const { return hand_; }
+	int NumHands() const { return num_hands_; }
+
+	int64_t CycleIndex(int64_t t_ns) const;
+
+	/**
+	 * @brief Sleep until the next master-clock tick, to start the periodic CAN stream on it.
+	 */
+	void WaitNextTick() const;
+
+	/**
+	 * @brief Post targets for all hands (num_hands x MAX_DOF), applied delay cycles from now.
+	 *        Never blocks: fails if another live process holds a target lock for
+	 *        SYNC_POST_TRIES attempts. A lock left by a process that died is taken over.
+	 */
+	bool PostTargets(const double* q_all, int delay);
+
+	/**
+	 * @brief Control thread: called once the cycle's encoder frames are in.
+	 * @return true if a posted target became due this cycle and was copied to q_des
+	 */
+	bool BeginCycle(int64_t rx_ns, int64_t* cycle, double* q_des);
+
+	/**
+	 * @brief Control thread: block until this hand's TX slot of the cycle.
+	 */
+	void WaitTxSlot(int64_t cycle);
+
+	/**
+	 * @brief Control thread: the stream drifted off the clock (or the clock
+	 *        changed); restart it on a tick (WaitNextTick) and call Rephased().
+	 */
+	bool RephaseDue() const { return rephase_; }
+	void Rephased();
+
+	/**
+	 * @brief Counters since start; safe to call from any thread.
+	 */
+	void GetStats(SyncStats_t* st) const;
+
+private:
+	SyncShared_t* shm_;
+	int hand_;
+	int num_hands_;
+	bool lost_;                 // the clock changed to an incompatible period
+	int64_t period_ns_;
+	uint32_t target_seq_;
+	uint32_t generation_;
+
+	// phase tracking, control thread
+	int phase_n_;               // cycles into SYNC_PHASE_SETTLE
+	int holdoff_;
+	int64_t phase_ref0_;
+	int64_t phase_sum_;
+	int64_t phase_ref_;
+	double phase_f_;
+	bool rephase_;
+
+	// written by the control thread only
+	std::atomic<uint64_t> cycles_;
+	std::atomic<uint64_t> late_tx_;
+	std::atomic<uint64_t> skew_n_;
+	std::atomic<int64_t> skew_sum_ns_;
+	std::atomic<int64_t> skew_max_ns_;
+	std::atomic<int64_t> tx_wait_sum_ns_;
+	std::atomic<int64_t> phase_err_ns_;
+	std::atomic<int64_t> phase_err_max_ns_;
+	std::atomic<uint64_t> rephases_;
+	std::atomic<uint64_t> clock_changes_;
+};
+
+#endif
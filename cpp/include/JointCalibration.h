@@ -0,0 +1,227 @@
+#ifndef _JOINTCALIBRATION_H
+#define _JOINTCALIBRATION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Per-joint encoder zero offset and direction, applied in the decode stage:
+//
+//     q = enc * scale + offset,   scale = sign * CALIB_RAD_PER_COUNT
+//
+// This replaces the constant scale of the plain conversion with a per-joint
+// one, so a calibrated hand costs nothing extra per cycle.
+//
+// Calibrations are kept in a text file keyed by the hand serial number
+// (ID_RTR_SERIAL), one line per joint: <serial> <joint> <sign> <offset_rad>.
+// The entry for the connected hand is loaded when its serial arrives.
+//
+// Two routines run on the control thread to measure a hand:
+//  - hard stops: one joint at a time, a short torque probe finds the encoder
+//    direction, then a torque-limited velocity loop drives the joint slowly
+//    into its upper and lower stop and back to mid-range. The offset puts
+//    the midpoint of the two stop readings at the midpoint of the stop
+//    angles, and the measured span against the nominal one is the check.
+//    The other joints hold their position under PD control.
+//  - fixture: the hand rests unpowered in a fixture of known pose; the
+//    offsets come from the averaged counts, the signs are kept.
+// A finished routine is applied at the next cycle; q_des is remapped so the
+// joints stay where they are.
+
+#define CALIB_RAD_PER_COUNT     ((333.3/65536.0)*(3.141592/180.0))
+#define CALIB_FILE_DEFAULT      "joint_calibration.txt"
+#define CALIB_SERIAL_LEN        8
+
+#define CALIB_PROBE_TAU         0.1     // direction probe torque
+#define CALIB_PROBE_RAD         0.05    // motion that counts as moved
+#define CALIB_PROBE_S           1.0     // per probe direction
+#define CALIB_DRIVE_VEL         0.3     // rad/s towards a stop
+#define CALIB_DRIVE_TAU_MAX     0.3     // torque limit of the velocity loop
+#define CALIB_DRIVE_KV          0.5
+#define CALIB_DRIVE_KI          2.0
+#define CALIB_STALL_VEL         0.02    // rad/s
+#define CALIB_STALL_S           0.3     // stalled at the torque limit this long = at the stop
+#define CALIB_PHASE_TIMEOUT_S   20.0
+#define CALIB_MAX_SPAN_ERR      0.15    // rad, measured vs. nominal stop-to-stop span
+#define CALIB_FIXTURE_S         0.5     // averaging time in the fixture
+
+enum
+{
+	CALIB_IDLE = 0,
+	CALIB_STARTING,                     // waiting for the control thread
+	CALIB_RUNNING,
+	CALIB_DONE,
+	CALIB_STOPPED
+};
+
+// result per joint of the last routine
+enum
+{
+	CALIB_JOINT_NONE = 0,               // not part of the routine
+	CALIB_JOINT_PENDING,
+	CALIB_JOINT_OK,
+	CALIB_JOINT_NO_MOTION,              // the probe moved it in neither direction
+	CALIB_JOINT_TIMEOUT,
+	CALIB_JOINT_SPAN                    // stop-to-stop span off by more than MAX_SPAN_ERR, not applied
+};
+
+typedef struct
+{
+	double scale[MAX_DOF];              // rad per count, signed
+	double offset[MAX_DOF];             // rad
+} JointCalib_t;
+
+class JointCalibration
+{
+public:
+	explicit JointCalibration(double period);
+
+	/**
+	 * @brief Control thread: encoder counts to joint angles.
+	 */
+	void Decode(const int* enc, double* q) const
+	{
+		for (int i=0; i<MAX_DOF; i++)
+			q[i] = enc[i] * cur_.scale[i] + cur_.offset[i];
+	}
+
+	/**
+	 * @brief Control thread, before Decode: pick up a new calibration or a
+	 *        routine start or end, remapping q_des to the same joint positions.
+	 * @return true if the calibration changed or a routine started or ended
+	 */
+	bool Apply(double* q_des);
+
+	/**
+	 * @brief Control thread: the calibration Decode uses.
+	 */
+	const JointCalib_t& Current() const { return cur_; }
+
+	/**
+	 * @brief Control thread, after the torques are computed: run the routine.
+	 * @return true while the routine owns the hand
+	 */
+	bool Step(const int* enc, const double* q, double* q_des, double* tau);
+
+	/**
+	 * @brief Control thread: the serial number frame (8 characters).
+	 */
+	void SetSerial(const unsigned char* data);
+
+	/**
+	 * @brief Any thread: serial number of the hand, empty until it arrived.
+	 */
+	std::string Serial() const;
+
+	/**
+	 * @brief Command thread: replace the calibration at the next cycle.
+	 * @return false while a routine runs or if the previous hand-off was not picked up
+	 */
+	bool Set(const JointCalib_t& c);
+
+	/**
+	 * @brief Any thread: the calibration in use.
+	 */
+	void GetCurrent(JointCalib_t* c) const;
+
+	/**
+	 * @brief Command thread: start the hard-stop routine for the joints in mask.
+	 */
+	bool StartHardStops(int mask);
+
+	/**
+	 * @brief Command thread: start the fixture routine.
+	 * @param q_fix joint angles of the fixture pose (rad)
+	 */
+	bool StartFixture(const double* q_fix, int mask);
+
+	void Stop() { if (IsRunning()) stop_.store(true, std::memory_order_release); }
+	bool IsRunning() const
+	{
+		int s = state_.load(std::memory_order_relaxed);
+		return s == CALIB_STARTING || s == CALIB_RUNNING;
+	}
+
+	/**
+	 * @brief Command thread: stop angles of a joint for the hard-stop routine
+	 *        (default: the joint limits).
+	 */
+	bool SetStops(int joint, double lower, double upper);
+
+	/**
+	 * @brief Command thread: load the entry of this hand's serial from path.
+	 * @return joints loaded, -1 without a serial or on a read error
+	 */
+	int Load(const char* path);
+
+	/**
+	 * @brief Command thread: store the calibration in use under this hand's
+	 *        serial, keeping the entries of other hands.
+	 */
+	bool Save(const char* path) const;
+
+	/**
+	 * @brief Any thread: routine state and per-joint results and calibration as text.
+	 */
+	void Report(std::string* out) const;
+
+	static void Nominal(JointCalib_t* c);
+
+private:
+	void Enter(int phase, int dir);
+	void NextJoint();
+	void Finish(int state);
+	void Publish();
+
+	double dt_;
+
+	// control thread
+	JointCalib_t cur_;
+	JointCalib_t next_;                 // result of a routine
+	bool local_pending_;
+	bool first_;
+	int joint_;
+	int phase_;
+	int dir_;
+	int t_;                             // cycles in the phase
+	int c0_;                            // count at the start of the phase
+	int prev_c_;
+	int stall_;
+	double v_f_;
+	double tau_i_;
+	int c_lo_[MAX_DOF];
+	int c_hi_[MAX_DOF];
+	double sum_[MAX_DOF];
+	int n_sum_;
+
+	// command thread -> control thread
+	JointCalib_t buf_[2];
+	std::atomic<int> pending_;          // buffer waiting to be picked up, -1 if none
+	std::atomic<int> active_;
+	std::atomic<bool> start_;
+	std::atomic<bool> stop_;
+	bool fixture_;
+	int mask_;
+	double q_fix_[MAX_DOF];
+	double stop_lo_[MAX_DOF];
+	double stop_hi_[MAX_DOF];
+
+	// written by the control thread
+	std::atomic<int> state_;
+	std::atomic<int> cur_joint_;
+	std::atomic<int> cur_phase_;
+	std::atomic<int> status_[MAX_DOF];
+	std::atomic<int> sign_[MAX_DOF];
+	std::atomic<double> offset_[MAX_DOF];
+	std::atomic<double> span_err_[MAX_DOF];
+
+	// seqlock-protected copy of cur_
+	std::atomic<unsigned> seq_;
+	JointCalib_t shared_;
+
+	char serial_[CALIB_SERIAL_LEN + 1];
+	std::atomic<bool> have_serial_;
+};
+
+#endif
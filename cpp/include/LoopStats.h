@@ -0,0 +1,53 @@
+#ifndef _LOOPSTATS_H
+#define _LOOPSTATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Control-loop quality metrics, recorded once per cycle by the control thread.
+//
+// Three fixed-bin histograms are kept: the interval between cycles (jitter,
+// missed encoder frames), the latency from a complete set of encoder frames
+// to the last torque frame written, and the joint tracking error (RMS over
+// the joints of q_des - q). Reports give percentiles from these, so fault
+// profiles on the simulated bus can be compared by their tails.
+
+#define LOOP_TIME_BIN_US    10          // interval/latency bins
+#define LOOP_ERR_BIN_MRAD   0.5         // tracking error bins
+#define LOOP_BINS           2000
+
+class LoopStats
+{
+public:
+	explicit LoopStats(double period);
+
+	/**
+	 * @brief Control thread: one cycle (RX complete time, TX done time, joint state).
+	 */
+	void Record(int64_t t_rx_ns, int64_t t_tx_ns, const double* q, const double* q_des);
+
+	/**
+	 * @brief Any thread: clear the statistics at the next cycle.
+	 */
+	void RequestReset() { reset_.store(true, std::memory_order_release); }
+
+	void Report(std::string* out) const;
+
+private:
+	void Clear();
+
+	int64_t period_ns_;
+	int64_t prev_rx_ns_;
+	std::atomic<bool> reset_;
+
+	std::atomic<uint64_t> cycles_;
+	std::atomic<uint64_t> missed_;          // interval above 1.5 periods
+	std::atomic<double> err_sq_sum_;        // written by the control thread only
+	std::atomic<uint32_t> interval_[LOOP_BINS];
+	std::atomic<uint32_t> latency_[LOOP_BINS];
+	std::atomic<uint32_t> error_[LOOP_BINS];
+};
+
+#endif
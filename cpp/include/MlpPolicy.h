@@ -0,0 +1,123 @@
+#ifndef _MLPPOLICY_H
+#define _MLPPOLICY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Small MLP policies evaluated on the control thread.
+//
+// A policy maps an observation to 16 joint targets every 'decimation'
+// cycles. The observation is q, qdot and the current q_des, followed by q
+// from the previous 'history' policy steps (most recent first), normalized
+// with the per-element mean and std stored in the file. The output y is
+// mapped to q_des = offset + scale * y and clamped to the joint limits. A
+// non-finite output is never applied: it stops the policy instead.
+//
+// Weights file, little-endian:
+//   u32 magic "ALMP", u32 version, u32 num_layers, u32 history, u32 decimation
+//   f32 obs_mean[obs_dim], f32 obs_std[obs_dim]      obs_dim = 48 + 16*history
+//   f32 act_scale[16], f32 act_offset[16]
+//   per layer: u32 in, u32 out, u32 activation (0 linear, 1 relu, 2 tanh),
+//              f32 weight[out][in], f32 bias[out]
+//
+// Networks are loaded off the control thread into one preallocated block
+// (weights with rows padded for the SIMD kernels, activation and history
+// buffers) and handed over through two slots like TrajectoryPlayer, so
+// inference never allocates or blocks.
+
+#define MLP_MAGIC           0x504d4c41  // "ALMP"
+#define MLP_VERSION         1
+#define MLP_MAX_LAYERS      8
+#define MLP_MAX_WIDTH       1024
+#define MLP_MAX_HISTORY     16
+#define MLP_OBS_BASE        (3 * MAX_DOF)
+
+enum
+{
+	MLP_ACT_LINEAR = 0,
+	MLP_ACT_RELU,
+	MLP_ACT_TANH
+};
+
+typedef struct
+{
+	int in;
+	int out;
+	int in_pad;                         // row stride, multiple of 8 floats
+	int act;
+	float* w;
+	float* b;
+} MlpLayer_t;
+
+typedef struct
+{
+	int num_layers;
+	int history;
+	int decimation;
+	int obs_dim;
+	uint64_t macs;                      // multiply-adds per inference
+	MlpLayer_t layer[MLP_MAX_LAYERS];
+	float* obs_mean;
+	float* obs_inv_std;
+	float act_scale[MAX_DOF];
+	float act_offset[MAX_DOF];
+	float* act[2];                      // ping-pong activations
+	double* hist;                       // [history][MAX_DOF] past q, ring
+	int hist_pos;
+	int hist_fill;
+	void* mem;
+} MlpNet_t;
+
+class MlpPolicy
+{
+public:
+	MlpPolicy();
+	~MlpPolicy();
+
+	/**
+	 * @brief Load a weights file and hand it to the control thread (non-RT side).
+	 *        The new network takes over at the next cycle; it starts stopped.
+	 */
+	bool Load(const char* path, std::string* err);
+
+	/**
+	 * @brief Start running the loaded policy; decimation 0 keeps the file's value.
+	 */
+	bool Run(int decimation);
+	void Stop();
+	bool IsRunning() const { return running_.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Control thread: run inference if due and write q_des.
+	 * @return true if q_des was updated
+	 */
+	bool Update(const double* q, const double* qdot, double* q_des);
+
+	/**
+	 * @brief Any thread: network size and per-inference cost as text.
+	 */
+	void Report(std::string* out) const;
+
+private:
+	static void Free(MlpNet_t* net);
+	static void Forward(MlpNet_t* net);
+
+	MlpNet_t* slot_[2];
+	std::atomic<int> pending_;          // slot waiting to be picked up, -1 if none
+	std::atomic<int> active_;           // slot owned by the control thread, -1 if none
+	std::atomic<int> run_request_;      // decimation to start with, 0 none, -1 stop
+	std::atomic<bool> running_;
+	int decimation_;
+	int countdown_;
+
+	// written by the control thread only
+	std::atomic<uint64_t> inferences_;
+	std::atomic<int64_t> sum_ns_;
+	std::atomic<int64_t> max_ns_;
+	std::atomic<int64_t> last_ns_;
+	std::atomic<uint64_t> rejected_;    // inferences with a non-finite output
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef _MOTIONSCRIPT_H
+#define _MOTIONSCRIPT_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Small motion-script engine run by the control thread.
+//
+// Scripts are compiled from text (see CompileMotionScript) into fixed-size
+// instructions plus pose and gain tables, stored in preallocated slots and
+// started by ID. The VM executes at most MS_MAX_OPS_PER_CYCLE instructions
+// per control cycle, so a cycle's cost is bounded whatever the script does.
+//
+// Script text, one statement per line ('#' starts a comment):
+//   pose <name> <q0>,...,<q15>         declare a pose
+//   gainset <name> <kp x16> <kd x16>   declare a gain set (comma-separated)
+//   <label>:                           jump target
+//   move <pose> [seconds]              ramp q_des to a pose
+//   wait <seconds>
+//   wait_contact <finger_mask> <tau> <timeout> [else_label]
+//                                      until |tau_des| of a masked finger exceeds tau
+//   wait_err <rad> <timeout> [else_label]
+//                                      until max |q_des - q| drops below rad
+//   gains <gainset>
+//   motion <none|home|ready|gravity|grasp3|grasp4|pinch_it|pinch_mt|envelop|joint_pd>
+//   goto <label>
+//   end
+//
+// Durations and timeouts are 0 to MS_MAX_SECONDS and all operands must be
+// finite; anything else fails the compile.
+
+#define MS_MAX_INSTR            256
+#define MS_MAX_POSES            32
+#define MS_MAX_GAINS            8
+#define MS_MAX_SCRIPTS          16
+#define MS_MAX_OPS_PER_CYCLE    16
+#define MS_MAX_SECONDS          3600.0  // longest move, wait or timeout
+
+enum eMsOp
+{
+	MS_OP_END = 0,
+	MS_OP_MOVE,             // a16 = pose, f0 = duration (s)
+	MS_OP_WAIT,             // f0 = duration (s)
+	MS_OP_WAIT_CONTACT,     // a8 = finger mask, f0 = torque, f1 = timeout (s), jump = else
+	MS_OP_WAIT_ERR,         // f0 = position error (rad), f1 = timeout (s), jump = else
+	MS_OP_GAINS,            // a16 = gain set
+	MS_OP_MOTION,           // a16 = BHand motion type
+	MS_OP_JUMP,             // jump = target
+	MS_NUM_OPS
+};
+
+typedef struct
+{
+	uint8_t  op;
+	uint8_t  a8;
+	uint16_t a16;
+	int32_t  jump;          // instruction index, -1 for none
+	float    f0;
+	float    f1;
+} MsInstr_t;
+
+typedef struct
+{
+	int num_instr;
+	MsInstr_t instr[MS_MAX_INSTR];
+	int num_poses;
+	double pose[MS_MAX_POSES][MAX_DOF];
+	int num_gains;
+	double kp[MS_MAX_GAINS][MAX_DOF];
+	double kd[MS_MAX_GAINS][MAX_DOF];
+} MotionScript_t;
+
+/**
+ * @brief Compile script text. On failure returns false and sets err to "<line>: <reason>".
+ */
+bool CompileMotionScript(const std::string& text, MotionScript_t* out, std::string* err);
+
+// Side effects the control thread must apply after a VM step
+typedef struct
+{
+	int motion_type;        // -1 if unchanged
+	const double* kp;       // NULL if unchanged
+	const double* kd;
+} MsEffects_t;
+
+class MotionScriptVM
+{
+public:
+	explicit MotionScriptVM(double dt);
+
+	/**
+	 * @brief Store a compiled script in a slot (non-RT side).
+	 * @return false if the slot is out of range or its script is running
+	 */
+	bool Upload(int id, const MotionScript_t& script);
+
+	/**
+	 * @brief Request a start/stop; picked up at the next cycle.
+	 */
+	bool Run(int id);
+	void Stop();
+
+	/**
+	 * @brief Execute one control cycle (control thread).
+	 * @return true while a script is running
+	 */
+	bool Step(const double* q, const double* tau, double* q_des, MsEffects_t* fx);
+
+	int RunningId() const { return running_.load(std::memory_order_relaxed); }
+	int Pc() const { return pc_.load(std::memory_order_relaxed); }
+
+private:
+	double dt_;
+	MotionScript_t slot_[MS_MAX_SCRIPTS];
+	bool valid_[MS_MAX_SCRIPTS];
+	std::atomic<int> request_;      // slot to start, -1 none, -2 stop
+	std::atomic<int> running_;      // slot being executed, -1 idle
+	std::atomic<int> pc_;
+
+	// execution state, control thread only
+	int wait_;                      // cycles left in the current wait/move
+	int move_len_;
+	double move_from_[MAX_DOF];
+};
+
+#endif
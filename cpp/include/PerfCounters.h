@@ -0,0 +1,82 @@
+#ifndef _PERFCOUNTERS_H
+#define _PERFCOUNTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+// Hardware/software performance counters of the control thread (--perf).
+//
+// One perf_event group (CPU cycles, instructions, cache misses, branch
+// misses and context switches, as far as the kernel offers them) is opened
+// on the control thread and read with a single read() at the start and end
+// of every cycle. The per-cycle deltas go
+// into lifetime log2 histograms and into a ring of the most recent cycles,
+// from which the report compares the slowest 1% of cycles with the rest.
+
+#define PERF_NUM_COUNTERS   5
+#define PERF_HIST_BUCKETS   40      // bucket b counts values in [2^(b-1), 2^b)
+#define PERF_RING_CYCLES    4096
+
+enum PerfCounterId
+{
+	PERF_CPU_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_CONTEXT_SWITCHES
+};
+
+typedef struct
+{
+	uint32_t cycle;
+	uint32_t dur_ns;                        // wall time from Begin() to End()
+	uint64_t count[PERF_NUM_COUNTERS];
+} PerfSample_t;
+
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+
+	/**
+	 * @brief Open the counter group on the calling thread.
+	 * @return false if perf events are unavailable (see /proc/sys/kernel/perf_event_paranoid)
+	 */
+	bool Open();
+	void Close();
+	bool IsOpen() const { return leader_ >= 0; }
+
+	/**
+	 * @brief Control thread: snapshot at the start of a cycle.
+	 */
+	void Begin();
+
+	/**
+	 * @brief Control thread: snapshot at the end of a cycle and record the deltas.
+	 */
+	void End(uint32_t cycle);
+
+	/**
+	 * @brief Text report: per counter mean/p50/p99/max over the ring, mean over the
+	 *        slowest 1% of cycles, and the lifetime histogram.
+	 */
+	void Report(std::string* out) const;
+
+private:
+	bool ReadGroup(uint64_t* values);
+
+	int fd_[PERF_NUM_COUNTERS];            // -1 for counters that are not available
+	int leader_;
+	int num_open_;
+	uint64_t start_[PERF_NUM_COUNTERS];
+	int64_t start_ns_;
+
+	std::atomic<uint64_t> head_;            // cycles recorded
+	PerfSample_t ring_[PERF_RING_CYCLES];
+	std::atomic<uint64_t> hist_[PERF_NUM_COUNTERS + 1][PERF_HIST_BUCKETS];  // last row: duration (ns)
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _PLUGINHOST_H
+#define _PLUGINHOST_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "AllegroPlugin.h"
+#include "rDeviceAllegroHandCANDef.h"
+
+// Loads controller plugins (AllegroPlugin.h) and runs them on the control
+// thread, in load order, once per cycle.
+//
+// The command thread builds a new plugin chain and hands it over through
+// two preallocated chain buffers (the pattern of TrajectoryPlayer); the
+// control thread switches at the start of a cycle, so loading, replacing
+// (hot swap of a plugin with the same name) and unloading never stall the
+// loop. Each shared object is opened from a private in-memory copy, so a
+// rebuilt library at the same path is really reloaded. Joint targets from a
+// plugin are clamped to the joint limits. Every plugin has a time
+// budget per cycle; a plugin that overruns it PLUGIN_MAX_OVERRUNS cycles in
+// a row, or whose compute() fails, is disabled and the built-in controller
+// takes over for it. A plugin that never returns cannot be stopped.
+
+#define PLUGIN_MAX              4
+#define PLUGIN_MAX_OVERRUNS     3
+#define PLUGIN_DEFAULT_BUDGET_US 300
+
+enum
+{
+	PLUGIN_ACTIVE = 0,
+	PLUGIN_DISABLED_BUDGET,
+	PLUGIN_DISABLED_ERROR
+};
+
+typedef struct
+{
+	void* dl;
+	int fd;                         // memory copy dlopen() mapped, open while loaded
+	const AllegroPluginDesc* desc;
+	void* ctx;
+	char name[64];
+	char path[256];
+	int64_t budget_ns;
+
+	// written by the control thread
+	std::atomic<int> state;
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> overruns;
+	std::atomic<int64_t> sum_ns;
+	std::atomic<int64_t> max_ns;
+	int consecutive;
+} PluginEntry_t;
+
+typedef struct
+{
+	int n;
+	PluginEntry_t* e[PLUGIN_MAX];
+} PluginChain_t;
+
+class PluginHost
+{
+public:
+	explicit PluginHost(double period);
+	~PluginHost();
+
+	/**
+	 * @brief Command thread: load a plugin, replacing a loaded one of the same name.
+	 * @param args passed to the plugin's init()
+	 */
+	bool Load(const char* path, int budget_us, const char* args, std::string* err);
+
+	/**
+	 * @brief Command thread: unload a plugin by name.
+	 */
+	bool Unload(const char* name, std::string* err);
+
+	/**
+	 * @brief Control thread: run the chain. q_des is updated in place.
+	 * @return true if a plugin commanded torques (written to tau)
+	 */
+	bool Run(int64_t t_ns, uint64_t cycle, const double* q, const double* qdot, double* q_des,
+	         const double* tau_prev, const int* enc, double* tau);
+
+	/**
+	 * @brief Command thread: one line per plugin.
+	 */
+	void Report(std::string* out) const;
+
+	/**
+	 * @brief Shut down and close every plugin (after the control thread has stopped).
+	 */
+	void UnloadAll();
+
+private:
+	bool Publish(const PluginChain_t& chain, std::string* err);
+	static void Close(PluginEntry_t* e);
+
+	double period_;
+	PluginChain_t chain_[2];
+	std::atomic<int> pending_;          // chain buffer waiting to be picked up, -1 if none
+	std::atomic<int> active_;           // chain buffer used by the control thread
+	AllegroPluginState state_;          // control thread
+	AllegroPluginOutput out_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _REACHABILITYMAP_H
+#define _REACHABILITYMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "AllegroKinematics.h"
+
+// Precomputed fingertip reachability map.
+//
+// Each finger gets a dense voxel grid over its workspace bounding box. Every
+// voxel holds one bit (reachable or not) and the joint configuration whose
+// fingertip landed closest to the voxel center, usable as an IK seed. The
+// file is written by the bake_reachability tool and mmap()ed read-only by the
+// server, so loading does not touch the data and queries are O(1).
+
+#define REACHMAP_MAGIC      "ALRMAP1"
+#define REACHMAP_VERSION    1
+#define REACHMAP_SEED_SCALE 1.0e-4      // rad per seed count (int16)
+
+typedef struct
+{
+	float    origin[3];         // palm-frame position of voxel (0,0,0) corner
+	uint32_t dims[3];           // voxel count along x, y, z
+	uint32_t reachable;         // number of reachable voxels
+	uint64_t bits_offset;       // byte offset of the occupancy bitset
+	uint64_t seeds_offset;      // byte offset of int16[dims][4] seeds
+} ReachMapFinger_t;
+
+typedef struct
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t right_hand;
+	float    voxel;             // voxel edge length (m)
+	uint32_t num_fingers;
+	ReachMapFinger_t finger[NUM_FINGERS];
+} ReachMapHeader_t;
+
+class ReachabilityMap
+{
+public:
+	ReachabilityMap();
+	~ReachabilityMap();
+
+	/**
+	 * @brief Map a baked file read-only. Returns false if it is missing, malformed
+	 *        or baked for the other hand.
+	 */
+	bool Load(const char* path, bool right_hand);
+	void Unload();
+	bool IsLoaded() const { return hdr_ != NULL; }
+
+	/**
+	 * @brief Reachability of a palm-frame point for one finger.
+	 * @param seed if non-NULL and reachable, the stored joint seed (rad)
+	 */
+	bool Query(int finger, const double p[3], double seed[DOF_PER_FINGER]) const;
+
+	const ReachMapHeader_t* Header() const { return hdr_; }
+
+	/**
+	 * @brief Sample each finger's joint space and write a map file.
+	 * @param voxel voxel edge length (m)
+	 * @param samples grid samples per joint
+	 * @return 0 on success
+	 */
+	static int Bake(const char* path, bool right_hand, double voxel, int samples);
+
+private:
+	const ReachMapHeader_t* hdr_;
+	const unsigned char* base_;
+	size_t size_;
+};
+
+#endif
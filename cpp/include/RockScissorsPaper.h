@@ -9,5 +9,10 @@ void MotionScissors();
 void MotionPaper();
 
 void SetTargetQ(std::vector<double> q);
+void SetJointPDMode();
+
+// BHand motion type, kept here because BHand does not report the active one
+void SetHandMotionType(int type);
+int HandMotionType();
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef _RTCLOCK_H
+#define _RTCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+
+// Monotonic time in nanoseconds
+static inline int64_t rt_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Sleep until an absolute monotonic time
+static inline void rt_sleep_until_ns(int64_t t)
+{
+	struct timespec ts;
+	ts.tv_sec = t / 1000000000LL;
+	ts.tv_nsec = t % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+#endif
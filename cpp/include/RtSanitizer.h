@@ -0,0 +1,62 @@
+#ifndef _RTSANITIZER_H
+#define _RTSANITIZER_H
+
+#include <stdint.h>
+#include <string>
+
+// Real-time safety checker for the control cycle (debug builds with
+// -DALLEGRO_RT_SANITIZER=ON).
+//
+// The sanitizer build interposes malloc/calloc/realloc/posix_memalign/free,
+// pthread_mutex_lock, stdio output and common blocking syscalls. Any of them
+// called on a thread that is inside a cycle (between RtCycleBegin() and
+// RtCycleEnd()) is counted and, for the first RT_SAN_MAX_REPORTS calls,
+// reported on stderr with a stack trace. Expected I/O such as the CAN
+// writes is wrapped in an RtAllowScope. Setting ALLEGRO_RT_SANITIZER_ABORT=1
+// in the environment aborts on the first violation, for use in tests.
+//
+// Without the build option all of this compiles to nothing.
+
+#define RT_SAN_MAX_REPORTS  20
+
+enum RtViolationKind
+{
+	RT_VIOLATION_ALLOC = 0,
+	RT_VIOLATION_FREE,
+	RT_VIOLATION_MUTEX,
+	RT_VIOLATION_STDIO,
+	RT_VIOLATION_SYSCALL,
+	RT_VIOLATION_COUNT
+};
+
+#ifdef ALLEGRO_RT_SANITIZER
+
+void RtCycleBegin();
+void RtCycleEnd();
+void RtAllowBegin();
+void RtAllowEnd();
+
+/**
+ * @brief Violation counts by kind since start.
+ */
+void RtSanitizerReport(std::string* out);
+
+#else
+
+inline void RtCycleBegin() {}
+inline void RtCycleEnd() {}
+inline void RtAllowBegin() {}
+inline void RtAllowEnd() {}
+inline void RtSanitizerReport(std::string* out) { *out = "rt sanitizer not built (-DALLEGRO_RT_SANITIZER=ON)"; }
+
+#endif
+
+// Marks a section of the cycle whose blocking calls are intended
+class RtAllowScope
+{
+public:
+	RtAllowScope() { RtAllowBegin(); }
+	~RtAllowScope() { RtAllowEnd(); }
+};
+
+#endif
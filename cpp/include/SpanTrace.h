@@ -0,0 +1,87 @@
+#ifndef _SPANTRACE_H
+#define _SPANTRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Lightweight span tracing of the control cycle stages.
+//
+// Every traced thread owns a ring of spans (start/end TSC plus the cycle
+// number) that only it writes, so recording a span is two TSC reads and one
+// store without locks or allocation. The export side copies each ring
+// without stopping the writers and discards entries overwritten meanwhile,
+// then converts the TSC stamps to CLOCK_MONOTONIC and writes Chrome trace
+// JSON, which chrome://tracing and the Perfetto UI both open.
+
+#define TRACE_MAX_THREADS       8
+#define TRACE_RING_SPANS        32768   // per thread; ~16 s of a 6-span cycle at 333 Hz
+
+enum TraceSpanId
+{
+	SPAN_RX = 0,            // first to last encoder frame of the cycle
+	SPAN_DECODE,            // sync, encoder -> q, qdot
+	SPAN_CONTROL,           // trajectory/script step and ComputeTorque
+	SPAN_SAFETY,            // torque clamp
+	SPAN_TX,                // TX slot wait and torque frames
+	SPAN_RECORD,            // state history push
+	SPAN_PUBLISH,           // state streams (publisher thread)
+	SPAN_COMMAND,           // one ZMQ command (command thread)
+	SPAN_COUNT
+};
+
+typedef struct
+{
+	uint64_t start;         // TSC
+	uint64_t end;
+	uint32_t id;
+	uint32_t cycle;
+} TraceSpan_t;
+
+/**
+ * @brief Timestamp counter (rdtsc on x86, CLOCK_MONOTONIC ns elsewhere).
+ */
+uint64_t TraceNow();
+
+/**
+ * @brief Give the calling thread a ring; call once per thread before recording.
+ */
+bool TraceRegisterThread(const char* name);
+
+/**
+ * @brief Record a finished span on the calling thread's ring (no-op if unregistered).
+ */
+void TraceRecord(int id, uint64_t start, uint64_t end, uint32_t cycle);
+
+/**
+ * @brief Write the spans of the last 'seconds' to a Chrome trace JSON file.
+ * @param pid process id in the trace (the hand index)
+ * @param scratch TRACE_RING_SPANS spans of copy space; NULL to allocate it
+ * @return number of spans written, -1 if the file cannot be written
+ */
+int TraceExportChrome(double seconds, const char* path, int pid, TraceSpan_t* scratch = NULL);
+
+/**
+ * @brief Close the span that began at *t_start and start the next stage at the same instant.
+ */
+inline void TraceStage(int id, uint64_t* t_start, uint32_t cycle)
+{
+	uint64_t t = TraceNow();
+	TraceRecord(id, *t_start, t, cycle);
+	*t_start = t;
+}
+
+// Records the enclosing scope as one span
+class TraceScope
+{
+public:
+	TraceScope(int id, uint32_t cycle) : id_(id), cycle_(cycle), start_(TraceNow()) {}
+	~TraceScope() { TraceRecord(id_, start_, TraceNow(), cycle_); }
+
+private:
+	int id_;
+	uint32_t cycle_;
+	uint64_t start_;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _STATECODEC_H
+#define _STATECODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "StateHistory.h"
+
+// Compact encoding of the raw encoder counts for thin links.
+//
+// A stream is a sequence of self-delimiting frames. A keyframe carries the
+// absolute counts; a delta frame carries, per joint, the change since the
+// frame 'divisor' cycles earlier as a zigzag varint (one byte for changes
+// within +-63 counts). Deltas are taken modulo 2^16, so every joint needs at
+// most three bytes. Keyframes are sent every STATE_CODEC_KEY_INTERVAL frames
+// of a stream; a decoder that missed a frame waits for the next one.
+//
+//   keyframe:  'K' | varint divisor | varint cycle | int64 t_ns | int16 enc x16
+//   delta:     'D' | varint cycle | zigzag varint dt_ns | zigzag varint d_enc x16
+
+#define STATE_CODEC_KEY             'K'
+#define STATE_CODEC_DELTA           'D'
+#define STATE_CODEC_KEY_INTERVAL    64
+#define STATE_CODEC_MAX_BYTES       (1 + 5 + 10 + 8 + 3*MAX_DOF)
+
+/**
+ * @brief Encode one sample; ref is the sample 'divisor' cycles earlier, or NULL for a keyframe.
+ * @return frame length in bytes (at most STATE_CODEC_MAX_BYTES)
+ */
+size_t EncodeStateFrame(const StateSample_t& s, const StateSample_t* ref, int divisor, uint8_t* out);
+
+class StateFrameDecoder
+{
+public:
+	StateFrameDecoder();
+
+	/**
+	 * @brief Decode one frame.
+	 * @return true if cycle/t_ns/enc were updated; false for a malformed frame or a
+	 *         delta frame whose predecessor was missed (skipped until the next keyframe)
+	 */
+	bool Decode(const uint8_t* buf, size_t len);
+
+	bool Synced() const { return synced_; }
+	uint64_t Cycle() const { return cycle_; }
+	int64_t Time() const { return t_ns_; }
+	const int16_t* Enc() const { return enc_; }
+	uint64_t Gaps() const { return gaps_; }
+
+private:
+	bool synced_;
+	uint32_t divisor_;
+	uint64_t cycle_;
+	int64_t t_ns_;
+	int16_t enc_[MAX_DOF];
+	uint64_t gaps_;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _STATECOMMANDS_H
+#define _STATECOMMANDS_H
+
+#include <string>
+#include <istream>
+#include "StateHistory.h"
+#include "StatePublisher.h"
+
+// Requests answered from the state history and the state publisher alone:
+// history, history_range, state_at, subscribe, unsubscribe, sub_stats,
+// pool_stats and codec_stats. Shared by the single-process server and the
+// network gateway, which serves them from the core's shared-memory history
+// without a round trip to the core.
+
+/**
+ * @brief Handle one of the commands above; 'args' holds the rest of the request.
+ * @param pub_port port of the publisher's ROUTER socket, returned to subscribers
+ * @return false if cmd is not a state command (reply untouched)
+ */
+bool HandleStateCommand(const std::string& cmd, std::istream& args, const StateHistory& history,
+                        StatePublisher& publisher, int pub_port, std::string& reply);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef _STATEHISTORY_H
+#define _STATEHISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// In-memory ring of the last N control cycles.
+//
+// The control thread is the only writer and appends one record per cycle.
+// Every slot carries its own sequence number (a per-slot seqlock), so
+// readers on other threads copy records without any lock and simply retry
+// or skip a slot that is being overwritten. Storage is allocated once and
+// every record starts on its own cache line. The ring can also live in a
+// POSIX shared-memory segment, so another process (the network gateway)
+// reads it with the same seqlock protocol.
+
+#define STATE_HISTORY_MAGIC     0x48534c41  // "ALSH"
+#define STATE_HISTORY_VERSION   1
+#define STATE_INTERP_MAGIC      0x49534c41  // "ALSI"
+#define STATE_INTERP_MAX        4096        // time stamps per query
+
+typedef struct
+{
+	int64_t  t_ns;                  // CLOCK_MONOTONIC at cycle start
+	uint64_t cycle;                 // control cycle count
+	double   q[MAX_DOF];
+	double   qdot[MAX_DOF];
+	double   q_des[MAX_DOF];
+	double   tau_des[MAX_DOF];
+	int16_t  enc[MAX_DOF];          // raw encoder counts
+} StateSample_t;
+
+typedef struct alignas(64)
+{
+	std::atomic<uint64_t> seq;      // 2*index+1 while written, 2*index+2 when valid
+	StateSample_t s;
+} StateRecord_t;
+
+typedef struct alignas(64)
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t record_bytes;
+	std::atomic<uint64_t> head;     // index of the next record to be written
+} StateHistoryHeader_t;
+
+// Wire format of a history reply: this header followed by 'count' packed StateSample_t
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t sample_bytes;
+	int64_t  now_ns;                // server clock when the reply was built
+} StateHistoryReply_t;
+
+// State at a requested time stamp, linearly interpolated between the two
+// cycles around it
+enum
+{
+	STATE_AT_OK = 0,
+	STATE_AT_GAP,                   // interpolated across missing cycles
+	STATE_AT_LATE,                  // newer than the latest cycle: holds the latest state
+	STATE_AT_EARLY                  // older than the history: no data
+};
+
+typedef struct
+{
+	int64_t  t_ns;                  // requested time
+	int32_t  status;                // STATE_AT_*
+	int32_t  reserved;
+	double   q[MAX_DOF];
+	double   qdot[MAX_DOF];
+} StateInterp_t;
+
+class StateHistory
+{
+public:
+	StateHistory();
+	~StateHistory();
+
+	/**
+	 * @brief Allocate a ring for 'capacity' cycles.
+	 */
+	bool Create(uint32_t capacity);
+
+	/**
+	 * @brief Create the ring in shared memory 'name' (writer process; unlinked on destruction).
+	 */
+	bool CreateShared(const char* name, uint32_t capacity);
+
+	/**
+	 * @brief Map a ring created by another process (readers only).
+	 */
+	bool AttachShared(const char* name);
+	uint32_t Capacity() const { return hdr_ ? hdr_->capacity : 0; }
+
+	/**
+	 * @brief Append one sample (control thread only).
+	 */
+	void Push(const StateSample_t& s);
+
+	/**
+	 * @brief Copy the sample with a given index; false if not written yet or already overwritten.
+	 */
+	bool Read(uint64_t index, StateSample_t* out) const;
+
+	/**
+	 * @brief Index range currently held: [first, end).
+	 */
+	void Range(uint64_t* first, uint64_t* end) const;
+
+	/**
+	 * @brief First index whose time is >= t_ns (end if none).
+	 */
+	uint64_t LowerBound(int64_t t_ns) const;
+
+	/**
+	 * @brief Append a binary reply with every stride-th sample in [t0_ns, t1_ns].
+	 * @param max_count upper bound on the samples returned
+	 * @return number of samples written
+	 */
+	uint32_t QueryWindow(int64_t t0_ns, int64_t t1_ns, uint32_t stride, uint32_t max_count, std::string* reply) const;
+
+	/**
+	 * @brief Interpolate the state at n time stamps (any order) in one pass over the ring.
+	 */
+	void Interpolate(const int64_t* t_ns, uint32_t n, StateInterp_t* out) const;
+
+	/**
+	 * @brief Append a binary reply: StateHistoryReply_t (magic STATE_INTERP_MAGIC) and n StateInterp_t.
+	 */
+	void QueryAt(const int64_t* t_ns, uint32_t n, std::string* reply) const;
+
+private:
+	StateHistoryHeader_t* hdr_;
+	StateRecord_t* rec_;
+	void* mem_;
+	size_t shm_bytes_;              // mapped size, 0 if heap-allocated
+	bool shm_owner_;
+	char shm_name_[64];
+};
+
+#endif
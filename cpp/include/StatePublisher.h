@@ -0,0 +1,138 @@
+#ifndef _STATEPUBLISHER_H
+#define _STATEPUBLISHER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include "StateHistory.h"
+#include "BufferPool.h"
+
+// Streams state to subscribers from a worker thread that follows the state
+// history ring, so the control thread does no publishing work.
+//
+// A subscription is a (rate divisor, field mask) pair. Each cycle, every
+// distinct pair that is due is packed once into a single message and handed
+// to each of its subscribers over a ZMQ ROUTER socket. Sends never block: a
+// subscriber whose queue is full loses that message and its own drop
+// counter goes up, which leaves every other subscriber unaffected.
+// Messages are written into slots of a preallocated pool and handed to ZMQ
+// without copying; all subscribers of a message share its slot.
+//
+// Clients connect a DEALER socket with the routing id returned by
+// 'subscribe' (e.g. "sub3") to tcp://<host>:<5557+hand>.
+//
+// A STATE_FIELD_ENC_DELTA subscription gets StateCodec frames instead of
+// StateMsgHeader_t messages; they are encoded here, on the publisher thread.
+
+#define STATE_FIELD_Q           0x01
+#define STATE_FIELD_QDOT        0x02
+#define STATE_FIELD_Q_DES       0x04
+#define STATE_FIELD_TAU_DES     0x08
+#define STATE_FIELD_ENC         0x10
+#define STATE_FIELD_ALL         0x1f
+#define STATE_FIELD_ENC_DELTA   0x20        // compact encoder-only stream (StateCodec.h), not combinable
+
+#define STATE_MSG_MAGIC         0x4d534c41  // "ALSM"
+#define PUB_MAX_SUBSCRIBERS     32
+#define PUB_QUEUE_DEPTH         16          // messages queued per subscriber before dropping
+#define PUB_LEASE_SECONDS       5.0         // unreachable subscribers are dropped after this
+#define PUB_POOL_SLOTS          (PUB_MAX_SUBSCRIBERS * (PUB_QUEUE_DEPTH + 2))
+
+// Message header; the selected fields follow in bit order (doubles x16, enc as int16 x16)
+typedef struct
+{
+	uint32_t magic;
+	uint16_t mask;
+	uint16_t divisor;
+	uint64_t cycle;                 // gaps in cycle/divisor reveal drops
+	int64_t  t_ns;
+} StateMsgHeader_t;
+
+typedef struct
+{
+	int id;
+	int divisor;
+	int mask;
+	uint64_t sent;
+	uint64_t dropped;               // queue full
+	uint64_t unreachable;           // not connected (yet)
+	double cost_us;                 // mean pack share + send time per message
+} SubscriberStats_t;
+
+typedef struct
+{
+	uint64_t frames;                // encoded once per delta stream and cycle
+	uint64_t keyframes;
+	uint64_t bytes;
+	uint64_t raw_bytes;             // same frames as uncompressed STATE_FIELD_ENC messages
+	uint64_t encode_ns;
+} CodecStats_t;
+
+class StatePublisher
+{
+public:
+	StatePublisher();
+	~StatePublisher();
+
+	bool Start(const StateHistory* history, int port, double period);
+	void Stop();
+
+	/**
+	 * @brief Register a subscription; returns its id or -1 if the table is full.
+	 */
+	int Subscribe(int divisor, int mask);
+	bool Unsubscribe(int id);
+
+	/**
+	 * @brief Snapshot of active subscribers; returns the count.
+	 */
+	int GetStats(SubscriberStats_t* out, int max) const;
+	uint64_t Overruns() const { return overruns_.load(std::memory_order_relaxed); }
+	void GetCodecStats(CodecStats_t* st) const;
+	void GetPoolStats(BufferPoolStats_t* st) const { pool_.GetStats(st); }
+
+	/**
+	 * @brief Size in bytes of a packed message for a field mask.
+	 */
+	static size_t MessageBytes(int mask);
+
+	/**
+	 * @brief Pack one sample into buf (MessageBytes(mask) long).
+	 */
+	static void Pack(const StateSample_t& s, int mask, int divisor, unsigned char* buf);
+
+private:
+	struct Subscriber
+	{
+		std::atomic<int> active;
+		int divisor;
+		int mask;
+		int64_t unreachable_since;
+		std::atomic<uint64_t> sent;
+		std::atomic<uint64_t> dropped;
+		std::atomic<uint64_t> unreachable;
+		std::atomic<uint64_t> cost_ns;
+	};
+
+	static void* ThreadProc(void* inst);
+	void Run();
+	void PublishSample(uint64_t index, const StateSample_t& s);
+	size_t EncodeDelta(uint64_t index, const StateSample_t& s, int divisor, uint8_t* buf);
+
+	const StateHistory* history_;
+	int port_;
+	int64_t period_ns_;
+	pthread_t thread_;
+	std::atomic<bool> run_;
+	std::atomic<uint64_t> overruns_;
+	std::atomic<uint64_t> codec_frames_;
+	std::atomic<uint64_t> codec_keyframes_;
+	std::atomic<uint64_t> codec_bytes_;
+	std::atomic<uint64_t> codec_ns_;
+	Subscriber subs_[PUB_MAX_SUBSCRIBERS];
+	BufferPool pool_;
+	void* socket_;                  // zmq::socket_t, owned by the publisher thread
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef _TASKSCHEDULER_H
+#define _TASKSCHEDULER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include "WorkerPool.h"
+
+// Periodic tasks in three tiers:
+//   SCHED_TIER_RT          run on the control thread by RunRt(), every N cycles,
+//                          with a fixed budget; a task that overruns it
+//                          SCHED_MAX_OVERRUNS times in a row is disabled
+//   SCHED_TIER_SOFT        own thread, for retargeting, planners and the like;
+//                          SCHED_FIFO just below the control thread once that
+//                          runs under SCHED_FIFO (SetControlPriority), else
+//                          SCHED_OTHER so it never preempts the control loop
+//   SCHED_TIER_BACKGROUND  own thread (SCHED_IDLE), for housekeeping; with a
+//                          WorkerPool attached the thread only dispatches and
+//                          the tasks run on the pool, one job per task at a time
+//
+// Tasks are registered before Start() and never change afterwards, so no
+// tier takes a lock. A soft or background task that falls behind skips the
+// missed periods instead of running back to back. Tiers exchange data
+// through SchedMailbox. Every task keeps run count, mean/max run time,
+// worst start lateness, overruns and skipped periods.
+
+#define SCHED_MAX_TASKS     16
+#define SCHED_MAX_OVERRUNS  3
+#define SCHED_SOFT_PRIORITY 10          // SCHED_FIFO priority of the soft tier, below the control thread
+
+enum
+{
+	SCHED_TIER_RT = 0,
+	SCHED_TIER_SOFT,
+	SCHED_TIER_BACKGROUND,
+	SCHED_NUM_TIERS
+};
+
+typedef void (*SchedTaskFn)(void* arg, int64_t now_ns);
+
+typedef struct
+{
+	char name[32];
+	int tier;
+	SchedTaskFn fn;
+	void* arg;
+	int64_t period_ns;
+	int period_cycles;                  // RT tier
+	int64_t budget_ns;
+
+	// owned by the tier's thread
+	int64_t next_ns;
+	int countdown;
+	int consecutive;
+
+	// written by the tier's thread, read anywhere
+	std::atomic<bool> disabled;
+	std::atomic<uint64_t> runs;
+	std::atomic<uint64_t> overruns;
+	std::atomic<uint64_t> skipped;
+	std::atomic<int64_t> sum_ns;
+	std::atomic<int64_t> max_ns;
+	std::atomic<int64_t> late_ns;       // worst start lateness
+	std::atomic<bool> in_pool;          // background job queued or running
+	class TaskScheduler* owner;
+} SchedTask_t;
+
+// Latest-value mailbox between one writer and one reader (triple buffer).
+// Neither side ever waits; the reader gets the most recent complete value.
+template <typename T>
+class SchedMailbox
+{
+public:
+	SchedMailbox() : middle_(1), back_(0), front_(2), has_(false) {}
+
+	void Write(const T& v)
+	{
+		buf_[back_] = v;
+		back_ = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel) & kIndex;
+	}
+
+	/**
+	 * @return false until the first value has been written
+	 */
+	bool Read(T* out)
+	{
+		if (middle_.load(std::memory_order_relaxed) & kFresh)
+		{
+			front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndex;
+			has_ = true;
+		}
+		if (has_) *out = buf_[front_];
+		return has_;
+	}
+
+private:
+	static const int kIndex = 3;
+	static const int kFresh = 4;
+
+	T buf_[3];
+	std::atomic<int> middle_;
+	int back_;                          // writer
+	int front_;                         // reader
+	bool has_;
+};
+
+class TaskScheduler
+{
+public:
+	explicit TaskScheduler(double control_period);
+	~TaskScheduler();
+
+	/**
+	 * @brief Register a task (before Start). RT-tier rates are rounded to a whole number of cycles.
+	 * @return task id, -1 if full or invalid
+	 */
+	int Add(const char* name, int tier, double rate_hz, double budget_us, SchedTaskFn fn, void* arg);
+
+	/**
+	 * @brief Run background tasks on a worker pool (before Start).
+	 */
+	void SetExecutor(WorkerPool* pool) { pool_ = pool; }
+
+	/**
+	 * @brief Start the soft and background threads.
+	 */
+	bool Start();
+	void Stop();
+
+	/**
+	 * @brief Control thread: its SCHED_FIFO priority (0: not real-time). The
+	 *        soft tier is raised to SCHED_FIFO only below a higher priority.
+	 */
+	void SetControlPriority(int priority);
+
+	/**
+	 * @brief Control thread: run the RT tasks due this cycle.
+	 */
+	void RunRt(int64_t now_ns);
+
+	/**
+	 * @brief Any thread: one line per task.
+	 */
+	void Report(std::string* out) const;
+
+private:
+	typedef struct
+	{
+		TaskScheduler* self;
+		int tier;
+	} ThreadArg_t;
+
+	static void* ThreadProc(void* arg);
+	static void PoolJob(void* arg, WorkArena_t* arena);
+	void RunTier(int tier);
+	void Dispatch(SchedTask_t* t, int64_t now_ns);
+	void Execute(SchedTask_t* t, int64_t now_ns);
+
+	double period_;
+	SchedTask_t tasks_[SCHED_MAX_TASKS];
+	int num_tasks_;
+	pthread_t thread_[SCHED_NUM_TIERS];
+	ThreadArg_t thread_arg_[SCHED_NUM_TIERS];
+	std::atomic<int> policy_[SCHED_NUM_TIERS];  // scheduling policy actually obtained
+	WorkerPool* pool_;
+	std::atomic<bool> run_;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _TEACHRECORDER_H
+#define _TEACHRECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "rDeviceAllegroHandCANDef.h"
+#include "TrajectoryPlayer.h"
+
+// Kinesthetic teaching: records q at the control rate while the hand is in
+// gravity compensation, then compresses the recording into keyframes for
+// TrajectoryPlayer.
+//
+// The buffer is allocated once; the control thread appends one sample per
+// cycle and publishes the count, so recording never allocates or blocks.
+// Start and stop requests are applied by the control thread at the next
+// cycle. Compression is Ramer-Douglas-Peucker in time: a sample is dropped
+// only if linear interpolation between the kept neighbours, which is what
+// the player does, reproduces every joint within the tolerance.
+
+enum
+{
+	TEACH_IDLE = 0,
+	TEACH_START,
+	TEACH_RECORDING
+};
+
+class TeachRecorder
+{
+public:
+	explicit TeachRecorder(int max_samples);
+	~TeachRecorder();
+
+	/**
+	 * @brief Command thread: start a new recording at the next cycle.
+	 */
+	void Start();
+
+	/**
+	 * @brief Command thread: stop recording; the samples so far are kept.
+	 */
+	void Stop();
+
+	bool IsRecording() const { return state_.load(std::memory_order_relaxed) != TEACH_IDLE; }
+	int Count() const { return count_.load(std::memory_order_acquire); }
+	int MaxSamples() const { return max_samples_; }
+
+	/**
+	 * @brief Control thread: append q if recording; stops by itself when the buffer is full.
+	 */
+	void Record(int64_t t_ns, const double* q);
+
+	/**
+	 * @brief Scratch bytes Compress() needs.
+	 */
+	size_t ScratchBytes() const { return (size_t)max_samples_ * (1 + 4 * sizeof(int)); }
+
+	/**
+	 * @brief Any one thread: compress the recording into at most max_knots keyframes.
+	 *        The tolerance is doubled until the keyframes fit.
+	 * @param tol in: max joint error (rad), out: tolerance actually used
+	 * @param max_err largest joint error of the result against the recording (rad)
+	 * @param scratch ScratchBytes() of int-aligned memory; NULL to allocate it
+	 * @return number of knots, t relative to the first sample; -1 if fewer than 2 samples
+	 */
+	int Compress(double* tol, TrajKnot_t* knots, int max_knots, double* max_err, void* scratch = NULL);
+
+private:
+	double Deviation(int a, int b, int* worst) const;
+	int Simplify(int n, double tol, int max_knots, uint8_t* keep, int* stack) const;
+
+	int max_samples_;
+	int64_t* t_;
+	double* q_;                         // [max_samples][MAX_DOF]
+	std::atomic<int> state_;
+	std::atomic<int> count_;
+};
+
+#endif
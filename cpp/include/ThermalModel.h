@@ -0,0 +1,95 @@
+#ifndef _THERMALMODEL_H
+#define _THERMALMODEL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "rDeviceAllegroHandCANDef.h"
+
+// Per-motor I^2t thermal model and torque derating.
+//
+// Each motor is a first-order thermal mass heated by the square of its
+// normalized current command (PWM / full scale) and cooling towards the
+// ambient temperature:
+//
+//     T += a*gain*RISE*u^2 - a*(T - T_amb),    a = dt / TAU
+//
+// The hand reports one temperature per finger. On every temperature frame
+// the model of that finger's four motors is pulled towards the reading
+// (observer correction) and the finger's heating gain is adapted, so the
+// prediction tracks the actual hand without per-unit tuning. The torque
+// limit of every joint is scaled down smoothly between DERATE_START and
+// DERATE_END, well below the firmware's high-temperature fault.
+//
+// The ambient temperature is configured (a warm default), never taken from
+// the first reading: after a warm restart that is the motor temperature. It
+// only goes down, to the lowest reading seen.
+
+#define THERMAL_TAU_S           60.0    // motor-to-ambient time constant (s)
+#define THERMAL_AMBIENT_C       30.0    // default ambient, on the warm side of a lab
+#define THERMAL_RISE_C          50.0    // steady-state rise at full continuous current (nominal)
+#define THERMAL_DERATE_START_C  55.0    // full torque below this
+#define THERMAL_DERATE_END_C    68.0    // minimum torque from here on (firmware fault ~70)
+#define THERMAL_MIN_SCALE       0.3     // torque limit scale at DERATE_END
+#define THERMAL_OBSERVER_GAIN   0.3     // fraction of the sensor error corrected per frame
+#define THERMAL_ADAPT_RATE      0.05    // heating gain adaptation per (degC x mean u^2)
+#define THERMAL_FINGERS         4
+
+class ThermalModel
+{
+public:
+	explicit ThermalModel(double period);
+
+	/**
+	 * @brief Before the control thread starts: ambient temperature (degC).
+	 */
+	void SetAmbient(double celsius);
+
+	/**
+	 * @brief Control thread: one cycle with the current commands applied (|u| <= 1).
+	 */
+	void Update(const double* u);
+
+	/**
+	 * @brief Control thread: a temperature frame of one finger (degC).
+	 */
+	void Measure(int finger, double celsius);
+
+	/**
+	 * @brief Torque limit scale of a joint (1 when cool, THERMAL_MIN_SCALE when hot).
+	 */
+	double Limit(int joint) const { return limit_[joint]; }
+
+	/**
+	 * @brief Any thread: predicted temperature of a joint's motor (degC).
+	 */
+	double Predicted(int joint) const { return temp_[joint].load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Any thread: time the present load can be held before derating starts (s; <0: indefinitely).
+	 */
+	double HoldTime(int joint) const;
+
+	/**
+	 * @brief Any thread: per-finger readings and per-joint predictions as text.
+	 */
+	void Report(std::string* out) const;
+
+private:
+	double a_;                              // dt / TAU
+	double ema_;                            // smoothing of the u^2 average used for hold times
+	double limit_[MAX_DOF];                 // control thread only
+
+	// written by the control thread, read anywhere
+	std::atomic<double> temp_[MAX_DOF];
+	std::atomic<double> u2_[MAX_DOF];       // recent mean of u^2
+	std::atomic<double> ambient_;
+	std::atomic<double> gain_[THERMAL_FINGERS];
+	std::atomic<double> measured_[THERMAL_FINGERS];
+	std::atomic<uint64_t> frames_;
+	bool initialized_;
+	double heat_sum_[THERMAL_FINGERS];      // u^2 summed since the last frame of the finger
+	uint32_t heat_n_[THERMAL_FINGERS];
+};
+
+#endif
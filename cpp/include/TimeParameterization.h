@@ -0,0 +1,67 @@
+#ifndef _TIMEPARAMETERIZATION_H
+#define _TIMEPARAMETERIZATION_H
+
+#include <vector>
+#include "rDeviceAllegroHandCANDef.h"
+#include "TrajectoryPlayer.h"
+
+// Per-joint limits for path timing
+typedef struct
+{
+	double vel[MAX_DOF];        // rad/s
+	double acc[MAX_DOF];        // rad/s^2
+	double tau[MAX_DOF];        // in tau_des units; the current clamp is +-1.0
+	double inertia[MAX_DOF];    // effective inertia, tau = inertia*qdd + damping*qd
+	double damping[MAX_DOF];
+} JointLimits_t;
+
+void SetDefaultJointLimits(JointLimits_t* lim);
+
+// Time-optimal parameterization of a geometric joint path, in the style of
+// TOPP-RA (Pham & Pham 2018): the waypoints are joined by a chord-length
+// cubic spline, the path parameter s is discretized, a backward pass builds
+// the controllable sets of sdot^2 and a greedy forward pass picks the
+// largest admissible path acceleration at each grid point.
+//
+// Velocity limits bound sdot^2 directly. Torque limits are folded into the
+// acceleration limits through the per-joint model above (the damping term is
+// bounded by damping*vel), so every stage is a two-variable LP with box
+// constraints that is solved in closed form.
+//
+// Work buffers are kept between calls, so replanning does not allocate once
+// the largest grid has been seen.
+class TimeParameterizer
+{
+public:
+	TimeParameterizer();
+
+	/**
+	 * @brief Compute the fastest feasible timing along a waypoint path.
+	 * @param wp num_wp waypoints of MAX_DOF joints each
+	 * @param qd_start joint velocity at the first waypoint, projected onto the
+	 *        path tangent so replanned paths start at the current speed (may be NULL)
+	 * @param grid number of grid intervals
+	 * @param out timed knots at every grid point (grid+1 entries)
+	 * @return knot count, or -1 if the path cannot be timed
+	 */
+	int Compute(const double* wp, int num_wp, const JointLimits_t& lim, const double* qd_start,
+	            int grid, TrajKnot_t* out);
+
+private:
+	bool BuildSpline(const double* wp, int num_wp);
+	void EvalSpline(double s, double* q, double* dq, double* ddq) const;
+
+	// spline
+	int nk_;
+	std::vector<double> knot_s_;    // chord-length parameter of each waypoint
+	std::vector<double> knot_q_;    // nk_ x MAX_DOF
+	std::vector<double> knot_m_;    // second derivatives, nk_ x MAX_DOF
+	std::vector<double> work_;
+
+	// grid
+	std::vector<double> q_, dq_, ddq_;  // (grid+1) x MAX_DOF
+	std::vector<double> xlo_, xhi_;     // controllable sets of sdot^2
+	std::vector<double> x_;
+};
+
+#endif
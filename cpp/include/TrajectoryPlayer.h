@@ -0,0 +1,66 @@
+#ifndef _TRAJECTORYPLAYER_H
+#define _TRAJECTORYPLAYER_H
+
+#include <atomic>
+#include "rDeviceAllegroHandCANDef.h"
+
+// One timed sample of a joint trajectory
+typedef struct
+{
+	double t;               // seconds from trajectory start
+	double q[MAX_DOF];
+} TrajKnot_t;
+
+// Plays a timed knot list into q_des on the control thread, interpolating
+// linearly between knots. Trajectories are handed over through two
+// preallocated buffers, so the control thread never allocates or blocks.
+class TrajectoryPlayer
+{
+public:
+	explicit TrajectoryPlayer(int max_knots);
+	~TrajectoryPlayer();
+
+	int MaxKnots() const { return max_knots_; }
+
+	/**
+	 * @brief Hand a new trajectory to the control thread (non-RT side).
+	 *        It replaces the current one at the next cycle.
+	 * @return false if n is out of range or the previous hand-off was not picked up
+	 */
+	bool Load(const TrajKnot_t* knots, int n);
+
+	/**
+	 * @brief Stop playback at the next cycle; q_des keeps its last value.
+	 */
+	void Stop();
+
+	/**
+	 * @brief Advance by dt and write the interpolated target (control thread).
+	 * @return true while a trajectory is playing
+	 */
+	bool Update(double dt, double* q_des);
+
+	bool IsPlaying() const { return playing_.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Commanded joint velocity of the last cycle, safe to call from any thread.
+	 */
+	void GetVelocity(double qd[MAX_DOF]) const;
+
+private:
+	int max_knots_;
+	TrajKnot_t* buf_[2];
+	int count_[2];
+	std::atomic<int> pending_;          // buffer waiting to be picked up, -1 if none
+	std::atomic<int> active_;           // buffer owned by the control thread
+	std::atomic<bool> stop_;
+	std::atomic<bool> playing_;
+	double t_;
+	int seg_;
+
+	// seqlock-protected commanded velocity
+	std::atomic<unsigned> vel_seq_;
+	double vel_[MAX_DOF];
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef _WORKERPOOL_H
+#define _WORKERPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+// Fixed-size work-stealing thread pool for non-real-time work.
+//
+// Every worker owns a bounded deque: it takes its own jobs from the back
+// and idle workers steal from the front of the others'. Jobs submitted from
+// outside the pool are spread round-robin. Queues are preallocated, so
+// Submit() never allocates, and a full pool rejects the job rather than
+// growing. Workers can be pinned to a CPU list that excludes the control
+// core. Every worker also owns a bump-allocated arena that jobs use for
+// scratch memory instead of the global allocator; it is reset after each
+// job. Call() runs a job on the pool and waits for it, for request/response
+// work such as trace export and teach compression.
+
+#define POOL_MAX_WORKERS        16
+#define POOL_QUEUE_CAPACITY     256     // jobs per worker
+#define POOL_ARENA_BYTES        (1 << 20)
+
+typedef struct
+{
+	char* base;
+	size_t size;
+	size_t used;
+	size_t high;                        // high-water mark
+} WorkArena_t;
+
+/**
+ * @brief Scratch memory valid until the job returns (16-byte aligned); NULL when the arena is full.
+ */
+void* ArenaAlloc(WorkArena_t* arena, size_t bytes);
+
+typedef void (*WorkFn)(void* arg, WorkArena_t* arena);
+
+typedef struct
+{
+	WorkFn fn;
+	void* arg;
+	int64_t enq_ns;
+} WorkItem_t;
+
+struct alignas(64) Worker_t
+{
+	std::mutex lock;
+	WorkItem_t q[POOL_QUEUE_CAPACITY];
+	int head;                           // index of the oldest job
+	int count;
+	WorkArena_t arena;
+	pthread_t thread;
+	int index;
+	class WorkerPool* pool;
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> stolen;       // jobs this worker took from others
+	std::atomic<size_t> arena_high;
+};
+
+class WorkerPool
+{
+public:
+	WorkerPool();
+	~WorkerPool();
+
+	/**
+	 * @brief Start the workers.
+	 * @param cpu_list CPUs to run on, e.g. "2,3" or "1-3"; NULL for any
+	 */
+	bool Start(int workers, const char* cpu_list);
+
+	/**
+	 * @brief Run the queued jobs, then join the workers.
+	 */
+	void Stop();
+
+	bool IsRunning() const { return run_.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Any thread: queue a job; false if the pool is stopped or full.
+	 */
+	bool Submit(WorkFn fn, void* arg);
+
+	/**
+	 * @brief Any thread: run a job on a worker and wait for it. When the pool is
+	 *        stopped or full the job runs on the calling thread with an empty
+	 *        arena, so jobs must cope with ArenaAlloc() returning NULL.
+	 */
+	void Call(WorkFn fn, void* arg);
+
+	/**
+	 * @brief Any thread: queue depth, latency and per-worker metrics as text.
+	 */
+	void Report(std::string* out) const;
+
+private:
+	static void* ThreadProc(void* arg);
+	void Run(Worker_t* w);
+	bool Take(Worker_t* w, WorkItem_t* item);
+	static void AtomicMax(std::atomic<int64_t>& m, int64_t v);
+
+	Worker_t workers_[POOL_MAX_WORKERS];
+	int num_workers_;
+	int num_cpus_;
+	cpu_set_t cpus_;
+	std::atomic<unsigned> next_;        // round-robin submit position
+	std::atomic<bool> run_;
+	std::mutex idle_lock_;
+	std::condition_variable idle_cv_;
+
+	std::atomic<int> queued_;
+	std::atomic<int> max_queued_;
+	std::atomic<uint64_t> submitted_;
+	std::atomic<uint64_t> rejected_;
+	std::atomic<int64_t> wait_sum_ns_;  // enqueue to start
+	std::atomic<int64_t> wait_max_ns_;
+	std::atomic<int64_t> run_sum_ns_;
+	std::atomic<int64_t> run_max_ns_;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+*\brief Simulated CAN bus with fault injection
+*\detailed Replaces the PCAN transport of canAPI.cpp when built with
+*          -DALLEGRO_SIM_CAN=ON. A simulated hand on the other side of the
+*          bus answers the Allegro CAN protocol: it streams encoder frames at
+*          the configured period and integrates a per-joint inertia/damping
+*          model driven by the torque frames. Frames pass between the host
+*          and the simulator thread through lock-free rings, so reads and
+*          writes never wait for the simulator, as with the real driver.
+*
+*          Faults are time-windowed rules, one per line:
+*
+*            <t0> <t1> drop <id|all> <prob>       frames lost (RX side)
+*            <t0> <t1> delay <mean_us> <jitter_us> [uniform|normal|exp]
+*            <t0> <t1> dup <prob>                 frame delivered twice
+*            <t0> <t1> reorder <prob>             frame overtaken by the next one
+*            <t0> <t1> errframe <prob>            error frame before a frame
+*            <t0> <t1> busoff                     no traffic, reads/writes fail
+*            <t0> <t1> txslow <factor>            TX bus time x factor (back-pressure)
+*            <t0> <t1> encoffset <joint|all> <rad> [flip]
+*                                                 encoder zero (and direction) off
+*
+*          Times are seconds from when the rule or file is loaded, 0 <= t0
+*          <= t1 <= 1e6; t1 may be 'inf'. Probabilities are 0-1, delays and
+*          jitter 0-1e6 us, the TX slow-down factor at most 1000 and encoder
+*          offsets within +-2 pi rad. Lines starting with '#' are comments.
+*/
+
+#ifndef _CANSIM_H
+#define _CANSIM_H
+
+#include <string>
+#include "canDef.h"
+
+CANAPI_BEGIN
+
+#define SIM_MAX_FAULTS      32
+
+/**
+ * @brief Add one fault rule, timed from now.
+ * @return 0 on success, -1 with a message in err
+ */
+int sim_fault_add(const char* rule, std::string* err);
+
+/**
+ * @brief Load a fault script (one rule per line), timed from now.
+ * @return number of rules loaded, -1 with a message in err
+ */
+int sim_fault_load(const char* path, std::string* err);
+
+/**
+ * @brief Remove all fault rules.
+ */
+void sim_fault_clear();
+
+/**
+ * @brief Active rules and injection counters as text.
+ */
+void sim_get_stats(std::string* out);
+
+CANAPI_END
+
+#endif
@@ -0,0 +1,77 @@
+/*
+*\brief Example controller plugin: joint-space PD on the current targets
+*\detailed Build as a MODULE library (lib/libjoint_pd.so), start the server
+*          with --plugin-dir lib (or copy it into plugins/) and load with
+*            plugin_load libjoint_pd.so 100 kp=0.8 kd=0.03 max=0.5
+*          Torques are normalized like the server's (see AllegroPlugin.h).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AllegroPlugin.h"
+
+typedef struct
+{
+	double kp;
+	double kd;
+	double max;
+} JointPd;
+
+static void* jpd_init(const char* args, double dt)
+{
+	JointPd* c = (JointPd*)malloc(sizeof(JointPd));
+	if (!c) return NULL;
+	c->kp = 0.8;
+	c->kd = 0.03;
+	c->max = 0.5;
+
+	// "key=value" pairs separated by spaces
+	const char* p = args;
+	while (p && *p)
+	{
+		char key[16];
+		double v;
+		int n = 0;
+		if (sscanf(p, " %15[^=]=%lf%n", key, &v, &n) != 2) break;
+		if (!strcmp(key, "kp")) c->kp = v;
+		else if (!strcmp(key, "kd")) c->kd = v;
+		else if (!strcmp(key, "max")) c->max = v;
+		p += n;
+	}
+	(void)dt;
+	return c;
+}
+
+static int jpd_compute(void* ctx, const AllegroPluginState* in, AllegroPluginOutput* out)
+{
+	const JointPd* c = (const JointPd*)ctx;
+	for (int i=0; i<ALLEGRO_PLUGIN_DOF; i++)
+	{
+		double tau = c->kp * (in->q_des[i] - in->q[i]) - c->kd * in->qdot[i];
+		if (tau > c->max) tau = c->max;
+		else if (tau < -c->max) tau = -c->max;
+		out->tau[i] = tau;
+	}
+	out->flags = ALLEGRO_PLUGIN_OUT_TORQUE;
+	return 0;
+}
+
+static void jpd_shutdown(void* ctx)
+{
+	free(ctx);
+}
+
+static const AllegroPluginDesc kDesc =
+{
+	ALLEGRO_PLUGIN_ABI_VERSION,
+	"joint_pd",
+	jpd_init,
+	jpd_compute,
+	jpd_shutdown
+};
+
+const AllegroPluginDesc* allegro_plugin_get(void)
+{
+	return &kDesc;
+}
@@ -0,0 +1,142 @@
+#include "AllegroKinematics.h"
+#include <math.h>
+#include <stddef.h>
+
+const double kJointLimitLower[NUM_FINGERS*DOF_PER_FINGER] = {
+	-0.47, -0.196, -0.174, -0.227,
+	-0.47, -0.196, -0.174, -0.227,
+	-0.47, -0.196, -0.174, -0.227,
+	0.263, -0.105, -0.189, -0.162};
+const double kJointLimitUpper[NUM_FINGERS*DOF_PER_FINGER] = {
+	0.47, 1.61, 1.709, 1.618,
+	0.47, 1.61, 1.709, 1.618,
+	0.47, 1.61, 1.709, 1.618,
+	1.396, 1.163, 1.644, 1.719};
+
+// One revolute joint: fixed transform from the parent (xyz, rpy) followed by
+// a rotation about 'axis'.
+typedef struct
+{
+	double xyz[3];
+	double rpy[3];
+	double axis[3];
+} JointDesc_t;
+
+typedef struct
+{
+	JointDesc_t joint[DOF_PER_FINGER];
+	double tip[3];
+} FingerDesc_t;
+
+static const FingerDesc_t kFingers[NUM_FINGERS] = {
+	{ { { {0.0,  0.0435, -0.001542}, {-0.08726646255, 0.0, 0.0}, {0, 0, 1} },
+	    { {0.0,  0.0,     0.0164},   {0.0, 0.0, 0.0},             {0, 1, 0} },
+	    { {0.0,  0.0,     0.054},    {0.0, 0.0, 0.0},             {0, 1, 0} },
+	    { {0.0,  0.0,     0.0384},   {0.0, 0.0, 0.0},             {0, 1, 0} } },
+	  {0.0, 0.0, 0.0267} },
+	{ { { {0.0,  0.0,     0.0007},   {0.0, 0.0, 0.0},             {0, 0, 1} },
+	    { {0.0,  0.0,     0.0164},   {0.0, 0.0, 0.0},             {0, 1, 0} },
+	    { {0.0,  0.0,     0.054},    {0.0, 0.0, 0.0},             {0, 1, 0} },
+	    { {0.0,  0.0,     0.0384},   {0.0, 0.0, 0.0},             {0, 1, 0} } },
+	  {0.0, 0.0, 0.0267} },
+	{ { { {0.0, -0.0435, -0.001542}, {0.08726646255, 0.0, 0.0},  {0, 0, 1} },
+	    { {0.0,  0.0,     0.0164},   {0.0, 0.0, 0.0},             {0, 1, 0} },
+	    { {0.0,  0.0,     0.054},    {0.0, 0.0, 0.0},             {0, 1, 0} },
+	    { {0.0,  0.0,     0.0384},   {0.0, 0.0, 0.0},             {0, 1, 0} } },
+	  {0.0, 0.0, 0.0267} },
+	{ { { {-0.0182, 0.019333, -0.045987}, {0.0, -1.65806278845, -1.5707963259}, {-1, 0, 0} },
+	    { {-0.027,  0.005,     0.0399},   {0.0, 0.0, 0.0},                      {0, 0, 1} },
+	    { {0.0,     0.0,       0.0177},   {0.0, 0.0, 0.0},                      {0, 1, 0} },
+	    { {0.0,     0.0,       0.0514},   {0.0, 0.0, 0.0},                      {0, 1, 0} } },
+	  {0.0, 0.0, 0.0423} },
+};
+
+// R = Rz(yaw) * Ry(pitch) * Rx(roll), row-major
+static void RpyToMatrix(const double rpy[3], double R[9])
+{
+	double cr = cos(rpy[0]), sr = sin(rpy[0]);
+	double cp = cos(rpy[1]), sp = sin(rpy[1]);
+	double cy = cos(rpy[2]), sy = sin(rpy[2]);
+	R[0] = cy*cp; R[1] = cy*sp*sr - sy*cr; R[2] = cy*sp*cr + sy*sr;
+	R[3] = sy*cp; R[4] = sy*sp*sr + cy*cr; R[5] = sy*sp*cr - cy*sr;
+	R[6] = -sp;   R[7] = cp*sr;            R[8] = cp*cr;
+}
+
+// Rodrigues' rotation about a unit axis
+static void AxisAngleToMatrix(const double a[3], double th, double R[9])
+{
+	double c = cos(th), s = sin(th), v = 1.0 - c;
+	R[0] = a[0]*a[0]*v + c;      R[1] = a[0]*a[1]*v - a[2]*s; R[2] = a[0]*a[2]*v + a[1]*s;
+	R[3] = a[1]*a[0]*v + a[2]*s; R[4] = a[1]*a[1]*v + c;      R[5] = a[1]*a[2]*v - a[0]*s;
+	R[6] = a[2]*a[0]*v - a[1]*s; R[7] = a[2]*a[1]*v + a[0]*s; R[8] = a[2]*a[2]*v + c;
+}
+
+static void MatMul(const double A[9], const double B[9], double C[9])
+{
+	for (int r=0; r<3; r++)
+		for (int c=0; c<3; c++)
+			C[r*3+c] = A[r*3+0]*B[0*3+c] + A[r*3+1]*B[1*3+c] + A[r*3+2]*B[2*3+c];
+}
+
+static void MatVec(const double A[9], const double x[3], double y[3])
+{
+	y[0] = A[0]*x[0] + A[1]*x[1] + A[2]*x[2];
+	y[1] = A[3]*x[0] + A[4]*x[1] + A[5]*x[2];
+	y[2] = A[6]*x[0] + A[7]*x[1] + A[8]*x[2];
+}
+
+void FingerFK(int finger, const double q[DOF_PER_FINGER], bool right_hand, double tip[3])
+{
+	FingerFKEx(finger, q, right_hand, tip, NULL, NULL);
+}
+
+void FingerFKEx(int finger, const double q[DOF_PER_FINGER], bool right_hand, double tip[3],
+                double axis[DOF_PER_FINGER][3], double origin[DOF_PER_FINGER][3])
+{
+	const FingerDesc_t& fd = kFingers[finger];
+	double R[9] = {1,0,0, 0,1,0, 0,0,1};
+	double p[3] = {0, 0, 0};
+	double F[9], J[9], T[9], d[3];
+
+	for (int j=0; j<DOF_PER_FINGER; j++)
+	{
+		const JointDesc_t& jd = fd.joint[j];
+
+		// The left hand is the mirror image of the right one: joints
+		// rotating about x or z turn the other way, y-axis joints don't.
+		double th = q[j];
+		if (!right_hand && jd.axis[1] == 0) th = -th;
+
+		MatVec(R, jd.xyz, d);
+		p[0] += d[0]; p[1] += d[1]; p[2] += d[2];
+		RpyToMatrix(jd.rpy, F);
+		MatMul(R, F, T);
+
+		if (axis) MatVec(T, jd.axis, axis[j]);
+		if (origin) { origin[j][0] = p[0]; origin[j][1] = p[1]; origin[j][2] = p[2]; }
+
+		AxisAngleToMatrix(jd.axis, th, J);
+		MatMul(T, J, R);
+	}
+
+	MatVec(R, fd.tip, d);
+	tip[0] = p[0] + d[0];
+	tip[1] = p[1] + d[1];
+	tip[2] = p[2] + d[2];
+
+	if (!right_hand)
+	{
+		tip[1] = -tip[1];
+		for (int j=0; j<DOF_PER_FINGER; j++)
+		{
+			// Reflecting a cross product flips its sign, so the effective
+			// axis is -M*a for y-axis joints and M*a for the negated ones.
+			if (axis)
+			{
+				if (fd.joint[j].axis[1] == 0) axis[j][1] = -axis[j][1];
+				else { axis[j][0] = -axis[j][0]; axis[j][2] = -axis[j][2]; }
+			}
+			if (origin) origin[j][1] = -origin[j][1];
+		}
+	}
+}
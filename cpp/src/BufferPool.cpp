@@ -0,0 +1,82 @@
+#include "BufferPool.h"
+#include <stdlib.h>
+
+BufferPool::BufferPool()
+	: mem_(NULL), next_(NULL), slots_(0), slot_bytes_(0),
+	  head_(0), in_use_(0), acquired_(0), exhausted_(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+	free(mem_);
+	delete[] next_;
+}
+
+bool BufferPool::Create(uint32_t slots, size_t slot_bytes)
+{
+	if (mem_ || slots == 0) return false;
+
+	slot_bytes_ = (slot_bytes + 63) & ~(size_t)63;  // one cache line multiple per slot
+	void* mem = NULL;
+	if (posix_memalign(&mem, 64, (size_t)slots * slot_bytes_) != 0)
+		return false;
+	mem_ = (uint8_t*)mem;
+	next_ = new std::atomic<uint32_t>[slots];
+
+	slots_ = slots;
+	for (uint32_t i=0; i<slots; i++)
+		next_[i].store(i + 1, std::memory_order_relaxed);
+	head_.store(0, std::memory_order_release);
+	return true;
+}
+
+void* BufferPool::Acquire()
+{
+	uint64_t head = head_.load(std::memory_order_acquire);
+	for (;;)
+	{
+		uint32_t index = (uint32_t)head;
+		if (index >= slots_)
+		{
+			exhausted_.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		}
+		uint64_t tag = (head >> 32) + 1;
+		uint64_t desired = (tag << 32) | next_[index].load(std::memory_order_relaxed);
+		if (head_.compare_exchange_weak(head, desired, std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			in_use_.fetch_add(1, std::memory_order_relaxed);
+			acquired_.fetch_add(1, std::memory_order_relaxed);
+			return mem_ + (size_t)index * slot_bytes_;
+		}
+	}
+}
+
+void BufferPool::Push(uint32_t index)
+{
+	uint64_t head = head_.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		next_[index].store((uint32_t)head, std::memory_order_relaxed);
+		uint64_t desired = (((head >> 32) + 1) << 32) | index;
+		if (head_.compare_exchange_weak(head, desired, std::memory_order_release, std::memory_order_relaxed))
+			break;
+	}
+	in_use_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void BufferPool::Release(void* data, void* hint)
+{
+	BufferPool* pool = (BufferPool*)hint;
+	size_t offset = (uint8_t*)data - pool->mem_;
+	pool->Push((uint32_t)(offset / pool->slot_bytes_));
+}
+
+void BufferPool::GetStats(BufferPoolStats_t* st) const
+{
+	st->slots = slots_;
+	st->in_use = in_use_.load(std::memory_order_relaxed);
+	st->acquired = acquired_.load(std::memory_order_relaxed);
+	st->exhausted = exhausted_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,134 @@
+#include "CartesianImpedance.h"
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+CartesianImpedance::CartesianImpedance(bool right_hand)
+	: right_hand_(right_hand), pending_(-1), active_(0), running_(false), seq_(0)
+{
+	memset(&params_, 0, sizeof(params_));
+	for (int f=0; f<NUM_FINGERS; f++)
+	{
+		for (int a=0; a<3; a++)
+		{
+			params_.k[f][a] = IMP_DEFAULT_K;
+			params_.d[f][a] = IMP_DEFAULT_D;
+		}
+	}
+	params_.f_max = IMP_DEFAULT_F_MAX;
+	params_.mask = (1 << NUM_FINGERS) - 1;
+	buf_[0] = buf_[1] = params_;
+	memset(x_, 0, sizeof(x_));
+	memset(f_, 0, sizeof(f_));
+}
+
+bool CartesianImpedance::SetParams(const ImpedanceParams_t& p)
+{
+	// wait (a few cycles at most) for the previous hand-off to be consumed
+	for (int i=0; pending_.load(std::memory_order_acquire) >= 0; i++)
+	{
+		if (i >= 20) return false;
+		usleep(1000);
+	}
+
+	int b = 1 - active_.load(std::memory_order_acquire);
+	buf_[b] = p;
+	params_ = p;
+	pending_.store(b, std::memory_order_release);
+	return true;
+}
+
+// control thread: the parameters in use, after picking up a hand-off
+const ImpedanceParams_t& CartesianImpedance::Active()
+{
+	int b = pending_.load(std::memory_order_acquire);
+	if (b >= 0)
+	{
+		active_.store(b, std::memory_order_release);
+		pending_.store(-1, std::memory_order_release);
+	}
+	return buf_[active_.load(std::memory_order_relaxed)];
+}
+
+void CartesianImpedance::ReleaseTargets(const double* q, double* q_des)
+{
+	bool running = running_.load(std::memory_order_acquire);
+	const ImpedanceParams_t& p = Active();
+	if (!running) return;
+
+	for (int f=0; f<NUM_FINGERS; f++)
+	{
+		if (!(p.mask & (1 << f))) continue;
+		for (int j=0; j<DOF_PER_FINGER; j++)
+			q_des[f * DOF_PER_FINGER + j] = q[f * DOF_PER_FINGER + j];
+	}
+}
+
+bool CartesianImpedance::Update(const double* q, const double* qdot, double* tau)
+{
+	// read the flag first: parameters set before Start() are then picked up in the same cycle
+	bool running = running_.load(std::memory_order_acquire);
+	const ImpedanceParams_t& p = Active();
+	if (!running) return false;
+	double x[NUM_FINGERS][3], force[NUM_FINGERS][3];
+	memset(force, 0, sizeof(force));
+
+	for (int f=0; f<NUM_FINGERS; f++)
+	{
+		const double* qf = &q[f * DOF_PER_FINGER];
+		const double* qdf = &qdot[f * DOF_PER_FINGER];
+		double axis[DOF_PER_FINGER][3], origin[DOF_PER_FINGER][3];
+		FingerFKEx(f, qf, right_hand_, x[f], axis, origin);
+		if (!(p.mask & (1 << f))) continue;
+
+		// revolute joints: column j of J is axis_j x (tip - origin_j)
+		double J[DOF_PER_FINGER][3];
+		double xdot[3] = {0, 0, 0};
+		for (int j=0; j<DOF_PER_FINGER; j++)
+		{
+			double r[3] = { x[f][0] - origin[j][0], x[f][1] - origin[j][1], x[f][2] - origin[j][2] };
+			J[j][0] = axis[j][1] * r[2] - axis[j][2] * r[1];
+			J[j][1] = axis[j][2] * r[0] - axis[j][0] * r[2];
+			J[j][2] = axis[j][0] * r[1] - axis[j][1] * r[0];
+			for (int a=0; a<3; a++)
+				xdot[a] += J[j][a] * qdf[j];
+		}
+
+		double fn = 0.0;
+		for (int a=0; a<3; a++)
+		{
+			force[f][a] = p.k[f][a] * (p.x_d[f][a] - x[f][a]) - p.d[f][a] * xdot[a];
+			fn += force[f][a] * force[f][a];
+		}
+		fn = sqrt(fn);
+		if (fn > p.f_max)
+		{
+			for (int a=0; a<3; a++)
+				force[f][a] *= p.f_max / fn;
+		}
+
+		for (int j=0; j<DOF_PER_FINGER; j++)
+			tau[f * DOF_PER_FINGER + j] += J[j][0] * force[f][0] + J[j][1] * force[f][1] + J[j][2] * force[f][2];
+	}
+
+	seq_.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(x_, x, sizeof(x_));
+	memcpy(f_, force, sizeof(f_));
+	std::atomic_thread_fence(std::memory_order_release);
+	seq_.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void CartesianImpedance::GetState(double x[NUM_FINGERS][3], double f[NUM_FINGERS][3]) const
+{
+	unsigned s0, s1;
+	do
+	{
+		s0 = seq_.load(std::memory_order_acquire);
+		memcpy(x, x_, sizeof(x_));
+		memcpy(f, f_, sizeof(f_));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s1 = seq_.load(std::memory_order_relaxed);
+	} while ((s0 & 1) || s0 != s1);
+}
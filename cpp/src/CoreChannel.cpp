@@ -0,0 +1,224 @@
+#include "CoreChannel.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define CORE_MAGIC      0x414c434f  // "ALCO"
+#define CORE_VERSION    1
+
+// every message: [len u32][id u32] payload, padded to 8 bytes
+typedef struct
+{
+	uint32_t len;
+	uint32_t id;
+} CoreMsgHeader_t;
+
+static inline uint64_t Padded(uint64_t n)
+{
+	return (n + 7) & ~(uint64_t)7;
+}
+
+// copy into / out of the ring, wrapping at the end of the buffer
+static void RingPut(CoreRing_t* r, uint64_t pos, const void* src, size_t n)
+{
+	size_t off = pos & (CORE_RING_BYTES - 1);
+	size_t first = (n < CORE_RING_BYTES - off) ? n : CORE_RING_BYTES - off;
+	memcpy(r->data + off, src, first);
+	memcpy(r->data, (const char*)src + first, n - first);
+}
+
+static void RingGet(const CoreRing_t* r, uint64_t pos, void* dst, size_t n)
+{
+	size_t off = pos & (CORE_RING_BYTES - 1);
+	size_t first = (n < CORE_RING_BYTES - off) ? n : CORE_RING_BYTES - off;
+	memcpy(dst, r->data + off, first);
+	memcpy((char*)dst + first, r->data, n - first);
+}
+
+CoreChannel::CoreChannel()
+	: shm_(NULL), owner_(false), fd_(-1), busy_(false)
+{
+	name_[0] = 0;
+}
+
+CoreChannel::~CoreChannel()
+{
+	Detach();
+}
+
+bool CoreChannel::Create(int hand, double period)
+{
+	if (shm_) return false;
+	snprintf(name_, sizeof(name_), CORE_SHM_NAME, hand);
+
+	shm_unlink(name_);
+	int fd = shm_open(name_, O_CREAT | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, sizeof(CoreShared_t)) < 0)
+	{
+		perror("CoreChannel: shm_open()");
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	void* mem = mmap(NULL, sizeof(CoreShared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+	{
+		perror("CoreChannel: mmap()");
+		shm_unlink(name_);
+		return false;
+	}
+
+	CoreShared_t* shm = (CoreShared_t*)mem;
+	shm->version = CORE_VERSION;
+	shm->hand = hand;
+	shm->core_pid = (int32_t)getpid();
+	shm->period = period;
+	shm->heartbeat.store(0, std::memory_order_relaxed);
+	shm->heartbeat_ns.store(0, std::memory_order_relaxed);
+	shm->gateway_pid.store(0, std::memory_order_relaxed);
+	shm->commands.store(0, std::memory_order_relaxed);
+	shm->cmd.head.store(0, std::memory_order_relaxed);
+	shm->cmd.tail.store(0, std::memory_order_relaxed);
+	shm->reply.head.store(0, std::memory_order_relaxed);
+	shm->reply.tail.store(0, std::memory_order_relaxed);
+	shm->magic.store(CORE_MAGIC, std::memory_order_release);
+
+	shm_ = shm;
+	owner_ = true;
+	return true;
+}
+
+bool CoreChannel::Attach(int hand)
+{
+	if (shm_) return false;
+	snprintf(name_, sizeof(name_), CORE_SHM_NAME, hand);
+
+	busy_ = false;
+	int fd = shm_open(name_, O_RDWR, 0600);
+	if (fd < 0) return false;
+
+	// one gateway per segment: the lock is held until Detach() or exit and is
+	// released by the kernel if the gateway dies. Nothing is written before it.
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+	{
+		busy_ = true;
+		close(fd);
+		return false;
+	}
+	void* mem = mmap(NULL, sizeof(CoreShared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	CoreShared_t* shm = (CoreShared_t*)mem;
+	if (shm->magic.load(std::memory_order_acquire) != CORE_MAGIC || shm->version != CORE_VERSION)
+	{
+		munmap(mem, sizeof(CoreShared_t));
+		close(fd);
+		return false;
+	}
+
+	// replies still queued belong to requests of a previous gateway
+	shm->reply.tail.store(shm->reply.head.load(std::memory_order_acquire), std::memory_order_release);
+	shm->gateway_pid.store((uint32_t)getpid(), std::memory_order_relaxed);
+
+	shm_ = shm;
+	owner_ = false;
+	fd_ = fd;
+	return true;
+}
+
+void CoreChannel::Detach()
+{
+	if (!shm_) return;
+	munmap(shm_, sizeof(CoreShared_t));
+	if (owner_) shm_unlink(name_);
+	if (fd_ >= 0) close(fd_);
+	fd_ = -1;
+	shm_ = NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// SPSC rings
+bool CoreChannel::Write(CoreRing_t* r, uint32_t id, const std::string& msg)
+{
+	if (msg.size() > CORE_MAX_MESSAGE) return false;
+
+	uint64_t head = r->head.load(std::memory_order_relaxed);
+	uint64_t tail = r->tail.load(std::memory_order_acquire);
+	uint64_t need = Padded(sizeof(CoreMsgHeader_t) + msg.size());
+	if (head + need - tail > CORE_RING_BYTES) return false;
+
+	CoreMsgHeader_t h;
+	h.len = (uint32_t)msg.size();
+	h.id = id;
+	RingPut(r, head, &h, sizeof(h));
+	RingPut(r, head + sizeof(h), msg.data(), msg.size());
+	r->head.store(head + need, std::memory_order_release);
+	return true;
+}
+
+bool CoreChannel::Read(CoreRing_t* r, uint32_t* id, std::string* msg)
+{
+	uint64_t tail = r->tail.load(std::memory_order_relaxed);
+	uint64_t head = r->head.load(std::memory_order_acquire);
+	if (head == tail) return false;
+
+	CoreMsgHeader_t h;
+	RingGet(r, tail, &h, sizeof(h));
+	uint64_t need = Padded(sizeof(h) + h.len);
+	if (h.len > CORE_MAX_MESSAGE || need > head - tail)
+	{
+		// the other process wrote garbage; drop everything queued
+		r->tail.store(head, std::memory_order_release);
+		return false;
+	}
+	*id = h.id;
+	msg->resize(h.len);
+	if (h.len) RingGet(r, tail + sizeof(h), &(*msg)[0], h.len);
+	r->tail.store(tail + need, std::memory_order_release);
+	return true;
+}
+
+bool CoreChannel::PostCommand(uint32_t id, const std::string& msg)
+{
+	return shm_ && Write(&shm_->cmd, id, msg);
+}
+
+bool CoreChannel::ReadReply(uint32_t* id, std::string* msg)
+{
+	return shm_ && Read(&shm_->reply, id, msg);
+}
+
+bool CoreChannel::ReadCommand(uint32_t* id, std::string* msg)
+{
+	return shm_ && Read(&shm_->cmd, id, msg);
+}
+
+bool CoreChannel::PostReply(uint32_t id, const std::string& msg)
+{
+	if (!shm_) return false;
+	shm_->commands.fetch_add(1, std::memory_order_relaxed);
+	return Write(&shm_->reply, id, msg);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// liveness
+void CoreChannel::Heartbeat(uint64_t cycle, int64_t t_ns)
+{
+	if (!shm_) return;
+	shm_->heartbeat.store(cycle, std::memory_order_relaxed);
+	shm_->heartbeat_ns.store(t_ns, std::memory_order_release);
+}
+
+int64_t CoreChannel::HeartbeatAge(int64_t now_ns) const
+{
+	if (!shm_) return -1;
+	int64_t t = shm_->heartbeat_ns.load(std::memory_order_acquire);
+	return t ? now_ns - t : -1;
+}
@@ -0,0 +1,140 @@
+#include "EncoderValidator.h"
+#include "AllegroKinematics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+static const char* kCounterNames[ENC_COUNTERS] = { "length", "range", "delta", "resync" };
+
+// single writer: a plain add is enough, no locked read-modify-write
+static inline void Bump(std::atomic<uint64_t>& c)
+{
+	c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+EncoderValidator::EncoderValidator(double period, double rad_per_count)
+	: frames_(0)
+{
+	max_delta_ = (int)ceil(ENC_MAX_SPEED_RAD_S * period / rad_per_count);
+	if (max_delta_ < 1) max_delta_ = 1;
+	max_stale_ = 65536 / max_delta_;
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		min_count_[i] = (int)floor((kJointLimitLower[i] - ENC_RANGE_MARGIN_RAD) / rad_per_count);
+		max_count_[i] = (int)ceil((kJointLimitUpper[i] + ENC_RANGE_MARGIN_RAD) / rad_per_count);
+		last_[i] = 0;
+		stale_[i] = 0;
+		valid_[i] = false;
+		cand_[i] = 0;
+		cand_n_[i] = 0;
+		for (int k=0; k<ENC_COUNTERS; k++)
+			count_[k][i].store(0, std::memory_order_relaxed);
+	}
+}
+
+int EncoderValidator::CheckFrame(int finger, const unsigned char* data, int len, int* enc)
+{
+	Bump(frames_);
+	int base = finger * 4;
+	int rejected = 0;
+
+	if (len != 8)
+	{
+		for (int j=0; j<4; j++)
+		{
+			Bump(count_[ENC_REJECT_LENGTH][base + j]);
+			if (stale_[base + j] < max_stale_) stale_[base + j]++;
+			cand_n_[base + j] = 0;
+			enc[j] = last_[base + j];
+		}
+		return 4;
+	}
+
+	for (int j=0; j<4; j++)
+	{
+		int i = base + j;
+		int c = (short)(data[2*j] | (data[2*j + 1] << 8));
+
+		if (c < min_count_[i] || c > max_count_[i])
+		{
+			Bump(count_[ENC_REJECT_RANGE][i]);
+			cand_n_[i] = 0;
+		}
+		else if (!valid_[i] || abs(c - last_[i]) <= max_delta_ * (stale_[i] + 1))
+		{
+			// the allowed change grows with the cycles since the last valid count
+			last_[i] = c;
+			stale_[i] = 0;
+			valid_[i] = true;
+			cand_n_[i] = 0;
+			enc[j] = c;
+			continue;
+		}
+		else
+		{
+			// a joint that really moved reads consistently, cycle to cycle, somewhere
+			// else; unrelated glitches do not agree with each other
+			cand_n_[i] = (cand_n_[i] > 0 && abs(c - cand_[i]) <= max_delta_) ? cand_n_[i] + 1 : 1;
+			cand_[i] = c;
+			if (cand_n_[i] >= ENC_RESYNC_CYCLES)
+			{
+				Bump(count_[ENC_RESYNC][i]);
+				last_[i] = c;
+				stale_[i] = 0;
+				cand_n_[i] = 0;
+				enc[j] = c;
+				continue;
+			}
+			Bump(count_[ENC_REJECT_DELTA][i]);
+		}
+
+		if (stale_[i] < max_stale_) stale_[i]++;
+		enc[j] = last_[i];
+		rejected++;
+	}
+	return rejected;
+}
+
+void EncoderValidator::SetCalibration(const double* scale, const double* offset, bool check_range)
+{
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		if (!check_range)
+		{
+			min_count_[i] = -32768;
+			max_count_[i] = 32767;
+			continue;
+		}
+		double a = (kJointLimitLower[i] - ENC_RANGE_MARGIN_RAD - offset[i]) / scale[i];
+		double b = (kJointLimitUpper[i] + ENC_RANGE_MARGIN_RAD - offset[i]) / scale[i];
+		min_count_[i] = (int)floor(a < b ? a : b);
+		max_count_[i] = (int)ceil(a < b ? b : a);
+	}
+}
+
+void EncoderValidator::Report(std::string* out) const
+{
+	char buf[128];
+	snprintf(buf, sizeof(buf), "frames %llu max_delta %d",
+	         (unsigned long long)frames_.load(std::memory_order_relaxed), max_delta_);
+	*out = buf;
+	for (int k=0; k<ENC_COUNTERS; k++)
+	{
+		uint64_t total = 0;
+		for (int i=0; i<MAX_DOF; i++)
+			total += count_[k][i].load(std::memory_order_relaxed);
+		snprintf(buf, sizeof(buf), " %s %llu", kCounterNames[k], (unsigned long long)total);
+		*out += buf;
+	}
+	// joints with anything to report: joint length range delta resync
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		uint64_t c[ENC_COUNTERS], any = 0;
+		for (int k=0; k<ENC_COUNTERS; k++)
+			any |= c[k] = count_[k][i].load(std::memory_order_relaxed);
+		if (!any) continue;
+		snprintf(buf, sizeof(buf), "\n%d %llu %llu %llu %llu", i, (unsigned long long)c[0], (unsigned long long)c[1],
+		         (unsigned long long)c[2], (unsigned long long)c[3]);
+		*out += buf;
+	}
+}
@@ -0,0 +1,100 @@
+#include "FrictionComp.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+FrictionComp::FrictionComp(double period)
+	: dt_(period), enabled_(false), adapt_(true), reset_(false), have_prev_(false)
+{
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		fc_[i].store(0.0);
+		fv_[i].store(0.0);
+		err2_[0][i].store(0.0);
+		err2_[1][i].store(0.0);
+		q_des_prev_[i] = 0.0;
+	}
+	cycles_[0].store(0);
+	cycles_[1].store(0);
+}
+
+void FrictionComp::SetParams(int joint, double fc, double fv)
+{
+	fc = (fc < 0.0) ? 0.0 : (fc > FRICTION_FC_MAX) ? FRICTION_FC_MAX : fc;
+	fv = (fv < 0.0) ? 0.0 : (fv > FRICTION_FV_MAX) ? FRICTION_FV_MAX : fv;
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		if (joint >= 0 && i != joint) continue;
+		fc_[i].store(fc, std::memory_order_relaxed);
+		fv_[i].store(fv, std::memory_order_relaxed);
+	}
+}
+
+void FrictionComp::Update(const double* q, const double* qdot, const double* q_des, bool tracking, double* tau)
+{
+	if (reset_.exchange(false, std::memory_order_acq_rel))
+	{
+		for (int k=0; k<2; k++)
+		{
+			for (int i=0; i<MAX_DOF; i++)
+				err2_[k][i].store(0.0, std::memory_order_relaxed);
+			cycles_[k].store(0, std::memory_order_relaxed);
+		}
+	}
+	if (!tracking)
+	{
+		have_prev_ = false;
+		return;
+	}
+
+	bool on = enabled_.load(std::memory_order_relaxed);
+	bool adapt = on && adapt_.load(std::memory_order_relaxed);
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		double e = q_des[i] - q[i];
+		double qd_ref = have_prev_ ? (q_des[i] - q_des_prev_[i]) / dt_ : 0.0;
+		if (qd_ref > FRICTION_MAX_REF_VEL) qd_ref = FRICTION_MAX_REF_VEL;
+		else if (qd_ref < -FRICTION_MAX_REF_VEL) qd_ref = -FRICTION_MAX_REF_VEL;
+		q_des_prev_[i] = q_des[i];
+
+		err2_[on][i].store(err2_[on][i].load(std::memory_order_relaxed) + e * e, std::memory_order_relaxed);
+		if (!on) continue;
+
+		double v = qd_ref + FRICTION_LAMBDA * e;
+		double sg = v / (fabs(v) + FRICTION_V_SMOOTH);
+		double fc = fc_[i].load(std::memory_order_relaxed);
+		double fv = fv_[i].load(std::memory_order_relaxed);
+		tau[i] += fc * sg + fv * qd_ref;
+
+		if (adapt && fabs(e) < FRICTION_ADAPT_MAX_ERR)
+		{
+			double s = (qd_ref - qdot[i]) + FRICTION_LAMBDA * e;
+			fc += FRICTION_GAMMA_C * s * sg * dt_;
+			fv += FRICTION_GAMMA_V * s * qd_ref * dt_;
+			fc_[i].store((fc < 0.0) ? 0.0 : (fc > FRICTION_FC_MAX) ? FRICTION_FC_MAX : fc, std::memory_order_relaxed);
+			fv_[i].store((fv < 0.0) ? 0.0 : (fv > FRICTION_FV_MAX) ? FRICTION_FV_MAX : fv, std::memory_order_relaxed);
+		}
+	}
+	have_prev_ = true;
+	cycles_[on].store(cycles_[on].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void FrictionComp::Report(std::string* out) const
+{
+	// first line: <on> <adapt> <cycles_off> <cycles_on>
+	// per joint:  <joint> <fc> <fv> <rms_err_off> <rms_err_on>   (rad)
+	uint64_t n0 = cycles_[0].load(std::memory_order_relaxed);
+	uint64_t n1 = cycles_[1].load(std::memory_order_relaxed);
+	char buf[128];
+	snprintf(buf, sizeof(buf), "%d %d %llu %llu", IsEnabled() ? 1 : 0, adapt_.load(std::memory_order_relaxed) ? 1 : 0,
+	         (unsigned long long)n0, (unsigned long long)n1);
+	*out = buf;
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		snprintf(buf, sizeof(buf), "\n%d %.4f %.4f %.5f %.5f", i, fc_[i].load(std::memory_order_relaxed),
+		         fv_[i].load(std::memory_order_relaxed),
+		         n0 ? sqrt(err2_[0][i].load(std::memory_order_relaxed) / n0) : 0.0,
+		         n1 ? sqrt(err2_[1][i].load(std::memory_order_relaxed) / n1) : 0.0);
+		*out += buf;
+	}
+}
@@ -0,0 +1,344 @@
+#include "HandSync.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SYNC_MAGIC      0x414c5359  // "ALSY"
+#define SYNC_VERSION    3
+
+// d modulo p, in [-p/2, p/2)
+static inline int64_t WrapPhase(int64_t d, int64_t p)
+{
+	d %= p;
+	if (d >= p / 2) d -= p;
+	else if (d < -p / 2) d += p;
+	return d;
+}
+
+HandSync::HandSync()
+	: shm_(NULL), hand_(0), num_hands_(1), lost_(false), period_ns_(0), target_seq_(0), generation_(0),
+	  phase_n_(0), holdoff_(0), phase_ref0_(0), phase_sum_(0), phase_ref_(0), phase_f_(0.0), rephase_(false),
+	  cycles_(0), late_tx_(0), skew_n_(0), skew_sum_ns_(0), skew_max_ns_(0), tx_wait_sum_ns_(0),
+	  phase_err_ns_(0), phase_err_max_ns_(0), rephases_(0), clock_changes_(0)
+{
+}
+
+HandSync::~HandSync()
+{
+	Detach();
+}
+
+bool HandSync::Attach(int hand, int num_hands, double period, double tx_offset, double stagger)
+{
+	if (hand < 0 || hand >= num_hands || num_hands > SYNC_MAX_HANDS) return false;
+
+	int fd;
+	if (hand == 0)
+	{
+		// reuse the segment of a previous run: the other hands may still have it mapped
+		fd = shm_open(SYNC_SHM_NAME, O_CREAT | O_RDWR, 0600);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) < 0
+		    || ((size_t)st.st_size != sizeof(SyncShared_t) && ftruncate(fd, sizeof(SyncShared_t)) < 0))
+		{
+			perror("HandSync: shm_open()");
+			if (fd >= 0) close(fd);
+			return false;
+		}
+	}
+	else
+	{
+		// wait for the master process to publish the clock
+		for (int i=0; (fd = shm_open(SYNC_SHM_NAME, O_RDWR, 0600)) < 0; i++)
+		{
+			if (i == 0) printf("HandSync: waiting for hand 0 to start...\n");
+			if (i >= 100)
+			{
+				printf("HandSync: no master clock at %s\n", SYNC_SHM_NAME);
+				return false;
+			}
+			usleep(100000);
+		}
+	}
+
+	void* mem = mmap(NULL, sizeof(SyncShared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+	{
+		perror("HandSync: mmap()");
+		return false;
+	}
+	SyncShared_t* shm = (SyncShared_t*)mem;
+
+	if (hand == 0)
+	{
+		int64_t p = (int64_t)(period * 1e9);
+		int64_t tx = (int64_t)(tx_offset * 1e9);
+		int64_t stg = (int64_t)(stagger * 1e9);
+		uint32_t g = shm->generation.load(std::memory_order_acquire);
+		if (shm->magic.load(std::memory_order_acquire) == SYNC_MAGIC && shm->version == SYNC_VERSION && !(g & 1)
+		    && shm->period_ns == p && shm->tx_offset_ns == tx && shm->stagger_ns == stg)
+		{
+			printf("HandSync: reusing the master clock of generation %u\n", g);
+		}
+		else
+		{
+			// (re-)initialize in place; hands still attached see the odd generation and wait
+			g |= 1;
+			shm->generation.store(g, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			shm->version = SYNC_VERSION;
+			shm->period_ns = p;
+			shm->tx_offset_ns = tx;
+			shm->stagger_ns = stg;
+			shm->epoch_ns = (rt_now_ns() / p + 1) * p;
+			for (int h=0; h<SYNC_MAX_HANDS; h++)
+			{
+				for (int k=0; k<SYNC_HISTORY; k++)
+					shm->hand[h].rx_cycle[k].store(-1, std::memory_order_relaxed);
+				shm->hand[h].target.owner.store(0, std::memory_order_relaxed);
+			}
+			g++;
+			shm->generation.store(g, std::memory_order_release);
+			shm->magic.store(SYNC_MAGIC, std::memory_order_release);
+		}
+		generation_ = g;
+	}
+	else
+	{
+		for (int i=0; shm->magic.load(std::memory_order_acquire) != SYNC_MAGIC
+		              || (shm->generation.load(std::memory_order_acquire) & 1); i++)
+		{
+			if (i >= 100) break;
+			usleep(10000);
+		}
+		generation_ = shm->generation.load(std::memory_order_acquire);
+		if (shm->magic.load(std::memory_order_acquire) != SYNC_MAGIC || (generation_ & 1)
+		    || shm->version != SYNC_VERSION || shm->period_ns != (int64_t)(period * 1e9))
+		{
+			printf("HandSync: master clock is incompatible (version or period mismatch)\n");
+			munmap(mem, sizeof(SyncShared_t));
+			return false;
+		}
+	}
+
+	shm_ = shm;
+	hand_ = hand;
+	num_hands_ = num_hands;
+	lost_ = false;
+	period_ns_ = shm->period_ns;
+	target_seq_ = shm->hand[hand].target.seq.load(std::memory_order_acquire);
+	printf("HandSync: hand %d of %d, period %.3f ms, TX slot %.3f ms\n", hand, num_hands,
+	       shm->period_ns * 1e-6, (shm->tx_offset_ns + hand * shm->stagger_ns) * 1e-6);
+	return true;
+}
+
+void HandSync::Detach()
+{
+	if (!shm_) return;
+	munmap(shm_, sizeof(SyncShared_t));
+	shm_ = NULL;
+}
+
+int64_t HandSync::CycleIndex(int64_t t_ns) const
+{
+	if (!shm_) return 0;
+	int64_t d = t_ns - shm_->epoch_ns;
+	return (d >= 0) ? d / shm_->period_ns : -((-d + shm_->period_ns - 1) / shm_->period_ns);
+}
+
+void HandSync::WaitNextTick() const
+{
+	if (!shm_) return;
+	rt_sleep_until_ns(shm_->epoch_ns + (CycleIndex(rt_now_ns()) + 1) * shm_->period_ns);
+}
+
+// Take the write side of a hand's target (several processes may post), or
+// the lock of a poster that died holding it
+static bool LockTarget(SyncTarget_t& t, int32_t me)
+{
+	int32_t o = 0;
+	for (int i=0; i<SYNC_POST_TRIES; i++)
+	{
+		o = 0;
+		if (t.owner.compare_exchange_weak(o, me, std::memory_order_acquire)) return true;
+	}
+	return o != 0 && o != me && kill(o, 0) < 0 && errno == ESRCH
+	       && t.owner.compare_exchange_strong(o, me, std::memory_order_acquire);
+}
+
+bool HandSync::PostTargets(const double* q_all, int delay)
+{
+	if (!shm_) return false;
+	int32_t me = (int32_t)getpid();
+	for (int h=0; h<num_hands_; h++)
+	{
+		if (LockTarget(shm_->hand[h].target, me)) continue;
+		while (h-- > 0)
+			shm_->hand[h].target.owner.store(0, std::memory_order_release);
+		return false;
+	}
+
+	int64_t apply = CycleIndex(rt_now_ns()) + delay;
+	for (int h=0; h<num_hands_; h++)
+	{
+		SyncTarget_t& t = shm_->hand[h].target;
+
+		// a dead poster may have left the sequence odd; the write completes it
+		uint32_t s = t.seq.load(std::memory_order_relaxed);
+		if (!(s & 1)) t.seq.store(++s, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		t.apply_cycle = apply;
+		memcpy(t.q, q_all + h * MAX_DOF, sizeof(t.q));
+		t.seq.store(s + 1, std::memory_order_release);
+		t.owner.store(0, std::memory_order_release);
+	}
+	return true;
+}
+
+bool HandSync::BeginCycle(int64_t rx_ns, int64_t* cycle, double* q_des)
+{
+	*cycle = 0;
+	if (!shm_ || lost_) return false;
+
+	// hand 0 restarted with a different clock: follow it, or give up on an incompatible one
+	uint32_t g = shm_->generation.load(std::memory_order_acquire);
+	if (g != generation_)
+	{
+		if (g & 1) return false;
+		generation_ = g;
+		clock_changes_.store(clock_changes_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (shm_->version != SYNC_VERSION || shm_->period_ns != period_ns_)
+		{
+			lost_ = true;
+			return false;
+		}
+		rephase_ = true;
+	}
+
+	int64_t c = CycleIndex(rx_ns);
+	*cycle = c;
+	if (c < 1) return false;
+
+	// phase of the stream against the clock; the reference is the average over
+	// the first cycles, the error is low-pass filtered against RX jitter
+	int64_t p = shm_->period_ns;
+	int64_t ph = rx_ns - (shm_->epoch_ns + c * p);
+	if (holdoff_ > 0)
+	{
+		holdoff_--;
+	}
+	else if (phase_n_ < SYNC_PHASE_SETTLE)
+	{
+		if (phase_n_ == 0) phase_ref0_ = ph;
+		phase_sum_ += WrapPhase(ph - phase_ref0_, p);
+		if (++phase_n_ == SYNC_PHASE_SETTLE)
+			phase_ref_ = phase_ref0_ + phase_sum_ / SYNC_PHASE_SETTLE;
+	}
+	else
+	{
+		phase_f_ += (WrapPhase(ph - phase_ref_, p) - phase_f_) * SYNC_PHASE_ALPHA;
+		int64_t e = (int64_t)phase_f_;
+		phase_err_ns_.store(e, std::memory_order_relaxed);
+		if (e < 0) e = -e;
+		if (e > phase_err_max_ns_.load(std::memory_order_relaxed))
+			phase_err_max_ns_.store(e, std::memory_order_relaxed);
+		if (fabs(phase_f_) > SYNC_REPHASE_US * 1e3) rephase_ = true;
+	}
+
+	SyncHand_t& me = shm_->hand[hand_];
+	int k = (int)(c % SYNC_HISTORY);
+	me.rx_ns[k].store(rx_ns, std::memory_order_relaxed);
+	me.rx_cycle[k].store(c, std::memory_order_release);
+
+	// skew of the previous cycle against every other hand
+	int kp = (int)((c - 1) % SYNC_HISTORY);
+	if (me.rx_cycle[kp].load(std::memory_order_acquire) == c - 1)
+	{
+		int64_t mine = me.rx_ns[kp].load(std::memory_order_relaxed);
+		int64_t worst = -1;
+		for (int h=0; h<num_hands_; h++)
+		{
+			if (h == hand_) continue;
+			SyncHand_t& other = shm_->hand[h];
+			if (other.rx_cycle[kp].load(std::memory_order_acquire) != c - 1) continue;
+			int64_t d = other.rx_ns[kp].load(std::memory_order_relaxed) - mine;
+			if (d < 0) d = -d;
+			if (d > worst) worst = d;
+		}
+		if (worst >= 0)
+		{
+			skew_n_.fetch_add(1, std::memory_order_relaxed);
+			skew_sum_ns_.fetch_add(worst, std::memory_order_relaxed);
+			if (worst > skew_max_ns_.load(std::memory_order_relaxed))
+				skew_max_ns_.store(worst, std::memory_order_relaxed);
+		}
+	}
+
+	// pick up a posted target once it is due
+	SyncTarget_t& t = me.target;
+	uint32_t s0 = t.seq.load(std::memory_order_acquire);
+	if (s0 == target_seq_ || (s0 & 1)) return false;
+	int64_t apply = t.apply_cycle;
+	double q[MAX_DOF];
+	memcpy(q, t.q, sizeof(q));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (t.seq.load(std::memory_order_relaxed) != s0 || apply > c) return false;
+
+	memcpy(q_des, q, sizeof(q));
+	target_seq_ = s0;
+	return true;
+}
+
+void HandSync::WaitTxSlot(int64_t cycle)
+{
+	if (!shm_ || lost_) return;
+
+	int64_t slot = shm_->epoch_ns + cycle * shm_->period_ns + shm_->tx_offset_ns + hand_ * shm_->stagger_ns;
+	int64_t now = rt_now_ns();
+	cycles_.fetch_add(1, std::memory_order_relaxed);
+	if (slot <= now || slot - now > shm_->period_ns)
+	{
+		late_tx_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	tx_wait_sum_ns_.fetch_add(slot - now, std::memory_order_relaxed);
+	rt_sleep_until_ns(slot);
+}
+
+void HandSync::Rephased()
+{
+	rephase_ = false;
+	phase_f_ = 0.0;
+	holdoff_ = SYNC_PHASE_HOLDOFF;
+	if (phase_n_ < SYNC_PHASE_SETTLE)
+	{
+		// the reference was not complete yet: measure it again on the new phase
+		phase_n_ = 0;
+		phase_sum_ = 0;
+	}
+	rephases_.store(rephases_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void HandSync::GetStats(SyncStats_t* st) const
+{
+	st->cycles = cycles_.load(std::memory_order_relaxed);
+	st->late_tx = late_tx_.load(std::memory_order_relaxed);
+	st->skew_samples = skew_n_.load(std::memory_order_relaxed);
+	st->skew_mean_us = st->skew_samples ? skew_sum_ns_.load(std::memory_order_relaxed) * 1e-3 / st->skew_samples : 0.0;
+	st->skew_max_us = skew_max_ns_.load(std::memory_order_relaxed) * 1e-3;
+	uint64_t on_time = st->cycles - st->late_tx;
+	st->tx_wait_mean_us = on_time ? tx_wait_sum_ns_.load(std::memory_order_relaxed) * 1e-3 / on_time : 0.0;
+	st->phase_err_us = phase_err_ns_.load(std::memory_order_relaxed) * 1e-3;
+	st->phase_err_max_us = phase_err_max_ns_.load(std::memory_order_relaxed) * 1e-3;
+	st->rephases = rephases_.load(std::memory_order_relaxed);
+	st->clock_changes = clock_changes_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,449 @@
+#include "JointCalibration.h"
+#include "AllegroKinematics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <fstream>
+
+enum
+{
+	PHASE_PROBE = 0,                    // find the encoder direction
+	PHASE_UPPER,
+	PHASE_LOWER,
+	PHASE_CENTER                        // back to mid-range
+};
+
+static const char* kStateNames[] = { "idle", "starting", "running", "done", "stopped" };
+static const char* kPhaseNames[] = { "probe", "upper", "lower", "center" };
+static const char* kJointStatusNames[] = { "-", "pending", "ok", "no_motion", "timeout", "span" };
+
+void JointCalibration::Nominal(JointCalib_t* c)
+{
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		c->scale[i] = CALIB_RAD_PER_COUNT;
+		c->offset[i] = 0.0;
+	}
+}
+
+JointCalibration::JointCalibration(double period)
+	: dt_(period), local_pending_(false), first_(false), joint_(-1), phase_(PHASE_PROBE), dir_(1),
+	  t_(0), c0_(0), prev_c_(0), stall_(0), v_f_(0.0), tau_i_(0.0), n_sum_(0),
+	  pending_(-1), active_(0), start_(false), stop_(false), fixture_(false), mask_(0),
+	  state_(CALIB_IDLE), cur_joint_(-1), cur_phase_(PHASE_PROBE), seq_(0), have_serial_(false)
+{
+	Nominal(&cur_);
+	next_ = buf_[0] = buf_[1] = shared_ = cur_;
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		c_lo_[i] = c_hi_[i] = 0;
+		sum_[i] = 0.0;
+		q_fix_[i] = 0.0;
+		stop_lo_[i] = kJointLimitLower[i];
+		stop_hi_[i] = kJointLimitUpper[i];
+		status_[i].store(CALIB_JOINT_NONE);
+		sign_[i].store(1);
+		offset_[i].store(0.0);
+		span_err_[i].store(0.0);
+	}
+	memset(serial_, 0, sizeof(serial_));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// control thread
+bool JointCalibration::Apply(double* q_des)
+{
+	// a finished routine is applied before the next one starts
+	if (!local_pending_ && start_.load(std::memory_order_acquire))
+	{
+		start_.store(false, std::memory_order_relaxed);
+		next_ = cur_;
+		first_ = true;
+		joint_ = -1;
+		n_sum_ = 0;
+		memset(sum_, 0, sizeof(sum_));
+		state_.store(CALIB_RUNNING, std::memory_order_relaxed);
+		if (!fixture_) NextJoint();
+		return true;
+	}
+
+	JointCalib_t* c = NULL;
+	if (local_pending_)
+	{
+		local_pending_ = false;
+		c = &next_;
+	}
+	else
+	{
+		int b = pending_.load(std::memory_order_acquire);
+		if (b < 0) return false;
+		active_.store(b, std::memory_order_release);
+		pending_.store(-1, std::memory_order_release);
+		c = &buf_[b];
+	}
+
+	// same encoder counts, new angles: the hand does not move
+	for (int i=0; i<MAX_DOF; i++)
+		q_des[i] = (q_des[i] - cur_.offset[i]) / cur_.scale[i] * c->scale[i] + c->offset[i];
+	cur_ = *c;
+	Publish();
+	return true;
+}
+
+void JointCalibration::Publish()
+{
+	seq_.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	shared_ = cur_;
+	std::atomic_thread_fence(std::memory_order_release);
+	seq_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void JointCalibration::Enter(int phase, int dir)
+{
+	phase_ = phase;
+	cur_phase_.store(phase, std::memory_order_relaxed);
+	dir_ = dir;
+	t_ = 0;
+	stall_ = 0;
+	v_f_ = 0.0;
+	tau_i_ = dir * CALIB_PROBE_TAU;     // start from the breakaway torque
+}
+
+void JointCalibration::NextJoint()
+{
+	do
+		joint_++;
+	while (joint_ < MAX_DOF && !(mask_ & (1 << joint_)));
+	if (joint_ >= MAX_DOF)
+	{
+		Finish(CALIB_DONE);
+		return;
+	}
+	cur_joint_.store(joint_, std::memory_order_relaxed);
+	Enter(PHASE_PROBE, 1);
+}
+
+void JointCalibration::Finish(int state)
+{
+	if (state != CALIB_DONE)
+	{
+		next_ = cur_;
+		for (int i=0; i<MAX_DOF; i++)
+			if (status_[i].load(std::memory_order_relaxed) == CALIB_JOINT_PENDING)
+				status_[i].store(CALIB_JOINT_NONE, std::memory_order_relaxed);
+	}
+	// applied (and the validator ranges restored) by the next Apply()
+	local_pending_ = true;
+	cur_joint_.store(-1, std::memory_order_relaxed);
+	state_.store(state, std::memory_order_release);
+}
+
+bool JointCalibration::Step(const int* enc, const double* q, double* q_des, double* tau)
+{
+	if (state_.load(std::memory_order_relaxed) != CALIB_RUNNING) return false;
+	if (stop_.exchange(false, std::memory_order_acq_rel))
+	{
+		Finish(CALIB_STOPPED);
+		return false;
+	}
+	if (first_)
+	{
+		// the other joints hold where they are
+		memcpy(q_des, q, sizeof(double) * MAX_DOF);
+		first_ = false;
+	}
+
+	if (fixture_)
+	{
+		// unpowered in the fixture: average the counts
+		for (int i=0; i<MAX_DOF; i++)
+		{
+			if (!(mask_ & (1 << i))) continue;
+			tau[i] = 0.0;
+			q_des[i] = q[i];
+			sum_[i] += enc[i];
+		}
+		if (++n_sum_ < (int)(CALIB_FIXTURE_S / dt_)) return true;
+		for (int i=0; i<MAX_DOF; i++)
+		{
+			if (!(mask_ & (1 << i))) continue;
+			next_.offset[i] = q_fix_[i] - next_.scale[i] * (sum_[i] / n_sum_);
+			sign_[i].store(next_.scale[i] > 0.0 ? 1 : -1, std::memory_order_relaxed);
+			offset_[i].store(next_.offset[i], std::memory_order_relaxed);
+			span_err_[i].store(0.0, std::memory_order_relaxed);
+			status_[i].store(CALIB_JOINT_OK, std::memory_order_relaxed);
+		}
+		Finish(CALIB_DONE);
+		return true;
+	}
+
+	int j = joint_;
+	int c = enc[j];
+	if (t_ == 0)
+	{
+		c0_ = c;
+		prev_c_ = c;
+	}
+	t_++;
+	q_des[j] = q[j];                    // PD takes over wherever the routine leaves the joint
+
+	if (phase_ == PHASE_PROBE)
+	{
+		// positive torque moves a joint towards its upper limit; the counts tell the sign
+		tau[j] = dir_ * CALIB_PROBE_TAU;
+		int moved = c - c0_;
+		if (abs(moved) * CALIB_RAD_PER_COUNT >= CALIB_PROBE_RAD)
+		{
+			sign_[j].store(moved > 0 ? dir_ : -dir_, std::memory_order_relaxed);
+			Enter(PHASE_UPPER, 1);
+		}
+		else if (t_ >= (int)(CALIB_PROBE_S / dt_))
+		{
+			if (dir_ > 0)
+				Enter(PHASE_PROBE, -1);     // possibly resting against the upper stop
+			else
+			{
+				status_[j].store(CALIB_JOINT_NO_MOTION, std::memory_order_relaxed);
+				NextJoint();
+			}
+		}
+		return true;
+	}
+
+	int s = sign_[j].load(std::memory_order_relaxed);
+	double v = s * CALIB_RAD_PER_COUNT * (c - prev_c_) / dt_;
+	prev_c_ = c;
+	v_f_ = 0.6*v_f_ + 0.4*v;
+
+	if (phase_ == PHASE_CENTER && s * (c - (c_lo_[j] + c_hi_[j]) / 2) >= 0)
+	{
+		next_.scale[j] = s * CALIB_RAD_PER_COUNT;
+		next_.offset[j] = offset_[j].load(std::memory_order_relaxed);
+		status_[j].store(CALIB_JOINT_OK, std::memory_order_relaxed);
+		NextJoint();
+		return true;
+	}
+
+	// torque-limited PI velocity loop towards the stop
+	double e = dir_ * CALIB_DRIVE_VEL - v_f_;
+	tau_i_ += CALIB_DRIVE_KI * e * dt_;
+	if (tau_i_ > CALIB_DRIVE_TAU_MAX) tau_i_ = CALIB_DRIVE_TAU_MAX;
+	else if (tau_i_ < -CALIB_DRIVE_TAU_MAX) tau_i_ = -CALIB_DRIVE_TAU_MAX;
+	double u = tau_i_ + CALIB_DRIVE_KV * e;
+	if (u > CALIB_DRIVE_TAU_MAX) u = CALIB_DRIVE_TAU_MAX;
+	else if (u < -CALIB_DRIVE_TAU_MAX) u = -CALIB_DRIVE_TAU_MAX;
+	tau[j] = u;
+
+	if (phase_ != PHASE_CENTER)
+	{
+		stall_ = (fabs(v_f_) < CALIB_STALL_VEL && dir_ * u >= 0.9 * CALIB_DRIVE_TAU_MAX) ? stall_ + 1 : 0;
+		if (stall_ >= (int)(CALIB_STALL_S / dt_))
+		{
+			if (phase_ == PHASE_UPPER)
+			{
+				c_hi_[j] = c;
+				Enter(PHASE_LOWER, -1);
+				return true;
+			}
+
+			// midpoint of the readings at the midpoint of the stops; the span is the check
+			c_lo_[j] = c;
+			double span = s * CALIB_RAD_PER_COUNT * (c_hi_[j] - c_lo_[j]);
+			double err = span - (stop_hi_[j] - stop_lo_[j]);
+			double off = 0.5 * (stop_lo_[j] + stop_hi_[j]) - s * CALIB_RAD_PER_COUNT * 0.5 * (c_lo_[j] + c_hi_[j]);
+			span_err_[j].store(err, std::memory_order_relaxed);
+			offset_[j].store(off, std::memory_order_relaxed);
+			if (span > 0.0 && fabs(err) <= CALIB_MAX_SPAN_ERR)
+				Enter(PHASE_CENTER, 1);
+			else
+			{
+				status_[j].store(CALIB_JOINT_SPAN, std::memory_order_relaxed);
+				NextJoint();
+			}
+			return true;
+		}
+	}
+
+	if (t_ >= (int)(CALIB_PHASE_TIMEOUT_S / dt_))
+	{
+		status_[j].store(CALIB_JOINT_TIMEOUT, std::memory_order_relaxed);
+		NextJoint();
+	}
+	return true;
+}
+
+void JointCalibration::SetSerial(const unsigned char* data)
+{
+	if (have_serial_.load(std::memory_order_relaxed)) return;
+	// a file key: no blanks or control characters
+	for (int i=0; i<CALIB_SERIAL_LEN; i++)
+		serial_[i] = isgraph(data[i]) ? (char)data[i] : '_';
+	serial_[CALIB_SERIAL_LEN] = 0;
+	have_serial_.store(true, std::memory_order_release);
+}
+
+std::string JointCalibration::Serial() const
+{
+	return have_serial_.load(std::memory_order_acquire) ? std::string(serial_) : std::string();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// command thread
+bool JointCalibration::Set(const JointCalib_t& c)
+{
+	if (IsRunning()) return false;
+	for (int i=0; i<MAX_DOF; i++)
+		if (c.scale[i] == 0.0 || !isfinite(c.scale[i]) || !isfinite(c.offset[i])) return false;
+
+	// wait (a few cycles at most) for the previous hand-off to be consumed
+	for (int i=0; pending_.load(std::memory_order_acquire) >= 0; i++)
+	{
+		if (i >= 20) return false;
+		usleep(1000);
+	}
+	int b = 1 - active_.load(std::memory_order_acquire);
+	buf_[b] = c;
+	pending_.store(b, std::memory_order_release);
+	return true;
+}
+
+void JointCalibration::GetCurrent(JointCalib_t* c) const
+{
+	unsigned s0, s1;
+	do
+	{
+		s0 = seq_.load(std::memory_order_acquire);
+		memcpy(c, &shared_, sizeof(shared_));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s1 = seq_.load(std::memory_order_relaxed);
+	} while ((s0 & 1) || s0 != s1);
+}
+
+bool JointCalibration::StartHardStops(int mask)
+{
+	mask &= (1 << MAX_DOF) - 1;
+	if (IsRunning() || !mask || pending_.load(std::memory_order_acquire) >= 0) return false;
+	fixture_ = false;
+	mask_ = mask;
+	for (int i=0; i<MAX_DOF; i++)
+		status_[i].store((mask & (1 << i)) ? CALIB_JOINT_PENDING : CALIB_JOINT_NONE, std::memory_order_relaxed);
+	stop_.store(false, std::memory_order_relaxed);
+	state_.store(CALIB_STARTING, std::memory_order_relaxed);
+	start_.store(true, std::memory_order_release);
+	return true;
+}
+
+bool JointCalibration::StartFixture(const double* q_fix, int mask)
+{
+	mask &= (1 << MAX_DOF) - 1;
+	if (IsRunning() || !mask || pending_.load(std::memory_order_acquire) >= 0) return false;
+	fixture_ = true;
+	mask_ = mask;
+	memcpy(q_fix_, q_fix, sizeof(q_fix_));
+	for (int i=0; i<MAX_DOF; i++)
+		status_[i].store((mask & (1 << i)) ? CALIB_JOINT_PENDING : CALIB_JOINT_NONE, std::memory_order_relaxed);
+	stop_.store(false, std::memory_order_relaxed);
+	state_.store(CALIB_STARTING, std::memory_order_relaxed);
+	start_.store(true, std::memory_order_release);
+	return true;
+}
+
+bool JointCalibration::SetStops(int joint, double lower, double upper)
+{
+	if (IsRunning() || joint < 0 || joint >= MAX_DOF || !(upper > lower)) return false;
+	stop_lo_[joint] = lower;
+	stop_hi_[joint] = upper;
+	return true;
+}
+
+int JointCalibration::Load(const char* path)
+{
+	std::string serial = Serial();
+	if (serial.empty()) return -1;
+	std::ifstream in(path);
+	if (!in) return -1;
+
+	JointCalib_t c;
+	GetCurrent(&c);
+	int n = 0;
+	std::string line;
+	char key[64];
+	int joint, sign;
+	double offset;
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#') continue;
+		if (sscanf(line.c_str(), "%63s %d %d %lf", key, &joint, &sign, &offset) != 4) continue;
+		if (serial != key || joint < 0 || joint >= MAX_DOF || (sign != 1 && sign != -1)) continue;
+		c.scale[joint] = sign * CALIB_RAD_PER_COUNT;
+		c.offset[joint] = offset;
+		n++;
+	}
+	if (n && !Set(c)) return -1;
+	return n;
+}
+
+bool JointCalibration::Save(const char* path) const
+{
+	std::string serial = Serial();
+	if (serial.empty()) return false;
+
+	// keep the other hands' entries
+	std::vector<std::string> keep;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line))
+	{
+		char key[64];
+		if (line[0] != '#' && sscanf(line.c_str(), "%63s", key) == 1 && serial == key) continue;
+		keep.push_back(line + "\n");
+	}
+	in.close();
+	if (keep.empty()) keep.push_back("# serial joint sign offset_rad\n");
+
+	std::string tmp = std::string(path) + ".tmp";
+	FILE* fp = fopen(tmp.c_str(), "w");
+	if (!fp)
+	{
+		perror("fopen()");
+		return false;
+	}
+	JointCalib_t c;
+	GetCurrent(&c);
+	for (size_t k=0; k<keep.size(); k++)
+		fputs(keep[k].c_str(), fp);
+	for (int i=0; i<MAX_DOF; i++)
+		fprintf(fp, "%s %d %d %.6f\n", serial.c_str(), i, c.scale[i] > 0.0 ? 1 : -1, c.offset[i]);
+	bool ok = (fclose(fp) == 0);
+	return ok && rename(tmp.c_str(), path) == 0;
+}
+
+void JointCalibration::Report(std::string* out) const
+{
+	// first line: <state> <serial|-> <joint> <phase>
+	// per joint:  <joint> <sign> <offset> <status> <measured_sign> <measured_offset> <span_err>
+	int st = state_.load(std::memory_order_acquire);
+	int j = cur_joint_.load(std::memory_order_relaxed);
+	std::string serial = Serial();
+	char buf[160];
+	snprintf(buf, sizeof(buf), "%s %s %d %s", kStateNames[st], serial.empty() ? "-" : serial.c_str(), j,
+	         (j >= 0 && !fixture_) ? kPhaseNames[cur_phase_.load(std::memory_order_relaxed)] : "-");
+	*out = buf;
+
+	JointCalib_t c;
+	GetCurrent(&c);
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		snprintf(buf, sizeof(buf), "\n%d %d %.5f %s %d %.5f %.4f", i, c.scale[i] > 0.0 ? 1 : -1, c.offset[i],
+		         kJointStatusNames[status_[i].load(std::memory_order_relaxed)],
+		         sign_[i].load(std::memory_order_relaxed), offset_[i].load(std::memory_order_relaxed),
+		         span_err_[i].load(std::memory_order_relaxed));
+		*out += buf;
+	}
+}
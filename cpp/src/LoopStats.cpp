@@ -0,0 +1,88 @@
+#include "LoopStats.h"
+#include <stdio.h>
+#include <math.h>
+
+static inline int Bin(double v, double width)
+{
+	int b = (int)(v / width);
+	if (b < 0) return 0;
+	return (b < LOOP_BINS) ? b : LOOP_BINS - 1;
+}
+
+// value at quantile p (0..1), from the upper edge of the bin; the last bin is open-ended
+static double Quantile(const std::atomic<uint32_t>* hist, uint64_t n, double p, double width)
+{
+	if (n == 0) return 0.0;
+	uint64_t target = (uint64_t)ceil(p * n), acc = 0;
+	for (int b=0; b<LOOP_BINS; b++)
+	{
+		acc += hist[b].load(std::memory_order_relaxed);
+		if (acc >= target) return (b + 1) * width;
+	}
+	return LOOP_BINS * width;
+}
+
+LoopStats::LoopStats(double period)
+	: period_ns_((int64_t)(period * 1e9)), prev_rx_ns_(0), reset_(false)
+{
+	Clear();
+}
+
+void LoopStats::Clear()
+{
+	cycles_.store(0, std::memory_order_relaxed);
+	missed_.store(0, std::memory_order_relaxed);
+	err_sq_sum_.store(0.0, std::memory_order_relaxed);
+	for (int b=0; b<LOOP_BINS; b++)
+	{
+		interval_[b].store(0, std::memory_order_relaxed);
+		latency_[b].store(0, std::memory_order_relaxed);
+		error_[b].store(0, std::memory_order_relaxed);
+	}
+	prev_rx_ns_ = 0;
+}
+
+void LoopStats::Record(int64_t t_rx_ns, int64_t t_tx_ns, const double* q, const double* q_des)
+{
+	if (reset_.exchange(false, std::memory_order_acq_rel))
+		Clear();
+
+	if (prev_rx_ns_)
+	{
+		int64_t dt = t_rx_ns - prev_rx_ns_;
+		interval_[Bin(dt * 1e-3, LOOP_TIME_BIN_US)].fetch_add(1, std::memory_order_relaxed);
+		if (dt * 2 > period_ns_ * 3) missed_.fetch_add(1, std::memory_order_relaxed);
+	}
+	prev_rx_ns_ = t_rx_ns;
+	latency_[Bin((t_tx_ns - t_rx_ns) * 1e-3, LOOP_TIME_BIN_US)].fetch_add(1, std::memory_order_relaxed);
+
+	double sq = 0.0;
+	for (int i=0; i<MAX_DOF; i++)
+		sq += (q_des[i] - q[i]) * (q_des[i] - q[i]);
+	sq /= MAX_DOF;
+	error_[Bin(sqrt(sq) * 1e3, LOOP_ERR_BIN_MRAD)].fetch_add(1, std::memory_order_relaxed);
+	err_sq_sum_.store(err_sq_sum_.load(std::memory_order_relaxed) + sq, std::memory_order_relaxed);
+
+	cycles_.fetch_add(1, std::memory_order_release);
+}
+
+void LoopStats::Report(std::string* out) const
+{
+	uint64_t n = cycles_.load(std::memory_order_acquire);
+	uint64_t ni = (n > 0) ? n - 1 : 0;
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+	         "cycles %llu missed %llu\n"
+	         "interval_us p50 %.0f p99 %.0f p999 %.0f max %.0f\n"
+	         "latency_us p50 %.0f p99 %.0f p999 %.0f max %.0f\n"
+	         "track_err_mrad rms %.2f p50 %.1f p99 %.1f p999 %.1f max %.1f",
+	         (unsigned long long)n, (unsigned long long)missed_.load(std::memory_order_relaxed),
+	         Quantile(interval_, ni, 0.5, LOOP_TIME_BIN_US), Quantile(interval_, ni, 0.99, LOOP_TIME_BIN_US),
+	         Quantile(interval_, ni, 0.999, LOOP_TIME_BIN_US), Quantile(interval_, ni, 1.0, LOOP_TIME_BIN_US),
+	         Quantile(latency_, n, 0.5, LOOP_TIME_BIN_US), Quantile(latency_, n, 0.99, LOOP_TIME_BIN_US),
+	         Quantile(latency_, n, 0.999, LOOP_TIME_BIN_US), Quantile(latency_, n, 1.0, LOOP_TIME_BIN_US),
+	         n ? sqrt(err_sq_sum_.load(std::memory_order_relaxed) / n) * 1e3 : 0.0,
+	         Quantile(error_, n, 0.5, LOOP_ERR_BIN_MRAD), Quantile(error_, n, 0.99, LOOP_ERR_BIN_MRAD),
+	         Quantile(error_, n, 0.999, LOOP_ERR_BIN_MRAD), Quantile(error_, n, 1.0, LOOP_ERR_BIN_MRAD));
+	*out = buf;
+}
@@ -0,0 +1,420 @@
+#include "MlpPolicy.h"
+#include "AllegroKinematics.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char* kActNames[] = { "linear", "relu", "tanh" };
+
+static inline int Pad8(int n)
+{
+	return (n + 7) & ~7;
+}
+
+static inline size_t Round64(size_t n)
+{
+	return (n + 63) & ~(size_t)63;
+}
+
+// next 64-byte aligned block of 'bytes' from a preallocated arena
+static void* Carve(char** p, size_t bytes)
+{
+	void* r = *p;
+	*p += Round64(bytes);
+	return r;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// y = W x + b; rows of W are 'stride' floats (multiple of 8), x padded with zeros
+#if defined(__SSE2__)
+static void MatVec(const float* w, int rows, int stride, const float* x, const float* b, float* y)
+{
+	int r = 0;
+	// four rows at a time share the loads of x
+	for (; r + 4 <= rows; r += 4)
+	{
+		const float* w0 = w + (size_t)r * stride;
+		const float* w1 = w0 + stride;
+		const float* w2 = w1 + stride;
+		const float* w3 = w2 + stride;
+		__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+		for (int k=0; k<stride; k+=4)
+		{
+			__m128 xv = _mm_load_ps(x + k);
+			a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_load_ps(w0 + k), xv));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_load_ps(w1 + k), xv));
+			a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_load_ps(w2 + k), xv));
+			a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_load_ps(w3 + k), xv));
+		}
+		// transpose-add: lane i of the result is the sum of a_i
+		__m128 t0 = _mm_unpacklo_ps(a0, a1), t1 = _mm_unpackhi_ps(a0, a1);
+		__m128 t2 = _mm_unpacklo_ps(a2, a3), t3 = _mm_unpackhi_ps(a2, a3);
+		__m128 s = _mm_add_ps(_mm_add_ps(_mm_movelh_ps(t0, t2), _mm_movehl_ps(t2, t0)),
+		                      _mm_add_ps(_mm_movelh_ps(t1, t3), _mm_movehl_ps(t3, t1)));
+		_mm_storeu_ps(y + r, _mm_add_ps(s, _mm_loadu_ps(b + r)));
+	}
+	for (; r < rows; r++)
+	{
+		const float* wr = w + (size_t)r * stride;
+		__m128 a = _mm_setzero_ps();
+		for (int k=0; k<stride; k+=4)
+			a = _mm_add_ps(a, _mm_mul_ps(_mm_load_ps(wr + k), _mm_load_ps(x + k)));
+		__m128 sh = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+		a = _mm_add_ps(a, sh);
+		sh = _mm_movehl_ps(sh, a);
+		a = _mm_add_ss(a, sh);
+		y[r] = _mm_cvtss_f32(a) + b[r];
+	}
+}
+#else
+static void MatVec(const float* w, int rows, int stride, const float* x, const float* b, float* y)
+{
+	for (int r=0; r<rows; r++)
+	{
+		const float* wr = w + (size_t)r * stride;
+		float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;
+		for (int k=0; k<stride; k+=4)
+		{
+			a0 += wr[k] * x[k];
+			a1 += wr[k + 1] * x[k + 1];
+			a2 += wr[k + 2] * x[k + 2];
+			a3 += wr[k + 3] * x[k + 3];
+		}
+		y[r] = (a0 + a1) + (a2 + a3) + b[r];
+	}
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////
+MlpPolicy::MlpPolicy()
+	: pending_(-1), active_(-1), run_request_(-1), running_(false), decimation_(1), countdown_(0),
+	  inferences_(0), sum_ns_(0), max_ns_(0), last_ns_(0), rejected_(0)
+{
+	slot_[0] = slot_[1] = NULL;
+}
+
+MlpPolicy::~MlpPolicy()
+{
+	Free(slot_[0]);
+	Free(slot_[1]);
+}
+
+void MlpPolicy::Free(MlpNet_t* net)
+{
+	if (!net) return;
+	free(net->mem);
+	delete net;
+}
+
+static bool ReadU32(FILE* fp, uint32_t* v)
+{
+	return fread(v, sizeof(*v), 1, fp) == 1;
+}
+
+// n finite floats; a single NaN or inf would reach the joint targets
+static bool ReadF32(FILE* fp, float* v, size_t n)
+{
+	if (fread(v, sizeof(float), n, fp) != n) return false;
+	for (size_t i=0; i<n; i++)
+		if (!isfinite(v[i])) return false;
+	return true;
+}
+
+bool MlpPolicy::Load(const char* path, std::string* err)
+{
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+	{
+		*err = "cannot open file";
+		return false;
+	}
+
+	uint32_t magic = 0, version = 0, layers = 0, history = 0, decimation = 0;
+	if (!ReadU32(fp, &magic) || !ReadU32(fp, &version) || !ReadU32(fp, &layers) ||
+	    !ReadU32(fp, &history) || !ReadU32(fp, &decimation) ||
+	    magic != MLP_MAGIC || version != MLP_VERSION)
+	{
+		fclose(fp);
+		*err = "not a policy file";
+		return false;
+	}
+	if (layers < 1 || layers > MLP_MAX_LAYERS || history > MLP_MAX_HISTORY || decimation < 1)
+	{
+		fclose(fp);
+		*err = "bad header";
+		return false;
+	}
+
+	// sizes first: the arena is allocated in one piece
+	MlpNet_t* net = new MlpNet_t;
+	memset(net, 0, sizeof(*net));
+	net->num_layers = layers;
+	net->history = history;
+	net->decimation = decimation;
+	net->obs_dim = MLP_OBS_BASE + MAX_DOF * history;
+
+	long data_pos = ftell(fp);
+	size_t obs_bytes = Pad8(net->obs_dim) * sizeof(float);
+	size_t bytes = 2 * Round64(obs_bytes) + Round64(history * MAX_DOF * sizeof(double));
+	int max_width = Pad8(net->obs_dim);
+	fseek(fp, (2 * net->obs_dim + 2 * MAX_DOF) * sizeof(float), SEEK_CUR);
+	for (int l=0; l<(int)layers; l++)
+	{
+		uint32_t in = 0, out = 0, act = 0;
+		int expect = l ? net->layer[l - 1].out : net->obs_dim;
+		if (!ReadU32(fp, &in) || !ReadU32(fp, &out) || !ReadU32(fp, &act) ||
+		    (int)in != expect || out < 1 || out > MLP_MAX_WIDTH || act > MLP_ACT_TANH ||
+		    (l == (int)layers - 1 && out != MAX_DOF))
+		{
+			fclose(fp);
+			Free(net);
+			*err = "bad layer " + std::to_string(l);
+			return false;
+		}
+		MlpLayer_t& L = net->layer[l];
+		L.in = in;
+		L.out = out;
+		L.in_pad = Pad8(in);
+		L.act = act;
+		bytes += Round64((size_t)out * L.in_pad * sizeof(float)) + Round64(Pad8(out) * sizeof(float));
+		if (Pad8(out) > max_width) max_width = Pad8(out);
+		net->macs += (uint64_t)in * out;
+		fseek(fp, ((long)in * out + out) * sizeof(float), SEEK_CUR);
+	}
+	bytes += 2 * Round64(max_width * sizeof(float));
+
+	if (posix_memalign(&net->mem, 64, bytes) != 0)
+	{
+		net->mem = NULL;
+		fclose(fp);
+		Free(net);
+		*err = "out of memory";
+		return false;
+	}
+	memset(net->mem, 0, bytes);
+
+	// now the data
+	char* p = (char*)net->mem;
+	net->obs_mean = (float*)Carve(&p, obs_bytes);
+	net->obs_inv_std = (float*)Carve(&p, obs_bytes);
+	net->act[0] = (float*)Carve(&p, max_width * sizeof(float));
+	net->act[1] = (float*)Carve(&p, max_width * sizeof(float));
+	net->hist = (double*)Carve(&p, history * MAX_DOF * sizeof(double));
+	fseek(fp, data_pos, SEEK_SET);
+	bool ok = ReadF32(fp, net->obs_mean, net->obs_dim) && ReadF32(fp, net->obs_inv_std, net->obs_dim) &&
+	          ReadF32(fp, net->act_scale, MAX_DOF) && ReadF32(fp, net->act_offset, MAX_DOF);
+	for (int i=0; ok && i<net->obs_dim; i++)
+	{
+		if (!(net->obs_inv_std[i] > 0.0f)) ok = false;
+		else ok = isfinite(net->obs_inv_std[i] = 1.0f / net->obs_inv_std[i]);
+	}
+	for (int l=0; ok && l<(int)layers; l++)
+	{
+		MlpLayer_t& L = net->layer[l];
+		L.w = (float*)Carve(&p, (size_t)L.out * L.in_pad * sizeof(float));
+		L.b = (float*)Carve(&p, Pad8(L.out) * sizeof(float));
+		fseek(fp, 3 * sizeof(uint32_t), SEEK_CUR);
+		for (int r=0; ok && r<L.out; r++)
+			ok = ReadF32(fp, L.w + (size_t)r * L.in_pad, L.in);
+		ok = ok && ReadF32(fp, L.b, L.out);
+	}
+	// anything left over means the header and the data disagree
+	bool trailing = ok && fgetc(fp) != EOF;
+	fclose(fp);
+	if (!ok || trailing)
+	{
+		Free(net);
+		*err = trailing ? "data beyond the last layer" : "truncated file, non-finite value or std <= 0";
+		return false;
+	}
+
+	// wait (a few cycles at most) for the previous hand-off to be consumed
+	for (int i=0; pending_.load(std::memory_order_acquire) >= 0; i++)
+	{
+		if (i >= 20)
+		{
+			Free(net);
+			*err = "control loop not running";
+			return false;
+		}
+		usleep(1000);
+	}
+
+	// the slot not in use by the control thread is ours until we publish it
+	int b = (active_.load(std::memory_order_acquire) == 0) ? 1 : 0;
+	Free(slot_[b]);
+	slot_[b] = net;
+	pending_.store(b, std::memory_order_release);
+	return true;
+}
+
+bool MlpPolicy::Run(int decimation)
+{
+	if (decimation < 0) return false;
+	if (active_.load(std::memory_order_acquire) < 0 && pending_.load(std::memory_order_acquire) < 0) return false;
+	run_request_.store(decimation, std::memory_order_release);
+	return true;
+}
+
+void MlpPolicy::Stop()
+{
+	run_request_.store(-2, std::memory_order_release);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// control thread
+void MlpPolicy::Forward(MlpNet_t* net)
+{
+	float* x = net->act[0];
+	float* y = net->act[1];
+	for (int l=0; l<net->num_layers; l++)
+	{
+		const MlpLayer_t& L = net->layer[l];
+		MatVec(L.w, L.out, L.in_pad, x, L.b, y);
+		if (L.act == MLP_ACT_RELU)
+		{
+			for (int i=0; i<L.out; i++)
+				if (y[i] < 0.0f) y[i] = 0.0f;
+		}
+		else if (L.act == MLP_ACT_TANH)
+		{
+			for (int i=0; i<L.out; i++)
+				y[i] = tanhf(y[i]);
+		}
+		// the next layer reads a zero-padded input
+		for (int i=L.out; i<Pad8(L.out); i++)
+			y[i] = 0.0f;
+		float* t = x;
+		x = y;
+		y = t;
+	}
+	net->act[0] = x;                    // output of the last layer
+	net->act[1] = y;
+}
+
+bool MlpPolicy::Update(const double* q, const double* qdot, double* q_des)
+{
+	int p = pending_.load(std::memory_order_acquire);
+	if (p >= 0)
+	{
+		active_.store(p, std::memory_order_release);
+		pending_.store(-1, std::memory_order_release);
+		running_.store(false, std::memory_order_relaxed);
+		inferences_.store(0, std::memory_order_relaxed);
+		sum_ns_.store(0, std::memory_order_relaxed);
+		max_ns_.store(0, std::memory_order_relaxed);
+		last_ns_.store(0, std::memory_order_relaxed);
+		rejected_.store(0, std::memory_order_relaxed);
+	}
+	if (run_request_.load(std::memory_order_relaxed) != -1)
+	{
+		int r = run_request_.exchange(-1, std::memory_order_acq_rel);
+		int a = active_.load(std::memory_order_relaxed);
+		if (r == -2 || a < 0)
+			running_.store(false, std::memory_order_relaxed);
+		else if (r >= 0)
+		{
+			decimation_ = r ? r : slot_[a]->decimation;
+			countdown_ = 0;
+			slot_[a]->hist_fill = 0;
+			running_.store(true, std::memory_order_relaxed);
+		}
+	}
+	if (!running_.load(std::memory_order_relaxed)) return false;
+	if (countdown_-- > 0) return false;
+	countdown_ = decimation_ - 1;
+
+	int64_t t0 = rt_now_ns();
+	MlpNet_t* net = slot_[active_.load(std::memory_order_relaxed)];
+
+	// observation: q, qdot, q_des, then past q (current q where there is no past yet)
+	float* x = net->act[0];
+	const float* m = net->obs_mean;
+	const float* s = net->obs_inv_std;
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		x[i] = (float)((q[i] - m[i]) * s[i]);
+		x[MAX_DOF + i] = (float)((qdot[i] - m[MAX_DOF + i]) * s[MAX_DOF + i]);
+		x[2*MAX_DOF + i] = (float)((q_des[i] - m[2*MAX_DOF + i]) * s[2*MAX_DOF + i]);
+	}
+	for (int h=0; h<net->history; h++)
+	{
+		const double* qh = (h < net->hist_fill) ?
+			net->hist + ((net->hist_pos - 1 - h + net->history) % net->history) * MAX_DOF : q;
+		int o = MLP_OBS_BASE + h * MAX_DOF;
+		for (int i=0; i<MAX_DOF; i++)
+			x[o + i] = (float)((qh[i] - m[o + i]) * s[o + i]);
+	}
+	for (int i=net->obs_dim; i<Pad8(net->obs_dim); i++)
+		x[i] = 0.0f;
+
+	Forward(net);
+
+	// all 16 targets or none: a non-finite output (or input) stops the policy
+	const float* y = net->act[0];
+	double v[MAX_DOF];
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		v[i] = net->act_offset[i] + net->act_scale[i] * y[i];
+		if (!isfinite(v[i]))
+		{
+			rejected_.store(rejected_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			running_.store(false, std::memory_order_relaxed);
+			return false;
+		}
+	}
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		if (v[i] < kJointLimitLower[i]) v[i] = kJointLimitLower[i];
+		if (v[i] > kJointLimitUpper[i]) v[i] = kJointLimitUpper[i];
+		q_des[i] = v[i];
+	}
+
+	if (net->history)
+	{
+		memcpy(net->hist + net->hist_pos * MAX_DOF, q, MAX_DOF * sizeof(double));
+		net->hist_pos = (net->hist_pos + 1) % net->history;
+		if (net->hist_fill < net->history) net->hist_fill++;
+	}
+
+	int64_t dt = rt_now_ns() - t0;
+	inferences_.store(inferences_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	sum_ns_.store(sum_ns_.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+	if (dt > max_ns_.load(std::memory_order_relaxed)) max_ns_.store(dt, std::memory_order_relaxed);
+	last_ns_.store(dt, std::memory_order_relaxed);
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// command thread (the only one that loads, so the active slot stays valid here)
+void MlpPolicy::Report(std::string* out) const
+{
+	int a = active_.load(std::memory_order_acquire);
+	if (a < 0)
+	{
+		*out = "none";
+		return;
+	}
+	const MlpNet_t* net = slot_[a];
+	uint64_t n = inferences_.load(std::memory_order_relaxed);
+	char buf[224];
+	snprintf(buf, sizeof(buf), "%s decimation %d obs %d macs %llu inferences %llu mean_us %.2f max_us %.2f last_us %.2f rejected %llu\nlayers",
+	         running_.load(std::memory_order_relaxed) ? "running" : "stopped",
+	         running_.load(std::memory_order_relaxed) ? decimation_ : net->decimation, net->obs_dim,
+	         (unsigned long long)net->macs, (unsigned long long)n,
+	         n ? sum_ns_.load(std::memory_order_relaxed) * 1e-3 / n : 0.0,
+	         max_ns_.load(std::memory_order_relaxed) * 1e-3, last_ns_.load(std::memory_order_relaxed) * 1e-3,
+	         (unsigned long long)rejected_.load(std::memory_order_relaxed));
+	*out = buf;
+	for (int l=0; l<net->num_layers; l++)
+	{
+		snprintf(buf, sizeof(buf), " %dx%d %s", net->layer[l].in, net->layer[l].out, kActNames[net->layer[l].act]);
+		*out += buf;
+	}
+}
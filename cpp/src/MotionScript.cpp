@@ -0,0 +1,354 @@
+#include "MotionScript.h"
+#include <BHand/BHand.h>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+#include <vector>
+#include <map>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Compiler
+
+static bool ParseCsv(const std::string& s, double* v, int n)
+{
+	std::stringstream ss(s);
+	int i = 0;
+	double x;
+	while (i < n && ss >> x)
+	{
+		if (!isfinite(x)) return false;
+		v[i++] = x;
+		if (ss.peek() == ',')
+			ss.ignore();
+	}
+	return i == n && !(ss >> x);
+}
+
+// a duration operand: finite, 0 to MS_MAX_SECONDS, narrowed to float
+static bool ToSeconds(double t, float* out)
+{
+	if (!isfinite(t) || t < 0.0 || t > MS_MAX_SECONDS) return false;
+	*out = (float)t;
+	return true;
+}
+
+static int MotionTypeByName(const std::string& name)
+{
+	static const struct { const char* name; int type; } kTypes[] = {
+		{"none", eMotionType_NONE},
+		{"home", eMotionType_HOME},
+		{"ready", eMotionType_READY},
+		{"gravity", eMotionType_GRAVITY_COMP},
+		{"grasp3", eMotionType_GRASP_3},
+		{"grasp4", eMotionType_GRASP_4},
+		{"pinch_it", eMotionType_PINCH_IT},
+		{"pinch_mt", eMotionType_PINCH_MT},
+		{"envelop", eMotionType_ENVELOP},
+		{"joint_pd", eMotionType_JOINT_PD},
+	};
+	for (size_t i=0; i<sizeof(kTypes)/sizeof(kTypes[0]); i++)
+		if (name == kTypes[i].name) return kTypes[i].type;
+	return -1;
+}
+
+bool CompileMotionScript(const std::string& text, MotionScript_t* out, std::string* err)
+{
+	memset(out, 0, sizeof(*out));
+
+	std::map<std::string, int> poses, gains, labels;
+	std::vector<std::pair<int, std::string> > fixups;   // instruction -> label
+	std::vector<int> fixup_lines;
+
+	std::stringstream in(text);
+	std::string line;
+	int lineno = 0;
+	char buf[128];
+
+#define MS_FAIL(msg) do { snprintf(buf, sizeof(buf), "%d: %s", lineno, msg); *err = buf; return false; } while (0)
+
+	while (std::getline(in, line))
+	{
+		lineno++;
+		size_t hash = line.find('#');
+		if (hash != std::string::npos) line.erase(hash);
+
+		std::stringstream ls(line);
+		std::string kw;
+		if (!(ls >> kw)) continue;
+
+		if (kw[kw.size() - 1] == ':')
+		{
+			std::string name = kw.substr(0, kw.size() - 1);
+			if (name.empty() || labels.count(name)) MS_FAIL("bad or duplicate label");
+			labels[name] = out->num_instr;
+			continue;
+		}
+		if (kw == "pose")
+		{
+			std::string name, csv;
+			if (!(ls >> name >> csv)) MS_FAIL("usage: pose <name> <q x16>");
+			if (out->num_poses >= MS_MAX_POSES) MS_FAIL("too many poses");
+			if (!ParseCsv(csv, out->pose[out->num_poses], MAX_DOF)) MS_FAIL("pose needs 16 values");
+			poses[name] = out->num_poses++;
+			continue;
+		}
+		if (kw == "gainset")
+		{
+			std::string name, kp, kd;
+			if (!(ls >> name >> kp >> kd)) MS_FAIL("usage: gainset <name> <kp x16> <kd x16>");
+			if (out->num_gains >= MS_MAX_GAINS) MS_FAIL("too many gain sets");
+			if (!ParseCsv(kp, out->kp[out->num_gains], MAX_DOF) || !ParseCsv(kd, out->kd[out->num_gains], MAX_DOF))
+				MS_FAIL("gain set needs 16 kp and 16 kd values");
+			gains[name] = out->num_gains++;
+			continue;
+		}
+
+		if (out->num_instr >= MS_MAX_INSTR) MS_FAIL("script too long");
+		MsInstr_t& ins = out->instr[out->num_instr];
+		ins.jump = -1;
+		std::string label;
+
+		if (kw == "move")
+		{
+			std::string name;
+			double t = 0.0;
+			if (!(ls >> name)) MS_FAIL("usage: move <pose> [seconds]");
+			ls >> t;
+			if (!poses.count(name)) MS_FAIL("unknown pose");
+			if (!ToSeconds(t, &ins.f0)) MS_FAIL("move duration must be 0-3600 s");
+			ins.op = MS_OP_MOVE;
+			ins.a16 = (uint16_t)poses[name];
+		}
+		else if (kw == "wait")
+		{
+			double t;
+			if (!(ls >> t) || !ToSeconds(t, &ins.f0)) MS_FAIL("usage: wait <seconds 0-3600>");
+			ins.op = MS_OP_WAIT;
+		}
+		else if (kw == "wait_contact")
+		{
+			int mask;
+			double tau, timeout;
+			if (!(ls >> mask >> tau >> timeout) || mask <= 0 || mask > 0x0f || !isfinite(tau) || fabs(tau) > 1e3)
+				MS_FAIL("usage: wait_contact <finger_mask 1-15> <tau> <timeout> [else_label]");
+			if (!ToSeconds(timeout, &ins.f1)) MS_FAIL("timeout must be 0-3600 s");
+			ls >> label;
+			ins.op = MS_OP_WAIT_CONTACT;
+			ins.a8 = (uint8_t)mask;
+			ins.f0 = (float)tau;
+		}
+		else if (kw == "wait_err")
+		{
+			double rad, timeout;
+			if (!(ls >> rad >> timeout) || !isfinite(rad) || fabs(rad) > 1e3)
+				MS_FAIL("usage: wait_err <rad> <timeout> [else_label]");
+			if (!ToSeconds(timeout, &ins.f1)) MS_FAIL("timeout must be 0-3600 s");
+			ls >> label;
+			ins.op = MS_OP_WAIT_ERR;
+			ins.f0 = (float)rad;
+		}
+		else if (kw == "gains")
+		{
+			std::string name;
+			if (!(ls >> name) || !gains.count(name)) MS_FAIL("unknown gain set");
+			ins.op = MS_OP_GAINS;
+			ins.a16 = (uint16_t)gains[name];
+		}
+		else if (kw == "motion")
+		{
+			std::string name;
+			ls >> name;
+			int type = MotionTypeByName(name);
+			if (type < 0) MS_FAIL("unknown motion type");
+			ins.op = MS_OP_MOTION;
+			ins.a16 = (uint16_t)type;
+		}
+		else if (kw == "goto")
+		{
+			if (!(ls >> label)) MS_FAIL("usage: goto <label>");
+			ins.op = MS_OP_JUMP;
+		}
+		else if (kw == "end")
+		{
+			ins.op = MS_OP_END;
+		}
+		else
+		{
+			MS_FAIL("unknown statement");
+		}
+
+		if (!label.empty())
+		{
+			fixups.push_back(std::make_pair(out->num_instr, label));
+			fixup_lines.push_back(lineno);
+		}
+		out->num_instr++;
+	}
+
+	for (size_t i=0; i<fixups.size(); i++)
+	{
+		lineno = fixup_lines[i];
+		if (!labels.count(fixups[i].second)) MS_FAIL("unknown label");
+		out->instr[fixups[i].first].jump = labels[fixups[i].second];
+	}
+
+	// falling off the end stops the script
+	if (out->num_instr == 0 || out->instr[out->num_instr - 1].op != MS_OP_END)
+	{
+		if (out->num_instr >= MS_MAX_INSTR) MS_FAIL("script too long");
+		out->instr[out->num_instr].op = MS_OP_END;
+		out->instr[out->num_instr].jump = -1;
+		out->num_instr++;
+	}
+#undef MS_FAIL
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// VM
+
+MotionScriptVM::MotionScriptVM(double dt)
+	: dt_(dt), request_(-1), running_(-1), pc_(0), wait_(-1), move_len_(0)
+{
+	memset(valid_, 0, sizeof(valid_));
+	memset(move_from_, 0, sizeof(move_from_));
+}
+
+bool MotionScriptVM::Upload(int id, const MotionScript_t& script)
+{
+	if (id < 0 || id >= MS_MAX_SCRIPTS) return false;
+	if (running_.load(std::memory_order_acquire) == id || request_.load(std::memory_order_acquire) == id)
+		return false;
+	valid_[id] = false;
+	memcpy(&slot_[id], &script, sizeof(script));
+	valid_[id] = true;
+	return true;
+}
+
+bool MotionScriptVM::Run(int id)
+{
+	if (id < 0 || id >= MS_MAX_SCRIPTS || !valid_[id]) return false;
+	request_.store(id, std::memory_order_release);
+	return true;
+}
+
+void MotionScriptVM::Stop()
+{
+	request_.store(-2, std::memory_order_release);
+}
+
+bool MotionScriptVM::Step(const double* q, const double* tau, double* q_des, MsEffects_t* fx)
+{
+	fx->motion_type = -1;
+	fx->kp = fx->kd = NULL;
+
+	int req = request_.exchange(-1, std::memory_order_acq_rel);
+	if (req == -2)
+	{
+		running_.store(-1, std::memory_order_release);
+	}
+	else if (req >= 0)
+	{
+		running_.store(req, std::memory_order_release);
+		pc_.store(0, std::memory_order_relaxed);
+		wait_ = -1;
+	}
+
+	int id = running_.load(std::memory_order_relaxed);
+	if (id < 0) return false;
+
+	const MotionScript_t& s = slot_[id];
+	int pc = pc_.load(std::memory_order_relaxed);
+
+	for (int ops=0; ops<MS_MAX_OPS_PER_CYCLE; ops++)
+	{
+		if (pc < 0 || pc >= s.num_instr)
+		{
+			running_.store(-1, std::memory_order_release);
+			break;
+		}
+		const MsInstr_t& ins = s.instr[pc];
+		bool blocked = false;
+
+		switch (ins.op)
+		{
+		case MS_OP_MOVE:
+		{
+			const double* to = s.pose[ins.a16];
+			if (wait_ < 0)
+			{
+				memcpy(move_from_, q_des, sizeof(move_from_));
+				move_len_ = (int)lround(ins.f0 / dt_);
+				wait_ = move_len_;
+			}
+			if (wait_ > 0)
+			{
+				double r = (double)(move_len_ - wait_ + 1) / move_len_;
+				for (int i=0; i<MAX_DOF; i++)
+					q_des[i] = move_from_[i] + r * (to[i] - move_from_[i]);
+				wait_--;
+				blocked = (wait_ > 0);
+			}
+			else
+			{
+				memcpy(q_des, to, sizeof(double) * MAX_DOF);
+			}
+			if (!blocked) { pc++; wait_ = -1; }
+			break;
+		}
+		case MS_OP_WAIT:
+			if (wait_ < 0) wait_ = (int)lround(ins.f0 / dt_);
+			if (wait_ > 0) { wait_--; blocked = true; }
+			else { pc++; wait_ = -1; }
+			break;
+		case MS_OP_WAIT_CONTACT:
+		case MS_OP_WAIT_ERR:
+		{
+			bool met = false;
+			if (ins.op == MS_OP_WAIT_CONTACT)
+			{
+				for (int i=0; i<MAX_DOF && !met; i++)
+					met = (ins.a8 & (1 << (i / 4))) && fabs(tau[i]) > ins.f0;
+			}
+			else
+			{
+				double e = 0.0;
+				for (int i=0; i<MAX_DOF; i++)
+					if (fabs(q_des[i] - q[i]) > e) e = fabs(q_des[i] - q[i]);
+				met = (e < ins.f0);
+			}
+			if (wait_ < 0) wait_ = (int)lround(ins.f1 / dt_);
+			if (met) { pc++; wait_ = -1; }
+			else if (wait_ == 0) { pc = (ins.jump >= 0) ? ins.jump : pc + 1; wait_ = -1; }
+			else { wait_--; blocked = true; }
+			break;
+		}
+		case MS_OP_GAINS:
+			fx->kp = s.kp[ins.a16];
+			fx->kd = s.kd[ins.a16];
+			pc++;
+			break;
+		case MS_OP_MOTION:
+			// a new motion type resets the BHand gains, so it voids earlier gains
+			fx->motion_type = ins.a16;
+			fx->kp = fx->kd = NULL;
+			pc++;
+			break;
+		case MS_OP_JUMP:
+			pc = ins.jump;
+			break;
+		case MS_OP_END:
+		default:
+			running_.store(-1, std::memory_order_release);
+			pc_.store(pc, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (blocked) break;
+	}
+
+	pc_.store(pc, std::memory_order_relaxed);
+	return running_.load(std::memory_order_relaxed) >= 0;
+}
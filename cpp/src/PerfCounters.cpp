@@ -0,0 +1,212 @@
+#include "PerfCounters.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <vector>
+
+static const char* kCounterNames[PERF_NUM_COUNTERS + 1] =
+{
+	"cpu_cycles", "instructions", "cache_misses", "branch_misses", "context_switches", "dur_ns"
+};
+
+static const uint32_t kCounterType[PERF_NUM_COUNTERS] =
+{
+	PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE
+};
+
+static const uint64_t kCounterConfig[PERF_NUM_COUNTERS] =
+{
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES
+};
+
+static int PerfEventOpen(uint32_t type, uint64_t config, int group_fd, bool exclude_kernel)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = (group_fd < 0) ? 1 : 0;
+	attr.exclude_kernel = exclude_kernel ? 1 : 0;
+	attr.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static inline int HistBucket(uint64_t v)
+{
+	int b = 0;
+	while (v && b < PERF_HIST_BUCKETS - 1)
+	{
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+PerfCounters::PerfCounters()
+	: leader_(-1), num_open_(0), start_ns_(0), head_(0)
+{
+	for (int i=0; i<PERF_NUM_COUNTERS; i++)
+		fd_[i] = -1;
+	memset(start_, 0, sizeof(start_));
+	memset(ring_, 0, sizeof(ring_));
+	for (int c=0; c<=PERF_NUM_COUNTERS; c++)
+		for (int b=0; b<PERF_HIST_BUCKETS; b++)
+			hist_[c][b].store(0, std::memory_order_relaxed);
+}
+
+PerfCounters::~PerfCounters()
+{
+	Close();
+}
+
+bool PerfCounters::Open()
+{
+	if (IsOpen()) return true;
+
+	// the first counter that opens leads the group; counters the kernel refuses
+	// (e.g. no PMU in a VM) are left out. Context switches happen in the kernel,
+	// so that one must not exclude it.
+	for (int i=0; i<PERF_NUM_COUNTERS; i++)
+	{
+		int fd = PerfEventOpen(kCounterType[i], kCounterConfig[i], leader_, i != PERF_CONTEXT_SWITCHES);
+		fd_[i] = fd;
+		if (fd < 0) continue;
+		if (leader_ < 0) leader_ = fd;
+		num_open_++;
+	}
+	if (leader_ < 0)
+	{
+		perror("perf_event_open");
+		return false;
+	}
+
+	ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+void PerfCounters::Close()
+{
+	for (int i=PERF_NUM_COUNTERS-1; i>=0; i--)
+	{
+		if (fd_[i] >= 0 && fd_[i] != leader_) close(fd_[i]);
+		fd_[i] = -1;
+	}
+	if (leader_ >= 0) close(leader_);
+	num_open_ = 0;
+	leader_ = -1;
+}
+
+bool PerfCounters::ReadGroup(uint64_t* values)
+{
+	uint64_t buf[1 + PERF_NUM_COUNTERS];
+	ssize_t n = read(leader_, buf, sizeof(buf));
+	if (n < (ssize_t)sizeof(uint64_t) || buf[0] != (uint64_t)num_open_) return false;
+
+	// group values come in open order; spread them back to counter ids
+	int k = 1;
+	for (int i=0; i<PERF_NUM_COUNTERS; i++)
+		values[i] = (fd_[i] >= 0) ? buf[k++] : 0;
+	return true;
+}
+
+void PerfCounters::Begin()
+{
+	if (!IsOpen()) return;
+	start_ns_ = rt_now_ns();
+	ReadGroup(start_);
+}
+
+void PerfCounters::End(uint32_t cycle)
+{
+	if (!IsOpen()) return;
+
+	uint64_t now[PERF_NUM_COUNTERS];
+	if (!ReadGroup(now)) return;
+	int64_t dur = rt_now_ns() - start_ns_;
+
+	uint64_t h = head_.load(std::memory_order_relaxed);
+	PerfSample_t& s = ring_[h % PERF_RING_CYCLES];
+	s.cycle = cycle;
+	s.dur_ns = (uint32_t)dur;
+	for (int i=0; i<PERF_NUM_COUNTERS; i++)
+	{
+		s.count[i] = now[i] - start_[i];
+		hist_[i][HistBucket(s.count[i])].fetch_add(1, std::memory_order_relaxed);
+	}
+	hist_[PERF_NUM_COUNTERS][HistBucket(s.dur_ns)].fetch_add(1, std::memory_order_relaxed);
+	head_.store(h + 1, std::memory_order_release);
+}
+
+void PerfCounters::Report(std::string* out) const
+{
+	char line[512];
+	if (!IsOpen())
+	{
+		*out = "perf counters not enabled (start the server with --perf)";
+		return;
+	}
+
+	// copy the ring without stopping the writer, then drop what it overwrote meanwhile
+	uint64_t end = head_.load(std::memory_order_acquire);
+	uint64_t begin = (end > PERF_RING_CYCLES) ? end - PERF_RING_CYCLES : 0;
+	std::vector<PerfSample_t> win;
+	win.reserve(end - begin);
+	for (uint64_t i=begin; i<end; i++)
+		win.push_back(ring_[i % PERF_RING_CYCLES]);
+	uint64_t head = head_.load(std::memory_order_acquire);
+	uint64_t valid = (head + 1 > PERF_RING_CYCLES) ? head + 1 - PERF_RING_CYCLES : 0;
+	if (valid > begin)
+		win.erase(win.begin(), win.begin() + std::min<uint64_t>(valid - begin, win.size()));
+
+	size_t n = win.size();
+	snprintf(line, sizeof(line), "cycles %llu window %zu", (unsigned long long)end, n);
+	*out = line;
+	if (n == 0) return;
+
+	// slowest 1% of the window by duration
+	std::sort(win.begin(), win.end(), [](const PerfSample_t& a, const PerfSample_t& b) { return a.dur_ns < b.dur_ns; });
+	size_t nslow = std::max<size_t>(1, n / 100);
+	snprintf(line, sizeof(line), " slow_threshold_ns %u", win[n - nslow].dur_ns);
+	*out += line;
+	*out += "\ncounter mean p50 p99 max slow_mean";
+
+	std::vector<uint64_t> v(n);
+	for (int c=0; c<=PERF_NUM_COUNTERS; c++)
+	{
+		if (c < PERF_NUM_COUNTERS && fd_[c] < 0) continue;
+		double sum = 0.0, slow_sum = 0.0;
+		for (size_t i=0; i<n; i++)
+		{
+			v[i] = (c < PERF_NUM_COUNTERS) ? win[i].count[c] : win[i].dur_ns;
+			sum += v[i];
+			if (i >= n - nslow) slow_sum += v[i];
+		}
+		std::sort(v.begin(), v.end());
+		snprintf(line, sizeof(line), "\n%s %.1f %llu %llu %llu %.1f", kCounterNames[c], sum / n,
+		         (unsigned long long)v[n / 2], (unsigned long long)v[std::min(n - 1, n * 99 / 100)],
+		         (unsigned long long)v[n - 1], slow_sum / nslow);
+		*out += line;
+	}
+
+	// lifetime histograms: bucket b holds values in [2^(b-1), 2^b)
+	for (int c=0; c<=PERF_NUM_COUNTERS; c++)
+	{
+		if (c < PERF_NUM_COUNTERS && fd_[c] < 0) continue;
+		*out += "\nhist ";
+		*out += kCounterNames[c];
+		for (int b=0; b<PERF_HIST_BUCKETS; b++)
+		{
+			snprintf(line, sizeof(line), " %llu", (unsigned long long)hist_[c][b].load(std::memory_order_relaxed));
+			*out += line;
+		}
+	}
+}
@@ -0,0 +1,321 @@
+#include "PluginHost.h"
+#include "RtClock.h"
+#include "AllegroKinematics.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+static const char* kStateNames[] = { "active", "disabled_budget", "disabled_error" };
+
+// copy a file into an anonymous memory file, so dlopen() maps the current
+// contents rather than a cached handle and no other process can swap it
+static int CopyToMemFd(const char* from)
+{
+	int in = open(from, O_RDONLY);
+	if (in < 0) return -1;
+	int out = memfd_create("allegro_plugin", MFD_CLOEXEC);
+	if (out < 0)
+	{
+		close(in);
+		return -1;
+	}
+	char buf[65536];
+	ssize_t n;
+	bool ok = true;
+	while (ok && (n = read(in, buf, sizeof(buf))) > 0)
+		ok = (write(out, buf, n) == n);
+	close(in);
+	if (!ok || n != 0)
+	{
+		close(out);
+		return -1;
+	}
+	return out;
+}
+
+PluginHost::PluginHost(double period)
+	: period_(period), pending_(-1), active_(0)
+{
+	chain_[0].n = chain_[1].n = 0;
+	memset(&state_, 0, sizeof(state_));
+	memset(&out_, 0, sizeof(out_));
+}
+
+PluginHost::~PluginHost()
+{
+}
+
+void PluginHost::Close(PluginEntry_t* e)
+{
+	if (!e) return;
+	if (e->desc->shutdown) e->desc->shutdown(e->ctx);
+	dlclose(e->dl);
+	close(e->fd);
+	delete e;
+}
+
+// hand a new chain to the control thread and wait until it has switched
+bool PluginHost::Publish(const PluginChain_t& chain, std::string* err)
+{
+	int b = 1 - active_.load(std::memory_order_acquire);
+	chain_[b] = chain;
+	pending_.store(b, std::memory_order_release);
+
+	for (int i=0; i<50; i++)
+	{
+		if (pending_.load(std::memory_order_acquire) < 0) return true;
+		usleep(1000);
+	}
+	// take it back, unless the control thread picks it up right now
+	int expected = b;
+	if (!pending_.compare_exchange_strong(expected, -1, std::memory_order_acq_rel)) return true;
+	*err = "control loop not running";
+	return false;
+}
+
+bool PluginHost::Load(const char* path, int budget_us, const char* args, std::string* err)
+{
+	int fd = CopyToMemFd(path);
+	if (fd < 0)
+	{
+		*err = "cannot read " + std::string(path);
+		return false;
+	}
+
+	// dlopen() matches on the name first and hands back an object already
+	// mapped under it; the fd stays open while the plugin is loaded, so live
+	// plugins have distinct names, and a name still held by an object that
+	// was not unmapped is skipped
+	char copy[64];
+	for (int i=0; ; i++)
+	{
+		snprintf(copy, sizeof(copy), "/proc/self/fd/%d", fd);
+		void* stale = dlopen(copy, RTLD_NOW | RTLD_NOLOAD);
+		if (!stale) break;
+		dlclose(stale);
+		int fd2 = (i < 8) ? dup(fd) : -1;
+		close(fd);
+		if (fd2 < 0)
+		{
+			*err = "no unique name for the plugin copy";
+			return false;
+		}
+		fd = fd2;
+	}
+	void* dl = dlopen(copy, RTLD_NOW | RTLD_LOCAL);
+	if (!dl)
+	{
+		*err = dlerror();
+		close(fd);
+		return false;
+	}
+
+	const PluginChain_t& cur = chain_[active_.load(std::memory_order_acquire)];
+	for (int i=0; i<cur.n; i++)
+	{
+		if (cur.e[i]->dl == dl)
+		{
+			dlclose(dl);
+			close(fd);
+			*err = "dlopen() returned a loaded plugin";
+			return false;
+		}
+	}
+
+	AllegroPluginGetFn get = (AllegroPluginGetFn)dlsym(dl, ALLEGRO_PLUGIN_ENTRY);
+	const AllegroPluginDesc* desc = get ? get() : NULL;
+	if (!desc || desc->abi_version != ALLEGRO_PLUGIN_ABI_VERSION || !desc->name || !desc->init || !desc->compute)
+	{
+		dlclose(dl);
+		close(fd);
+		*err = desc ? "ABI version mismatch" : "no " ALLEGRO_PLUGIN_ENTRY "()";
+		return false;
+	}
+
+	// replace a plugin of the same name in place, or append
+	PluginChain_t next = cur;
+	int at = next.n;
+	for (int i=0; i<next.n; i++)
+		if (!strcmp(next.e[i]->name, desc->name)) at = i;
+	if (at == PLUGIN_MAX)
+	{
+		dlclose(dl);
+		close(fd);
+		*err = "too many plugins";
+		return false;
+	}
+
+	void* ctx = desc->init(args ? args : "", period_);
+	if (!ctx)
+	{
+		dlclose(dl);
+		close(fd);
+		*err = "init failed";
+		return false;
+	}
+
+	PluginEntry_t* e = new PluginEntry_t;
+	e->dl = dl;
+	e->fd = fd;
+	e->desc = desc;
+	e->ctx = ctx;
+	snprintf(e->name, sizeof(e->name), "%s", desc->name);
+	snprintf(e->path, sizeof(e->path), "%s", path);
+	e->budget_ns = (int64_t)(budget_us > 0 ? budget_us : PLUGIN_DEFAULT_BUDGET_US) * 1000;
+	e->state.store(PLUGIN_ACTIVE, std::memory_order_relaxed);
+	e->calls.store(0, std::memory_order_relaxed);
+	e->overruns.store(0, std::memory_order_relaxed);
+	e->sum_ns.store(0, std::memory_order_relaxed);
+	e->max_ns.store(0, std::memory_order_relaxed);
+	e->consecutive = 0;
+
+	PluginEntry_t* old = (at < next.n) ? next.e[at] : NULL;
+	next.e[at] = e;
+	if (at == next.n) next.n++;
+	if (!Publish(next, err))
+	{
+		Close(e);
+		return false;
+	}
+	Close(old);
+	return true;
+}
+
+bool PluginHost::Unload(const char* name, std::string* err)
+{
+	const PluginChain_t& cur = chain_[active_.load(std::memory_order_acquire)];
+	PluginChain_t next;
+	next.n = 0;
+	PluginEntry_t* old = NULL;
+	for (int i=0; i<cur.n; i++)
+	{
+		if (!strcmp(cur.e[i]->name, name))
+			old = cur.e[i];
+		else
+			next.e[next.n++] = cur.e[i];
+	}
+	if (!old)
+	{
+		*err = "not loaded";
+		return false;
+	}
+	if (!Publish(next, err)) return false;
+	Close(old);
+	return true;
+}
+
+void PluginHost::UnloadAll()
+{
+	int p = pending_.exchange(-1);
+	if (p >= 0) active_.store(p);
+	PluginChain_t& cur = chain_[active_.load()];
+	for (int i=0; i<cur.n; i++)
+		Close(cur.e[i]);
+	cur.n = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// control thread
+bool PluginHost::Run(int64_t t_ns, uint64_t cycle, const double* q, const double* qdot, double* q_des,
+                     const double* tau_prev, const int* enc, double* tau)
+{
+	int p = pending_.load(std::memory_order_acquire);
+	if (p >= 0)
+	{
+		active_.store(p, std::memory_order_release);
+		pending_.store(-1, std::memory_order_release);
+	}
+	const PluginChain_t& c = chain_[active_.load(std::memory_order_relaxed)];
+	if (!c.n) return false;
+
+	state_.t_ns = t_ns;
+	state_.cycle = cycle;
+	state_.dt = period_;
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		state_.q[i] = q[i];
+		state_.qdot[i] = qdot[i];
+		state_.tau_prev[i] = tau_prev[i];
+		state_.enc[i] = (int16_t)enc[i];
+	}
+
+	bool torque = false;
+	for (int k=0; k<c.n; k++)
+	{
+		PluginEntry_t* e = c.e[k];
+		if (e->state.load(std::memory_order_relaxed) != PLUGIN_ACTIVE) continue;
+
+		memcpy(state_.q_des, q_des, sizeof(state_.q_des));
+		out_.flags = 0;
+		int64_t t0 = rt_now_ns();
+		int r = e->desc->compute(e->ctx, &state_, &out_);
+		int64_t dt = rt_now_ns() - t0;
+
+		e->calls.store(e->calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		e->sum_ns.store(e->sum_ns.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+		if (dt > e->max_ns.load(std::memory_order_relaxed)) e->max_ns.store(dt, std::memory_order_relaxed);
+		if (dt > e->budget_ns)
+		{
+			e->overruns.store(e->overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (++e->consecutive >= PLUGIN_MAX_OVERRUNS)
+				e->state.store(PLUGIN_DISABLED_BUDGET, std::memory_order_relaxed);
+		}
+		else
+			e->consecutive = 0;
+
+		// a failed call or a non-finite output is not applied
+		bool ok = (r >= 0);
+		for (int i=0; ok && i<MAX_DOF; i++)
+		{
+			if ((out_.flags & ALLEGRO_PLUGIN_OUT_TARGET) && !isfinite(out_.q_des[i])) ok = false;
+			if ((out_.flags & ALLEGRO_PLUGIN_OUT_TORQUE) && !isfinite(out_.tau[i])) ok = false;
+		}
+		if (!ok)
+		{
+			e->state.store(PLUGIN_DISABLED_ERROR, std::memory_order_relaxed);
+			continue;
+		}
+		if (out_.flags & ALLEGRO_PLUGIN_OUT_TARGET)
+		{
+			for (int i=0; i<MAX_DOF; i++)
+			{
+				double v = out_.q_des[i];
+				if (v < kJointLimitLower[i]) v = kJointLimitLower[i];
+				if (v > kJointLimitUpper[i]) v = kJointLimitUpper[i];
+				q_des[i] = v;
+			}
+		}
+		if (out_.flags & ALLEGRO_PLUGIN_OUT_TORQUE)
+		{
+			memcpy(tau, out_.tau, sizeof(out_.tau));
+			torque = true;
+		}
+	}
+	return torque;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// command thread
+void PluginHost::Report(std::string* out) const
+{
+	const PluginChain_t& c = chain_[active_.load(std::memory_order_acquire)];
+	// name state budget_us calls mean_us max_us overruns path
+	char buf[512];
+	out->clear();
+	for (int k=0; k<c.n; k++)
+	{
+		const PluginEntry_t* e = c.e[k];
+		uint64_t n = e->calls.load(std::memory_order_relaxed);
+		snprintf(buf, sizeof(buf), "%s%s %s %lld %llu %.2f %.2f %llu %s", k ? "\n" : "", e->name,
+		         kStateNames[e->state.load(std::memory_order_relaxed)], (long long)(e->budget_ns / 1000),
+		         (unsigned long long)n, n ? e->sum_ns.load(std::memory_order_relaxed) * 1e-3 / n : 0.0,
+		         e->max_ns.load(std::memory_order_relaxed) * 1e-3,
+		         (unsigned long long)e->overruns.load(std::memory_order_relaxed), e->path);
+		*out += buf;
+	}
+	if (!c.n) *out = "none";
+}
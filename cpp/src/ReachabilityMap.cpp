@@ -0,0 +1,234 @@
+#include "ReachabilityMap.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+// [offset, offset + bytes) lies inside a file of 'size' bytes, without overflowing
+static inline bool InFile(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+	return offset <= size && bytes <= size - offset;
+}
+
+ReachabilityMap::ReachabilityMap()
+	: hdr_(NULL), base_(NULL), size_(0)
+{
+}
+
+ReachabilityMap::~ReachabilityMap()
+{
+	Unload();
+}
+
+bool ReachabilityMap::Load(const char* path, bool right_hand)
+{
+	Unload();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ReachMapHeader_t))
+	{
+		close(fd);
+		return false;
+	}
+
+	void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) return false;
+
+	const ReachMapHeader_t* hdr = (const ReachMapHeader_t*)mem;
+	bool ok = (memcmp(hdr->magic, REACHMAP_MAGIC, sizeof(REACHMAP_MAGIC)) == 0)
+		&& hdr->version == REACHMAP_VERSION
+		&& hdr->num_fingers == NUM_FINGERS
+		&& isfinite(hdr->voxel) && hdr->voxel > 0.0f;
+	for (int f=0; ok && f<NUM_FINGERS; f++)
+	{
+		// every voxel has a seed, so a grid larger than the file is corrupt; bounding
+		// the product by the file size at each step keeps it from overflowing
+		const ReachMapFinger_t& fi = hdr->finger[f];
+		uint64_t size = (uint64_t)st.st_size;
+		uint64_t n = 1;
+		for (int k=0; ok && k<3; k++)
+		{
+			ok = isfinite(fi.origin[k]) && fi.dims[k] > 0 && n <= size / fi.dims[k];
+			n *= fi.dims[k];
+		}
+		ok = ok && InFile(fi.bits_offset, (n + 7) / 8, size)
+			&& InFile(fi.seeds_offset, n * DOF_PER_FINGER * sizeof(int16_t), size)
+			&& fi.seeds_offset % sizeof(int16_t) == 0;
+	}
+	if (!ok)
+	{
+		printf("ReachabilityMap: %s is not a valid map (version %d expected)\n", path, REACHMAP_VERSION);
+		munmap(mem, st.st_size);
+		return false;
+	}
+	if ((hdr->right_hand != 0) != right_hand)
+	{
+		// a mirrored map would give plausible but wrong seeds
+		printf("ReachabilityMap: %s was baked for the %s hand\n", path, hdr->right_hand ? "right" : "left");
+		munmap(mem, st.st_size);
+		return false;
+	}
+
+	hdr_ = hdr;
+	base_ = (const unsigned char*)mem;
+	size_ = st.st_size;
+	return true;
+}
+
+void ReachabilityMap::Unload()
+{
+	if (base_) munmap((void*)base_, size_);
+	hdr_ = NULL;
+	base_ = NULL;
+	size_ = 0;
+}
+
+bool ReachabilityMap::Query(int finger, const double p[3], double seed[DOF_PER_FINGER]) const
+{
+	if (!hdr_ || finger < 0 || finger >= NUM_FINGERS) return false;
+
+	const ReachMapFinger_t& fi = hdr_->finger[finger];
+	uint32_t idx[3];
+	for (int k=0; k<3; k++)
+	{
+		// written so that NaN fails too, before the cast
+		double v = floor((p[k] - fi.origin[k]) / hdr_->voxel);
+		if (!(v >= 0.0 && v < (double)fi.dims[k])) return false;
+		idx[k] = (uint32_t)v;
+	}
+	uint64_t n = ((uint64_t)idx[2] * fi.dims[1] + idx[1]) * fi.dims[0] + idx[0];
+
+	const unsigned char* bits = base_ + fi.bits_offset;
+	if (!(bits[n >> 3] & (1 << (n & 7)))) return false;
+
+	if (seed)
+	{
+		const int16_t* s = (const int16_t*)(base_ + fi.seeds_offset) + n * DOF_PER_FINGER;
+		for (int j=0; j<DOF_PER_FINGER; j++)
+			seed[j] = s[j] * REACHMAP_SEED_SCALE;
+	}
+	return true;
+}
+
+// Joint-space grid walker shared by both baking passes
+static void SampleQ(int finger, int samples, long k, double q[DOF_PER_FINGER])
+{
+	for (int j=0; j<DOF_PER_FINGER; j++)
+	{
+		int i = k % samples;
+		k /= samples;
+		double lo = kJointLimitLower[finger*DOF_PER_FINGER + j];
+		double hi = kJointLimitUpper[finger*DOF_PER_FINGER + j];
+		q[j] = lo + (hi - lo) * i / (samples - 1);
+	}
+}
+
+int ReachabilityMap::Bake(const char* path, bool right_hand, double voxel, int samples)
+{
+	if (voxel <= 0.0 || samples < 2) return -1;
+
+	ReachMapHeader_t hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, REACHMAP_MAGIC, sizeof(REACHMAP_MAGIC));
+	hdr.version = REACHMAP_VERSION;
+	hdr.right_hand = right_hand ? 1 : 0;
+	hdr.voxel = (float)voxel;
+	hdr.num_fingers = NUM_FINGERS;
+
+	long total = 1;
+	for (int j=0; j<DOF_PER_FINGER; j++) total *= samples;
+
+	std::vector<unsigned char> bits[NUM_FINGERS];
+	std::vector<int16_t> seeds[NUM_FINGERS];
+	uint64_t offset = sizeof(ReachMapHeader_t);
+
+	for (int f=0; f<NUM_FINGERS; f++)
+	{
+		ReachMapFinger_t& fi = hdr.finger[f];
+		double q[DOF_PER_FINGER], tip[3];
+		double lo[3] = {1e9, 1e9, 1e9}, hi[3] = {-1e9, -1e9, -1e9};
+
+		// pass 1: workspace bounding box, padded by one voxel
+		for (long k=0; k<total; k++)
+		{
+			SampleQ(f, samples, k, q);
+			FingerFK(f, q, right_hand, tip);
+			for (int a=0; a<3; a++)
+			{
+				if (tip[a] < lo[a]) lo[a] = tip[a];
+				if (tip[a] > hi[a]) hi[a] = tip[a];
+			}
+		}
+		for (int a=0; a<3; a++)
+		{
+			fi.origin[a] = (float)(lo[a] - voxel);
+			fi.dims[a] = (uint32_t)ceil((hi[a] - lo[a]) / voxel) + 2;
+		}
+		uint64_t n = (uint64_t)fi.dims[0] * fi.dims[1] * fi.dims[2];
+
+		// pass 2: keep the sample closest to each voxel center as its seed
+		std::vector<float> best(n, 1e9f);
+		bits[f].assign((n + 7) / 8, 0);
+		seeds[f].assign(n * DOF_PER_FINGER, 0);
+		for (long k=0; k<total; k++)
+		{
+			SampleQ(f, samples, k, q);
+			FingerFK(f, q, right_hand, tip);
+			uint64_t idx[3];
+			double d2 = 0.0;
+			for (int a=0; a<3; a++)
+			{
+				double v = (tip[a] - fi.origin[a]) / voxel;
+				idx[a] = (uint64_t)v;
+				double c = (idx[a] + 0.5) - v;
+				d2 += c * c;
+			}
+			uint64_t m = (idx[2] * fi.dims[1] + idx[1]) * fi.dims[0] + idx[0];
+			if (d2 >= best[m]) continue;
+			if (best[m] > 1e8f) fi.reachable++;
+			best[m] = (float)d2;
+			bits[f][m >> 3] |= (1 << (m & 7));
+			for (int j=0; j<DOF_PER_FINGER; j++)
+				seeds[f][m*DOF_PER_FINGER + j] = (int16_t)lrint(q[j] / REACHMAP_SEED_SCALE);
+		}
+
+		fi.bits_offset = offset;
+		offset += bits[f].size();
+		offset = (offset + 7) & ~(uint64_t)7;
+		fi.seeds_offset = offset;
+		offset += seeds[f].size() * sizeof(int16_t);
+		offset = (offset + 7) & ~(uint64_t)7;
+
+		printf("finger %d: %u x %u x %u voxels, %u reachable\n", f,
+		       fi.dims[0], fi.dims[1], fi.dims[2], fi.reachable);
+	}
+
+	FILE* fp = fopen(path, "wb");
+	if (!fp)
+	{
+		perror("fopen()");
+		return -1;
+	}
+	static const char pad[8] = {0};
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+	uint64_t pos = sizeof(hdr);
+	for (int f=0; ok && f<NUM_FINGERS; f++)
+	{
+		ok = ok && fwrite(pad, 1, hdr.finger[f].bits_offset - pos, fp) == hdr.finger[f].bits_offset - pos;
+		ok = ok && fwrite(&bits[f][0], 1, bits[f].size(), fp) == bits[f].size();
+		pos = hdr.finger[f].bits_offset + bits[f].size();
+		ok = ok && fwrite(pad, 1, hdr.finger[f].seeds_offset - pos, fp) == hdr.finger[f].seeds_offset - pos;
+		ok = ok && fwrite(&seeds[f][0], sizeof(int16_t), seeds[f].size(), fp) == seeds[f].size();
+		pos = hdr.finger[f].seeds_offset + seeds[f].size() * sizeof(int16_t);
+	}
+	if (fclose(fp) != 0) ok = false;
+	return ok ? 0 : -1;
+}
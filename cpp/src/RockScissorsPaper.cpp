@@ -1,7 +1,9 @@
 
 #include "rDeviceAllegroHandCANDef.h"
+#include "RockScissorsPaper.h"
 #include <BHand/BHand.h>
 #include <vector>
+#include <atomic>
 
 // ROCK-SCISSORS-PAPER(LEFT HAND)
 //static double rock[] = {
@@ -64,7 +66,7 @@ void MotionRock()
 {
 	for (int i=0; i<16; i++)
 		q_des[i] = rock[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
+	SetHandMotionType(eMotionType_JOINT_PD);
 	SetGainsRSP();
 
 }
@@ -73,7 +75,7 @@ void MotionScissors()
 {
 	for (int i=0; i<16; i++)
 		q_des[i] = scissors[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
+	SetHandMotionType(eMotionType_JOINT_PD);
 	SetGainsRSP();
 }
 
@@ -81,7 +83,13 @@ void MotionPaper()
 {
 	for (int i=0; i<16; i++)
 		q_des[i] = paper[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
+	SetHandMotionType(eMotionType_JOINT_PD);
+	SetGainsRSP();
+}
+
+void SetJointPDMode()
+{
+	SetHandMotionType(eMotionType_JOINT_PD);
 	SetGainsRSP();
 }
 
@@ -89,6 +97,20 @@ void SetTargetQ(std::vector<double> q)
 {
 	for (int i=0; i<16; i++)
 		q_des[i] = q[i];
-	if (pBHand) pBHand->SetMotionType(eMotionType_JOINT_PD);
+	SetHandMotionType(eMotionType_JOINT_PD);
 	SetGainsRSP();
 }
+
+static std::atomic<int> handMotionType(eMotionType_NONE);
+
+void SetHandMotionType(int type)
+{
+	if (!pBHand) return;
+	pBHand->SetMotionType(type);
+	handMotionType.store(type, std::memory_order_relaxed);
+}
+
+int HandMotionType()
+{
+	return handMotionType.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,309 @@
+// Interposers for the real-time sanitizer build (see RtSanitizer.h).
+// Only compiled with -DALLEGRO_RT_SANITIZER=ON.
+
+#include "RtSanitizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <atomic>
+
+// glibc's allocator entry points, so the interposers need no dlsym bootstrap
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+extern "C" void* __libc_memalign(size_t align, size_t size);
+extern "C" void  __libc_free(void* p);
+
+static const char* kViolationNames[RT_VIOLATION_COUNT] = { "alloc", "free", "mutex", "stdio", "syscall" };
+
+static std::atomic<uint64_t> g_count[RT_VIOLATION_COUNT];
+static std::atomic<int> g_reports(0);
+static int g_abort = -1;                // from ALLEGRO_RT_SANITIZER_ABORT, read on first use
+
+static __thread int t_in_cycle = 0;
+static __thread int t_allow = 0;
+static __thread int t_busy = 0;         // inside the sanitizer itself
+
+template <typename F>
+static F Real(const char* name)
+{
+	return (F)dlsym(RTLD_NEXT, name);
+}
+
+static ssize_t RawWrite(const char* s)
+{
+	static ssize_t (*real_write)(int, const void*, size_t) = Real<ssize_t (*)(int, const void*, size_t)>("write");
+	return real_write(2, s, strlen(s));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// violation reporting
+static inline bool Checking()
+{
+	return t_in_cycle && !t_allow && !t_busy;
+}
+
+static void Violation(int kind, const char* what)
+{
+	t_busy = 1;
+	g_count[kind].fetch_add(1, std::memory_order_relaxed);
+
+	if (g_reports.fetch_add(1, std::memory_order_relaxed) < RT_SAN_MAX_REPORTS)
+	{
+		char line[160];
+		snprintf(line, sizeof(line), "RT SANITIZER: %s (%s) called inside the control cycle\n", what, kViolationNames[kind]);
+		RawWrite(line);
+		void* frames[32];
+		int n = backtrace(frames, 32);
+		backtrace_symbols_fd(frames + 1, n - 1, 2);
+	}
+
+	if (g_abort < 0)
+	{
+		const char* env = getenv("ALLEGRO_RT_SANITIZER_ABORT");
+		g_abort = (env && atoi(env)) ? 1 : 0;
+	}
+	if (g_abort) abort();
+	t_busy = 0;
+}
+
+#define RT_CHECK(kind, what)    do { if (Checking()) Violation(kind, what); } while (0)
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// cycle markers
+void RtCycleBegin()
+{
+	if (!t_in_cycle)
+	{
+		// backtrace() loads libgcc on first use; do that outside any cycle
+		static __thread bool primed = false;
+		if (!primed)
+		{
+			void* frames[2];
+			backtrace(frames, 2);
+			primed = true;
+		}
+	}
+	t_in_cycle = 1;
+}
+
+void RtCycleEnd()
+{
+	t_in_cycle = 0;
+}
+
+void RtAllowBegin()
+{
+	t_allow++;
+}
+
+void RtAllowEnd()
+{
+	t_allow--;
+}
+
+void RtSanitizerReport(std::string* out)
+{
+	char buf[64];
+	out->clear();
+	for (int k=0; k<RT_VIOLATION_COUNT; k++)
+	{
+		snprintf(buf, sizeof(buf), "%s%s %llu", k ? " " : "", kViolationNames[k],
+		         (unsigned long long)g_count[k].load(std::memory_order_relaxed));
+		*out += buf;
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// allocator
+extern "C" void* malloc(size_t size) __THROW
+{
+	RT_CHECK(RT_VIOLATION_ALLOC, "malloc");
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) __THROW
+{
+	RT_CHECK(RT_VIOLATION_ALLOC, "calloc");
+	return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) __THROW
+{
+	RT_CHECK(RT_VIOLATION_ALLOC, "realloc");
+	return __libc_realloc(p, size);
+}
+
+extern "C" int posix_memalign(void** p, size_t align, size_t size) __THROW
+{
+	RT_CHECK(RT_VIOLATION_ALLOC, "posix_memalign");
+	if (align < sizeof(void*) || (align & (align - 1))) return EINVAL;
+	void* m = __libc_memalign(align, size);
+	if (!m) return ENOMEM;
+	*p = m;
+	return 0;
+}
+
+extern "C" void free(void* p) __THROW
+{
+	if (p) RT_CHECK(RT_VIOLATION_FREE, "free");
+	__libc_free(p);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// locks
+extern "C" int pthread_mutex_lock(pthread_mutex_t* m) __THROWNL
+{
+	static int (*real)(pthread_mutex_t*) = Real<int (*)(pthread_mutex_t*)>("pthread_mutex_lock");
+	RT_CHECK(RT_VIOLATION_MUTEX, "pthread_mutex_lock");
+	return real(m);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// stdio output (std::cout ends up in fwrite)
+extern "C" int vfprintf(FILE* fp, const char* fmt, va_list ap)
+{
+	static int (*real)(FILE*, const char*, va_list) = Real<int (*)(FILE*, const char*, va_list)>("vfprintf");
+	RT_CHECK(RT_VIOLATION_STDIO, "vfprintf");
+	return real(fp, fmt, ap);
+}
+
+extern "C" int vprintf(const char* fmt, va_list ap)
+{
+	return vfprintf(stdout, fmt, ap);
+}
+
+extern "C" int fprintf(FILE* fp, const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int r = vfprintf(fp, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+extern "C" int printf(const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int r = vfprintf(stdout, fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+extern "C" int puts(const char* s)
+{
+	static int (*real)(const char*) = Real<int (*)(const char*)>("puts");
+	RT_CHECK(RT_VIOLATION_STDIO, "puts");
+	return real(s);
+}
+
+extern "C" int putchar(int c)
+{
+	static int (*real)(int) = Real<int (*)(int)>("putchar");
+	RT_CHECK(RT_VIOLATION_STDIO, "putchar");
+	return real(c);
+}
+
+extern "C" int fputs(const char* s, FILE* fp)
+{
+	static int (*real)(const char*, FILE*) = Real<int (*)(const char*, FILE*)>("fputs");
+	RT_CHECK(RT_VIOLATION_STDIO, "fputs");
+	return real(s, fp);
+}
+
+extern "C" size_t fwrite(const void* p, size_t size, size_t n, FILE* fp)
+{
+	static size_t (*real)(const void*, size_t, size_t, FILE*) = Real<size_t (*)(const void*, size_t, size_t, FILE*)>("fwrite");
+	RT_CHECK(RT_VIOLATION_STDIO, "fwrite");
+	return real(p, size, n, fp);
+}
+
+extern "C" int fflush(FILE* fp)
+{
+	static int (*real)(FILE*) = Real<int (*)(FILE*)>("fflush");
+	RT_CHECK(RT_VIOLATION_STDIO, "fflush");
+	return real(fp);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// blocking syscalls
+extern "C" ssize_t read(int fd, void* buf, size_t n)
+{
+	static ssize_t (*real)(int, void*, size_t) = Real<ssize_t (*)(int, void*, size_t)>("read");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "read");
+	return real(fd, buf, n);
+}
+
+extern "C" ssize_t write(int fd, const void* buf, size_t n)
+{
+	static ssize_t (*real)(int, const void*, size_t) = Real<ssize_t (*)(int, const void*, size_t)>("write");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "write");
+	return real(fd, buf, n);
+}
+
+extern "C" int open(const char* path, int flags, ...)
+{
+	static int (*real)(const char*, int, ...) = Real<int (*)(const char*, int, ...)>("open");
+	va_list ap;
+	va_start(ap, flags);
+	int mode = va_arg(ap, int);
+	va_end(ap);
+	RT_CHECK(RT_VIOLATION_SYSCALL, "open");
+	return real(path, flags, mode);
+}
+
+extern "C" int close(int fd)
+{
+	static int (*real)(int) = Real<int (*)(int)>("close");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "close");
+	return real(fd);
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+	static int (*real)(int, unsigned long, ...) = Real<int (*)(int, unsigned long, ...)>("ioctl");
+	va_list ap;
+	va_start(ap, request);
+	void* arg = va_arg(ap, void*);
+	va_end(ap);
+	RT_CHECK(RT_VIOLATION_SYSCALL, "ioctl");
+	return real(fd, request, arg);
+}
+
+extern "C" int poll(struct pollfd* fds, nfds_t n, int timeout)
+{
+	static int (*real)(struct pollfd*, nfds_t, int) = Real<int (*)(struct pollfd*, nfds_t, int)>("poll");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "poll");
+	return real(fds, n, timeout);
+}
+
+extern "C" int nanosleep(const struct timespec* req, struct timespec* rem)
+{
+	static int (*real)(const struct timespec*, struct timespec*) = Real<int (*)(const struct timespec*, struct timespec*)>("nanosleep");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "nanosleep");
+	return real(req, rem);
+}
+
+extern "C" int usleep(useconds_t us)
+{
+	static int (*real)(useconds_t) = Real<int (*)(useconds_t)>("usleep");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "usleep");
+	return real(us);
+}
+
+extern "C" int sched_yield() __THROW
+{
+	static int (*real)() = Real<int (*)()>("sched_yield");
+	RT_CHECK(RT_VIOLATION_SYSCALL, "sched_yield");
+	return real();
+}
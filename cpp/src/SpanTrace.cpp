@@ -0,0 +1,139 @@
+#include "SpanTrace.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef struct
+{
+	char name[32];
+	std::atomic<uint64_t> head;     // index of the next span to be written
+	TraceSpan_t spans[TRACE_RING_SPANS];
+} TraceRing_t;
+
+static const char* kSpanNames[SPAN_COUNT] =
+{
+	"rx", "decode", "control", "safety", "tx", "record", "publish", "command"
+};
+
+static std::atomic<TraceRing_t*> g_rings[TRACE_MAX_THREADS];
+static std::atomic<int> g_num_rings(0);         // slots claimed, may exceed TRACE_MAX_THREADS
+static __thread TraceRing_t* t_ring = NULL;
+
+// TSC <-> CLOCK_MONOTONIC reference pair, taken at the first registration
+static std::once_flag g_time_once;
+static uint64_t g_tsc0 = 0;
+static int64_t g_ns0 = 0;
+
+uint64_t TraceNow()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t)rt_now_ns();
+#endif
+}
+
+bool TraceRegisterThread(const char* name)
+{
+	if (t_ring) return true;
+
+	// threads may register concurrently: the time base is set once, slots are claimed atomically
+	std::call_once(g_time_once, []()
+	{
+		g_ns0 = rt_now_ns();
+		g_tsc0 = TraceNow();
+	});
+	if (g_num_rings.load(std::memory_order_relaxed) >= TRACE_MAX_THREADS) return false;
+
+	TraceRing_t* ring = (TraceRing_t*)calloc(1, sizeof(TraceRing_t));
+	if (!ring) return false;
+	strncpy(ring->name, name, sizeof(ring->name) - 1);
+	ring->head.store(0, std::memory_order_relaxed);
+
+	int n = g_num_rings.fetch_add(1, std::memory_order_relaxed);
+	if (n >= TRACE_MAX_THREADS)
+	{
+		free(ring);
+		return false;
+	}
+	g_rings[n].store(ring, std::memory_order_release);
+	t_ring = ring;
+	return true;
+}
+
+void TraceRecord(int id, uint64_t start, uint64_t end, uint32_t cycle)
+{
+	TraceRing_t* ring = t_ring;
+	if (!ring) return;
+
+	uint64_t h = ring->head.load(std::memory_order_relaxed);
+	TraceSpan_t& s = ring->spans[h % TRACE_RING_SPANS];
+	s.start = start;
+	s.end = end;
+	s.id = (uint32_t)id;
+	s.cycle = cycle;
+	ring->head.store(h + 1, std::memory_order_release);
+}
+
+int TraceExportChrome(double seconds, const char* path, int pid, TraceSpan_t* scratch)
+{
+	FILE* fp = fopen(path, "w");
+	if (!fp) return -1;
+
+	// scale from the reference pair to now
+	uint64_t tsc1 = TraceNow();
+	int64_t ns1 = rt_now_ns();
+	double ns_per_tick = (tsc1 > g_tsc0) ? (double)(ns1 - g_ns0) / (double)(tsc1 - g_tsc0) : 1.0;
+	uint64_t cutoff = tsc1 - (uint64_t)(seconds * 1e9 / ns_per_tick);
+
+	TraceSpan_t* copy = scratch ? scratch : (TraceSpan_t*)malloc(sizeof(TraceSpan_t) * TRACE_RING_SPANS);
+	if (!copy)
+	{
+		fclose(fp);
+		return -1;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	int count = 0;
+	bool first = true;
+	int num = g_num_rings.load(std::memory_order_relaxed);
+	if (num > TRACE_MAX_THREADS) num = TRACE_MAX_THREADS;
+	for (int t=0; t<num; t++)
+	{
+		// claimed but not published yet
+		const TraceRing_t* ring = g_rings[t].load(std::memory_order_acquire);
+		if (!ring) continue;
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+		        first ? "" : ",\n", pid, t, ring->name);
+		first = false;
+
+		// copy without stopping the writer, then drop what it overwrote meanwhile
+		uint64_t end = ring->head.load(std::memory_order_acquire);
+		uint64_t begin = (end > TRACE_RING_SPANS) ? end - TRACE_RING_SPANS : 0;
+		for (uint64_t i=begin; i<end; i++)
+			copy[i - begin] = ring->spans[i % TRACE_RING_SPANS];
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t valid = (head + 1 > TRACE_RING_SPANS) ? head + 1 - TRACE_RING_SPANS : 0;
+
+		for (uint64_t i=(begin > valid ? begin : valid); i<end; i++)
+		{
+			const TraceSpan_t& s = copy[i - begin];
+			if (s.start < cutoff || s.id >= SPAN_COUNT) continue;
+			double ts_us = (g_ns0 + (double)(int64_t)(s.start - g_tsc0) * ns_per_tick) * 1e-3;
+			double dur_us = (double)(s.end - s.start) * ns_per_tick * 1e-3;
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cycle\":%u}}",
+			        kSpanNames[s.id], pid, t, ts_us, dur_us, s.cycle);
+			count++;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+
+	if (copy != scratch) free(copy);
+	fclose(fp);
+	return count;
+}
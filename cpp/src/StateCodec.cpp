@@ -0,0 +1,125 @@
+#include "StateCodec.h"
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// varint helpers (LEB128, little-endian groups of 7 bits)
+static inline size_t PutVarint(uint64_t v, uint8_t* out)
+{
+	size_t n = 0;
+	while (v >= 0x80)
+	{
+		out[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	out[n++] = (uint8_t)v;
+	return n;
+}
+
+static inline bool GetVarint(const uint8_t* buf, size_t len, size_t* pos, uint64_t* v)
+{
+	uint64_t r = 0;
+	for (int shift=0; shift<64 && *pos<len; shift+=7)
+	{
+		uint8_t b = buf[(*pos)++];
+		r |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+		{
+			*v = r;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline uint64_t ZigZag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// encoder
+size_t EncodeStateFrame(const StateSample_t& s, const StateSample_t* ref, int divisor, uint8_t* out)
+{
+	size_t n = 0;
+	if (!ref)
+	{
+		out[n++] = STATE_CODEC_KEY;
+		n += PutVarint((uint64_t)divisor, out + n);
+		n += PutVarint(s.cycle, out + n);
+		memcpy(out + n, &s.t_ns, sizeof(s.t_ns));
+		n += sizeof(s.t_ns);
+		memcpy(out + n, s.enc, sizeof(s.enc));
+		n += sizeof(s.enc);
+		return n;
+	}
+
+	out[n++] = STATE_CODEC_DELTA;
+	n += PutVarint(s.cycle, out + n);
+	n += PutVarint(ZigZag(s.t_ns - ref->t_ns), out + n);
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		int16_t d = (int16_t)(uint16_t)(s.enc[i] - ref->enc[i]);  // modulo 2^16
+		n += PutVarint(ZigZag(d), out + n);
+	}
+	return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// decoder
+StateFrameDecoder::StateFrameDecoder()
+	: synced_(false), divisor_(1), cycle_(0), t_ns_(0), gaps_(0)
+{
+	memset(enc_, 0, sizeof(enc_));
+}
+
+bool StateFrameDecoder::Decode(const uint8_t* buf, size_t len)
+{
+	size_t pos = 1;
+	uint64_t v;
+	if (len < 1) return false;
+
+	if (buf[0] == STATE_CODEC_KEY)
+	{
+		uint64_t divisor, cycle;
+		if (!GetVarint(buf, len, &pos, &divisor) || !GetVarint(buf, len, &pos, &cycle)) return false;
+		if (len - pos != sizeof(t_ns_) + sizeof(enc_) || divisor == 0) return false;
+		divisor_ = (uint32_t)divisor;
+		cycle_ = cycle;
+		memcpy(&t_ns_, buf + pos, sizeof(t_ns_));
+		memcpy(enc_, buf + pos + sizeof(t_ns_), sizeof(enc_));
+		synced_ = true;
+		return true;
+	}
+	if (buf[0] != STATE_CODEC_DELTA) return false;
+
+	uint64_t cycle;
+	if (!GetVarint(buf, len, &pos, &cycle)) return false;
+	if (!synced_) return false;
+	if (cycle != cycle_ + divisor_)
+	{
+		// predecessor lost: stay out of sync until the next keyframe
+		synced_ = false;
+		gaps_++;
+		return false;
+	}
+
+	int16_t enc[MAX_DOF];
+	if (!GetVarint(buf, len, &pos, &v)) return false;
+	int64_t t_ns = t_ns_ + UnZigZag(v);
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		if (!GetVarint(buf, len, &pos, &v)) return false;
+		enc[i] = (int16_t)(uint16_t)(enc_[i] + (int16_t)UnZigZag(v));
+	}
+	if (pos != len) return false;
+
+	cycle_ = cycle;
+	t_ns_ = t_ns;
+	memcpy(enc_, enc, sizeof(enc_));
+	return true;
+}
@@ -0,0 +1,110 @@
+#include "StateCommands.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <vector>
+
+bool HandleStateCommand(const std::string& cmd, std::istream& args, const StateHistory& history,
+                        StatePublisher& publisher, int pub_port, std::string& reply)
+{
+	if (cmd == "history" || cmd == "history_range")
+	{
+		// history <seconds_back> [stride]  |  history_range <t0_ns> <t1_ns> [stride]
+		// binary reply: StateHistoryReply_t followed by the samples
+		int64_t now = rt_now_ns(), t0, t1 = now;
+		unsigned stride = 1;
+		if (cmd == "history")
+		{
+			double secs = 0.0;
+			args >> secs;
+			t0 = now - (int64_t)(secs * 1e9);
+		}
+		else
+		{
+			long long a = 0, b = 0;
+			args >> a >> b;
+			t0 = a;
+			t1 = b;
+		}
+		args >> stride;
+		reply.clear();
+		history.QueryWindow(t0, t1, stride, history.Capacity(), &reply);
+		return true;
+	}
+	else if (cmd == "state_at")
+	{
+		// state_at <t_ns> [<t_ns> ...]: q and qdot interpolated at each time stamp, in request order
+		// binary reply: StateHistoryReply_t (magic STATE_INTERP_MAGIC) followed by StateInterp_t
+		std::vector<int64_t> t;
+		long long v;
+		while (t.size() < STATE_INTERP_MAX && args >> v)
+			t.push_back(v);
+		reply.clear();
+		history.QueryAt(t.data(), (uint32_t)t.size(), &reply);
+		return true;
+	}
+	else if (cmd == "subscribe")
+	{
+		// subscribe <divisor> <field_mask>  ->  succ <id> <routing_id> <port>
+		int divisor = 0, mask = 0;
+		args >> divisor >> mask;
+		int id = publisher.Subscribe(divisor, mask);
+		if (id < 0)
+		{
+			reply = "fail";
+			return true;
+		}
+		char buf[64];
+		snprintf(buf, sizeof(buf), "succ %d sub%d %d", id, id, pub_port);
+		reply = buf;
+		return true;
+	}
+	else if (cmd == "unsubscribe")
+	{
+		int id = -1;
+		args >> id;
+		reply = publisher.Unsubscribe(id) ? "succ" : "fail";
+		return true;
+	}
+	else if (cmd == "sub_stats")
+	{
+		// overruns, then one line per subscriber: id divisor mask sent dropped unreachable cost_us
+		SubscriberStats_t st[PUB_MAX_SUBSCRIBERS];
+		int n = publisher.GetStats(st, PUB_MAX_SUBSCRIBERS);
+		char buf[160];
+		snprintf(buf, sizeof(buf), "overruns %llu", (unsigned long long)publisher.Overruns());
+		reply = buf;
+		for (int k=0; k<n; k++)
+		{
+			snprintf(buf, sizeof(buf), "\n%d %d 0x%02x %llu %llu %llu %.2f", st[k].id, st[k].divisor, st[k].mask,
+			         (unsigned long long)st[k].sent, (unsigned long long)st[k].dropped,
+			         (unsigned long long)st[k].unreachable, st[k].cost_us);
+			reply += buf;
+		}
+		return true;
+	}
+	else if (cmd == "pool_stats")
+	{
+		// publisher message pool: slots, slots held by queued messages, acquisitions, misses
+		BufferPoolStats_t st;
+		publisher.GetPoolStats(&st);
+		char buf[160];
+		snprintf(buf, sizeof(buf), "slots %u in_use %u acquired %llu exhausted %llu", st.slots, st.in_use,
+		         (unsigned long long)st.acquired, (unsigned long long)st.exhausted);
+		reply = buf;
+		return true;
+	}
+	else if (cmd == "codec_stats")
+	{
+		// delta-encoded encoder streams: frames, keyframes, bytes vs. raw, mean encode time
+		CodecStats_t st;
+		publisher.GetCodecStats(&st);
+		char buf[256];
+		snprintf(buf, sizeof(buf), "frames %llu keyframes %llu bytes %llu raw_bytes %llu ratio %.2f encode_ns %.0f",
+		         (unsigned long long)st.frames, (unsigned long long)st.keyframes, (unsigned long long)st.bytes,
+		         (unsigned long long)st.raw_bytes, st.bytes ? (double)st.raw_bytes / st.bytes : 0.0,
+		         st.frames ? (double)st.encode_ns / st.frames : 0.0);
+		reply = buf;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,303 @@
+#include "StateHistory.h"
+#include "RtClock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+StateHistory::StateHistory()
+	: hdr_(NULL), rec_(NULL), mem_(NULL), shm_bytes_(0), shm_owner_(false)
+{
+	shm_name_[0] = 0;
+}
+
+StateHistory::~StateHistory()
+{
+	if (!shm_bytes_)
+	{
+		free(mem_);
+		return;
+	}
+	munmap(mem_, shm_bytes_);
+	if (shm_owner_) shm_unlink(shm_name_);
+}
+
+static void InitHeader(StateHistoryHeader_t* hdr, uint32_t capacity)
+{
+	hdr->magic = STATE_HISTORY_MAGIC;
+	hdr->version = STATE_HISTORY_VERSION;
+	hdr->capacity = capacity;
+	hdr->record_bytes = sizeof(StateRecord_t);
+	hdr->head.store(0, std::memory_order_release);
+}
+
+bool StateHistory::Create(uint32_t capacity)
+{
+	if (mem_ || capacity < 2) return false;
+
+	size_t bytes = sizeof(StateHistoryHeader_t) + (size_t)capacity * sizeof(StateRecord_t);
+	if (posix_memalign(&mem_, 64, bytes) != 0)
+	{
+		mem_ = NULL;
+		return false;
+	}
+	memset(mem_, 0, bytes);
+
+	hdr_ = (StateHistoryHeader_t*)mem_;
+	rec_ = (StateRecord_t*)((char*)mem_ + sizeof(StateHistoryHeader_t));
+	InitHeader(hdr_, capacity);
+	return true;
+}
+
+bool StateHistory::CreateShared(const char* name, uint32_t capacity)
+{
+	if (mem_ || capacity < 2 || strlen(name) >= sizeof(shm_name_)) return false;
+
+	size_t bytes = sizeof(StateHistoryHeader_t) + (size_t)capacity * sizeof(StateRecord_t);
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, bytes) < 0)
+	{
+		perror("StateHistory: shm_open()");
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+	{
+		perror("StateHistory: mmap()");
+		shm_unlink(name);
+		return false;
+	}
+
+	// fresh pages are zero: every slot's seq is 0, i.e. not written
+	mem_ = mem;
+	shm_bytes_ = bytes;
+	shm_owner_ = true;
+	strcpy(shm_name_, name);
+	hdr_ = (StateHistoryHeader_t*)mem_;
+	rec_ = (StateRecord_t*)((char*)mem_ + sizeof(StateHistoryHeader_t));
+	InitHeader(hdr_, capacity);
+	return true;
+}
+
+bool StateHistory::AttachShared(const char* name)
+{
+	if (mem_ || strlen(name) >= sizeof(shm_name_)) return false;
+
+	int fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(StateHistoryHeader_t))
+	{
+		close(fd);
+		return false;
+	}
+	void* mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) return false;
+
+	StateHistoryHeader_t* hdr = (StateHistoryHeader_t*)mem;
+	if (hdr->magic != STATE_HISTORY_MAGIC || hdr->version != STATE_HISTORY_VERSION ||
+	    hdr->record_bytes != sizeof(StateRecord_t) ||
+	    sizeof(StateHistoryHeader_t) + (size_t)hdr->capacity * sizeof(StateRecord_t) > (size_t)st.st_size)
+	{
+		printf("StateHistory: %s has an incompatible layout\n", name);
+		munmap(mem, st.st_size);
+		return false;
+	}
+
+	mem_ = mem;
+	shm_bytes_ = st.st_size;
+	shm_owner_ = false;
+	strcpy(shm_name_, name);
+	hdr_ = hdr;
+	rec_ = (StateRecord_t*)((char*)mem_ + sizeof(StateHistoryHeader_t));
+	return true;
+}
+
+void StateHistory::Push(const StateSample_t& s)
+{
+	if (!hdr_) return;
+
+	uint64_t n = hdr_->head.load(std::memory_order_relaxed);
+	StateRecord_t& r = rec_[n % hdr_->capacity];
+	r.seq.store(2*n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	r.s = s;
+	r.seq.store(2*n + 2, std::memory_order_release);
+	hdr_->head.store(n + 1, std::memory_order_release);
+}
+
+bool StateHistory::Read(uint64_t index, StateSample_t* out) const
+{
+	if (!hdr_) return false;
+
+	const StateRecord_t& r = rec_[index % hdr_->capacity];
+	uint64_t s0 = r.seq.load(std::memory_order_acquire);
+	if (s0 != 2*index + 2) return false;
+	*out = r.s;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return r.seq.load(std::memory_order_relaxed) == s0;
+}
+
+void StateHistory::Range(uint64_t* first, uint64_t* end) const
+{
+	uint64_t head = hdr_ ? hdr_->head.load(std::memory_order_acquire) : 0;
+	uint64_t cap = hdr_ ? hdr_->capacity : 0;
+	*end = head;
+	// keep one slot of margin: the writer may be overwriting the oldest one
+	*first = (head + 1 > cap) ? head + 1 - cap : 0;
+}
+
+uint64_t StateHistory::LowerBound(int64_t t_ns) const
+{
+	uint64_t lo, hi;
+	Range(&lo, &hi);
+
+	// binary search on the time stamps; slots overwritten meanwhile count as "too old"
+	StateSample_t s;
+	while (lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (!Read(mid, &s) || s.t_ns < t_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+uint32_t StateHistory::QueryWindow(int64_t t0_ns, int64_t t1_ns, uint32_t stride, uint32_t max_count, std::string* reply) const
+{
+	if (stride < 1) stride = 1;
+
+	uint64_t first, end;
+	Range(&first, &end);
+	uint64_t i = LowerBound(t0_ns);
+
+	uint64_t avail = (end > i) ? (end - i + stride - 1) / stride : 0;
+	if (avail > max_count) avail = max_count;
+
+	StateHistoryReply_t hdr;
+	size_t base = reply->size();
+	reply->resize(base + sizeof(hdr) + avail * sizeof(StateSample_t));
+
+	uint32_t count = 0;
+	StateSample_t* out = (StateSample_t*)&(*reply)[base + sizeof(hdr)];
+	StateSample_t s;
+	for (; i < end && count < avail; i += stride)
+	{
+		if (!Read(i, &s)) continue;
+		if (s.t_ns > t1_ns) break;
+		memcpy(&out[count++], &s, sizeof(s));
+	}
+
+	hdr.magic = STATE_HISTORY_MAGIC;
+	hdr.version = STATE_HISTORY_VERSION;
+	hdr.count = count;
+	hdr.sample_bytes = sizeof(StateSample_t);
+	hdr.now_ns = rt_now_ns();
+	memcpy(&(*reply)[base], &hdr, sizeof(hdr));
+	reply->resize(base + sizeof(hdr) + count * sizeof(StateSample_t));
+	return count;
+}
+
+void StateHistory::Interpolate(const int64_t* t_ns, uint32_t n, StateInterp_t* out) const
+{
+	if (!n) return;
+
+	// visit the time stamps in ascending order, so the ring is swept once
+	std::vector<uint32_t> order(n);
+	for (uint32_t j=0; j<n; j++) order[j] = j;
+	std::sort(order.begin(), order.end(), [t_ns](uint32_t x, uint32_t y) { return t_ns[x] < t_ns[y]; });
+
+	uint64_t first, end;
+	Range(&first, &end);
+	uint64_t k = LowerBound(t_ns[order[0]]);
+	StateSample_t a, b;                 // samples k-1 and k, once read
+	uint64_t ia = UINT64_MAX, ib = UINT64_MAX;
+
+	for (uint32_t m=0; m<n; m++)
+	{
+		int64_t t = t_ns[order[m]];
+		StateInterp_t* o = &out[order[m]];
+		memset(o, 0, sizeof(*o));
+		o->t_ns = t;
+
+		// advance to the first sample at or after t; overwritten slots are skipped
+		while (k < end)
+		{
+			if (ib != k)
+			{
+				if (!Read(k, &b))
+				{
+					k++;
+					continue;
+				}
+				ib = k;
+			}
+			if (b.t_ns >= t) break;
+			a = b;
+			ia = k++;
+		}
+
+		if (k == end)
+		{
+			if (end > first && (ia == end - 1 || Read(end - 1, &a)))
+			{
+				ia = end - 1;
+				memcpy(o->q, a.q, sizeof(o->q));
+				memcpy(o->qdot, a.qdot, sizeof(o->qdot));
+				o->status = STATE_AT_LATE;
+			}
+			else
+				o->status = STATE_AT_EARLY;
+			continue;
+		}
+		if (b.t_ns == t)
+		{
+			memcpy(o->q, b.q, sizeof(o->q));
+			memcpy(o->qdot, b.qdot, sizeof(o->qdot));
+			continue;
+		}
+		if (ia != k - 1)
+		{
+			if (k <= first || !Read(k - 1, &a))
+			{
+				o->status = STATE_AT_EARLY;
+				continue;
+			}
+			ia = k - 1;
+		}
+
+		double w = (double)(t - a.t_ns) / (double)(b.t_ns - a.t_ns);
+		for (int i=0; i<MAX_DOF; i++)
+		{
+			o->q[i] = a.q[i] + w * (b.q[i] - a.q[i]);
+			o->qdot[i] = a.qdot[i] + w * (b.qdot[i] - a.qdot[i]);
+		}
+		o->status = (b.cycle - a.cycle > 1) ? STATE_AT_GAP : STATE_AT_OK;
+	}
+}
+
+void StateHistory::QueryAt(const int64_t* t_ns, uint32_t n, std::string* reply) const
+{
+	StateHistoryReply_t hdr;
+	size_t base = reply->size();
+	reply->resize(base + sizeof(hdr) + n * sizeof(StateInterp_t));
+	Interpolate(t_ns, n, (StateInterp_t*)&(*reply)[base + sizeof(hdr)]);
+
+	hdr.magic = STATE_INTERP_MAGIC;
+	hdr.version = STATE_HISTORY_VERSION;
+	hdr.count = n;
+	hdr.sample_bytes = sizeof(StateInterp_t);
+	hdr.now_ns = rt_now_ns();
+	memcpy(&(*reply)[base], &hdr, sizeof(hdr));
+}
@@ -0,0 +1,314 @@
+#include "StatePublisher.h"
+#include "RtClock.h"
+#include "StateCodec.h"
+#include "SpanTrace.h"
+#include <stdio.h>
+#include <string.h>
+#include <zmq.hpp>
+
+StatePublisher::StatePublisher()
+	: history_(NULL), port_(0), period_ns_(0), thread_(0), run_(false), overruns_(0),
+	  codec_frames_(0), codec_keyframes_(0), codec_bytes_(0), codec_ns_(0), socket_(NULL)
+{
+	for (int i=0; i<PUB_MAX_SUBSCRIBERS; i++)
+	{
+		subs_[i].active.store(0, std::memory_order_relaxed);
+		subs_[i].unreachable_since = 0;
+	}
+}
+
+StatePublisher::~StatePublisher()
+{
+	Stop();
+}
+
+bool StatePublisher::Start(const StateHistory* history, int port, double period)
+{
+	if (run_.load()) return false;
+	size_t slot_bytes = MessageBytes(STATE_FIELD_ALL);
+	if (slot_bytes < STATE_CODEC_MAX_BYTES) slot_bytes = STATE_CODEC_MAX_BYTES;
+	if (!pool_.SlotBytes() && !pool_.Create(PUB_POOL_SLOTS, slot_bytes)) return false;
+	history_ = history;
+	port_ = port;
+	period_ns_ = (int64_t)(period * 1e9);
+	run_.store(true);
+	if (pthread_create(&thread_, NULL, ThreadProc, this) != 0)
+	{
+		run_.store(false);
+		return false;
+	}
+	return true;
+}
+
+void StatePublisher::Stop()
+{
+	if (!run_.exchange(false)) return;
+	pthread_join(thread_, NULL);
+	thread_ = 0;
+}
+
+int StatePublisher::Subscribe(int divisor, int mask)
+{
+	if (divisor < 1 || divisor > 0xffff) return -1;
+	if (mask != STATE_FIELD_ENC_DELTA && ((mask & ~STATE_FIELD_ALL) || mask == 0)) return -1;
+	for (int i=0; i<PUB_MAX_SUBSCRIBERS; i++)
+	{
+		Subscriber& sub = subs_[i];
+		if (sub.active.load(std::memory_order_acquire)) continue;
+		sub.divisor = divisor;
+		sub.mask = mask;
+		sub.unreachable_since = 0;
+		sub.sent.store(0, std::memory_order_relaxed);
+		sub.dropped.store(0, std::memory_order_relaxed);
+		sub.unreachable.store(0, std::memory_order_relaxed);
+		sub.cost_ns.store(0, std::memory_order_relaxed);
+		sub.active.store(1, std::memory_order_release);
+		return i;
+	}
+	return -1;
+}
+
+bool StatePublisher::Unsubscribe(int id)
+{
+	if (id < 0 || id >= PUB_MAX_SUBSCRIBERS) return false;
+	return subs_[id].active.exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+int StatePublisher::GetStats(SubscriberStats_t* out, int max) const
+{
+	int n = 0;
+	for (int i=0; i<PUB_MAX_SUBSCRIBERS && n<max; i++)
+	{
+		const Subscriber& sub = subs_[i];
+		if (!sub.active.load(std::memory_order_acquire)) continue;
+		SubscriberStats_t& st = out[n++];
+		st.id = i;
+		st.divisor = sub.divisor;
+		st.mask = sub.mask;
+		st.sent = sub.sent.load(std::memory_order_relaxed);
+		st.dropped = sub.dropped.load(std::memory_order_relaxed);
+		st.unreachable = sub.unreachable.load(std::memory_order_relaxed);
+		uint64_t tries = st.sent + st.dropped;
+		st.cost_us = tries ? sub.cost_ns.load(std::memory_order_relaxed) * 1e-3 / tries : 0.0;
+	}
+	return n;
+}
+
+void StatePublisher::GetCodecStats(CodecStats_t* st) const
+{
+	st->frames = codec_frames_.load(std::memory_order_relaxed);
+	st->keyframes = codec_keyframes_.load(std::memory_order_relaxed);
+	st->bytes = codec_bytes_.load(std::memory_order_relaxed);
+	st->raw_bytes = st->frames * MessageBytes(STATE_FIELD_ENC);
+	st->encode_ns = codec_ns_.load(std::memory_order_relaxed);
+}
+
+size_t StatePublisher::MessageBytes(int mask)
+{
+	if (mask == STATE_FIELD_ENC_DELTA) return STATE_CODEC_MAX_BYTES;
+	size_t n = sizeof(StateMsgHeader_t);
+	for (int b=0; b<4; b++)
+		if (mask & (1 << b)) n += MAX_DOF * sizeof(double);
+	if (mask & STATE_FIELD_ENC) n += MAX_DOF * sizeof(int16_t);
+	return n;
+}
+
+void StatePublisher::Pack(const StateSample_t& s, int mask, int divisor, unsigned char* buf)
+{
+	StateMsgHeader_t hdr;
+	hdr.magic = STATE_MSG_MAGIC;
+	hdr.mask = (uint16_t)mask;
+	hdr.divisor = (uint16_t)divisor;
+	hdr.cycle = s.cycle;
+	hdr.t_ns = s.t_ns;
+	memcpy(buf, &hdr, sizeof(hdr));
+	buf += sizeof(hdr);
+
+	const double* fields[4] = { s.q, s.qdot, s.q_des, s.tau_des };
+	for (int b=0; b<4; b++)
+	{
+		if (!(mask & (1 << b))) continue;
+		memcpy(buf, fields[b], MAX_DOF * sizeof(double));
+		buf += MAX_DOF * sizeof(double);
+	}
+	if (mask & STATE_FIELD_ENC)
+		memcpy(buf, s.enc, MAX_DOF * sizeof(int16_t));
+}
+
+void* StatePublisher::ThreadProc(void* inst)
+{
+	((StatePublisher*)inst)->Run();
+	return NULL;
+}
+
+void StatePublisher::Run()
+{
+	zmq::context_t ctx;
+	zmq::socket_t sock(ctx, ZMQ_ROUTER);
+	sock.setsockopt(ZMQ_ROUTER_MANDATORY, 1);
+	sock.setsockopt(ZMQ_SNDHWM, PUB_QUEUE_DEPTH);
+	sock.setsockopt(ZMQ_LINGER, 0);
+	sock.bind("tcp://*:" + std::to_string(port_));
+	socket_ = &sock;
+	TraceRegisterThread("publisher");
+	printf("StatePublisher: subscriptions on port %d\n", port_);
+
+	uint64_t first, next;
+	history_->Range(&first, &next);
+	int64_t last_t = rt_now_ns();
+	StateSample_t s;
+
+	while (run_.load(std::memory_order_relaxed))
+	{
+		uint64_t end;
+		history_->Range(&first, &end);
+		if (next < first)
+		{
+			overruns_.fetch_add(first - next, std::memory_order_relaxed);
+			next = first;
+		}
+		if (next >= end)
+		{
+			// nothing new: sleep until shortly after the next cycle is due
+			int64_t now = rt_now_ns();
+			int64_t wake = last_t + period_ns_ + 100000;
+			rt_sleep_until_ns(wake > now ? wake : now + 100000);
+			continue;
+		}
+		for (; next < end; next++)
+		{
+			if (!history_->Read(next, &s))
+			{
+				overruns_.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			PublishSample(next, s);
+			last_t = s.t_ns;
+		}
+	}
+
+	socket_ = NULL;
+}
+
+size_t StatePublisher::EncodeDelta(uint64_t index, const StateSample_t& s, int divisor, uint8_t* buf)
+{
+	int64_t t0 = rt_now_ns();
+
+	// delta against the frame 'divisor' cycles back, if it is still in the history
+	StateSample_t ref;
+	bool key = (s.cycle / divisor) % STATE_CODEC_KEY_INTERVAL == 0 || index < (uint64_t)divisor ||
+	           !history_->Read(index - divisor, &ref) || ref.cycle + divisor != s.cycle;
+	size_t n = EncodeStateFrame(s, key ? NULL : &ref, divisor, buf);
+
+	codec_frames_.fetch_add(1, std::memory_order_relaxed);
+	if (key) codec_keyframes_.fetch_add(1, std::memory_order_relaxed);
+	codec_bytes_.fetch_add(n, std::memory_order_relaxed);
+	codec_ns_.fetch_add(rt_now_ns() - t0, std::memory_order_relaxed);
+	return n;
+}
+
+void StatePublisher::PublishSample(uint64_t index, const StateSample_t& s)
+{
+	zmq::socket_t& sock = *(zmq::socket_t*)socket_;
+	TraceScope span(SPAN_PUBLISH, (uint32_t)s.cycle);
+
+	// distinct (divisor, mask) pairs due this cycle, each packed once
+	struct Topic
+	{
+		int divisor, mask, subs;
+		bool valid;
+		int64_t pack_ns;
+		zmq::message_t msg;
+	};
+	Topic topics[PUB_MAX_SUBSCRIBERS];      // references released on return
+	int topic_of[PUB_MAX_SUBSCRIBERS];
+	int ntopics = 0;
+
+	for (int i=0; i<PUB_MAX_SUBSCRIBERS; i++)
+	{
+		topic_of[i] = -1;
+		Subscriber& sub = subs_[i];
+		if (!sub.active.load(std::memory_order_acquire) || s.cycle % sub.divisor != 0) continue;
+
+		int t = 0;
+		while (t < ntopics && !(topics[t].divisor == sub.divisor && topics[t].mask == sub.mask))
+			t++;
+		if (t == ntopics)
+		{
+			int64_t t0 = rt_now_ns();
+			topics[t].divisor = sub.divisor;
+			topics[t].mask = sub.mask;
+			topics[t].subs = 0;
+
+			// written once into a pool slot that every subscriber's message references;
+			// the slot returns to the pool when ZMQ has sent the last of them
+			uint8_t* slot = (uint8_t*)pool_.Acquire();
+			topics[t].valid = (slot != NULL);
+			if (slot)
+			{
+				size_t n = MessageBytes(sub.mask);
+				if (sub.mask == STATE_FIELD_ENC_DELTA)
+					n = EncodeDelta(index, s, sub.divisor, slot);
+				else
+					Pack(s, sub.mask, sub.divisor, slot);
+				zmq::message_t msg(slot, n, BufferPool::Release, &pool_);
+				topics[t].msg.move(msg);
+			}
+			topics[t].pack_ns = rt_now_ns() - t0;
+			ntopics++;
+		}
+		topics[t].subs++;
+		topic_of[i] = t;
+	}
+
+	int64_t now = rt_now_ns();
+	for (int i=0; i<PUB_MAX_SUBSCRIBERS; i++)
+	{
+		if (topic_of[i] < 0) continue;
+		Subscriber& sub = subs_[i];
+		Topic& topic = topics[topic_of[i]];
+		int64_t t0 = rt_now_ns();
+		if (!topic.valid)
+		{
+			sub.dropped.fetch_add(1, std::memory_order_relaxed);   // pool exhausted
+			continue;
+		}
+
+		char rid[16];
+		int len = snprintf(rid, sizeof(rid), "sub%d", i);
+		zmq::message_t id_msg(rid, len);
+		zmq::message_t body;
+		body.copy(topic.msg);       // reference to the pool slot, no copy
+
+		bool sent = false, reachable = true;
+		try
+		{
+			sent = (bool)sock.send(id_msg, zmq::send_flags::sndmore | zmq::send_flags::dontwait);
+			if (sent)
+				sock.send(body, zmq::send_flags::dontwait);
+		}
+		catch (const zmq::error_t&)
+		{
+			reachable = false;      // EHOSTUNREACH: client not connected
+		}
+
+		if (sent)
+		{
+			sub.sent.fetch_add(1, std::memory_order_relaxed);
+			sub.unreachable_since = 0;
+		}
+		else if (reachable)
+		{
+			sub.dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			sub.unreachable.fetch_add(1, std::memory_order_relaxed);
+			if (sub.unreachable_since == 0)
+				sub.unreachable_since = now;
+			else if (now - sub.unreachable_since > (int64_t)(PUB_LEASE_SECONDS * 1e9))
+				sub.active.store(0, std::memory_order_release);
+		}
+		sub.cost_ns.fetch_add(topic.pack_ns / topic.subs + (rt_now_ns() - t0), std::memory_order_relaxed);
+	}
+}
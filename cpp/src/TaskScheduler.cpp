@@ -0,0 +1,235 @@
+#include "TaskScheduler.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+
+static const char* kTierNames[] = { "rt", "soft", "background" };
+static const int64_t kMaxIdleNs = 50000000;     // re-check the stop flag at least this often
+
+TaskScheduler::TaskScheduler(double control_period)
+	: period_(control_period), num_tasks_(0), pool_(NULL), run_(false)
+{
+	for (int i=0; i<SCHED_NUM_TIERS; i++)
+	{
+		thread_[i] = 0;
+		policy_[i] = SCHED_OTHER;
+	}
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	Stop();
+}
+
+int TaskScheduler::Add(const char* name, int tier, double rate_hz, double budget_us, SchedTaskFn fn, void* arg)
+{
+	if (run_.load() || num_tasks_ >= SCHED_MAX_TASKS || tier < 0 || tier >= SCHED_NUM_TIERS || rate_hz <= 0.0 || !fn)
+		return -1;
+
+	SchedTask_t& t = tasks_[num_tasks_];
+	snprintf(t.name, sizeof(t.name), "%s", name);
+	t.tier = tier;
+	t.fn = fn;
+	t.arg = arg;
+	t.period_cycles = (int)floor(1.0 / (rate_hz * period_) + 0.5);
+	if (t.period_cycles < 1) t.period_cycles = 1;
+	t.period_ns = (tier == SCHED_TIER_RT) ? (int64_t)(t.period_cycles * period_ * 1e9) : (int64_t)(1e9 / rate_hz);
+	t.budget_ns = (int64_t)(budget_us * 1000.0);
+	t.next_ns = 0;
+	t.countdown = 1;
+	t.consecutive = 0;
+	t.disabled.store(false, std::memory_order_relaxed);
+	t.runs.store(0, std::memory_order_relaxed);
+	t.overruns.store(0, std::memory_order_relaxed);
+	t.skipped.store(0, std::memory_order_relaxed);
+	t.sum_ns.store(0, std::memory_order_relaxed);
+	t.max_ns.store(0, std::memory_order_relaxed);
+	t.late_ns.store(0, std::memory_order_relaxed);
+	t.in_pool.store(false, std::memory_order_relaxed);
+	t.owner = this;
+	return num_tasks_++;
+}
+
+bool TaskScheduler::Start()
+{
+	if (run_.exchange(true)) return false;
+	for (int tier=SCHED_TIER_SOFT; tier<SCHED_NUM_TIERS; tier++)
+	{
+		thread_arg_[tier].self = this;
+		thread_arg_[tier].tier = tier;
+		if (pthread_create(&thread_[tier], NULL, ThreadProc, &thread_arg_[tier]) != 0)
+		{
+			thread_[tier] = 0;
+			printf("ERROR starting the %s scheduler tier\n", kTierNames[tier]);
+		}
+	}
+	return true;
+}
+
+void TaskScheduler::Stop()
+{
+	if (!run_.exchange(false)) return;
+	for (int tier=0; tier<SCHED_NUM_TIERS; tier++)
+	{
+		if (!thread_[tier]) continue;
+		pthread_join(thread_[tier], NULL);
+		thread_[tier] = 0;
+	}
+}
+
+void TaskScheduler::SetControlPriority(int priority)
+{
+	pthread_t soft = thread_[SCHED_TIER_SOFT];
+	if (priority <= SCHED_SOFT_PRIORITY || !soft) return;
+	struct sched_param sp;
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = SCHED_SOFT_PRIORITY;
+	if (pthread_setschedparam(soft, SCHED_FIFO, &sp) == 0)
+		policy_[SCHED_TIER_SOFT] = SCHED_FIFO;
+}
+
+void* TaskScheduler::ThreadProc(void* arg)
+{
+	ThreadArg_t* a = (ThreadArg_t*)arg;
+	a->self->RunTier(a->tier);
+	return NULL;
+}
+
+void TaskScheduler::Execute(SchedTask_t* t, int64_t now_ns)
+{
+	int64_t t0 = rt_now_ns();
+	t->fn(t->arg, now_ns);
+	int64_t dt = rt_now_ns() - t0;
+
+	t->runs.store(t->runs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	t->sum_ns.store(t->sum_ns.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+	if (dt > t->max_ns.load(std::memory_order_relaxed)) t->max_ns.store(dt, std::memory_order_relaxed);
+	if (t->budget_ns > 0 && dt > t->budget_ns)
+	{
+		t->overruns.store(t->overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (++t->consecutive >= SCHED_MAX_OVERRUNS && t->tier == SCHED_TIER_RT)
+			t->disabled.store(true, std::memory_order_relaxed);
+	}
+	else
+		t->consecutive = 0;
+}
+
+void TaskScheduler::PoolJob(void* arg, WorkArena_t*)
+{
+	SchedTask_t* t = (SchedTask_t*)arg;
+	t->owner->Execute(t, rt_now_ns());
+	t->in_pool.store(false, std::memory_order_release);
+}
+
+// background tasks go to the pool when there is one; still queued or running counts as skipped
+void TaskScheduler::Dispatch(SchedTask_t* t, int64_t now_ns)
+{
+	if (t->tier != SCHED_TIER_BACKGROUND || !pool_ || !pool_->IsRunning())
+	{
+		Execute(t, now_ns);
+		return;
+	}
+	if (t->in_pool.load(std::memory_order_acquire))
+	{
+		t->skipped.store(t->skipped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+	t->in_pool.store(true, std::memory_order_relaxed);
+	if (!pool_->Submit(PoolJob, t))
+	{
+		t->in_pool.store(false, std::memory_order_relaxed);
+		t->skipped.store(t->skipped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// control thread
+void TaskScheduler::RunRt(int64_t now_ns)
+{
+	for (int i=0; i<num_tasks_; i++)
+	{
+		SchedTask_t* t = &tasks_[i];
+		if (t->tier != SCHED_TIER_RT || t->disabled.load(std::memory_order_relaxed)) continue;
+		if (--t->countdown > 0) continue;
+		t->countdown = t->period_cycles;
+		Execute(t, now_ns);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// soft and background threads
+void TaskScheduler::RunTier(int tier)
+{
+	// the soft tier starts under SCHED_OTHER; SetControlPriority() may raise it
+	if (tier == SCHED_TIER_BACKGROUND)
+	{
+		struct sched_param sp;
+		memset(&sp, 0, sizeof(sp));
+		// without the privilege the tier keeps running under SCHED_OTHER
+		if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp) == 0)
+			policy_[tier] = SCHED_IDLE;
+	}
+
+	int64_t now = rt_now_ns();
+	for (int i=0; i<num_tasks_; i++)
+		if (tasks_[i].tier == tier) tasks_[i].next_ns = now;
+
+	while (run_.load(std::memory_order_relaxed))
+	{
+		int64_t wake = now + kMaxIdleNs;
+		for (int i=0; i<num_tasks_; i++)
+		{
+			SchedTask_t* t = &tasks_[i];
+			if (t->tier != tier) continue;
+			now = rt_now_ns();
+			if (now >= t->next_ns)
+			{
+				int64_t late = now - t->next_ns;
+				if (late > t->late_ns.load(std::memory_order_relaxed)) t->late_ns.store(late, std::memory_order_relaxed);
+				Dispatch(t, now);
+
+				// fell behind: skip the missed periods rather than run back to back
+				t->next_ns += t->period_ns;
+				now = rt_now_ns();
+				if (t->next_ns <= now)
+				{
+					int64_t missed = (now - t->next_ns) / t->period_ns + 1;
+					t->skipped.store(t->skipped.load(std::memory_order_relaxed) + missed, std::memory_order_relaxed);
+					t->next_ns += missed * t->period_ns;
+				}
+			}
+			if (t->next_ns < wake) wake = t->next_ns;
+		}
+		rt_sleep_until_ns(wake);
+		now = rt_now_ns();
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// command thread
+void TaskScheduler::Report(std::string* out) const
+{
+	// name tier(policy) rate_hz budget_us runs mean_us max_us late_max_us overruns skipped [disabled]
+	char buf[256];
+	out->clear();
+	for (int i=0; i<num_tasks_; i++)
+	{
+		const SchedTask_t& t = tasks_[i];
+		const char* pol = (t.tier == SCHED_TIER_RT) ? "control"
+		                : (t.tier == SCHED_TIER_BACKGROUND && pool_) ? "pool"
+		                : (policy_[t.tier] == SCHED_FIFO) ? "fifo"
+		                : (policy_[t.tier] == SCHED_IDLE) ? "idle" : "other";
+		uint64_t n = t.runs.load(std::memory_order_relaxed);
+		snprintf(buf, sizeof(buf), "%s%s %s(%s) %.1f %.0f %llu %.2f %.2f %.2f %llu %llu%s", i ? "\n" : "",
+		         t.name, kTierNames[t.tier], pol, 1e9 / t.period_ns, t.budget_ns * 1e-3, (unsigned long long)n,
+		         n ? t.sum_ns.load(std::memory_order_relaxed) * 1e-3 / n : 0.0,
+		         t.max_ns.load(std::memory_order_relaxed) * 1e-3, t.late_ns.load(std::memory_order_relaxed) * 1e-3,
+		         (unsigned long long)t.overruns.load(std::memory_order_relaxed),
+		         (unsigned long long)t.skipped.load(std::memory_order_relaxed),
+		         t.disabled.load(std::memory_order_relaxed) ? " disabled" : "");
+		*out += buf;
+	}
+	if (!num_tasks_) *out = "none";
+}
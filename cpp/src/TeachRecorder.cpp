@@ -0,0 +1,139 @@
+#include "TeachRecorder.h"
+#include <string.h>
+#include <math.h>
+
+TeachRecorder::TeachRecorder(int max_samples)
+	: max_samples_(max_samples), state_(TEACH_IDLE), count_(0)
+{
+	t_ = new int64_t[max_samples];
+	q_ = new double[(size_t)max_samples * MAX_DOF];
+
+	// touch the buffer now, not on the control thread
+	memset(t_, 0, sizeof(int64_t) * max_samples);
+	memset(q_, 0, sizeof(double) * MAX_DOF * max_samples);
+}
+
+TeachRecorder::~TeachRecorder()
+{
+	delete[] t_;
+	delete[] q_;
+}
+
+void TeachRecorder::Start()
+{
+	state_.store(TEACH_START, std::memory_order_release);
+}
+
+void TeachRecorder::Stop()
+{
+	state_.store(TEACH_IDLE, std::memory_order_release);
+}
+
+void TeachRecorder::Record(int64_t t_ns, const double* q)
+{
+	int st = state_.load(std::memory_order_acquire);
+	if (st == TEACH_IDLE) return;
+
+	int n = count_.load(std::memory_order_relaxed);
+	if (st == TEACH_START)
+	{
+		n = 0;
+		count_.store(0, std::memory_order_release);
+		int expected = TEACH_START;
+		state_.compare_exchange_strong(expected, TEACH_RECORDING, std::memory_order_acq_rel);
+	}
+	if (n >= max_samples_)
+	{
+		int expected = TEACH_RECORDING;
+		state_.compare_exchange_strong(expected, TEACH_IDLE, std::memory_order_acq_rel);
+		return;
+	}
+	t_[n] = t_ns;
+	memcpy(&q_[(size_t)n * MAX_DOF], q, sizeof(double) * MAX_DOF);
+	count_.store(n + 1, std::memory_order_release);
+}
+
+// largest joint error between samples (a, b) and the line from a to b
+double TeachRecorder::Deviation(int a, int b, int* worst) const
+{
+	const double* qa = &q_[(size_t)a * MAX_DOF];
+	const double* qb = &q_[(size_t)b * MAX_DOF];
+	double span = (double)(t_[b] - t_[a]);
+	double dmax = 0.0;
+	*worst = -1;
+	for (int k=a+1; k<b; k++)
+	{
+		const double* qk = &q_[(size_t)k * MAX_DOF];
+		double w = (span > 0.0) ? (double)(t_[k] - t_[a]) / span : 0.0;
+		for (int i=0; i<MAX_DOF; i++)
+		{
+			double d = fabs(qk[i] - (qa[i] + w * (qb[i] - qa[i])));
+			if (d > dmax)
+			{
+				dmax = d;
+				*worst = k;
+			}
+		}
+	}
+	return dmax;
+}
+
+// mark the samples to keep; -1 as soon as more than max_knots are needed.
+// stack holds the pending (first, last) ranges
+int TeachRecorder::Simplify(int n, double tol, int max_knots, uint8_t* keep, int* stack) const
+{
+	memset(keep, 0, n);
+	keep[0] = keep[n - 1] = 1;
+	int kept = 2;
+
+	// explicit stack, recordings are far too long to recurse on
+	int sp = 0;
+	stack[sp++] = 0;
+	stack[sp++] = n - 1;
+	while (sp > 0)
+	{
+		int b = stack[--sp];
+		int a = stack[--sp];
+		if (b - a < 2) continue;
+
+		int k;
+		if (Deviation(a, b, &k) <= tol) continue;
+		keep[k] = 1;
+		if (++kept > max_knots) return -1;
+		stack[sp++] = a;
+		stack[sp++] = k;
+		stack[sp++] = k;
+		stack[sp++] = b;
+	}
+	return kept;
+}
+
+int TeachRecorder::Compress(double* tol, TrajKnot_t* knots, int max_knots, double* max_err, void* scratch)
+{
+	int n = Count();
+	if (n < 2 || max_knots < 2) return -1;
+	char* mem = scratch ? (char*)scratch : new char[ScratchBytes()];
+	int* stack = (int*)mem;
+	uint8_t* keep = (uint8_t*)(stack + 4 * (size_t)max_samples_);
+
+	if (*tol <= 0.0) *tol = 1e-4;
+	while (Simplify(n, *tol, max_knots, keep, stack) < 0)
+		*tol *= 2.0;
+
+	int count = 0, prev = 0;
+	*max_err = 0.0;
+	for (int k=0; k<n; k++)
+	{
+		if (!keep[k]) continue;
+		knots[count].t = (t_[k] - t_[0]) * 1e-9;
+		memcpy(knots[count].q, &q_[(size_t)k * MAX_DOF], sizeof(knots[count].q));
+		count++;
+
+		int worst;
+		double d = Deviation(prev, k, &worst);
+		if (d > *max_err) *max_err = d;
+		prev = k;
+	}
+	if (mem != scratch) delete[] mem;
+	return count;
+}
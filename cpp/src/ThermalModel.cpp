@@ -0,0 +1,140 @@
+#include "ThermalModel.h"
+#include <stdio.h>
+#include <math.h>
+
+#define THERMAL_U2_WINDOW_S         1.0     // averaging of the load for hold-time estimates
+#define THERMAL_GAIN_MIN            0.25
+#define THERMAL_GAIN_MAX            4.0
+
+// 1 below DERATE_START, MIN_SCALE above DERATE_END, smoothstep in between
+static inline double DerateScale(double t)
+{
+	double s = (t - THERMAL_DERATE_START_C) * (1.0 / (THERMAL_DERATE_END_C - THERMAL_DERATE_START_C));
+	if (s <= 0.0) return 1.0;
+	if (s >= 1.0) return THERMAL_MIN_SCALE;
+	return 1.0 - (1.0 - THERMAL_MIN_SCALE) * s * s * (3.0 - 2.0 * s);
+}
+
+ThermalModel::ThermalModel(double period)
+	: a_(period / THERMAL_TAU_S), ema_(period / THERMAL_U2_WINDOW_S), frames_(0), initialized_(false)
+{
+	ambient_.store(THERMAL_AMBIENT_C, std::memory_order_relaxed);
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		limit_[i] = 1.0;
+		temp_[i].store(THERMAL_AMBIENT_C, std::memory_order_relaxed);
+		u2_[i].store(0.0, std::memory_order_relaxed);
+	}
+	for (int f=0; f<THERMAL_FINGERS; f++)
+	{
+		gain_[f].store(1.0, std::memory_order_relaxed);
+		measured_[f].store(NAN, std::memory_order_relaxed);
+		heat_sum_[f] = 0.0;
+		heat_n_[f] = 0;
+	}
+}
+
+void ThermalModel::SetAmbient(double celsius)
+{
+	ambient_.store(celsius, std::memory_order_relaxed);
+	for (int i=0; i<MAX_DOF; i++)
+		temp_[i].store(celsius, std::memory_order_relaxed);
+}
+
+void ThermalModel::Update(const double* u)
+{
+	double amb = ambient_.load(std::memory_order_relaxed);
+	for (int f=0; f<THERMAL_FINGERS; f++)
+	{
+		double heat = gain_[f].load(std::memory_order_relaxed) * THERMAL_RISE_C;
+		double sum = 0.0;
+		for (int j=4*f; j<4*f+4; j++)
+		{
+			double u2 = u[j] * u[j];
+			double t = temp_[j].load(std::memory_order_relaxed);
+			t += a_ * (heat * u2 - (t - amb));
+			temp_[j].store(t, std::memory_order_relaxed);
+			double m = u2_[j].load(std::memory_order_relaxed);
+			u2_[j].store(m + ema_ * (u2 - m), std::memory_order_relaxed);
+			limit_[j] = DerateScale(t);
+			sum += u2;
+		}
+		heat_sum_[f] += sum * 0.25;
+		heat_n_[f]++;
+	}
+}
+
+void ThermalModel::Measure(int finger, double celsius)
+{
+	if (finger < 0 || finger >= THERMAL_FINGERS) return;
+	frames_.fetch_add(1, std::memory_order_relaxed);
+	measured_[finger].store(celsius, std::memory_order_relaxed);
+
+	// first reading: the motors are at that temperature, but after a warm restart
+	// the surroundings are not; a motor cannot stay below ambient, though
+	if (!initialized_)
+	{
+		for (int i=0; i<MAX_DOF; i++)
+			temp_[i].store(celsius, std::memory_order_relaxed);
+		initialized_ = true;
+	}
+	if (celsius < ambient_.load(std::memory_order_relaxed))
+		ambient_.store(celsius, std::memory_order_relaxed);
+
+	// the sensor sees the finger as a whole: compare with the mean of its motors
+	double mean = 0.0;
+	for (int j=4*finger; j<4*finger+4; j++)
+		mean += temp_[j].load(std::memory_order_relaxed);
+	double e = celsius - mean * 0.25;
+
+	for (int j=4*finger; j<4*finger+4; j++)
+		temp_[j].store(temp_[j].load(std::memory_order_relaxed) + THERMAL_OBSERVER_GAIN * e, std::memory_order_relaxed);
+
+	// under load, a persistent error means the heating gain is off
+	double u2 = heat_n_[finger] ? heat_sum_[finger] / heat_n_[finger] : 0.0;
+	if (u2 > 0.01)
+	{
+		double g = gain_[finger].load(std::memory_order_relaxed) * (1.0 + THERMAL_ADAPT_RATE * e * u2);
+		if (g < THERMAL_GAIN_MIN) g = THERMAL_GAIN_MIN;
+		if (g > THERMAL_GAIN_MAX) g = THERMAL_GAIN_MAX;
+		gain_[finger].store(g, std::memory_order_relaxed);
+	}
+	heat_sum_[finger] = 0.0;
+	heat_n_[finger] = 0;
+}
+
+double ThermalModel::HoldTime(int joint) const
+{
+	double t = temp_[joint].load(std::memory_order_relaxed);
+	if (t >= THERMAL_DERATE_START_C) return 0.0;
+	double t_ss = ambient_.load(std::memory_order_relaxed) +
+	              gain_[joint / 4].load(std::memory_order_relaxed) * THERMAL_RISE_C * u2_[joint].load(std::memory_order_relaxed);
+	if (t_ss <= THERMAL_DERATE_START_C) return -1.0;
+	return THERMAL_TAU_S * log((t_ss - t) / (t_ss - THERMAL_DERATE_START_C));
+}
+
+void ThermalModel::Report(std::string* out) const
+{
+	char buf[160];
+	snprintf(buf, sizeof(buf), "ambient %.1f frames %llu derate %.0f..%.0f",
+	         ambient_.load(std::memory_order_relaxed), (unsigned long long)frames_.load(std::memory_order_relaxed),
+	         THERMAL_DERATE_START_C, THERMAL_DERATE_END_C);
+	*out = buf;
+	for (int f=0; f<THERMAL_FINGERS; f++)
+	{
+		snprintf(buf, sizeof(buf), "\nfinger %d measured %.1f gain %.2f", f,
+		         measured_[f].load(std::memory_order_relaxed), gain_[f].load(std::memory_order_relaxed));
+		*out += buf;
+	}
+	// joint predicted_degC torque_scale hold_s (inf: indefinitely)
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		double t = temp_[i].load(std::memory_order_relaxed);
+		double hold = HoldTime(i);
+		if (hold < 0.0)
+			snprintf(buf, sizeof(buf), "\n%d %.1f %.2f inf", i, t, DerateScale(t));
+		else
+			snprintf(buf, sizeof(buf), "\n%d %.1f %.2f %.0f", i, t, DerateScale(t), hold);
+		*out += buf;
+	}
+}
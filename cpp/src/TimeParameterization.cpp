@@ -0,0 +1,246 @@
+#include "TimeParameterization.h"
+#include <math.h>
+#include <string.h>
+
+#define TP_EPS  1e-9
+
+void SetDefaultJointLimits(JointLimits_t* lim)
+{
+	// Rough values for a v4 hand under the default JOINT_PD gains; the torque
+	// limit leaves headroom below the +-1.0 clamp for the feedback term.
+	for (int i=0; i<MAX_DOF; i++)
+	{
+		lim->vel[i] = 3.0;
+		lim->acc[i] = 30.0;
+		lim->tau[i] = 0.7;
+		lim->inertia[i] = 0.01;
+		lim->damping[i] = 0.02;
+	}
+}
+
+TimeParameterizer::TimeParameterizer()
+	: nk_(0)
+{
+}
+
+bool TimeParameterizer::BuildSpline(const double* wp, int num_wp)
+{
+	knot_s_.resize(num_wp);
+	knot_q_.resize(num_wp * MAX_DOF);
+	knot_m_.assign(num_wp * MAX_DOF, 0.0);
+	work_.resize(num_wp * 2);
+
+	// drop repeated waypoints, parameterize by joint-space chord length
+	nk_ = 0;
+	for (int k=0; k<num_wp; k++)
+	{
+		const double* w = wp + k * MAX_DOF;
+		double d2 = 0.0;
+		if (nk_ > 0)
+		{
+			const double* prev = &knot_q_[(nk_ - 1) * MAX_DOF];
+			for (int i=0; i<MAX_DOF; i++)
+				d2 += (w[i] - prev[i]) * (w[i] - prev[i]);
+			if (d2 < 1e-12) continue;
+		}
+		knot_s_[nk_] = (nk_ > 0) ? knot_s_[nk_ - 1] + sqrt(d2) : 0.0;
+		memcpy(&knot_q_[nk_ * MAX_DOF], w, MAX_DOF * sizeof(double));
+		nk_++;
+	}
+	if (nk_ < 2) return false;
+
+	// natural cubic spline: one tridiagonal system shared by all joints
+	int n = nk_;
+	double* c = &work_[0];
+	double* dd = &work_[n];
+	for (int j=0; j<MAX_DOF; j++)
+	{
+		double* m = &knot_m_[0];
+		for (int i=1; i<n-1; i++)
+		{
+			double h0 = knot_s_[i] - knot_s_[i-1];
+			double h1 = knot_s_[i+1] - knot_s_[i];
+			double a = h0, b = 2.0 * (h0 + h1), cc = h1;
+			double r = 6.0 * ((knot_q_[(i+1)*MAX_DOF + j] - knot_q_[i*MAX_DOF + j]) / h1
+			                - (knot_q_[i*MAX_DOF + j] - knot_q_[(i-1)*MAX_DOF + j]) / h0);
+			if (i > 1)
+			{
+				b -= a * c[i-1];
+				r -= a * dd[i-1];
+			}
+			c[i] = cc / b;
+			dd[i] = r / b;
+		}
+		m[(n-1)*MAX_DOF + j] = 0.0;
+		m[j] = 0.0;
+		for (int i=n-2; i>=1; i--)
+			m[i*MAX_DOF + j] = dd[i] - c[i] * m[(i+1)*MAX_DOF + j];
+	}
+	return true;
+}
+
+void TimeParameterizer::EvalSpline(double s, double* q, double* dq, double* ddq) const
+{
+	int i = 0;
+	while (i < nk_ - 2 && s > knot_s_[i+1])
+		i++;
+
+	double h = knot_s_[i+1] - knot_s_[i];
+	double a = knot_s_[i+1] - s;
+	double b = s - knot_s_[i];
+	const double* y0 = &knot_q_[i*MAX_DOF];
+	const double* y1 = &knot_q_[(i+1)*MAX_DOF];
+	const double* m0 = &knot_m_[i*MAX_DOF];
+	const double* m1 = &knot_m_[(i+1)*MAX_DOF];
+	for (int j=0; j<MAX_DOF; j++)
+	{
+		double c0 = y0[j]/h - m0[j]*h/6.0;
+		double c1 = y1[j]/h - m1[j]*h/6.0;
+		q[j] = m0[j]*a*a*a/(6.0*h) + m1[j]*b*b*b/(6.0*h) + c0*a + c1*b;
+		dq[j] = -m0[j]*a*a/(2.0*h) + m1[j]*b*b/(2.0*h) - c0 + c1;
+		ddq[j] = (m0[j]*a + m1[j]*b) / h;
+	}
+}
+
+// Constraints of one stage written as bounds on the path acceleration u that
+// are affine in x = sdot^2: lower_k(x) <= u <= upper_l(x), 0 <= x <= xmax.
+typedef struct
+{
+	int nlo, nup;
+	double lo[MAX_DOF + 1][2];
+	double up[MAX_DOF + 1][2];
+	double xmax;
+} StageLP_t;
+
+static void BuildStage(const double* dq, const double* ddq, const double* amax, const double* vmax,
+                       double ds, double next_lo, double next_hi, StageLP_t* st)
+{
+	st->nlo = st->nup = 0;
+	st->xmax = 1e30;
+	for (int j=0; j<MAX_DOF; j++)
+	{
+		double p = dq[j], r = ddq[j], a = amax[j];
+		if (fabs(p) > TP_EPS)
+		{
+			double v = vmax[j] / p;
+			if (v * v < st->xmax) st->xmax = v * v;
+			double lo = ((p > 0) ? -a : a) / p;
+			double up = ((p > 0) ? a : -a) / p;
+			st->lo[st->nlo][0] = lo; st->lo[st->nlo][1] = -r / p; st->nlo++;
+			st->up[st->nup][0] = up; st->up[st->nup][1] = -r / p; st->nup++;
+		}
+		else if (fabs(r) > TP_EPS)
+		{
+			if (a / fabs(r) < st->xmax) st->xmax = a / fabs(r);
+		}
+	}
+	// x_next = x + 2 ds u must stay inside the next controllable set
+	st->lo[st->nlo][0] = next_lo / (2.0*ds); st->lo[st->nlo][1] = -1.0 / (2.0*ds); st->nlo++;
+	st->up[st->nup][0] = next_hi / (2.0*ds); st->up[st->nup][1] = -1.0 / (2.0*ds); st->nup++;
+}
+
+// Range of x for which some u satisfies every lower/upper pair
+static bool StageRange(const StageLP_t& st, double* xlo, double* xhi)
+{
+	double lo = 0.0, hi = st.xmax;
+	for (int k=0; k<st.nlo; k++)
+	{
+		for (int l=0; l<st.nup; l++)
+		{
+			double db = st.lo[k][1] - st.up[l][1];
+			double da = st.up[l][0] - st.lo[k][0];
+			if (db > TP_EPS) { if (da / db < hi) hi = da / db; }
+			else if (db < -TP_EPS) { if (da / db > lo) lo = da / db; }
+			else if (da < -TP_EPS) return false;
+		}
+	}
+	*xlo = lo;
+	*xhi = hi;
+	return lo <= hi + TP_EPS;
+}
+
+int TimeParameterizer::Compute(const double* wp, int num_wp, const JointLimits_t& lim, const double* qd_start,
+                               int grid, TrajKnot_t* out)
+{
+	if (grid < 1 || !BuildSpline(wp, num_wp)) return -1;
+
+	int N = grid;
+	double L = knot_s_[nk_ - 1];
+	double ds = L / N;
+	q_.resize((N + 1) * MAX_DOF);
+	dq_.resize((N + 1) * MAX_DOF);
+	ddq_.resize((N + 1) * MAX_DOF);
+	xlo_.resize(N + 1);
+	xhi_.resize(N + 1);
+	x_.resize(N + 1);
+
+	for (int i=0; i<=N; i++)
+		EvalSpline(ds * i, &q_[i*MAX_DOF], &dq_[i*MAX_DOF], &ddq_[i*MAX_DOF]);
+
+	// torque limits expressed as acceleration limits
+	double amax[MAX_DOF];
+	for (int j=0; j<MAX_DOF; j++)
+	{
+		amax[j] = lim.acc[j];
+		if (lim.inertia[j] > 0.0)
+		{
+			double a = (lim.tau[j] - lim.damping[j] * lim.vel[j]) / lim.inertia[j];
+			if (a < amax[j]) amax[j] = a;
+		}
+		if (amax[j] <= 0.0) return -1;
+	}
+
+	// backward pass: controllable sets, coming to rest at the end
+	StageLP_t st;
+	xlo_[N] = 0.0;
+	xhi_[N] = 0.0;
+	for (int i=N-1; i>=0; i--)
+	{
+		BuildStage(&dq_[i*MAX_DOF], &ddq_[i*MAX_DOF], amax, lim.vel, ds, xlo_[i+1], xhi_[i+1], &st);
+		if (!StageRange(st, &xlo_[i], &xhi_[i])) return -1;
+	}
+
+	// forward pass: greedy maximum path acceleration
+	double x0 = 0.0;
+	if (qd_start)
+	{
+		// sdot = (qd . q') / |q'|^2, only forward motion along the path counts
+		double num = 0.0, den = 0.0;
+		for (int j=0; j<MAX_DOF; j++)
+		{
+			num += qd_start[j] * dq_[j];
+			den += dq_[j] * dq_[j];
+		}
+		double sd = (den > TP_EPS && num > 0.0) ? num / den : 0.0;
+		x0 = sd * sd;
+	}
+	x_[0] = (x0 < xlo_[0]) ? xlo_[0] : (x0 > xhi_[0]) ? xhi_[0] : x0;
+	for (int i=0; i<N; i++)
+	{
+		BuildStage(&dq_[i*MAX_DOF], &ddq_[i*MAX_DOF], amax, lim.vel, ds, xlo_[i+1], xhi_[i+1], &st);
+		double u = 1e30;
+		for (int l=0; l<st.nup; l++)
+		{
+			double v = st.up[l][0] + st.up[l][1] * x_[i];
+			if (v < u) u = v;
+		}
+		double x = x_[i] + 2.0 * ds * u;
+		if (x > xhi_[i+1]) x = xhi_[i+1];
+		if (x < xlo_[i+1]) x = xlo_[i+1];
+		x_[i+1] = (x > 0.0) ? x : 0.0;
+	}
+
+	double t = 0.0;
+	for (int i=0; i<=N; i++)
+	{
+		if (i > 0)
+		{
+			double v = sqrt(x_[i-1]) + sqrt(x_[i]);
+			if (v < TP_EPS) return -1;
+			t += 2.0 * ds / v;
+		}
+		out[i].t = t;
+		memcpy(out[i].q, &q_[i*MAX_DOF], MAX_DOF * sizeof(double));
+	}
+	return N + 1;
+}
@@ -0,0 +1,112 @@
+#include "TrajectoryPlayer.h"
+#include <string.h>
+#include <unistd.h>
+
+TrajectoryPlayer::TrajectoryPlayer(int max_knots)
+	: max_knots_(max_knots), pending_(-1), active_(0), stop_(false), playing_(false),
+	  t_(0.0), seg_(0), vel_seq_(0)
+{
+	buf_[0] = new TrajKnot_t[max_knots];
+	buf_[1] = new TrajKnot_t[max_knots];
+	count_[0] = count_[1] = 0;
+	memset(vel_, 0, sizeof(vel_));
+}
+
+TrajectoryPlayer::~TrajectoryPlayer()
+{
+	delete[] buf_[0];
+	delete[] buf_[1];
+}
+
+bool TrajectoryPlayer::Load(const TrajKnot_t* knots, int n)
+{
+	if (n < 1 || n > max_knots_) return false;
+
+	// wait (a few cycles at most) for the previous hand-off to be consumed
+	for (int i=0; pending_.load(std::memory_order_acquire) >= 0; i++)
+	{
+		if (i >= 20) return false;
+		usleep(1000);
+	}
+
+	// the buffer not being played is ours until we publish it
+	int b = 1 - active_.load(std::memory_order_acquire);
+	memcpy(buf_[b], knots, n * sizeof(TrajKnot_t));
+	count_[b] = n;
+	stop_.store(false, std::memory_order_relaxed);
+	pending_.store(b, std::memory_order_release);
+	return true;
+}
+
+void TrajectoryPlayer::Stop()
+{
+	stop_.store(true, std::memory_order_release);
+}
+
+bool TrajectoryPlayer::Update(double dt, double* q_des)
+{
+	int b = pending_.load(std::memory_order_acquire);
+	if (b >= 0)
+	{
+		active_.store(b, std::memory_order_release);
+		pending_.store(-1, std::memory_order_release);
+		playing_.store(true, std::memory_order_relaxed);
+		t_ = 0.0;
+		seg_ = 0;
+	}
+	if (stop_.exchange(false, std::memory_order_acq_rel))
+		playing_.store(false, std::memory_order_relaxed);
+
+	double qd[MAX_DOF];
+	memset(qd, 0, sizeof(qd));
+
+	bool playing = playing_.load(std::memory_order_relaxed);
+	if (playing)
+	{
+		const TrajKnot_t* k = buf_[active_.load(std::memory_order_relaxed)];
+		int n = count_[active_.load(std::memory_order_relaxed)];
+
+		t_ += dt;
+		while (seg_ < n - 1 && k[seg_ + 1].t <= t_)
+			seg_++;
+
+		if (seg_ >= n - 1)
+		{
+			memcpy(q_des, k[n - 1].q, sizeof(k[n - 1].q));
+			playing = false;
+			playing_.store(false, std::memory_order_relaxed);
+		}
+		else
+		{
+			const TrajKnot_t& a = k[seg_];
+			const TrajKnot_t& c = k[seg_ + 1];
+			double h = c.t - a.t;
+			double r = (h > 0.0) ? (t_ - a.t) / h : 1.0;
+			for (int i=0; i<MAX_DOF; i++)
+			{
+				q_des[i] = a.q[i] + r * (c.q[i] - a.q[i]);
+				qd[i] = (h > 0.0) ? (c.q[i] - a.q[i]) / h : 0.0;
+			}
+		}
+	}
+
+	vel_seq_.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(vel_, qd, sizeof(vel_));
+	std::atomic_thread_fence(std::memory_order_release);
+	vel_seq_.fetch_add(1, std::memory_order_relaxed);
+
+	return playing;
+}
+
+void TrajectoryPlayer::GetVelocity(double qd[MAX_DOF]) const
+{
+	unsigned s0, s1;
+	do
+	{
+		s0 = vel_seq_.load(std::memory_order_acquire);
+		memcpy(qd, vel_, sizeof(vel_));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s1 = vel_seq_.load(std::memory_order_relaxed);
+	} while ((s0 & 1) || s0 != s1);
+}
@@ -0,0 +1,287 @@
+#include "WorkerPool.h"
+#include "RtClock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+// worker the calling thread belongs to, so jobs submitted from jobs stay local
+static thread_local Worker_t* tlsWorker = NULL;
+
+void* ArenaAlloc(WorkArena_t* arena, size_t bytes)
+{
+	size_t at = (arena->used + 15) & ~(size_t)15;
+	if (at + bytes > arena->size) return NULL;
+	arena->used = at + bytes;
+	if (arena->used > arena->high) arena->high = arena->used;
+	return arena->base + at;
+}
+
+// "2,3,5-7"
+static int ParseCpuList(const char* list, cpu_set_t* set)
+{
+	CPU_ZERO(set);
+	int n = 0;
+	const char* p = list;
+	while (*p)
+	{
+		char* end;
+		long a = strtol(p, &end, 10);
+		if (end == p) return -1;
+		long b = a;
+		p = end;
+		if (*p == '-')
+		{
+			b = strtol(p + 1, &end, 10);
+			if (end == p + 1) return -1;
+			p = end;
+		}
+		for (long c=a; c<=b && c<CPU_SETSIZE; c++, n++)
+			CPU_SET(c, set);
+		if (*p == ',') p++;
+		else if (*p) return -1;
+	}
+	return n;
+}
+
+WorkerPool::WorkerPool()
+	: num_workers_(0), num_cpus_(0), next_(0), run_(false),
+	  queued_(0), max_queued_(0), submitted_(0), rejected_(0),
+	  wait_sum_ns_(0), wait_max_ns_(0), run_sum_ns_(0), run_max_ns_(0)
+{
+	CPU_ZERO(&cpus_);
+}
+
+WorkerPool::~WorkerPool()
+{
+	Stop();
+}
+
+bool WorkerPool::Start(int workers, const char* cpu_list)
+{
+	if (run_.load() || workers < 1 || workers > POOL_MAX_WORKERS) return false;
+	num_cpus_ = 0;
+	if (cpu_list && (num_cpus_ = ParseCpuList(cpu_list, &cpus_)) <= 0)
+	{
+		printf("ERROR invalid worker CPU list '%s'\n", cpu_list);
+		return false;
+	}
+
+	num_workers_ = workers;
+	run_.store(true);
+	for (int i=0; i<workers; i++)
+	{
+		Worker_t& w = workers_[i];
+		w.head = w.count = 0;
+		w.index = i;
+		w.pool = this;
+		w.executed.store(0);
+		w.stolen.store(0);
+		w.arena_high.store(0);
+		// touch the arena now, not inside the first job
+		w.arena.base = (char*)malloc(POOL_ARENA_BYTES);
+		w.arena.size = w.arena.base ? POOL_ARENA_BYTES : 0;
+		w.arena.used = w.arena.high = 0;
+		if (w.arena.base) memset(w.arena.base, 0, POOL_ARENA_BYTES);
+	}
+	for (int i=0; i<workers; i++)
+	{
+		if (pthread_create(&workers_[i].thread, NULL, ThreadProc, &workers_[i]) != 0)
+		{
+			// the queues of missing workers are still drained by stealing
+			workers_[i].thread = 0;
+			printf("ERROR starting worker %d\n", i);
+		}
+		else if (num_cpus_ && pthread_setaffinity_np(workers_[i].thread, sizeof(cpus_), &cpus_) != 0)
+			printf("WARNING worker %d: cannot set CPU affinity\n", i);
+	}
+	return true;
+}
+
+void WorkerPool::Stop()
+{
+	if (!run_.exchange(false)) return;
+	{
+		std::lock_guard<std::mutex> g(idle_lock_);
+		idle_cv_.notify_all();
+	}
+	for (int i=0; i<num_workers_; i++)
+		if (workers_[i].thread) pthread_join(workers_[i].thread, NULL);
+	for (int i=0; i<num_workers_; i++)
+		free(workers_[i].arena.base);
+	num_workers_ = 0;
+}
+
+void WorkerPool::AtomicMax(std::atomic<int64_t>& m, int64_t v)
+{
+	int64_t cur = m.load(std::memory_order_relaxed);
+	while (v > cur && !m.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+		;
+}
+
+bool WorkerPool::Submit(WorkFn fn, void* arg)
+{
+	if (!run_.load(std::memory_order_acquire) || !fn) return false;
+
+	WorkItem_t item;
+	item.fn = fn;
+	item.arg = arg;
+	item.enq_ns = rt_now_ns();
+
+	// own queue first when called from a job, otherwise round-robin; try every queue once
+	int start = (tlsWorker && tlsWorker->pool == this) ? tlsWorker->index
+	          : (int)(next_.fetch_add(1, std::memory_order_relaxed) % num_workers_);
+	for (int k=0; k<num_workers_; k++)
+	{
+		Worker_t& w = workers_[(start + k) % num_workers_];
+		std::lock_guard<std::mutex> g(w.lock);
+		if (w.count == POOL_QUEUE_CAPACITY) continue;
+		w.q[(w.head + w.count) % POOL_QUEUE_CAPACITY] = item;
+		w.count++;
+
+		submitted_.fetch_add(1, std::memory_order_relaxed);
+		int depth = queued_.fetch_add(1, std::memory_order_acq_rel) + 1;
+		int cur = max_queued_.load(std::memory_order_relaxed);
+		while (depth > cur && !max_queued_.compare_exchange_weak(cur, depth, std::memory_order_relaxed))
+			;
+		std::lock_guard<std::mutex> gi(idle_lock_);
+		idle_cv_.notify_one();
+		return true;
+	}
+	rejected_.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+typedef struct
+{
+	WorkFn fn;
+	void* arg;
+	std::mutex lock;
+	std::condition_variable cv;
+	bool done;
+} PoolCall_t;
+
+static void CallJob(void* arg, WorkArena_t* arena)
+{
+	PoolCall_t* c = (PoolCall_t*)arg;
+	c->fn(c->arg, arena);
+	std::lock_guard<std::mutex> g(c->lock);
+	c->done = true;
+	c->cv.notify_one();
+}
+
+void WorkerPool::Call(WorkFn fn, void* arg)
+{
+	// from a job: run it here, after the caller's allocations in the same arena
+	if (tlsWorker && tlsWorker->pool == this)
+	{
+		fn(arg, &tlsWorker->arena);
+		return;
+	}
+	PoolCall_t c;
+	c.fn = fn;
+	c.arg = arg;
+	c.done = false;
+	if (!Submit(CallJob, &c))
+	{
+		WorkArena_t none = { NULL, 0, 0, 0 };
+		fn(arg, &none);
+		return;
+	}
+	std::unique_lock<std::mutex> g(c.lock);
+	c.cv.wait(g, [&c] { return c.done; });
+}
+
+// newest job from our own queue, else the oldest one of another worker
+bool WorkerPool::Take(Worker_t* w, WorkItem_t* item)
+{
+	{
+		std::lock_guard<std::mutex> g(w->lock);
+		if (w->count > 0)
+		{
+			w->count--;
+			*item = w->q[(w->head + w->count) % POOL_QUEUE_CAPACITY];
+			return true;
+		}
+	}
+	for (int k=1; k<num_workers_; k++)
+	{
+		Worker_t& v = workers_[(w->index + k) % num_workers_];
+		std::lock_guard<std::mutex> g(v.lock);
+		if (v.count == 0) continue;
+		*item = v.q[v.head];
+		v.head = (v.head + 1) % POOL_QUEUE_CAPACITY;
+		v.count--;
+		w->stolen.store(w->stolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void* WorkerPool::ThreadProc(void* arg)
+{
+	Worker_t* w = (Worker_t*)arg;
+	tlsWorker = w;
+	w->pool->Run(w);
+	return NULL;
+}
+
+void WorkerPool::Run(Worker_t* w)
+{
+	WorkItem_t item;
+	for (;;)
+	{
+		if (Take(w, &item))
+		{
+			queued_.fetch_sub(1, std::memory_order_acq_rel);
+			int64_t t0 = rt_now_ns();
+			item.fn(item.arg, &w->arena);
+			int64_t t1 = rt_now_ns();
+			w->arena.used = 0;
+			w->arena_high.store(w->arena.high, std::memory_order_relaxed);
+
+			w->executed.store(w->executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			wait_sum_ns_.fetch_add(t0 - item.enq_ns, std::memory_order_relaxed);
+			AtomicMax(wait_max_ns_, t0 - item.enq_ns);
+			run_sum_ns_.fetch_add(t1 - t0, std::memory_order_relaxed);
+			AtomicMax(run_max_ns_, t1 - t0);
+			continue;
+		}
+		// queues drained: stop, or sleep until a job arrives
+		if (!run_.load(std::memory_order_acquire)) break;
+		std::unique_lock<std::mutex> g(idle_lock_);
+		idle_cv_.wait_for(g, std::chrono::milliseconds(100), [this] {
+			return queued_.load(std::memory_order_acquire) > 0 || !run_.load(std::memory_order_acquire);
+		});
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// command thread
+void WorkerPool::Report(std::string* out) const
+{
+	// workers cpus queued max_queued submitted rejected wait_mean_us wait_max_us run_mean_us run_max_us
+	// then per worker: <index> <executed> <stolen> <arena_high_bytes>
+	char buf[256];
+	uint64_t done = 0;
+	for (int i=0; i<num_workers_; i++)
+		done += workers_[i].executed.load(std::memory_order_relaxed);
+	snprintf(buf, sizeof(buf), "%d %d %d %d %llu %llu %.2f %.2f %.2f %.2f", num_workers_, num_cpus_,
+	         queued_.load(std::memory_order_relaxed), max_queued_.load(std::memory_order_relaxed),
+	         (unsigned long long)submitted_.load(std::memory_order_relaxed),
+	         (unsigned long long)rejected_.load(std::memory_order_relaxed),
+	         done ? wait_sum_ns_.load(std::memory_order_relaxed) * 1e-3 / done : 0.0,
+	         wait_max_ns_.load(std::memory_order_relaxed) * 1e-3,
+	         done ? run_sum_ns_.load(std::memory_order_relaxed) * 1e-3 / done : 0.0,
+	         run_max_ns_.load(std::memory_order_relaxed) * 1e-3);
+	*out = buf;
+	for (int i=0; i<num_workers_; i++)
+	{
+		const Worker_t& w = workers_[i];
+		snprintf(buf, sizeof(buf), "\n%d %llu %llu %zu", i,
+		         (unsigned long long)w.executed.load(std::memory_order_relaxed),
+		         (unsigned long long)w.stolen.load(std::memory_order_relaxed),
+		         w.arena_high.load(std::memory_order_relaxed));
+		*out += buf;
+	}
+}
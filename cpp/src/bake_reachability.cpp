@@ -0,0 +1,40 @@
+//
+// Offline build step for the fingertip reachability map.
+//
+// usage: bake_reachability <out.bin> [voxel_mm=5] [samples_per_joint=32] [left]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ReachabilityMap.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <out.bin> [voxel_mm=5] [samples_per_joint=32] [left]\n", argv[0]);
+        return 1;
+    }
+
+    double voxel_mm = (argc > 2) ? atof(argv[2]) : 5.0;
+    int samples = (argc > 3) ? atoi(argv[3]) : 32;
+    bool right_hand = !(argc > 4 && strcmp(argv[4], "left") == 0);
+
+    printf("baking %s hand map: voxel %.2f mm, %d samples per joint\n",
+           right_hand ? "right" : "left", voxel_mm, samples);
+    if (ReachabilityMap::Bake(argv[1], right_hand, voxel_mm * 1e-3, samples) != 0)
+    {
+        printf("ERROR writing %s\n", argv[1]);
+        return 1;
+    }
+
+    // sanity check: the file must load back
+    ReachabilityMap map;
+    if (!map.Load(argv[1], right_hand))
+    {
+        printf("ERROR reloading %s\n", argv[1]);
+        return 1;
+    }
+    printf("wrote %s\n", argv[1]);
+    return 0;
+}
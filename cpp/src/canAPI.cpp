@@ -22,7 +22,9 @@ typedef unsigned short WORD;
 typedef char BYTE;
 typedef void* LPSTR;
 
+#ifndef ALLEGRO_SIM_CAN
 #include <PCANBasic.h>
+#endif
 
 #include "canDef.h"
 #include "canAPI.h"
@@ -62,6 +64,7 @@ typedef struct __attribute__((packed))
 /*       Global file-scope variables       */
 /*=========================================*/
 unsigned char CAN_ID = 0;
+#ifndef ALLEGRO_SIM_CAN
 TPCANHandle canDev[MAX_BUS] = {
     PCAN_NONEBUS, // Undefined/default value for a PCAN bus
 
@@ -98,11 +101,19 @@ TPCANHandle canDev[MAX_BUS] = {
     PCAN_PCCBUS2, // PCAN-PC Card interface, channel 2
 };
 
+#endif
+
 /*==========================================*/
 /*       Private functions prototypes       */
 /*==========================================*/
+int initCAN(int bus);
+int freeCAN(int bus);
 int canReadMsg(int bus, int *id, int *len, unsigned char *data, int blocking);
 int canSendMsg(int bus, int id, char len, unsigned char *data, int blocking);
+int canSentRTR(int bus, int id, int blocking);
+
+// PCAN transport; the simulated bus (canSim.cpp) provides these instead
+#ifndef ALLEGRO_SIM_CAN
 
 /*========================================*/
 /*       Public functions (CAN API)       */
@@ -223,6 +234,7 @@ int canSentRTR(int bus, int id, int blocking){
 
     return 0; //PCAN_ERROR_OK;
 }
+#endif // ALLEGRO_SIM_CAN
 
 /*========================================*/
 /*       CAN API                          */
@@ -256,18 +268,10 @@ int command_can_close(int ch)
 {
     assert(ch >= 0 && ch < MAX_BUS);
 
-    TPCANStatus Status = PCAN_ERROR_OK;
-    char strMsg[256];
     printf("<< CAN: Close...\n");
 
-    Status = CAN_Uninitialize(canDev[ch]);
-    if (Status != PCAN_ERROR_OK)
-    {
-        CAN_GetErrorText(Status, 0, strMsg);
-        printf("freeCAN(): CAN_Uninitialize() failed with error %u\n", Status);
-        printf("%s\n", strMsg);
-        return Status;
-    }
+    int ret = freeCAN(ch);
+    if (ret != 0) return ret;
 
     printf("\t- Done\n");
     return 0; //PCAN_ERROR_OK;
@@ -0,0 +1,806 @@
+/*======================*/
+/*       Includes       */
+/*======================*/
+//system headers
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <random>
+#include <string>
+
+#include "canDef.h"
+#include "canAPI.h"
+#include "canSim.h"
+#include "RtClock.h"
+#include "AllegroKinematics.h"
+#include "rDeviceAllegroHandCANDef.h"
+
+CANAPI_BEGIN
+
+/*=====================*/
+/*       Defines       */
+/*=====================*/
+//status codes, same values as PCANBasic
+#define SIM_OK                  0x00
+#define SIM_ERROR_BUSHEAVY      0x08
+#define SIM_ERROR_BUSOFF        0x10
+#define SIM_ERROR_QRCVEMPTY     0x20
+#define SIM_ERROR_QXMTFULL      0x80
+
+//constants
+#define SIM_RX_QUEUE_SIZE       256
+#define SIM_RING_SIZE           256         // host <-> simulator rings, power of two, >= TX_QUEUE_SIZE
+#define SIM_FRAME_NS            130000      // 8-byte standard frame at 1 Mbit/s incl. stuffing
+#define SIM_PLANT_DT_NS         500000      // plant integration step
+#define SIM_JOINT_INERTIA       0.01
+#define SIM_JOINT_DAMPING       0.05
+#define SIM_JOINT_COULOMB       0.03        // kinetic friction, torque units
+#define SIM_JOINT_STICTION      0.04        // breakaway torque
+#define SIM_PWM_PER_TORQUE      1200.0
+#define SIM_THERMAL_TAU_S       60.0        // motor-to-ambient time constant
+#define SIM_THERMAL_RISE_C      40.0        // rise at full continuous torque
+#define SIM_AMBIENT_C           32.0
+#define SIM_FAULT_MAX_S         1e6         // latest finite fault window end
+#define SIM_FAULT_MAX_DELAY_US  1e6         // delay and jitter; more would hold up the RX queue
+#define SIM_FAULT_MAX_TXSLOW    1000.0
+#define SIM_RAD_PER_COUNT       ((333.3/65536.0)*(3.141592/180.0))
+
+enum
+{
+    FAULT_DROP = 0,
+    FAULT_DELAY,
+    FAULT_DUP,
+    FAULT_REORDER,
+    FAULT_ERRFRAME,
+    FAULT_BUSOFF,
+    FAULT_TXSLOW,
+    FAULT_ENCOFFSET,
+    FAULT_KINDS
+};
+
+enum
+{
+    DIST_UNIFORM = 0,
+    DIST_NORMAL,
+    DIST_EXP
+};
+
+//structures
+typedef struct
+{
+    int64_t t0_ns;
+    int64_t t1_ns;
+    int kind;
+    int id;                 // -1: every ID (encoffset: joint)
+    double p;               // probability, or factor for txslow
+    double mean_us;
+    double jitter_us;
+    int dist;
+    double offset;          // encoffset: added to the reported angle (rad)
+    bool flip;              // encoffset: reversed encoder direction
+    char text[96];
+} SimFault_t;
+
+typedef struct
+{
+    int64_t t_ns;           // RX: delivery time, TX: end of transmission
+    int id;
+    int len;
+    bool rtr;
+    bool error;
+    unsigned char data[8];
+} SimFrame_t;
+
+// bounded lock-free frame ring (per-slot sequence numbers): any number of
+// producers, one consumer. A slot's seq is its position once it can be
+// written and position + 1 once the frame in it can be read.
+typedef struct
+{
+    std::atomic<uint64_t> seq[SIM_RING_SIZE];
+    SimFrame_t frame[SIM_RING_SIZE];
+    std::atomic<uint64_t> head;     // next position to write
+    std::atomic<uint64_t> tail;     // next position to read
+} SimRing_t;
+
+/*=========================================*/
+/*       Global file-scope variables       */
+/*=========================================*/
+static const char* kFaultNames[FAULT_KINDS] = { "drop", "delay", "dup", "reorder", "errframe", "busoff", "txslow", "encoffset" };
+
+// The simulator thread owns the bus and the hand. The host side (the control
+// thread's reads and writes) only touches the two rings and a few atomics, so
+// it never waits for the simulator, as with the real driver.
+static pthread_t simThread;
+static std::atomic<bool> simRun(false);
+static std::mt19937 simRng(1);
+
+// fault rules: the command side's copy, handed to the simulator thread through
+// two buffers (the simulator uses simFaultBuf[simFaultActive])
+static pthread_mutex_t simCmdLock = PTHREAD_MUTEX_INITIALIZER;   // fault API callers only
+static SimFault_t simCmdFaults[SIM_MAX_FAULTS];
+static int simCmdNumFaults = 0;
+static SimFault_t simFaultBuf[2][SIM_MAX_FAULTS];
+static int simFaultCount[2];
+static std::atomic<int> simFaultPending(-1);
+static std::atomic<int> simFaultActive(0);
+static const SimFault_t* simFaults = simFaultBuf[0];
+static int simNumFaults = 0;
+
+static std::atomic<unsigned long long> simInjected[FAULT_KINDS];
+static std::atomic<unsigned long long> simRxFrames(0);
+static std::atomic<unsigned long long> simTxFrames(0);
+static std::atomic<unsigned long long> simRxOverflow(0);
+
+// host <-> simulator
+static SimRing_t simRxRing;             // frames due within the next plant step
+static SimRing_t simTxRing;             // frames handed to the bus
+static std::atomic<int> simTxInFlight(0);   // queued or on the bus, at most TX_QUEUE_SIZE
+static std::atomic<bool> simBusOff(false);
+
+// bus queues of the simulator thread; RX is kept sorted by delivery time
+static SimFrame_t simRx[SIM_RX_QUEUE_SIZE];
+static int simNumRx = 0;
+static SimFrame_t simTx[TX_QUEUE_SIZE];
+static int simNumTx = 0;
+static int64_t simBusFreeNs = 0;
+
+// simulated hand
+static double simQ[MAX_DOF];
+static double simQd[MAX_DOF];
+static double simTau[MAX_DOF];
+static double simTemp[4];           // per finger, as reported by the hand
+static bool simServoOn = false;
+static int64_t simPosPeriodNs = 0;
+static int64_t simTempPeriodNs = 0;
+static int64_t simNextPosNs = 0;
+static int64_t simNextTempNs = 0;
+
+/*==========================================*/
+/*       Fault rules                        */
+/*==========================================*/
+static inline void Count(std::atomic<unsigned long long>& c)
+{
+    c.fetch_add(1, std::memory_order_relaxed);
+}
+
+static bool FaultActive(const SimFault_t& f, int64_t now, int id)
+{
+    return now >= f.t0_ns && now < f.t1_ns && (f.id < 0 || f.id == id);
+}
+
+static bool Chance(double p)
+{
+    return p > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(simRng) < p;
+}
+
+static bool AnyFault(int kind, int64_t now, int id, const SimFault_t** match)
+{
+    for (int i=0; i<simNumFaults; i++)
+    {
+        if (simFaults[i].kind == kind && FaultActive(simFaults[i], now, id))
+        {
+            if (match) *match = &simFaults[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static double DelaySample(const SimFault_t& f)
+{
+    double d = f.mean_us;
+    switch (f.dist)
+    {
+    case DIST_NORMAL: d += std::normal_distribution<double>(0.0, f.jitter_us)(simRng); break;
+    case DIST_EXP:    d += (f.jitter_us > 0.0) ? std::exponential_distribution<double>(1.0 / f.jitter_us)(simRng) : 0.0; break;
+    default:          d += std::uniform_real_distribution<double>(-f.jitter_us, f.jitter_us)(simRng); break;
+    }
+    return d > 0.0 ? d : 0.0;
+}
+
+// a numeric argument, nothing else, in [lo, hi]; NaN fails too
+static bool ParseArg(const char* s, double lo, double hi, double* v)
+{
+    char* end;
+    *v = strtod(s, &end);
+    return end != s && *end == 0 && *v >= lo && *v <= hi;
+}
+
+static int ParseFault(const char* line, int64_t base_ns, SimFault_t* f, std::string* err)
+{
+    char kind[16] = {0}, a1[32] = {0}, a2[32] = {0}, a3[32] = {0};
+    double t0, t1;
+    int n = sscanf(line, "%lf %lf %15s %31s %31s %31s", &t0, &t1, kind, a1, a2, a3);
+    if (n < 3)
+    {
+        *err = "expected: <t0> <t1> <fault> [args]";
+        return -1;
+    }
+
+    if (!(t0 >= 0.0 && t0 <= SIM_FAULT_MAX_S && t1 >= t0 && (t1 <= SIM_FAULT_MAX_S || isinf(t1))))
+    {
+        *err = "need 0 <= t0 <= t1 <= 1e6 s (t1 may be inf)";
+        return -1;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->t0_ns = base_ns + (int64_t)(t0 * 1e9);
+    f->t1_ns = isinf(t1) ? INT64_MAX : base_ns + (int64_t)(t1 * 1e9);
+    f->id = -1;
+    f->kind = -1;
+    for (int k=0; k<FAULT_KINDS; k++)
+        if (!strcmp(kind, kFaultNames[k])) f->kind = k;
+
+    int need = 0;
+    bool ok = true;
+    switch (f->kind)
+    {
+    case FAULT_DROP:
+        need = 2;
+        f->id = strcmp(a1, "all") ? (int)strtol(a1, NULL, 0) : -1;
+        ok = ParseArg(a2, 0.0, 1.0, &f->p);
+        break;
+    case FAULT_DELAY:
+        need = 2;
+        ok = ParseArg(a1, 0.0, SIM_FAULT_MAX_DELAY_US, &f->mean_us)
+          && ParseArg(a2, 0.0, SIM_FAULT_MAX_DELAY_US, &f->jitter_us);
+        f->dist = !strcmp(a3, "normal") ? DIST_NORMAL : !strcmp(a3, "exp") ? DIST_EXP : DIST_UNIFORM;
+        break;
+    case FAULT_DUP:
+    case FAULT_REORDER:
+    case FAULT_ERRFRAME:
+        need = 1;
+        ok = ParseArg(a1, 0.0, 1.0, &f->p);
+        break;
+    case FAULT_BUSOFF:
+        break;
+    case FAULT_TXSLOW:
+        need = 1;
+        ok = ParseArg(a1, -HUGE_VAL, SIM_FAULT_MAX_TXSLOW, &f->p);
+        if (f->p < 1.0) f->p = 1.0;
+        break;
+    case FAULT_ENCOFFSET:
+        need = 2;
+        f->id = strcmp(a1, "all") ? atoi(a1) : -1;
+        ok = ParseArg(a2, -2.0 * M_PI, 2.0 * M_PI, &f->offset);
+        f->flip = !strcmp(a3, "flip");
+        break;
+    default:
+        *err = std::string("unknown fault '") + kind + "'";
+        return -1;
+    }
+    if (n < 3 + need)
+    {
+        *err = std::string("missing arguments for '") + kind + "'";
+        return -1;
+    }
+    if (!ok)
+    {
+        *err = std::string("argument out of range for '") + kind + "'";
+        return -1;
+    }
+    snprintf(f->text, sizeof(f->text), "%s", line);
+    char* nl = strchr(f->text, '\n');
+    if (nl) *nl = 0;
+    return 0;
+}
+
+/*==========================================*/
+/*       Bus                                */
+/*==========================================*/
+static void RxInsert(const SimFrame_t& fr)
+{
+    if (simNumRx >= SIM_RX_QUEUE_SIZE)
+    {
+        Count(simRxOverflow);
+        return;
+    }
+    int i = simNumRx++;
+    while (i > 0 && simRx[i-1].t_ns > fr.t_ns)
+    {
+        simRx[i] = simRx[i-1];
+        i--;
+    }
+    simRx[i] = fr;
+}
+
+// hand -> host, through the active faults
+static void Emit(int64_t now, int id, const unsigned char* data, int len)
+{
+    const SimFault_t* f = NULL;
+    if (AnyFault(FAULT_BUSOFF, now, id, NULL))
+    {
+        Count(simInjected[FAULT_BUSOFF]);
+        return;
+    }
+    for (int i=0; i<simNumFaults; i++)
+    {
+        if (simFaults[i].kind == FAULT_DROP && FaultActive(simFaults[i], now, id) && Chance(simFaults[i].p))
+        {
+            Count(simInjected[FAULT_DROP]);
+            return;
+        }
+    }
+
+    SimFrame_t fr;
+    memset(&fr, 0, sizeof(fr));
+    fr.id = id;
+    fr.len = len;
+    memcpy(fr.data, data, len);
+    fr.t_ns = now;
+    if (AnyFault(FAULT_DELAY, now, id, &f))
+    {
+        fr.t_ns += (int64_t)(DelaySample(*f) * 1e3);
+        Count(simInjected[FAULT_DELAY]);
+    }
+    if (AnyFault(FAULT_REORDER, now, id, &f) && Chance(f->p))
+    {
+        fr.t_ns += SIM_FRAME_NS + 1;        // the next frame overtakes this one
+        Count(simInjected[FAULT_REORDER]);
+    }
+    if (AnyFault(FAULT_ERRFRAME, now, id, &f) && Chance(f->p))
+    {
+        SimFrame_t ef = fr;
+        ef.error = true;
+        ef.t_ns -= 1;
+        RxInsert(ef);
+        Count(simInjected[FAULT_ERRFRAME]);
+    }
+    RxInsert(fr);
+    Count(simRxFrames);
+    if (AnyFault(FAULT_DUP, now, id, &f) && Chance(f->p))
+    {
+        fr.t_ns += SIM_FRAME_NS;
+        RxInsert(fr);
+        Count(simInjected[FAULT_DUP]);
+    }
+}
+
+static void EmitFingerPoses(int64_t now)
+{
+    for (int f=0; f<4; f++)
+    {
+        short enc[4];
+        for (int j=0; j<4; j++)
+        {
+            // a unit whose encoder zero or direction is off
+            double q = simQ[4*f + j];
+            const SimFault_t* m = NULL;
+            if (AnyFault(FAULT_ENCOFFSET, now, 4*f + j, &m))
+            {
+                q = (m->flip ? -q : q) + m->offset;
+                Count(simInjected[FAULT_ENCOFFSET]);
+            }
+            enc[j] = (short)lround(q / SIM_RAD_PER_COUNT);
+        }
+        Emit(now + f * SIM_FRAME_NS, ID_RTR_FINGER_POSE + f, (unsigned char*)enc, 8);   // back to back on the bus
+    }
+}
+
+static void EmitTemperatures(int64_t now)
+{
+    for (int s=0; s<4; s++)
+    {
+        int celsius = (int)lround(simTemp[s]);
+        Emit(now, ID_RTR_TEMPERATURE + s, (unsigned char*)&celsius, 4);
+    }
+}
+
+// a frame from the host reached the hand
+static void Apply(int64_t now, const SimFrame_t& fr)
+{
+    if (fr.id >= ID_CMD_SET_TORQUE_1 && fr.id <= ID_CMD_SET_TORQUE_4)
+    {
+        const short* pwm = (const short*)fr.data;
+        int f = fr.id - ID_CMD_SET_TORQUE_1;
+        for (int j=0; j<4; j++)
+            simTau[4*f + j] = pwm[j] / SIM_PWM_PER_TORQUE;
+    }
+    else if (fr.id == ID_CMD_SET_PERIOD)
+    {
+        const unsigned short* period = (const unsigned short*)fr.data;
+        simPosPeriodNs = (int64_t)period[0] * 1000000;
+        simTempPeriodNs = (int64_t)period[2] * 1000000;
+        simNextPosNs = now + simPosPeriodNs;
+        simNextTempNs = now + simTempPeriodNs;
+    }
+    else if (fr.id == ID_CMD_SYSTEM_ON || fr.id == ID_CMD_SYSTEM_OFF)
+    {
+        simServoOn = (fr.id == ID_CMD_SYSTEM_ON);
+        memset(simTau, 0, sizeof(simTau));
+    }
+    else if (fr.rtr && fr.id == ID_RTR_HAND_INFO)
+    {
+        unsigned char info[8] = { 0x00, 0x04, 0x00, 0x04, 0, 35, (unsigned char)(simServoOn ? 0x01 : 0x00), 0 };
+        Emit(now, ID_RTR_HAND_INFO, info, 8);
+    }
+    else if (fr.rtr && fr.id == ID_RTR_SERIAL)
+    {
+        Emit(now, ID_RTR_SERIAL, (const unsigned char*)"SIMHAND0", 8);
+    }
+    else if (fr.rtr && fr.id >= ID_RTR_FINGER_POSE_1 && fr.id <= ID_RTR_FINGER_POSE_4)
+    {
+        EmitFingerPoses(now);
+    }
+}
+
+static void StepPlant(double dt)
+{
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        double tau = simServoOn ? simTau[i] : 0.0;
+
+        // stick-slip: a joint at rest stays there below the breakaway torque,
+        // a moving one loses Coulomb friction that can stop it but not reverse it
+        if (simQd[i] == 0.0 && fabs(tau) <= SIM_JOINT_STICTION)
+            continue;
+        double dir = (simQd[i] != 0.0) ? (simQd[i] > 0.0 ? 1.0 : -1.0) : (tau > 0.0 ? 1.0 : -1.0);
+        double qd = simQd[i] + dt * (tau - SIM_JOINT_DAMPING * simQd[i] - SIM_JOINT_COULOMB * dir) / SIM_JOINT_INERTIA;
+        if (simQd[i] != 0.0 && qd * simQd[i] < 0.0) qd = 0.0;
+        simQd[i] = qd;
+        simQ[i] += dt * simQd[i];
+        if (simQ[i] < kJointLimitLower[i]) { simQ[i] = kJointLimitLower[i]; simQd[i] = 0.0; }
+        if (simQ[i] > kJointLimitUpper[i]) { simQ[i] = kJointLimitUpper[i]; simQd[i] = 0.0; }
+    }
+    for (int f=0; f<4; f++)
+    {
+        double heat = 0.0;
+        for (int j=0; j<4; j++)
+        {
+            double tau = simServoOn ? simTau[4*f + j] : 0.0;
+            heat += 0.25 * tau * tau;
+        }
+        simTemp[f] += dt * (SIM_THERMAL_RISE_C * heat - (simTemp[f] - SIM_AMBIENT_C)) / SIM_THERMAL_TAU_S;
+    }
+}
+
+/*==========================================*/
+/*       Host <-> simulator rings           */
+/*==========================================*/
+static void RingInit(SimRing_t* r)
+{
+    for (int i=0; i<SIM_RING_SIZE; i++)
+        r->seq[i].store(i, std::memory_order_relaxed);
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+}
+
+static bool RingPush(SimRing_t* r, const SimFrame_t& fr)
+{
+    uint64_t pos = r->head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        int64_t d = (int64_t)(r->seq[pos & (SIM_RING_SIZE - 1)].load(std::memory_order_acquire) - pos);
+        if (d == 0)
+        {
+            if (r->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (d < 0)
+            return false;       // full
+        else
+            pos = r->head.load(std::memory_order_relaxed);
+    }
+    r->frame[pos & (SIM_RING_SIZE - 1)] = fr;
+    r->seq[pos & (SIM_RING_SIZE - 1)].store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+// consumer only: the oldest frame, left in the ring
+static const SimFrame_t* RingFront(SimRing_t* r)
+{
+    uint64_t pos = r->tail.load(std::memory_order_relaxed);
+    if (r->seq[pos & (SIM_RING_SIZE - 1)].load(std::memory_order_acquire) != pos + 1)
+        return NULL;
+    return &r->frame[pos & (SIM_RING_SIZE - 1)];
+}
+
+static void RingPop(SimRing_t* r)
+{
+    uint64_t pos = r->tail.load(std::memory_order_relaxed);
+    r->seq[pos & (SIM_RING_SIZE - 1)].store(pos + SIM_RING_SIZE, std::memory_order_release);
+    r->tail.store(pos + 1, std::memory_order_relaxed);
+}
+
+/*==========================================*/
+/*       Simulator thread                   */
+/*==========================================*/
+static void* SimThreadProc(void*)
+{
+    int64_t next = rt_now_ns();
+    while (simRun.load(std::memory_order_relaxed))
+    {
+        next += SIM_PLANT_DT_NS;
+        rt_sleep_until_ns(next);
+        int64_t now = rt_now_ns();
+
+        // new fault rules
+        int b = simFaultPending.load(std::memory_order_acquire);
+        if (b >= 0)
+        {
+            simFaultActive.store(b, std::memory_order_relaxed);
+            simFaultPending.store(-1, std::memory_order_release);
+            simFaults = simFaultBuf[b];
+            simNumFaults = simFaultCount[b];
+        }
+        simBusOff.store(AnyFault(FAULT_BUSOFF, now, -1, NULL), std::memory_order_release);
+
+        // frames handed over by the host go onto the bus one after another;
+        // txslow stretches each one
+        const SimFrame_t* h;
+        while (simNumTx < TX_QUEUE_SIZE && (h = RingFront(&simTxRing)) != NULL)
+        {
+            SimFrame_t& fr = simTx[simNumTx++];
+            fr = *h;
+            RingPop(&simTxRing);
+            const SimFault_t* f = NULL;
+            double factor = 1.0;
+            if (AnyFault(FAULT_TXSLOW, fr.t_ns, fr.id, &f))
+            {
+                factor = f->p;
+                Count(simInjected[FAULT_TXSLOW]);
+            }
+            int64_t start = (simBusFreeNs > fr.t_ns) ? simBusFreeNs : fr.t_ns;
+            fr.t_ns = start + (int64_t)(SIM_FRAME_NS * factor);
+            simBusFreeNs = fr.t_ns;
+            Count(simTxFrames);
+        }
+
+        // host frames whose transmission has finished
+        int k = 0;
+        for (int i=0; i<simNumTx; i++)
+        {
+            if (simTx[i].t_ns <= now)
+            {
+                Apply(now, simTx[i]);
+                simTxInFlight.fetch_sub(1, std::memory_order_release);
+            }
+            else
+                simTx[k++] = simTx[i];
+        }
+        simNumTx = k;
+
+        StepPlant(SIM_PLANT_DT_NS * 1e-9);
+
+        if (simPosPeriodNs > 0 && now >= simNextPosNs)
+        {
+            EmitFingerPoses(now);
+            simNextPosNs += simPosPeriodNs;
+            if (simNextPosNs < now) simNextPosNs = now + simPosPeriodNs;
+        }
+        if (simTempPeriodNs > 0 && now >= simNextTempNs)
+        {
+            EmitTemperatures(now);
+            simNextTempNs += simTempPeriodNs;
+            if (simNextTempNs < now) simNextTempNs = now + simTempPeriodNs;
+        }
+
+        // frames due before the next step go to the host, which delivers
+        // each one at its own time
+        int n = 0;
+        while (n < simNumRx && simRx[n].t_ns <= now + SIM_PLANT_DT_NS && RingPush(&simRxRing, simRx[n]))
+            n++;
+        if (n)
+        {
+            memmove(simRx, simRx + n, (simNumRx - n) * sizeof(SimFrame_t));
+            simNumRx -= n;
+        }
+    }
+    return NULL;
+}
+
+// host side: never waits for the simulator thread
+static int Transmit(int id, int len, const unsigned char* data, bool rtr)
+{
+    if (simBusOff.load(std::memory_order_acquire))
+    {
+        Count(simInjected[FAULT_BUSOFF]);
+        return SIM_ERROR_BUSOFF;
+    }
+    if (simTxInFlight.fetch_add(1, std::memory_order_acquire) >= TX_QUEUE_SIZE)
+    {
+        simTxInFlight.fetch_sub(1, std::memory_order_relaxed);
+        return SIM_ERROR_QXMTFULL;
+    }
+
+    SimFrame_t fr;
+    memset(&fr, 0, sizeof(fr));
+    fr.t_ns = rt_now_ns();
+    fr.id = id;
+    fr.len = len;
+    fr.rtr = rtr;
+    if (len > 0) memcpy(fr.data, data, len);
+    RingPush(&simTxRing, fr);       // room for TX_QUEUE_SIZE frames in flight
+    return SIM_OK;
+}
+
+/*========================================*/
+/*       Transport used by canAPI.cpp     */
+/*========================================*/
+int initCAN(int bus)
+{
+    if (simRun.load()) return 0;
+
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        simQ[i] = (kJointLimitLower[i] > 0.0) ? kJointLimitLower[i] : (kJointLimitUpper[i] < 0.0 ? kJointLimitUpper[i] : 0.0);
+        simQd[i] = 0.0;
+        simTau[i] = 0.0;
+    }
+    for (int f=0; f<4; f++)
+        simTemp[f] = SIM_AMBIENT_C;
+    simNumRx = simNumTx = 0;
+    simBusFreeNs = 0;
+    RingInit(&simRxRing);
+    RingInit(&simTxRing);
+    simTxInFlight.store(0);
+    simBusOff.store(false);
+    simRun.store(true);
+    if (pthread_create(&simThread, NULL, SimThreadProc, NULL) != 0)
+    {
+        simRun.store(false);
+        return -1;
+    }
+    printf("initCAN(): simulated CAN bus %d\n", bus);
+    return 0;
+}
+
+int freeCAN(int bus)
+{
+    if (!simRun.load()) return 0;
+    simRun.store(false);
+    pthread_join(simThread, NULL);
+    return 0;
+}
+
+int canReadMsg(int bus, int *id, int *len, unsigned char *data, int blocking)
+{
+    if (simBusOff.load(std::memory_order_acquire))
+        return SIM_ERROR_BUSOFF;
+
+    const SimFrame_t* fr = RingFront(&simRxRing);
+    if (!fr || fr->t_ns > rt_now_ns())
+        return SIM_ERROR_QRCVEMPTY;
+
+    int ret = SIM_ERROR_BUSHEAVY;
+    if (!fr->error)
+    {
+        *id = fr->id;
+        *len = fr->len;
+        memcpy(data, fr->data, fr->len);
+        ret = SIM_OK;
+    }
+    RingPop(&simRxRing);
+    return ret;
+}
+
+int canSendMsg(int bus, int id, char len, unsigned char *data, int blocking)
+{
+    return Transmit(id, len & 0x0F, data, false);
+}
+
+int canSentRTR(int bus, int id, int blocking)
+{
+    return Transmit(id, 0, NULL, true);
+}
+
+/*========================================*/
+/*       Fault injection API              */
+/*========================================*/
+// under simCmdLock: hand simCmdFaults to the simulator thread
+static bool PublishFaults(std::string* err)
+{
+    // wait (a few plant steps at most) for the previous hand-off to be consumed
+    for (int i=0; simRun.load() && simFaultPending.load(std::memory_order_acquire) >= 0; i++)
+    {
+        if (i >= 20)
+        {
+            if (err) *err = "simulator busy";
+            return false;
+        }
+        usleep(1000);
+    }
+
+    int b = 1 - simFaultActive.load(std::memory_order_relaxed);
+    memcpy(simFaultBuf[b], simCmdFaults, simCmdNumFaults * sizeof(SimFault_t));
+    simFaultCount[b] = simCmdNumFaults;
+    simFaultPending.store(b, std::memory_order_release);
+    return true;
+}
+
+int sim_fault_add(const char* rule, std::string* err)
+{
+    SimFault_t f;
+    if (ParseFault(rule, rt_now_ns(), &f, err) < 0) return -1;
+
+    pthread_mutex_lock(&simCmdLock);
+    int ret = -1;
+    if (simCmdNumFaults < SIM_MAX_FAULTS)
+    {
+        simCmdFaults[simCmdNumFaults++] = f;
+        if (PublishFaults(err))
+            ret = 0;
+        else
+            simCmdNumFaults--;
+    }
+    else
+        *err = "too many fault rules";
+    pthread_mutex_unlock(&simCmdLock);
+    return ret;
+}
+
+int sim_fault_load(const char* path, std::string* err)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp)
+    {
+        *err = std::string("cannot open ") + path;
+        return -1;
+    }
+
+    int64_t base = rt_now_ns();
+    char line[256];
+    int n = 0, lineno = 0;
+    SimFault_t rules[SIM_MAX_FAULTS];
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        const char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == 0) continue;
+        if (n >= SIM_MAX_FAULTS || ParseFault(p, base, &rules[n], err) < 0)
+        {
+            if (n >= SIM_MAX_FAULTS) *err = "too many fault rules";
+            *err = "line " + std::to_string(lineno) + ": " + *err;
+            fclose(fp);
+            return -1;
+        }
+        n++;
+    }
+    fclose(fp);
+
+    pthread_mutex_lock(&simCmdLock);
+    memcpy(simCmdFaults, rules, n * sizeof(SimFault_t));
+    simCmdNumFaults = n;
+    if (!PublishFaults(err)) n = -1;
+    pthread_mutex_unlock(&simCmdLock);
+    return n;
+}
+
+void sim_fault_clear()
+{
+    pthread_mutex_lock(&simCmdLock);
+    simCmdNumFaults = 0;
+    PublishFaults(NULL);
+    pthread_mutex_unlock(&simCmdLock);
+}
+
+void sim_get_stats(std::string* out)
+{
+    char buf[160];
+    int64_t now = rt_now_ns();
+
+    snprintf(buf, sizeof(buf), "rx_frames %llu tx_frames %llu rx_overflow %llu",
+             simRxFrames.load(std::memory_order_relaxed), simTxFrames.load(std::memory_order_relaxed),
+             simRxOverflow.load(std::memory_order_relaxed));
+    *out = buf;
+    for (int k=0; k<FAULT_KINDS; k++)
+    {
+        snprintf(buf, sizeof(buf), " %s %llu", kFaultNames[k], simInjected[k].load(std::memory_order_relaxed));
+        *out += buf;
+    }
+    pthread_mutex_lock(&simCmdLock);
+    for (int i=0; i<simCmdNumFaults; i++)
+    {
+        const char* state = (now < simCmdFaults[i].t0_ns) ? "pending " : (now < simCmdFaults[i].t1_ns) ? "active  " : "done    ";
+        *out += std::string("\n") + state + simCmdFaults[i].text;
+    }
+    pthread_mutex_unlock(&simCmdLock);
+}
+
+CANAPI_END
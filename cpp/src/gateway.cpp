@@ -0,0 +1,210 @@
+//
+// Network gateway for a real-time core started with 'grasp --core'.
+//
+// usage: grasp_gateway [--hand <index>] [--timeout <ms>]
+//
+// Binds the command socket (5556+hand) and the state stream socket
+// (5557+hand) in place of the core. History queries and stream commands are
+// served from the core's shared-memory state history; every other request
+// is checked here (see CheckRequest) and forwarded to the core through the
+// shared-memory command channel. The gateway can be stopped and restarted
+// at any time without affecting the control loop. It exits when the core
+// goes away.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <math.h>
+#include <sstream>
+#include <zmq.hpp>
+#include "CoreChannel.h"
+#include "StateHistory.h"
+#include "StatePublisher.h"
+#include "StateCommands.h"
+#include "SpanTrace.h"
+#include "RtClock.h"
+#include "rDeviceAllegroHandCANDef.h"
+
+#define GATEWAY_MAX_REQUEST     (64 * 1024)     // well below CORE_MAX_MESSAGE
+
+static bool CoreAlive(const CoreChannel& ch)
+{
+    pid_t pid = ch.Shared()->core_pid;
+    return !(kill(pid, 0) < 0 && errno == ESRCH);
+}
+
+// Validate a request before it reaches the core, which then only ever sees
+// printable text under a command name, or exactly 16 finite joint angles
+// (rewritten in canonical form)
+static bool CheckRequest(const std::string& req, std::string* out)
+{
+    if (req.empty() || req.size() > GATEWAY_MAX_REQUEST) return false;
+    for (size_t k=0; k<req.size(); k++)
+    {
+        unsigned char c = (unsigned char)req[k];
+        if (c < 0x20 && c != '\t' && c != '\n') return false;
+        if (c >= 0x7f) return false;
+    }
+
+    if (isalpha((unsigned char)req[0]))
+    {
+        size_t k = 0;
+        while (k < req.size() && (isalnum((unsigned char)req[k]) || req[k] == '_'))
+            k++;
+        if (k < req.size() && !isspace((unsigned char)req[k])) return false;
+        *out = req;
+        return true;
+    }
+
+    // the joint list: 16 comma- or space-separated finite angles, nothing else
+    std::stringstream ss(req);
+    double v[MAX_DOF];
+    int n = 0;
+    while (n < MAX_DOF && ss >> v[n])
+    {
+        if (!isfinite(v[n])) return false;
+        n++;
+        ss >> std::ws;
+        if (ss.peek() == ',')
+            ss.ignore();
+    }
+    ss >> std::ws;
+    if (n != MAX_DOF || !ss.eof()) return false;
+    char buf[32];
+    out->clear();
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        snprintf(buf, sizeof(buf), i ? ",%.17g" : "%.17g", v[i]);
+        *out += buf;
+    }
+    return true;
+}
+
+// Forward one request to the core and wait for the reply with the same id
+static bool Forward(CoreChannel& ch, uint32_t id, const std::string& req, int timeout_ms, std::string* reply)
+{
+    if (!ch.PostCommand(id, req)) return false;
+
+    int64_t deadline = rt_now_ns() + (int64_t)timeout_ms * 1000000;
+    uint32_t rid;
+    while (rt_now_ns() < deadline)
+    {
+        if (!ch.ReadReply(&rid, reply))
+        {
+            usleep(50);
+            continue;
+        }
+        if (rid == id) return true;
+        // a late reply to a request that already timed out
+    }
+    return false;
+}
+
+int main(int argc, char* argv[])
+{
+    int hand = 0;
+    int timeout_ms = 2000;
+    for (int a=1; a+1<argc; a++)
+    {
+        if (!strcmp(argv[a], "--hand")) hand = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--timeout")) timeout_ms = atoi(argv[++a]);
+    }
+
+    // wait for the core to come up
+    CoreChannel channel;
+    for (int i=0; !channel.Attach(hand); i++)
+    {
+        if (channel.Busy())
+        {
+            printf("ERROR another gateway is attached to hand %d\n", hand);
+            return 1;
+        }
+        if (i == 0) printf("gateway: waiting for 'grasp --core --hand %d'...\n", hand);
+        usleep(100000);
+    }
+    char history_name[64];
+    snprintf(history_name, sizeof(history_name), CORE_HISTORY_NAME, hand);
+    StateHistory history;
+    if (!history.AttachShared(history_name))
+    {
+        printf("ERROR attaching %s\n", history_name);
+        return 1;
+    }
+    printf("gateway: attached to core pid %d, hand %d\n", channel.Shared()->core_pid, hand);
+
+    StatePublisher publisher;
+    int pub_port = 5557 + hand;
+    if (!publisher.Start(&history, pub_port, channel.Shared()->period))
+    {
+        printf("ERROR starting the state publisher\n");
+        return 1;
+    }
+
+    zmq::context_t ctx;
+    zmq::socket_t socket(ctx, ZMQ_REP);
+    socket.bind("tcp://*:" + std::to_string(5556 + hand));
+    socket.setsockopt(ZMQ_RCVTIMEO, 1000);
+    TraceRegisterThread("gateway");
+    printf("gateway: ZMQ setup done\n");
+
+    uint32_t next_id = (uint32_t)rt_now_ns();
+    uint64_t forwarded = 0, timeouts = 0, rejected = 0;
+    while (true)
+    {
+        zmq::message_t recv_msg;
+        if (!socket.recv(&recv_msg))
+        {
+            if (!CoreAlive(channel))
+            {
+                printf("gateway: core stopped, exiting\n");
+                break;
+            }
+            continue;
+        }
+
+        std::string req = recv_msg.to_string(), reply, checked;
+        std::stringstream ss(req);
+        std::string cmd;
+        if (!req.empty() && isalpha((unsigned char)req[0]))
+            ss >> cmd;
+
+        if (HandleStateCommand(cmd, ss, history, publisher, pub_port, reply))
+            ;
+        else if (cmd == "gateway_stats")
+        {
+            // core pid, control cycles, time since the last one, requests forwarded, timeouts, rejected
+            const CoreShared_t* sh = channel.Shared();
+            char buf[224];
+            snprintf(buf, sizeof(buf), "core_pid %d cycles %llu heartbeat_age_ms %.1f forwarded %llu timeouts %llu rejected %llu",
+                     sh->core_pid, (unsigned long long)sh->heartbeat.load(std::memory_order_relaxed),
+                     channel.HeartbeatAge(rt_now_ns()) * 1e-6, (unsigned long long)forwarded,
+                     (unsigned long long)timeouts, (unsigned long long)rejected);
+            reply = buf;
+        }
+        else if (!CheckRequest(req, &checked))
+        {
+            rejected++;
+            reply = "fail malformed request";
+        }
+        else
+        {
+            forwarded++;
+            if (!Forward(channel, ++next_id, checked, timeout_ms, &reply))
+            {
+                timeouts++;
+                reply = CoreAlive(channel) ? "fail core timeout" : "fail core stopped";
+            }
+        }
+
+        zmq::message_t reply_msg(reply.length());
+        memcpy(reply_msg.data(), reply.data(), reply.length());
+        socket.send(reply_msg, zmq::send_flags::none);
+    }
+
+    publisher.Stop();
+    return 1;
+}
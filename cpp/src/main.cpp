@@ -9,13 +9,48 @@
 #include <termios.h>  //_getch
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include <pthread.h>
+#include <sys/stat.h>
 #include "canAPI.h"
 #include "rDeviceAllegroHandCANDef.h"
 #include "RockScissorsPaper.h"
+#include "ReachabilityMap.h"
+#include "TimeParameterization.h"
+#include "TrajectoryPlayer.h"
+#include "MotionScript.h"
+#include "HandSync.h"
+#include "RtClock.h"
+#include "StateHistory.h"
+#include "StatePublisher.h"
+#include "SpanTrace.h"
+#include "PerfCounters.h"
+#include "RtSanitizer.h"
+#include "LoopStats.h"
+#include "ThermalModel.h"
+#include "EncoderValidator.h"
+#include "MlpPolicy.h"
+#include "PluginHost.h"
+#include "TeachRecorder.h"
+#include "CartesianImpedance.h"
+#include "TaskScheduler.h"
+#include "WorkerPool.h"
+#include "FrictionComp.h"
+#include "JointCalibration.h"
+#include "StateCommands.h"
+#include "CoreChannel.h"
+#ifdef ALLEGRO_SIM_CAN
+#include "canSim.h"
+#endif
 #include <BHand/BHand.h>
 #include <zmq.hpp>
 #include <vector>
+#include <sstream>
+#include <ctype.h>
+#include <iterator>
+#include <atomic>
+#include <signal.h>
 
 #define PEAKCAN (1)
 
@@ -42,6 +77,7 @@ double curTime = 0.0;
 // for BHand library
 BHand* pBHand = NULL;
 double q[MAX_DOF];
+double qdot[MAX_DOF];
 double q_des[MAX_DOF];
 double tau_des[MAX_DOF];
 double cur_des[MAX_DOF];
@@ -52,17 +88,136 @@ const int	HAND_VERSION = 4;
 
 const double tau_cov_const_v4 = 1200.0; // 1200.0 for SAH040xxxxx
 
+// MULTI-HAND CONFIGURATION (--hand <index> --hands <count>)
+// Each hand runs its own process on CAN channel USBBUS<index+1> and ZMQ port 5556+index.
+int HAND_INDEX = 0;
+int NUM_HANDS = 1;
+const double SYNC_TX_OFFSET = 0.0015;   // TX slot of hand 0 after each master tick (s)
+const double SYNC_TX_STAGGER = 0.0005;  // TX slot delay per hand index (s)
+HandSync handSync;
+short commPeriod[3] = {3, 0, 1000};     // millisecond {position, imu, temperature}
+
+// per-cycle state history (--history <seconds>)
+double HISTORY_SECONDS = 10.0;
+StateHistory stateHistory;
+StatePublisher statePublisher;   // per-subscriber state streams on port 5557+HAND_INDEX
+
+// --core: CAN and control only; ZMQ, parsing and state streams run in grasp_gateway
+bool CORE_MODE = false;
+CoreChannel coreChannel;
+volatile sig_atomic_t coreRun = 1;
+
+// control-loop jitter, latency and tracking metrics
+LoopStats loopStats(delT);
+const char* SIM_FAULT_FILE = NULL;      // --sim-faults <file>, simulated CAN builds only
+
+// cycle stage span traces
+const char* TRACE_DIR = "traces";       // --trace-dir <dir>: the only place trace_export writes to
+
+// step RPC: a target applied by the control thread at the next cycle boundary
+const int STEP_MAX_CYCLES = 500;
+enum { STEP_IDLE = 0, STEP_PENDING, STEP_CLAIMED };     // claimed by the control thread or cancelled by the RPC
+std::atomic<int> stepState(STEP_IDLE);
+double stepTarget[MAX_DOF];
+std::atomic<int64_t> stepAppliedCycle(-1);
+
+// learned policies evaluated on the control thread
+MlpPolicy mlpPolicy;
+
+// controller plugins run on the control thread (--plugin <path>, plugin_load)
+PluginHost pluginHost(delT);
+const char* PLUGIN_DIR = "plugins";     // --plugin-dir <dir>: the only place plugin_load reads from
+const char* PLUGIN_FILES[PLUGIN_MAX];
+int NUM_PLUGIN_FILES = 0;
+double tau_plugin[MAX_DOF];
+
+// decode-stage encoder glitch rejection
+EncoderValidator encValidator(delT, CALIB_RAD_PER_COUNT);
+
+// per-joint encoder offsets and directions, stored per hand serial (--calib <file>)
+JointCalibration jointCalib(delT);
+const char* CALIB_FILE = CALIB_FILE_DEFAULT;
+
+// motor temperature prediction and torque derating
+ThermalModel thermalModel(delT);
+double AMBIENT_C = THERMAL_AMBIENT_C;   // --ambient <degC>
+
+// control-thread perf_event counters (--perf)
+bool PERF_ENABLED = false;
+PerfCounters perfCounters;
+
+// fingertip reachability map baked by bake_reachability (optional)
+const char* REACH_MAP_FILE = "reachability.bin";
+ReachabilityMap reachMap;
+
+// time-parameterized joint paths played on the control thread
+const int MAX_TRAJ_KNOTS = 4096;
+TrajectoryPlayer trajPlayer(MAX_TRAJ_KNOTS);
+TimeParameterizer pathTimer;
+JointLimits_t pathLimits;
+
+// adaptive Coulomb + viscous friction feedforward (friction on, --friction)
+FrictionComp frictionComp(delT);
+
+// per-finger Cartesian impedance on top of BHand gravity compensation
+CartesianImpedance cartImpedance(RIGHT_HAND);
+
+// work-stealing pool for background work, kept off the control core with --pool-cpus
+WorkerPool workerPool;
+int POOL_THREADS = 2;                   // --pool-threads <n>
+const char* POOL_CPUS = NULL;           // --pool-cpus <list>, e.g. 1-3
+
+// multi-rate tasks: RT tier on the control thread, soft and background tiers on their own threads
+TaskScheduler scheduler(delT);
+const int CONTROL_PRIORITY = 40;        // SCHED_FIFO priority of the control thread, when permitted
+typedef struct
+{
+    int64_t t_ns;
+    double q[MAX_DOF];
+    double qdot[MAX_DOF];
+} CycleState_t;
+typedef struct
+{
+    int64_t t_ns;
+    double tip[NUM_FINGERS][3];
+} FingertipState_t;
+SchedMailbox<CycleState_t> cycleStateBox;       // RT tier -> soft tier
+SchedMailbox<FingertipState_t> fingertipBox;    // soft tier -> command thread
+
+// kinesthetic teaching: q recorded every cycle in gravity compensation, replayed as keyframes
+const double TEACH_MAX_SECONDS = 120.0;
+TeachRecorder teachRecorder((int)(TEACH_MAX_SECONDS / delT));
+TrajKnot_t teachKnots[MAX_TRAJ_KNOTS];
+int teachKnotCount = 0;
+
+// uploaded motion scripts, executed on the control thread
+MotionScriptVM scriptVM(delT);
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // functions declarations
 char Getch();
 void PrintInstruction();
 void MainLoop();
+void CoreLoop();
 bool OpenCAN();
 void CloseCAN();
 int GetCANChannelIndex(const TCHAR* cname);
 bool CreateBHandAlgorithm();
 void DestroyBHandAlgorithm();
 void ComputeTorque();
+void HandleCommand(const std::string& recv_str, std::string& reply);
+
+// controllers and recorders a new motion command takes over from (StopAllMotion)
+enum
+{
+    MOTION_TRAJ = 0x01,
+    MOTION_SCRIPT = 0x02,
+    MOTION_POLICY = 0x04,
+    MOTION_IMPEDANCE = 0x08,
+    MOTION_CALIB = 0x10,
+    MOTION_TEACH = 0x20
+};
+void StopAllMotion(int keep);
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // Read keyboard input (one char) from stdin
@@ -100,6 +255,23 @@ static void* ioThreadProc(void* inst)
     unsigned char data[8];
     unsigned char data_return = 0;
     int i;
+    double q_prev[MAX_DOF];
+    bool have_q_prev = false;
+    StateSample_t sample;
+    uint64_t t_span = 0;
+
+    TraceRegisterThread("control");
+
+    // above every other thread of the server, the soft scheduler tier included
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = CONTROL_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) == 0)
+        scheduler.SetControlPriority(CONTROL_PRIORITY);
+    else
+        printf("WARNING control thread: no SCHED_FIFO, the soft task tier stays under SCHED_OTHER\n");
+    if (PERF_ENABLED && perfCounters.Open())
+        printf("perf counters enabled on the control thread\n");
 
     while (ioThreadRun)
     {
@@ -129,6 +301,7 @@ static void* ioThreadProc(void* inst)
             {
                 printf(">CAN(%d): AllegroHand serial number: SAH0%d0 %c%c%c%c%c%c%c%c\n", CAN_Ch, HAND_VERSION
                        , data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
+                jointCalib.SetSerial(data);
             }
                 break;
             case ID_RTR_FINGER_POSE_1:
@@ -137,11 +310,10 @@ static void* ioThreadProc(void* inst)
             case ID_RTR_FINGER_POSE_4:
             {
                 int findex = (id & 0x00000007);
+                if (data_return == 0) t_span = TraceNow();
 
-                vars.enc_actual[findex*4 + 0] = (short)(data[0] | (data[1] << 8));
-                vars.enc_actual[findex*4 + 1] = (short)(data[2] | (data[3] << 8));
-                vars.enc_actual[findex*4 + 2] = (short)(data[4] | (data[5] << 8));
-                vars.enc_actual[findex*4 + 3] = (short)(data[6] | (data[7] << 8));
+                // range/step/length checks; rejected joints keep their last valid count
+                encValidator.CheckFrame(findex, data, len, &vars.enc_actual[findex*4]);
                 data_return |= (0x01 << (findex));
                 recvNum++;
 
@@ -152,11 +324,53 @@ static void* ioThreadProc(void* inst)
 
                 if (data_return == (0x01 | 0x02 | 0x04 | 0x08))
                 {
-                    // convert encoder count to joint angle
+                    TraceStage(SPAN_RX, &t_span, sendNum);
+                    perfCounters.Begin();
+                    RtCycleBegin();
+
+                    // align to the shared cycle clock and pick up cross-hand targets
+                    int64_t t_cycle = rt_now_ns();
+                    int64_t cycle = 0;
+                    if (handSync.BeginCycle(t_cycle, &cycle, q_des))
+                    {
+                        StopAllMotion(0);
+                        SetJointPDMode();
+                    }
+                    int step = STEP_PENDING;
+                    if (stepState.load(std::memory_order_relaxed) == STEP_PENDING
+                        && stepState.compare_exchange_strong(step, STEP_CLAIMED, std::memory_order_acq_rel))
+                    {
+                        memcpy(q_des, stepTarget, sizeof(q_des));
+                        StopAllMotion(0);
+                        SetJointPDMode();
+                        stepAppliedCycle.store(sendNum, std::memory_order_release);
+                        stepState.store(STEP_IDLE, std::memory_order_release);
+                    }
+
+                    // pick up a new joint calibration; q_des is remapped, so the hand holds still.
+                    // Every other controller holds targets in the old joint coordinates (the
+                    // impedance target is a fixed Cartesian point), so they all stop.
+                    if (jointCalib.Apply(q_des))
+                    {
+                        const JointCalib_t& cal = jointCalib.Current();
+                        encValidator.SetCalibration(cal.scale, cal.offset, !jointCalib.IsRunning());
+                        StopAllMotion(MOTION_CALIB);
+                        have_q_prev = false;
+                    }
+
+                    // convert encoder count to joint angle (per-joint offset and direction)
+                    jointCalib.Decode(vars.enc_actual, q);
+
+                    // joint velocity by low-pass filtered finite differences
                     for (i=0; i<MAX_DOF; i++)
                     {
-                        q[i] = (double)(vars.enc_actual[i])*(333.3/65536.0)*(3.141592/180.0);
+                        double v = have_q_prev ? (q[i] - q_prev[i]) / delT : 0.0;
+                        qdot[i] = 0.6*qdot[i] + 0.4*v;
+                        q_prev[i] = q[i];
                     }
+                    have_q_prev = true;
+                    teachRecorder.Record(t_cycle, q);
+                    TraceStage(SPAN_DECODE, &t_span, sendNum);
 
                     // print joint angles
                 //     printf("joint angles (radians):\n");
@@ -172,18 +386,46 @@ static void* ioThreadProc(void* inst)
                 //            , CAN_Ch, i, q[i*4+0]*RAD2DEG, q[i*4+1]*RAD2DEG, q[i*4+2]*RAD2DEG, q[i*4+3]*RAD2DEG);
                 //    }
 
+                    // advance the active trajectory, if any
+                    trajPlayer.Update(delT, q_des);
+
+                    // step the running motion script, if any
+                    MsEffects_t fx;
+                    scriptVM.Step(q, tau_des, q_des, &fx);
+                    if (fx.motion_type >= 0) SetHandMotionType(fx.motion_type);
+                    if (pBHand && fx.kp) pBHand->SetGainsEx((double*)fx.kp, (double*)fx.kd);
+
+                    // run the loaded policy, if due
+                    mlpPolicy.Update(q, qdot, q_des);
+
+                    // loaded plugins may adjust the targets or command torques
+                    bool plugin_tau = pluginHost.Run(t_cycle, sendNum, q, qdot, q_des, cur_des, vars.enc_actual, tau_plugin);
+
                     // compute joint torque
+                    cartImpedance.ReleaseTargets(q, q_des);
                     ComputeTorque();
+                    frictionComp.Update(q, qdot, q_des, HandMotionType() == eMotionType_JOINT_PD && !cartImpedance.IsRunning()
+                                        && !teachRecorder.IsRecording() && !jointCalib.IsRunning(), tau_des);
+                    cartImpedance.Update(q, qdot, tau_des);
+                    if (plugin_tau) memcpy(tau_des, tau_plugin, sizeof(tau_des));
+                    jointCalib.Step(vars.enc_actual, q, q_des, tau_des);
+                    TraceStage(SPAN_CONTROL, &t_span, sendNum);
 
-                    // convert desired torque to desired current and PWM count
+                    // convert desired torque to desired current and PWM count,
+                    // limited further while a motor is predicted to run hot
                     for (int i=0; i<MAX_DOF; i++)
                     {
+                        double lim = thermalModel.Limit(i);
                         cur_des[i] = tau_des[i];
-                        if (cur_des[i] > 1.0) cur_des[i] = 1.0;
-                        else if (cur_des[i] < -1.0) cur_des[i] = -1.0;
+                        if (cur_des[i] > lim) cur_des[i] = lim;
+                        else if (cur_des[i] < -lim) cur_des[i] = -lim;
                     }
+                    thermalModel.Update(cur_des);
+                    TraceStage(SPAN_SAFETY, &t_span, sendNum);
 
-                    // send torques
+                    // send torques in this hand's TX slot
+                    RtAllowBegin();
+                    handSync.WaitTxSlot(cycle);
                     for (int i=0; i<4;i++)
                     {
                         vars.pwm_demand[i*4+0] = (short)(cur_des[i*4+0]*tau_cov_const_v4);
@@ -194,6 +436,39 @@ static void* ioThreadProc(void* inst)
                         command_set_torque(CAN_Ch, i, &vars.pwm_demand[4*i]);
                         //usleep(5);
                     }
+                    RtAllowEnd();
+
+                    // the hand's oscillator drifted off the master clock: restart its stream on a tick
+                    if (handSync.RephaseDue())
+                    {
+                        RtAllowBegin();
+                        handSync.WaitNextTick();
+                        command_set_period(CAN_Ch, commPeriod);
+                        RtAllowEnd();
+                        handSync.Rephased();
+                    }
+
+                    TraceStage(SPAN_TX, &t_span, sendNum);
+                    loopStats.Record(t_cycle, rt_now_ns(), q, q_des);
+
+                    // record the cycle
+                    sample.t_ns = t_cycle;
+                    sample.cycle = sendNum;
+                    for (i=0; i<MAX_DOF; i++)
+                    {
+                        sample.q[i] = q[i];
+                        sample.qdot[i] = qdot[i];
+                        sample.q_des[i] = q_des[i];
+                        sample.tau_des[i] = tau_des[i];
+                        sample.enc[i] = (int16_t)vars.enc_actual[i];
+                    }
+                    stateHistory.Push(sample);
+                    scheduler.RunRt(t_cycle);
+                    coreChannel.Heartbeat(sendNum + 1, t_cycle);
+                    TraceStage(SPAN_RECORD, &t_span, sendNum);
+                    RtCycleEnd();
+                    perfCounters.End(sendNum);
+
                     sendNum++;
                     curTime += delT;
                     data_return = 0;
@@ -217,7 +492,7 @@ static void* ioThreadProc(void* inst)
                               (int)(data[1] << 8 ) |
                               (int)(data[2] << 16) |
                               (int)(data[3] << 24);
-                printf(">CAN(%d): Temperature[%d]: %d (celsius)\n", CAN_Ch, sindex, celsius);
+                thermalModel.Measure(sindex, celsius);
             }
                 break;
             default:
@@ -231,6 +506,858 @@ static void* ioThreadProc(void* inst)
     return NULL;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// Stop every controller and recording except the ones in keep (MOTION_*), before a new
+// motion takes over. Any thread; each stop takes effect at the next cycle.
+void StopAllMotion(int keep)
+{
+    if (!(keep & MOTION_TRAJ)) trajPlayer.Stop();
+    if (!(keep & MOTION_SCRIPT)) scriptVM.Stop();
+    if (!(keep & MOTION_POLICY)) mlpPolicy.Stop();
+    if (!(keep & MOTION_IMPEDANCE)) cartImpedance.Stop();
+    if (!(keep & MOTION_CALIB)) jointCalib.Stop();
+    if (!(keep & MOTION_TEACH)) teachRecorder.Stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Request work run on the worker pool (workerPool.Call), with scratch in the worker's arena
+typedef struct
+{
+    double secs;
+    const char* path;
+    int n;
+} TraceExportJob_t;
+
+void TraceExportJob(void* arg, WorkArena_t* arena)
+{
+    TraceExportJob_t* job = (TraceExportJob_t*)arg;
+    TraceSpan_t* scratch = (TraceSpan_t*)ArenaAlloc(arena, sizeof(TraceSpan_t) * TRACE_RING_SPANS);
+    job->n = TraceExportChrome(job->secs, job->path, HAND_INDEX, scratch);
+}
+
+typedef struct
+{
+    double tol;
+    double max_err;
+    int n;
+} TeachCompressJob_t;
+
+void TeachCompressJob(void* arg, WorkArena_t* arena)
+{
+    TeachCompressJob_t* job = (TeachCompressJob_t*)arg;
+    void* scratch = ArenaAlloc(arena, teachRecorder.ScratchBytes());
+    job->n = teachRecorder.Compress(&job->tol, teachKnots, MAX_TRAJ_KNOTS - 1, &job->max_err, scratch);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Handle one ZMQ request and build the reply. Requests starting with a keyword are
+// commands; anything else is the original comma-separated list of 16 joint targets.
+void HandleCommand(const std::string& recv_str, std::string& reply)
+{
+    std::stringstream ss(recv_str);
+    std::string cmd;
+    if (!recv_str.empty() && isalpha((unsigned char)recv_str[0]))
+        ss >> cmd;
+
+    // history queries and state streams (answered by the gateway in --core mode)
+    if (HandleStateCommand(cmd, ss, stateHistory, statePublisher, 5557 + HAND_INDEX, reply))
+        return;
+
+    if (cmd == "reach")
+    {
+        // reach <finger> <x> <y> <z>  ->  "1,<q0>,<q1>,<q2>,<q3>" or "0"
+        int finger = -1;
+        double p[3], seed[DOF_PER_FINGER];
+        if (!(ss >> finger >> p[0] >> p[1] >> p[2]) || !reachMap.IsLoaded())
+        {
+            reply = "fail";
+            return;
+        }
+        if (!reachMap.Query(finger, p, seed))
+        {
+            reply = "0";
+            return;
+        }
+        char buf[128];
+        snprintf(buf, sizeof(buf), "1,%.4f,%.4f,%.4f,%.4f", seed[0], seed[1], seed[2], seed[3]);
+        reply = buf;
+        return;
+    }
+    else if (cmd == "path")
+    {
+        // path <q_1>;<q_2>;...  (16 comma-separated joints each), timed from the current target
+        std::vector<double> wp(q_des, q_des + MAX_DOF);
+        std::string seg;
+        while (std::getline(ss, seg, ';'))
+        {
+            std::stringstream ws(seg);
+            int n = 0;
+            double v;
+            while (ws >> v)
+            {
+                wp.push_back(v);
+                n++;
+                if (ws.peek() == ',')
+                    ws.ignore();
+            }
+            if (n != 0 && n != MAX_DOF)
+            {
+                reply = "fail";
+                return;
+            }
+        }
+        int num_wp = (int)wp.size() / MAX_DOF;
+        int grid = 50 * (num_wp - 1);
+        if (grid >= MAX_TRAJ_KNOTS) grid = MAX_TRAJ_KNOTS - 1;
+
+        static TrajKnot_t knots[MAX_TRAJ_KNOTS];
+        double qd[MAX_DOF];
+        trajPlayer.GetVelocity(qd);
+        int n = pathTimer.Compute(&wp[0], num_wp, pathLimits, qd, grid, knots);
+        if (n < 0 || !pBHand)
+        {
+            reply = "fail";
+            return;
+        }
+        if (!trajPlayer.IsPlaying())
+            SetJointPDMode();
+        StopAllMotion(MOTION_TRAJ);
+        if (!trajPlayer.Load(knots, n))
+        {
+            reply = "fail";
+            return;
+        }
+        char buf[64];
+        snprintf(buf, sizeof(buf), "succ %.4f", knots[n - 1].t);
+        reply = buf;
+        return;
+    }
+    else if (cmd == "path_limits")
+    {
+        // path_limits vel|acc|tau|inertia|damping <16 comma-separated values>
+        std::string which;
+        ss >> which;
+        double* dst = (which == "vel") ? pathLimits.vel
+                    : (which == "acc") ? pathLimits.acc
+                    : (which == "tau") ? pathLimits.tau
+                    : (which == "inertia") ? pathLimits.inertia
+                    : (which == "damping") ? pathLimits.damping : NULL;
+        double v[MAX_DOF];
+        int n = 0;
+        while (dst && n < MAX_DOF && ss >> v[n])
+        {
+            n++;
+            if (ss.peek() == ',')
+                ss.ignore();
+        }
+        if (!dst || n != MAX_DOF)
+        {
+            reply = "fail";
+            return;
+        }
+        // the path timing divides by the velocity and acceleration limits; the
+        // joint model may be zero (inertia 0 turns the torque limit off)
+        bool model = (dst == pathLimits.inertia || dst == pathLimits.damping);
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            if (!isfinite(v[i]) || v[i] < 0.0 || (v[i] == 0.0 && !model))
+            {
+                reply = "fail limits must be finite and positive";
+                return;
+            }
+        }
+        memcpy(dst, v, sizeof(v));
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "script_upload")
+    {
+        // script_upload <id>\n<script text>  ->  "succ <instructions>" or "fail <line>: <error>"
+        int id = -1;
+        ss >> id;
+        std::string text((std::istreambuf_iterator<char>(ss)), std::istreambuf_iterator<char>());
+        static MotionScript_t script;
+        std::string err;
+        if (!CompileMotionScript(text, &script, &err))
+        {
+            reply = "fail " + err;
+            return;
+        }
+        if (!scriptVM.Upload(id, script))
+        {
+            reply = "fail slot busy or out of range";
+            return;
+        }
+        reply = "succ " + std::to_string(script.num_instr);
+        return;
+    }
+    else if (cmd == "script_run")
+    {
+        int id = -1;
+        ss >> id;
+        if (!pBHand)
+        {
+            reply = "fail";
+            return;
+        }
+        StopAllMotion(MOTION_SCRIPT);
+        SetJointPDMode();
+        reply = scriptVM.Run(id) ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "script_stop")
+    {
+        scriptVM.Stop();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "policy_load")
+    {
+        // policy_load <weights file>: replaces the current policy, stopped (see MlpPolicy.h)
+        std::string path, err;
+        ss >> path;
+        reply = mlpPolicy.Load(path.c_str(), &err) ? "succ" : "fail " + err;
+        return;
+    }
+    else if (cmd == "policy_run")
+    {
+        // policy_run [every_n_cycles]: default from the weights file
+        int decimation = 0;
+        ss >> decimation;
+        StopAllMotion(MOTION_POLICY);
+        SetJointPDMode();
+        reply = mlpPolicy.Run(decimation) ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "policy_stop")
+    {
+        mlpPolicy.Stop();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "policy_stats")
+    {
+        // state, network size (multiply-adds) and per-inference cost
+        mlpPolicy.Report(&reply);
+        return;
+    }
+    else if (cmd == "plugin_load")
+    {
+        // plugin_load <file.so> [budget_us] [args...]: a file in PLUGIN_DIR; replaces a loaded plugin of the same name
+        std::string name, args, err;
+        int budget_us = 0;
+        ss >> name >> budget_us;
+        std::getline(ss >> std::ws, args);
+        if (name.empty() || name[0] == '.' || name.find('/') != std::string::npos)
+        {
+            reply = "fail plugin file name expected";
+            return;
+        }
+        std::string path = std::string(PLUGIN_DIR) + "/" + name;
+        reply = pluginHost.Load(path.c_str(), budget_us, args.c_str(), &err) ? "succ" : "fail " + err;
+        return;
+    }
+    else if (cmd == "plugin_unload")
+    {
+        std::string name, err;
+        ss >> name;
+        reply = pluginHost.Unload(name.c_str(), &err) ? "succ" : "fail " + err;
+        return;
+    }
+    else if (cmd == "plugin_stats")
+    {
+        // per plugin: name state budget_us calls mean_us max_us overruns path
+        pluginHost.Report(&reply);
+        return;
+    }
+    else if (cmd == "script_status")
+    {
+        // "running <id> <pc>" or "idle"
+        int id = scriptVM.RunningId();
+        reply = (id < 0) ? "idle"
+              : "running " + std::to_string(id) + " " + std::to_string(scriptVM.Pc());
+        return;
+    }
+    else if (cmd == "sched_stats")
+    {
+        // per task: name tier(policy) rate_hz budget_us runs mean_us max_us late_max_us overruns skipped
+        scheduler.Report(&reply);
+        return;
+    }
+    else if (cmd == "worker_stats")
+    {
+        // workers cpus queued max_queued submitted rejected wait_mean_us wait_max_us run_mean_us run_max_us
+        // then per worker: <index> <executed> <stolen> <arena_high_bytes>
+        workerPool.Report(&reply);
+        return;
+    }
+    else if (cmd == "fingertips")
+    {
+        // fingertip positions from the soft tier (60 Hz): <age_ms> <x>,<y>,<z>;... (m, palm frame)
+        FingertipState_t tips;
+        if (!fingertipBox.Read(&tips))
+        {
+            reply = "fail";
+            return;
+        }
+        char buf[96];
+        snprintf(buf, sizeof(buf), "%.1f", (rt_now_ns() - tips.t_ns) * 1e-6);
+        reply = buf;
+        for (int f=0; f<NUM_FINGERS; f++)
+        {
+            snprintf(buf, sizeof(buf), "%s%.4f,%.4f,%.4f", f ? ";" : " ", tips.tip[f][0], tips.tip[f][1], tips.tip[f][2]);
+            reply += buf;
+        }
+        return;
+    }
+    else if (cmd == "friction")
+    {
+        // friction on|off [adapt|fixed]
+        std::string mode, adapt;
+        ss >> mode >> adapt;
+        if ((mode != "on" && mode != "off") || (!adapt.empty() && adapt != "adapt" && adapt != "fixed"))
+        {
+            reply = "fail";
+            return;
+        }
+        frictionComp.Enable(mode == "on");
+        if (!adapt.empty()) frictionComp.EnableAdaptation(adapt == "adapt");
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "friction_set")
+    {
+        // friction_set <joint|-1> <fc> <fv>: Coulomb (tau units) and viscous (per rad/s) coefficients
+        int joint = -2;
+        double fc = -1.0, fv = -1.0;
+        ss >> joint >> fc >> fv;
+        if (joint < -1 || joint >= MAX_DOF || fc < 0.0 || fv < 0.0)
+        {
+            reply = "fail";
+            return;
+        }
+        frictionComp.SetParams(joint, fc, fv);
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "friction_stats")
+    {
+        // <on> <adapt> <cycles_off> <cycles_on>, then per joint <joint> <fc> <fv> <rms_err_off> <rms_err_on>
+        frictionComp.Report(&reply);
+        return;
+    }
+    else if (cmd == "friction_stats_reset")
+    {
+        frictionComp.ResetStats();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "calib_start" || cmd == "calib_fixture")
+    {
+        // calib_start [joint_mask]: drive each joint slowly into both hard stops (clear the workspace)
+        // calib_fixture <q0>,...,<q15> [joint_mask]: hand resting in a fixture of known pose (rad)
+        std::string list, m;
+        if (cmd == "calib_fixture") ss >> list;
+        ss >> m;
+        int mask = m.empty() ? (1 << MAX_DOF) - 1 : (int)strtol(m.c_str(), NULL, 0);
+        double q_fix[MAX_DOF];
+        int n = 0;
+        for (const char* p = list.c_str(); cmd == "calib_fixture" && n < MAX_DOF; n++)
+        {
+            char* end;
+            q_fix[n] = strtod(p, &end);
+            if (end == p) break;
+            p = (*end == ',') ? end + 1 : end;
+        }
+        if (!pBHand || (cmd == "calib_fixture" && n != MAX_DOF))
+        {
+            reply = "fail";
+            return;
+        }
+        StopAllMotion(MOTION_CALIB);
+        SetJointPDMode();
+        bool ok = (cmd == "calib_start") ? jointCalib.StartHardStops(mask) : jointCalib.StartFixture(q_fix, mask);
+        reply = ok ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "calib_stop")
+    {
+        jointCalib.Stop();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "calib_status")
+    {
+        // <state> <serial> <joint> <phase>, then per joint
+        // <joint> <sign> <offset> <status> <measured_sign> <measured_offset> <span_err>
+        jointCalib.Report(&reply);
+        return;
+    }
+    else if (cmd == "calib_set")
+    {
+        // calib_set <joint|-1> <sign> <offset_rad>: q = sign * enc * rad_per_count + offset
+        int joint = -2, sign = 0;
+        double offset = NAN;
+        ss >> joint >> sign >> offset;
+        JointCalib_t c;
+        jointCalib.GetCurrent(&c);
+        if (joint < -1 || joint >= MAX_DOF || (sign != 1 && sign != -1) || !isfinite(offset))
+        {
+            reply = "fail";
+            return;
+        }
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            if (joint >= 0 && i != joint) continue;
+            c.scale[i] = sign * CALIB_RAD_PER_COUNT;
+            c.offset[i] = offset;
+        }
+        reply = jointCalib.Set(c) ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "calib_stops")
+    {
+        // calib_stops <joint> <lower> <upper>: hard-stop angles for calib_start (default: joint limits)
+        int joint = -1;
+        double lo = 0.0, hi = 0.0;
+        ss >> joint >> lo >> hi;
+        reply = jointCalib.SetStops(joint, lo, hi) ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "calib_load" || cmd == "calib_save")
+    {
+        // calib_load|calib_save [file]: this hand's entry, keyed by its serial number;
+        // a named file lives next to CALIB_FILE
+        std::string name, path = CALIB_FILE;
+        ss >> name;
+        if (!name.empty())
+        {
+            if (name[0] == '.' || name.find('/') != std::string::npos)
+            {
+                reply = "fail calibration file name expected";
+                return;
+            }
+            size_t slash = path.rfind('/');
+            path = (slash == std::string::npos) ? name : path.substr(0, slash + 1) + name;
+        }
+        if (cmd == "calib_save")
+        {
+            reply = jointCalib.Save(path.c_str()) ? "succ" : "fail";
+            return;
+        }
+        int n = jointCalib.Load(path.c_str());
+        reply = (n > 0) ? "succ " + std::to_string(n) : "fail";
+        return;
+    }
+    else if (cmd == "imp_start")
+    {
+        // imp_start [finger_mask]: Cartesian impedance holding the current fingertip positions
+        int mask = (1 << NUM_FINGERS) - 1;
+        ss >> mask;
+        if (!pBHand)
+        {
+            reply = "fail";
+            return;
+        }
+        ImpedanceParams_t p = cartImpedance.Params();
+        p.mask = mask;
+        for (int f=0; f<NUM_FINGERS; f++)
+            FingerFK(f, &q[f * DOF_PER_FINGER], RIGHT_HAND, p.x_d[f]);
+        StopAllMotion(MOTION_IMPEDANCE);
+        if (!cartImpedance.SetParams(p))
+        {
+            reply = "fail";
+            return;
+        }
+        if ((mask & ((1 << NUM_FINGERS) - 1)) == (1 << NUM_FINGERS) - 1)
+            SetHandMotionType(eMotionType_GRAVITY_COMP);
+        else
+        {
+            // the other fingers hold where they are under joint PD
+            SetTargetQ(std::vector<double>(q, q + MAX_DOF));
+        }
+        cartImpedance.Start();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "imp_gains" || cmd == "imp_target")
+    {
+        // imp_gains <finger|-1> <kx>,<ky>,<kz> <dx>,<dy>,<dz> [f_max]   (N/m, N s/m, N)
+        // imp_target <finger> <x>,<y>,<z>                            (m, palm frame)
+        int finger = -2;
+        std::string a, b;
+        double v[3], w[3];
+        ss >> finger >> a >> b;
+        ImpedanceParams_t p = cartImpedance.Params();
+        bool ok = (finger >= (cmd == "imp_gains" ? -1 : 0)) && finger < NUM_FINGERS
+                  && sscanf(a.c_str(), "%lf,%lf,%lf", &v[0], &v[1], &v[2]) == 3;
+        if (ok && cmd == "imp_gains")
+        {
+            ok = sscanf(b.c_str(), "%lf,%lf,%lf", &w[0], &w[1], &w[2]) == 3;
+            ss >> p.f_max;
+            // negative stiffness or damping would drive the finger unstable
+            for (int a=0; ok && a<3; a++)
+                ok = isfinite(v[a]) && v[a] > 0.0 && isfinite(w[a]) && w[a] >= 0.0;
+            ok = ok && isfinite(p.f_max) && p.f_max > 0.0;
+            for (int f=0; ok && f<NUM_FINGERS; f++)
+            {
+                if (finger >= 0 && f != finger) continue;
+                memcpy(p.k[f], v, sizeof(v));
+                memcpy(p.d[f], w, sizeof(w));
+            }
+        }
+        else if (ok)
+            memcpy(p.x_d[finger], v, sizeof(v));
+        reply = (ok && cartImpedance.SetParams(p)) ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "imp_stop")
+    {
+        // hold the current joint positions
+        cartImpedance.Stop();
+        memcpy(q_des, q, sizeof(q_des));
+        SetJointPDMode();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "imp_stats")
+    {
+        // per finger: <finger> <on> <x,y,z> <x_d> <force>
+        const ImpedanceParams_t& p = cartImpedance.Params();
+        double x[NUM_FINGERS][3], force[NUM_FINGERS][3];
+        cartImpedance.GetState(x, force);
+        bool on = cartImpedance.IsRunning();
+        char buf[256];
+        reply.clear();
+        for (int f=0; f<NUM_FINGERS; f++)
+        {
+            snprintf(buf, sizeof(buf), "%s%d %d %.4f,%.4f,%.4f %.4f,%.4f,%.4f %.3f,%.3f,%.3f", f ? "\n" : "",
+                     f, on && (p.mask & (1 << f)) ? 1 : 0, x[f][0], x[f][1], x[f][2],
+                     p.x_d[f][0], p.x_d[f][1], p.x_d[f][2], force[f][0], force[f][1], force[f][2]);
+            reply += buf;
+        }
+        return;
+    }
+    else if (cmd == "teach_start")
+    {
+        // teach_start: gravity compensation, q recorded every cycle (up to TEACH_MAX_SECONDS)
+        if (!pBHand)
+        {
+            reply = "fail";
+            return;
+        }
+        StopAllMotion(0);
+        SetHandMotionType(eMotionType_GRAVITY_COMP);
+        teachRecorder.Start();
+        reply = "succ";
+        return;
+    }
+    else if (cmd == "teach_stop")
+    {
+        // teach_stop [tol_rad]: hold the current pose and compress the recording into keyframes
+        // reply: succ <samples> <knots> <duration_s> <tol_used> <max_err>
+        double tol = 0.005;
+        ss >> tol;
+        teachRecorder.Stop();
+        memcpy(q_des, q, sizeof(q_des));
+        SetJointPDMode();
+        TeachCompressJob_t job = { tol, 0.0, 0 };
+        workerPool.Call(TeachCompressJob, &job);
+        int n = job.n;
+        tol = job.tol;
+        double max_err = job.max_err;
+        if (n < 2)
+        {
+            teachKnotCount = 0;
+            reply = "fail too short";
+            return;
+        }
+        teachKnotCount = n;
+        char buf[128];
+        snprintf(buf, sizeof(buf), "succ %d %d %.3f %.5f %.5f", teachRecorder.Count(), n,
+                 teachKnots[n - 1].t, tol, max_err);
+        reply = buf;
+        return;
+    }
+    else if (cmd == "teach_play")
+    {
+        // teach_play: move to the first keyframe, then replay the demonstration with its timing
+        if (teachKnotCount < 2 || !pBHand)
+        {
+            reply = "fail";
+            return;
+        }
+        static TrajKnot_t knots[MAX_TRAJ_KNOTS];
+        double lead = 0.3;
+        for (int i=0; i<MAX_DOF; i++)
+        {
+            double t = 2.0 * fabs(teachKnots[0].q[i] - q_des[i]) / pathLimits.vel[i];
+            if (t > lead) lead = t;
+        }
+        knots[0].t = 0.0;
+        memcpy(knots[0].q, q_des, sizeof(knots[0].q));
+        for (int k=0; k<teachKnotCount; k++)
+        {
+            knots[k + 1] = teachKnots[k];
+            knots[k + 1].t += lead;
+        }
+        if (!trajPlayer.IsPlaying())
+            SetJointPDMode();
+        StopAllMotion(MOTION_TRAJ);
+        if (!trajPlayer.Load(knots, teachKnotCount + 1))
+        {
+            reply = "fail";
+            return;
+        }
+        char buf[64];
+        snprintf(buf, sizeof(buf), "succ %.4f", knots[teachKnotCount].t);
+        reply = buf;
+        return;
+    }
+    else if (cmd == "teach_knots")
+    {
+        // keyframes of the last recording: <t>,<q_1>,...,<q_16>;...
+        reply.clear();
+        char buf[32];
+        for (int k=0; k<teachKnotCount; k++)
+        {
+            snprintf(buf, sizeof(buf), "%s%.4f", k ? ";" : "", teachKnots[k].t);
+            reply += buf;
+            for (int i=0; i<MAX_DOF; i++)
+            {
+                snprintf(buf, sizeof(buf), ",%.5f", teachKnots[k].q[i]);
+                reply += buf;
+            }
+        }
+        return;
+    }
+    else if (cmd == "sync_q")
+    {
+        // sync_q <delay_cycles> <16 x NUM_HANDS comma-separated targets>, applied in the same cycle on all hands
+        int delay = 0;
+        ss >> delay;
+        std::vector<double> qs;
+        double v;
+        while (ss >> v)
+        {
+            qs.push_back(v);
+            if (ss.peek() == ',')
+                ss.ignore();
+        }
+        if (!handSync.IsAttached() || delay < 2 || (int)qs.size() != MAX_DOF * NUM_HANDS)
+        {
+            reply = "fail";
+            return;
+        }
+        reply = handSync.PostTargets(&qs[0], delay) ? "succ" : "fail";
+        return;
+    }
+    else if (cmd == "step")
+    {
+        // step <N> <16 comma-separated targets>: applied at the next cycle boundary, replied
+        // after exactly N cycles. Binary reply as for history: the sample of the cycle that
+        // applied the targets, then the observation N cycles later.
+        int n = 0;
+        ss >> n;
+        std::vector<double> qs;
+        double v;
+        while (ss >> v)
+        {
+            qs.push_back(v);
+            if (ss.peek() == ',')
+                ss.ignore();
+        }
+        if (!pBHand || n < 1 || n > STEP_MAX_CYCLES || qs.size() != MAX_DOF
+            || stepState.load(std::memory_order_acquire) != STEP_IDLE)
+        {
+            reply = "fail";
+            return;
+        }
+        memcpy(stepTarget, &qs[0], sizeof(stepTarget));
+        stepAppliedCycle.store(-1, std::memory_order_relaxed);
+        stepState.store(STEP_PENDING, std::memory_order_release);
+
+        // poll the history until the observation cycle has been recorded
+        int64_t deadline = rt_now_ns() + (int64_t)((n + 100) * delT * 1e9);
+        int64_t k;
+        uint64_t first, end;
+        while (true)
+        {
+            k = stepAppliedCycle.load(std::memory_order_acquire);
+            if (k >= 0)
+            {
+                stateHistory.Range(&first, &end);
+                if (end > (uint64_t)(k + n)) break;
+            }
+            if (rt_now_ns() > deadline)
+            {
+                // withdraw the request unless the control thread already claimed it
+                int pending = STEP_PENDING;
+                bool cancelled = stepState.compare_exchange_strong(pending, STEP_IDLE, std::memory_order_acq_rel);
+                reply = cancelled ? "fail" : "fail applied";
+                return;
+            }
+            usleep(100);
+        }
+
+        StateHistoryReply_t hdr;
+        StateSample_t s[2];
+        if (!stateHistory.Read(k, &s[0]) || !stateHistory.Read(k + n, &s[1]))
+        {
+            reply = "fail";
+            return;
+        }
+        hdr.magic = STATE_HISTORY_MAGIC;
+        hdr.version = STATE_HISTORY_VERSION;
+        hdr.count = 2;
+        hdr.sample_bytes = sizeof(StateSample_t);
+        hdr.now_ns = rt_now_ns();
+        reply.assign((const char*)&hdr, sizeof(hdr));
+        reply.append((const char*)s, sizeof(s));
+        return;
+    }
+    else if (cmd == "sync_stats")
+    {
+        // cycles, late TX slots, skew samples, mean/max cross-hand skew (us), mean TX wait (us),
+        // current/max phase error of the stream (us), stream re-phases, master clock changes
+        SyncStats_t st;
+        handSync.GetStats(&st);
+        char buf[384];
+        snprintf(buf, sizeof(buf), "cycles %llu late_tx %llu skew_n %llu skew_mean_us %.1f skew_max_us %.1f tx_wait_us %.1f"
+                 " phase_err_us %.1f phase_err_max_us %.1f rephases %llu clock_changes %llu",
+                 (unsigned long long)st.cycles, (unsigned long long)st.late_tx, (unsigned long long)st.skew_samples,
+                 st.skew_mean_us, st.skew_max_us, st.tx_wait_mean_us, st.phase_err_us, st.phase_err_max_us,
+                 (unsigned long long)st.rephases, (unsigned long long)st.clock_changes);
+        reply = buf;
+        return;
+    }
+    else if (cmd == "loop_stats")
+    {
+        // cycle interval and RX->TX latency percentiles, missed cycles, tracking error
+        loopStats.Report(&reply);
+        return;
+    }
+    else if (cmd == "enc_stats")
+    {
+        // rejected encoder readings: totals per check, then per joint: joint length range delta resync
+        encValidator.Report(&reply);
+        return;
+    }
+    else if (cmd == "thermal")
+    {
+        // per-finger readings and heating gains, then: joint predicted_degC torque_scale hold_s
+        thermalModel.Report(&reply);
+        return;
+    }
+    else if (cmd == "loop_stats_reset")
+    {
+        loopStats.RequestReset();
+        reply = "succ";
+        return;
+    }
+#ifdef ALLEGRO_SIM_CAN
+    else if (cmd == "sim_fault")
+    {
+        // sim_fault <t0> <t1> <fault> [args]  |  sim_fault clear   (see canSim.h)
+        std::string rule, err;
+        std::getline(ss >> std::ws, rule);
+        if (rule == "clear")
+        {
+            sim_fault_clear();
+            reply = "succ";
+        }
+        else
+            reply = (sim_fault_add(rule.c_str(), &err) == 0) ? "succ" : "fail " + err;
+        return;
+    }
+    else if (cmd == "sim_faults")
+    {
+        // sim_faults <file>: replace the rules with a fault script
+        std::string path, err;
+        ss >> path;
+        int n = sim_fault_load(path.c_str(), &err);
+        reply = (n >= 0) ? "succ " + std::to_string(n) : "fail " + err;
+        return;
+    }
+    else if (cmd == "sim_stats")
+    {
+        sim_get_stats(&reply);
+        return;
+    }
+#endif
+    else if (cmd == "rt_violations")
+    {
+        // blocking calls caught inside the control cycle (sanitizer builds only)
+        RtSanitizerReport(&reply);
+        return;
+    }
+    else if (cmd == "perf_stats")
+    {
+        // per-cycle counter deltas over the last cycles and lifetime log2 histograms
+        perfCounters.Report(&reply);
+        return;
+    }
+    else if (cmd == "trace_export")
+    {
+        // trace_export <seconds> <file>: Chrome trace JSON of the recent cycle stage spans, in TRACE_DIR
+        double secs = 0.0;
+        std::string name;
+        ss >> secs >> name;
+        if (name.empty() || name[0] == '.' || name.find('/') != std::string::npos)
+        {
+            reply = "fail trace file name expected";
+            return;
+        }
+        mkdir(TRACE_DIR, 0755);
+        std::string path = std::string(TRACE_DIR) + "/" + name;
+        TraceExportJob_t job = { secs, path.c_str(), 0 };
+        workerPool.Call(TraceExportJob, &job);
+        int n = job.n;
+        reply = (n < 0) ? "fail" : "succ " + std::to_string(n);
+        return;
+    }
+    else if (!cmd.empty())
+    {
+        std::cout << "Unknown command " << cmd << endl;
+        reply = "fail";
+        return;
+    }
+
+    // parse the message
+    std::vector<double> vect;
+    double i;
+    while (ss >> i)
+    {
+        vect.push_back(i);
+        if (ss.peek() == ',')
+            ss.ignore();
+    }
+    bool valid = (vect.size() == MAX_DOF);
+    for (size_t k=0; valid && k<vect.size(); k++)
+        valid = isfinite(vect[k]);
+    if (!valid)
+    {
+        reply = "fail";
+        return;
+    }
+    std::cout << "Setting Allegro q to ";
+    for (i=0; i< vect.size()-1; i++)
+        std::cout << vect.at(i) <<", ";
+    std::cout << vect.at(vect.size()-1) << endl;
+    // Set the joint angle
+    // for (int i=0; i<16; i++)
+    //   q_des[i] = scissors[i];
+    if (pBHand){
+        StopAllMotion(0);
+        SetHandMotionType(eMotionType_JOINT_PD);
+        SetTargetQ(vect);
+        reply = "succ";
+    }
+    else{
+        reply = "fail";
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Application main-loop. It handles the commands from rPanelManipulator and keyboard events
 void MainLoop()
@@ -240,8 +1367,9 @@ void MainLoop()
     // Set up zmq
     zmq::context_t ctx;
     zmq::socket_t socket(ctx, ZMQ_REP);
-    socket.bind("tcp://*:5556");
+    socket.bind("tcp://*:" + std::to_string(5556 + HAND_INDEX));
     std::cout << "ZMQ setup done" << endl;
+    TraceRegisterThread("command");
 
     while (bRun)
     {
@@ -249,39 +1377,14 @@ void MainLoop()
         // Wait for ZMQ message
         zmq::message_t recv_msg; // TODO: figure out size
         socket.recv(&recv_msg);
-        // parse the message
-        std::string recv_str = recv_msg.to_string();
-        std::stringstream ss(recv_str);
-        std::vector<double> vect;
-        double i;
-        while (ss >> i)
-        {
-            vect.push_back(i);
-            if (ss.peek() == ',')
-            ss.ignore();
-        }
-        assert(vect.size() == 16);
-        std::cout << "Setting Allegro q to ";
-        for (i=0; i< vect.size()-1; i++)
-        std::cout << vect.at(i) <<", ";
-        std::cout << vect.at(vect.size()-1) << endl;
-        // Set the joint angle
-        // for (int i=0; i<16; i++)
-        //   q_des[i] = scissors[i];
-        if (pBHand){
-        pBHand->SetMotionType(eMotionType_JOINT_PD);
-        SetTargetQ(vect);
-        std::string succ_str="succ";
-        zmq::message_t succ_msg (succ_str.length());
-        memcpy (succ_msg.data (), succ_str.data(), succ_str.length());
-        socket.send(succ_msg, zmq::send_flags::none);
-        } 
-        else{
-        std::string fail_str="fail";
-        zmq::message_t fail_msg (fail_str.length());
-        memcpy (fail_msg.data (), fail_str.data(), fail_str.length());
-        socket.send(fail_msg, zmq::send_flags::none);
+        std::string reply_str;
+        {
+            TraceScope span(SPAN_COMMAND, sendNum);
+            HandleCommand(recv_msg.to_string(), reply_str);
         }
+        zmq::message_t reply_msg (reply_str.length());
+        memcpy (reply_msg.data (), reply_str.data(), reply_str.length());
+        socket.send(reply_msg, zmq::send_flags::none);
         // int c = Getch();
         // switch (c)
         // {
@@ -341,6 +1444,43 @@ void MainLoop()
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// Stop the core on SIGINT/SIGTERM so CAN is closed and the shared memory removed
+static void CoreSignal(int)
+{
+    coreRun = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Core main-loop (--core). Commands arrive from the gateway through shared memory and
+// are handled here, on a normal-priority thread, exactly as MainLoop would handle them.
+void CoreLoop()
+{
+    signal(SIGINT, CoreSignal);
+    signal(SIGTERM, CoreSignal);
+    printf("Core running, waiting for grasp_gateway --hand %d\n", HAND_INDEX);
+    TraceRegisterThread("command");
+
+    uint32_t id;
+    std::string cmd_str, reply_str;
+    while (coreRun)
+    {
+        if (!coreChannel.ReadCommand(&id, &cmd_str))
+        {
+            usleep(200);
+            continue;
+        }
+        reply_str.clear();
+        {
+            TraceScope span(SPAN_COMMAND, sendNum);
+            HandleCommand(cmd_str, reply_str);
+        }
+        if (!coreChannel.PostReply(id, reply_str))
+            printf("Core: reply %u dropped (gateway not reading)\n", id);
+    }
+    printf("Core stopping\n");
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Compute control torque for each joint using BHand library
 void ComputeTorque()
@@ -369,7 +1509,9 @@ void ComputeTorque()
 bool OpenCAN()
 {
 #if defined(PEAKCAN)
-    CAN_Ch = GetCANChannelIndex(_T("USBBUS1"));
+    char cname[16];
+    snprintf(cname, sizeof(cname), "USBBUS%d", HAND_INDEX + 1);
+    CAN_Ch = GetCANChannelIndex(cname);
 #elif defined(IXXATCAN)
     CAN_Ch = 1;
 #elif defined(SOFTINGCAN)
@@ -408,10 +1550,19 @@ bool OpenCAN()
         return false;
     }
 
-    // set periodic communication parameters(period)
+    // joint calibration stored for this hand's serial number
+    for (int i=0; i<200 && jointCalib.Serial().empty(); i++)
+        usleep(1000);
+    int calib_joints = jointCalib.Load(CALIB_FILE);
+    if (calib_joints > 0)
+        printf(">CAN: joint calibration of %s loaded from %s (%d joints)\n", jointCalib.Serial().c_str(), CALIB_FILE, calib_joints);
+    else
+        printf(">CAN: no joint calibration for '%s' in %s, using the nominal encoder zero\n", jointCalib.Serial().c_str(), CALIB_FILE);
+
+    // set periodic communication parameters(period), starting on a master-clock tick
     printf(">CAN: Comm period set\n");
-    short comm_period[3] = {3, 0, 0}; // millisecond {position, imu, temperature}
-    ret = command_set_period(CAN_Ch, comm_period);
+    handSync.WaitNextTick();
+    ret = command_set_period(CAN_Ch, commPeriod);
     if(ret < 0)
     {
         printf("ERROR command_set_period !!! \n");
@@ -468,7 +1619,7 @@ bool CreateBHandAlgorithm()
         pBHand = bhCreateLeftHand();
 
     if (!pBHand) return false;
-    pBHand->SetMotionType(eMotionType_NONE);
+    SetHandMotionType(eMotionType_NONE);
     pBHand->SetTimeInterval(delT);
     return true;
 }
@@ -575,23 +1726,139 @@ int GetCANChannelIndex(const TCHAR* cname)
         return 0;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// Scheduled tasks
+
+// RT tier, every cycle: hand the cycle's state to the soft tier
+void TaskCycleState(void*, int64_t now_ns)
+{
+    CycleState_t s;
+    s.t_ns = now_ns;
+    memcpy(s.q, q, sizeof(s.q));
+    memcpy(s.qdot, qdot, sizeof(s.qdot));
+    cycleStateBox.Write(s);
+}
+
+// soft tier: fingertip positions for the 'fingertips' query
+void TaskFingertips(void*, int64_t)
+{
+    CycleState_t s;
+    if (!cycleStateBox.Read(&s)) return;
+    FingertipState_t tips;
+    tips.t_ns = s.t_ns;
+    for (int f=0; f<NUM_FINGERS; f++)
+        FingerFK(f, &s.q[f * DOF_PER_FINGER], RIGHT_HAND, tips.tip[f]);
+    fingertipBox.Write(tips);
+}
+
+// background tier: report motors entering or leaving thermal derating
+void TaskHealth(void*, int64_t)
+{
+    static bool derating[MAX_DOF];
+    for (int i=0; i<MAX_DOF; i++)
+    {
+        double t = thermalModel.Predicted(i);
+        bool d = (t >= THERMAL_DERATE_START_C);
+        if (d != derating[i])
+            printf("Joint %d %s thermal derating (%.1f C)\n", i, d ? "entered" : "left", t);
+        derating[i] = d;
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Program main
 int main(int argc, TCHAR* argv[])
 {
+    for (int a=1; a<argc; a++)
+    {
+        if (!strcmp(argv[a], "--perf")) PERF_ENABLED = true;
+        else if (!strcmp(argv[a], "--core")) CORE_MODE = true;
+        else if (!strcmp(argv[a], "--friction")) frictionComp.Enable(true);
+        else if (a+1 >= argc) break;
+        else if (!strcmp(argv[a], "--hand")) HAND_INDEX = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--hands")) NUM_HANDS = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--history")) HISTORY_SECONDS = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--sim-faults")) SIM_FAULT_FILE = argv[++a];
+        else if (!strcmp(argv[a], "--pool-threads")) POOL_THREADS = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--pool-cpus")) POOL_CPUS = argv[++a];
+        else if (!strcmp(argv[a], "--calib")) CALIB_FILE = argv[++a];
+        else if (!strcmp(argv[a], "--ambient")) AMBIENT_C = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--plugin-dir")) PLUGIN_DIR = argv[++a];
+        else if (!strcmp(argv[a], "--trace-dir")) TRACE_DIR = argv[++a];
+        else if (!strcmp(argv[a], "--plugin") && NUM_PLUGIN_FILES < PLUGIN_MAX) PLUGIN_FILES[NUM_PLUGIN_FILES++] = argv[++a];
+    }
+
     PrintInstruction();
 
     memset(&vars, 0, sizeof(vars));
     memset(q, 0, sizeof(q));
+    memset(qdot, 0, sizeof(qdot));
     memset(q_des, 0, sizeof(q_des));
     memset(tau_des, 0, sizeof(tau_des));
     memset(cur_des, 0, sizeof(cur_des));
     curTime = 0.0;
+    SetDefaultJointLimits(&pathLimits);
+    uint32_t history_cycles = (uint32_t)(HISTORY_SECONDS / delT) + 1;
+    char history_name[64];
+    snprintf(history_name, sizeof(history_name), CORE_HISTORY_NAME, HAND_INDEX);
+    if (CORE_MODE ? !stateHistory.CreateShared(history_name, history_cycles) : !stateHistory.Create(history_cycles))
+    {
+        printf("ERROR allocating state history\n");
+        return 1;
+    }
+
+    thermalModel.SetAmbient(AMBIENT_C);
+
+    if (reachMap.Load(REACH_MAP_FILE, RIGHT_HAND))
+        printf("Reachability map loaded from %s\n", REACH_MAP_FILE);
+
+    if (NUM_HANDS > 1 && !handSync.Attach(HAND_INDEX, NUM_HANDS, delT, SYNC_TX_OFFSET, SYNC_TX_STAGGER))
+        return 1;
+
+    if (CORE_MODE)
+    {
+        if (!coreChannel.Create(HAND_INDEX, delT))
+        {
+            printf("ERROR creating the core channel\n");
+            return 1;
+        }
+    }
+    else
+        statePublisher.Start(&stateHistory, 5557 + HAND_INDEX, delT);
+
+#ifdef ALLEGRO_SIM_CAN
+    std::string fault_err;
+    if (SIM_FAULT_FILE && sim_fault_load(SIM_FAULT_FILE, &fault_err) < 0)
+        printf("ERROR loading %s: %s\n", SIM_FAULT_FILE, fault_err.c_str());
+#endif
+
+    if (workerPool.Start(POOL_THREADS, POOL_CPUS))
+        scheduler.SetExecutor(&workerPool);
+    scheduler.Add("cycle_state", SCHED_TIER_RT, 1.0 / delT, 20, TaskCycleState, NULL);
+    scheduler.Add("fingertips", SCHED_TIER_SOFT, 60.0, 2000, TaskFingertips, NULL);
+    scheduler.Add("health", SCHED_TIER_BACKGROUND, 1.0, 10000, TaskHealth, NULL);
+    scheduler.Start();
 
     if (CreateBHandAlgorithm() && OpenCAN())
-        MainLoop();
+    {
+        for (int i=0; i<NUM_PLUGIN_FILES; i++)
+        {
+            std::string err;
+            if (!pluginHost.Load(PLUGIN_FILES[i], 0, "", &err))
+                printf("ERROR loading plugin %s: %s\n", PLUGIN_FILES[i], err.c_str());
+        }
+
+        if (CORE_MODE)
+            CoreLoop();
+        else
+            MainLoop();
+    }
 
+    statePublisher.Stop();
     CloseCAN();
+    scheduler.Stop();
+    workerPool.Stop();
+    pluginHost.UnloadAll();
     DestroyBHandAlgorithm();
 
     return 0;
@@ -16,4 +16,4 @@ fi
 
 # Execute the grasp binary
 echo "Running grasp server..."
-./build/bin/grasp
\ No newline at end of file
+./build/bin/grasp "$@"
\ No newline at end of file